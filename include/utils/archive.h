@@ -0,0 +1,100 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace warpgate::utils::archive {
+    enum class Format {
+        // Store-only zip, switching to zip64 records past 65535 entries or 4 GiB
+        Zip,
+        // POSIX ustar, with pax headers for names that don't fit
+        Tar,
+    };
+
+    /**
+     * The archive format for a path's extension: .zip or .tar
+     */
+    std::optional<Format> format_for(const std::filesystem::path &path);
+
+    /**
+     * Writes an uncompressed zip or tar that any number of threads can add entries to at once.
+     *
+     * Each entry reserves its byte range with a single atomic add on the end of the archive, then copies its header and data
+     * into 4 MiB segments of the file. Whichever thread completes a segment writes it out in one call, so the file is written in
+     * large, nearly sequential pieces no matter how small the entries are. Only the list of entries kept for the zip central
+     * directory is behind a lock.
+     */
+    class Writer {
+    public:
+        Writer(std::filesystem::path path, Format format);
+        ~Writer();
+
+        Writer(const Writer&) = delete;
+        Writer &operator=(const Writer&) = delete;
+
+        bool is_open() const;
+
+        /**
+         * Adds a file named `name` ('/' separated, relative) holding data. Returns false if the archive is closed or a write failed.
+         * Names are normalized, dropping empty and "." components. Absolute names and names with ".." components are rejected.
+         */
+        bool add(std::string_view name, std::span<const uint8_t> data);
+
+        /**
+         * Writes the zip central directory (or the tar end of archive blocks), flushes the last segment and closes the file.
+         * Call once every add has returned. Returns false if any write failed.
+         */
+        bool finish();
+
+    private:
+        struct Segment;
+
+        struct Entry {
+            std::string name;
+            uint64_t offset, size;
+            uint32_t crc;
+        };
+
+        uint64_t reserve(uint64_t size);
+        void write(uint64_t offset, std::span<const uint8_t> data);
+        void flush(uint64_t index, const Segment &segment, size_t size);
+
+        std::filesystem::path m_path;
+        Format m_format;
+        std::FILE *m_file;
+        std::mutex m_file_mutex, m_segments_mutex, m_entries_mutex;
+        std::atomic<uint64_t> m_end = 0;
+        std::atomic<size_t> m_count = 0;
+        std::atomic<bool> m_failed = false, m_finished = false;
+        std::unordered_map<uint64_t, std::shared_ptr<Segment>> m_segments;
+        std::vector<Entry> m_entries;
+        uint16_t m_dos_time = 0, m_dos_date = 0;
+        uint64_t m_mtime = 0;
+    };
+
+    /**
+     * Sends every file written through write_file into a new archive at `path` instead of to disk, named by its path relative to root.
+     * Call before any files are written. Returns false if the archive could not be created.
+     */
+    bool init_archive(std::filesystem::path path, std::filesystem::path root);
+    bool enabled();
+
+    /**
+     * Adds data to the archive as `path` relative to the root. Returns false if no archive is open or path is outside the root.
+     */
+    bool write_file(const std::filesystem::path &path, std::span<const uint8_t> data);
+
+    /**
+     * Finishes the archive opened by init_archive. Returns false if it was incomplete.
+     */
+    bool close_archive();
+}
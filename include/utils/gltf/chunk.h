@@ -8,9 +8,18 @@
 #include <cnk1.h>
 #include "tiny_gltf.h"
 #include "utils/aabb.h"
+#include "utils/textures/atlas.h"
 #include "utils/tsqueue.h"
 
 namespace warpgate::utils::gltf::chunk {
+    /**
+     * Where one of a chunk's textures was placed in the terrain atlas, and the material of its atlas page
+     */
+    struct AtlasTexture {
+        textures::atlas::Slot slot;
+        int material;
+    };
+
     int add_chunks_to_gltf(
         tinygltf::Model &gltf,
         const warpgate::chunk::CNK0 &chunk0,
@@ -28,7 +37,8 @@ namespace warpgate::utils::gltf::chunk {
         const warpgate::chunk::CNK0 &chunk,
         int material_base_index,
         std::string name,
-        bool include_colors = false
+        bool include_colors = false,
+        std::span<const AtlasTexture> atlas_textures = {}
     );
 
     int add_materials_to_gltf(
@@ -40,6 +50,19 @@ namespace warpgate::utils::gltf::chunk {
         int sampler_index
     );
 
+    /**
+     * Reserves a terrain atlas cell for each of the chunk's textures and queues them to be packed.
+     * Every texture on the same atlas page shares that page's material.
+     */
+    std::vector<AtlasTexture> add_atlas_materials_to_gltf(
+        tinygltf::Model &gltf,
+        const warpgate::chunk::CNK1 &chunk,
+        utils::tsqueue<std::tuple<std::string, std::shared_ptr<uint8_t[]>, uint32_t, std::shared_ptr<uint8_t[]>, uint32_t>> &image_queue,
+        std::filesystem::path output_directory,
+        std::string name,
+        int sampler_index
+    );
+
     tinygltf::Model build_gltf_from_chunks(
         const warpgate::chunk::CNK0 &chunk0,
         const warpgate::chunk::CNK1 &chunk1,
@@ -19,6 +19,14 @@ namespace warpgate::utils::gltf {
 
     void update_bone_transforms(tinygltf::Model &gltf, int skeleton_root);
 
+    /**
+     * Collapses buffers and bufferViews with identical contents, using a 128 bit content hash to find candidates.
+     * Accessors and images are pointed at the surviving copy, and buffers/bufferViews left unreferenced are removed.
+     *
+     * Returns the number of buffer bytes saved.
+     */
+    size_t deduplicate_buffers(tinygltf::Model &gltf);
+
     bool isCOG(tinygltf::Node node);
 
     int findCOGIndex(tinygltf::Model &gltf, tinygltf::Node &node);
@@ -7,6 +7,7 @@
 
 #include <dme.h>
 #include "utils/actor_sockets.h"
+#include "utils/hash.h"
 #include "json.hpp"
 #include "parameter.h"
 #include "tiny_gltf.h"
@@ -26,7 +27,13 @@ namespace warpgate::utils::gltf::dme {
         bool rigify
     );
     
-    int add_mesh_to_gltf(tinygltf::Model &gltf, const DME &dme, uint32_t index, uint32_t material_index, bool include_skeleton = true);
+    /**
+     * dme_key is the mesh cache hash of the whole DME, computed here if not given while the cache is enabled
+     */
+    int add_mesh_to_gltf(
+        tinygltf::Model &gltf, const DME &dme, uint32_t index, uint32_t material_index, bool include_skeleton = true,
+        std::optional<utils::hash::Hash128> dme_key = {}
+    );
     int add_skeleton_to_gltf(tinygltf::Model &gltf, const DME &dme, std::vector<int> mesh_nodes, bool rigify);
     int add_actorsockets_to_gltf(tinygltf::Model &gltf, ActorSockets &actorSockets, std::string basename, int parent);
     
@@ -0,0 +1,47 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+
+#include "tiny_gltf.h"
+
+namespace warpgate::utils::gltf::staging {
+    /**
+     * Enables staging. Once more than `threshold` bytes of buffer data have been added to models,
+     * further buffers are moved into a temporary file in `directory` instead of being kept in memory.
+     */
+    void init_staging(std::filesystem::path directory, size_t threshold);
+    bool enabled();
+
+    /**
+     * Counts gltf's buffers from first_buffer onwards against the threshold, moving them to disk once it has been reached.
+     * Staged buffers keep no data and are marked through their uri. Buffers with the same contents share one copy on disk
+     * and the same uri.
+     */
+    void stage_buffers(tinygltf::Model &gltf, size_t first_buffer);
+
+    /**
+     * Stops counting gltf's buffers against the threshold and frees their space in the staging file for reuse.
+     * Called once the model has been written; its buffers are emptied.
+     */
+    void release(tinygltf::Model &gltf);
+    // As above for a single buffer dropped from a model
+    void release(tinygltf::Buffer &buffer);
+
+    bool is_staged(const tinygltf::Buffer &buffer);
+
+    /**
+     * The length of the buffer's data, whether it is staged or in memory
+     */
+    size_t buffer_length(const tinygltf::Buffer &buffer);
+
+    /**
+     * Reads a staged buffer back into memory, where it counts against the threshold again. Returns false if it could not be read.
+     */
+    bool restore(tinygltf::Buffer &buffer);
+
+    /**
+     * Appends a staged buffer's data to output, using copy_file_range/sendfile where available.
+     */
+    bool copy_staged(const tinygltf::Buffer &buffer, std::FILE *output);
+}
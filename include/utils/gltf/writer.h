@@ -0,0 +1,23 @@
+#pragma once
+#include <filesystem>
+#include <string>
+
+#include "tiny_gltf.h"
+
+namespace warpgate::utils::gltf {
+    /**
+     * Serializes the glTF JSON for gltf without going through a JSON DOM.
+     * The model's buffers are described as the single merged buffer written by write_gltf,
+     * or as they are with their own uris if keep_buffers is set.
+     */
+    std::string serialize_gltf(const tinygltf::Model &gltf, bool pretty, std::string buffer_uri = "", bool keep_buffers = false);
+
+    /**
+     * Writes gltf to path, as a .glb if binary is set or as a .gltf with a single .bin file next to it otherwise.
+     * The model's buffers are merged into one (each starting on a 16 byte boundary) and bufferViews are rebased to match.
+     * When writing a .gltf whose buffers all have a file uri, each buffer is instead written to its own file as named.
+     *
+     * Returns false if a file could not be written.
+     */
+    bool write_gltf(const tinygltf::Model &gltf, std::filesystem::path path, bool binary, bool pretty = false);
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+
+namespace warpgate::utils::hash {
+    struct Hash128 {
+        uint64_t low = 0, high = 0;
+
+        bool operator==(const Hash128 &other) const {
+            return low == other.low && high == other.high;
+        }
+
+        std::string hex() const;
+    };
+
+    struct Hash128Hasher {
+        size_t operator()(const Hash128 &hash) const {
+            return (size_t)(hash.low ^ (hash.high * 0x9E3779B97F4A7C15ull));
+        }
+    };
+
+    // MurmurHash3 x64 128 bit variant
+    Hash128 hash128(std::span<const uint8_t> data, uint64_t seed = 0);
+    Hash128 hash128(std::string_view data, uint64_t seed = 0);
+
+    // Folds another hash into `hash`, for building keys out of several parts
+    Hash128 combine(Hash128 hash, Hash128 other);
+    Hash128 combine(Hash128 hash, uint64_t value);
+}
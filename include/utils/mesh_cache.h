@@ -0,0 +1,47 @@
+#pragma once
+#include <filesystem>
+#include <optional>
+#include <span>
+#include <vector>
+
+#include <dme.h>
+#include "json.hpp"
+#include "utils/hash.h"
+
+namespace warpgate::utils::mesh_cache {
+    // Bump whenever expand_vertex_stream or the input layout handling changes its output
+    constexpr uint32_t format_version = 2;
+
+    // Only the expanded vertex streams are cached, indices are used straight from the DME
+    struct CachedMesh {
+        nlohmann::json layout;
+        std::vector<std::vector<uint8_t>> vertex_streams;
+    };
+
+    /**
+     * Enables the cache. Entries are stored under `directory`, which is created if needed.
+     */
+    void init_cache(std::filesystem::path directory);
+    bool enabled();
+
+    /**
+     * Hash of the DME's whole content. Compute once per model and pass to mesh_key for each of its meshes.
+     */
+    hash::Hash128 dme_key(const DME &dme);
+
+    /**
+     * Keyed by the DME's content (from dme_key), the mesh index, its material definition and the (unexpanded) input layout it is converted with
+     */
+    hash::Hash128 mesh_key(const hash::Hash128 &dme_key, const DME &dme, uint32_t mesh_index, const nlohmann::json &layout);
+
+    std::optional<CachedMesh> load(const hash::Hash128 &key);
+
+    /**
+     * Writes to a temporary file and renames it into place, so concurrent exporters never see partial entries.
+     */
+    bool store(
+        const hash::Hash128 &key, 
+        const nlohmann::json &layout, 
+        std::vector<std::span<const uint8_t>> vertex_streams
+    );
+}
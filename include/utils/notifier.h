@@ -0,0 +1,36 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+namespace warpgate::utils {
+    /**
+     * Lets a thread sleep until any of several sources has work, instead of polling each of them in turn.
+     *
+     * Sources call notify() after making work available. A consumer takes a token, checks every source, and only if none had work
+     * waits with that token. The wait returns straight away if anything was notified after the token was taken, so work added
+     * while the sources were being checked is never slept through.
+     */
+    class notifier {
+    public:
+        notifier(const notifier&) = delete;
+        notifier &operator=(const notifier&) = delete;
+        notifier() = default;
+
+        // Take before checking the sources, and pass to wait if none of them had work.
+        uint64_t token() const;
+
+        // Wake every waiting thread. Only takes the lock when a thread is waiting.
+        void notify();
+
+        // Sleep until notify is called after `token` was taken.
+        void wait(uint64_t token);
+
+    private:
+        std::atomic<uint64_t> epoch = 0;
+        std::atomic<uint32_t> waiting = 0;
+        std::mutex m;
+        std::condition_variable c;
+    };
+}
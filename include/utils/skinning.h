@@ -0,0 +1,67 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <glm/mat4x4.hpp>
+
+#include "dme.h"
+#include "mrn_loader.h"
+#include "tiny_gltf.h"
+
+namespace warpgate::utils::skinning {
+    struct PoseRequest {
+        std::string animation;
+        float time;
+    };
+
+    /**
+     * Parses a pose in the form <animation>:<time>, where time is in seconds.
+     */
+    std::optional<PoseRequest> parse_pose(std::string_view value);
+
+    /**
+     * Samples animation at time seconds and returns the model space transform of every bone in skeleton.
+     * Samples between two keys are interpolated, times outside the animation are clamped.
+     */
+    std::vector<glm::mat4> evaluate_pose(std::shared_ptr<mrn::SkeletonData> skeleton, std::shared_ptr<mrn::NSAFile> animation, float time);
+
+    /**
+     * Builds one skinning matrix per DME bone (posed * inverse bind) by matching bone names against the MRN skeleton.
+     * DME bones without a match follow their closest matched ancestor.
+     */
+    std::vector<glm::mat4> joint_matrices(const DME &dme, const mrn::Skeleton &skeleton, std::span<const glm::mat4> posed);
+
+    /**
+     * Counts how many of the DME's bones can be found in the MRN skeleton
+     */
+    uint32_t matching_bones(const DME &dme, const mrn::Skeleton &skeleton);
+
+    /**
+     * Linear blend skinning of count vertices.
+     *   joints:    4 joint indices per vertex
+     *   weights:   4 weights per vertex
+     *   positions: xyz per vertex, skinned in place
+     *   normals:   xyz per vertex, skinned in place by the inverse transpose and renormalized. May be empty.
+     *
+     * Processes 8 vertices per iteration when built with AVX2.
+     */
+    void skin_vertices(
+        std::span<const glm::mat4> joint_matrices,
+        std::span<const uint32_t> joints,
+        std::span<const float> weights,
+        std::span<float> positions,
+        std::span<float> normals
+    );
+
+    /**
+     * Skins every skinned mesh in gltf with one matrix per skin joint,
+     * then removes the skins and their joint nodes so the meshes are exported as static geometry.
+     * Other nodes parented to a joint are kept where the pose puts them.
+     */
+    void apply_pose(tinygltf::Model &gltf, std::span<const glm::mat4> joint_matrices);
+}
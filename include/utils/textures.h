@@ -1,21 +1,100 @@
 #pragma once
 #include <filesystem>
+#include <functional>
+#include <memory>
 #include <span>
 #include <optional>
+#include <string_view>
 
 #include "gli/gli.hpp"
+#include "utils/textures/bc.h"
+#include "utils/textures/container.h"
+#include "utils/textures/encoder.h"
+#include "utils/textures/image.h"
+#include "utils/textures/image_cache.h"
+#include "utils/textures/mips.h"
+#include "utils/textures/normals.h"
+#include "utils/textures/png.h"
+#include "utils/textures/scheduler.h"
+#include "utils/textures/specular.h"
+#include "utils/textures/terrain.h"
 
 namespace warpgate::utils::textures {
+    enum class OutputFormat {
+        PNG,
+        // Unprocessed textures keep their original blocks, processed maps are block compressed by the encoder
+        DDS,
+    };
+
+    /**
+     * Parses a texture output format: png or dds
+     */
+    std::optional<OutputFormat> parse_output_format(std::string_view value);
+
+    /**
+     * Sets the format every texture is written in. Call before any textures are written.
+     */
+    void init_output_format(OutputFormat format);
+    OutputFormat output_format();
+
+    /**
+     * The extension, including the dot, of textures written in the current output format
+     */
+    std::string output_extension();
+
+    /**
+     * Limits the width and height of written textures, 0 for no limit. Call before any textures are written.
+     * Textures are written from their largest mip level within the limit, and box filtered down if no level fits.
+     */
+    void init_max_texture_size(uint32_t size);
+    uint32_t max_texture_size();
+
+    /**
+     * Packs occlusion, roughness and metalness into one ORM map per specular texture, with the tint masks of the material's normal map
+     * in its alpha (see specular::packed_tint) instead of a tint map of their own. Call before any textures are written.
+     */
+    void init_pack_orm(bool pack);
+    bool pack_orm();
+
     std::string relabel_texture(std::string texture_name, std::string label);
 
-    bool write_texture(std::span<uint32_t> data, std::filesystem::path texture_path, gli::texture2d::extent_type extent);
+    /**
+     * Writes pixels in the current output format, with a mip chain filtered according to content if mips are enabled.
+     * DDS outputs hold every level and are block compressed by the encoder as BC7, normal maps
+     * included so they keep their Z, unless the encoder quality is None. PNG outputs write the levels below the first to separate files.
+     */
+    bool write_texture(std::span<uint32_t> data, std::filesystem::path texture_path, gli::texture2d::extent_type extent, mips::Content content = mips::Content::Color);
+    bool write_texture(const Image &image, std::filesystem::path texture_path, mips::Content content = mips::Content::Color);
+
+    /**
+     * Decodes `region` (the whole level by default) of one mip level to RGBA8.
+     * BC1-3 are decoded natively, other formats go through gli::convert.
+     */
+    std::optional<Image> decode_texture(const gli::texture2d &texture, size_t level = 0, std::optional<bc::Region> region = {});
+
+    /**
+     * Loads a DDS from memory and decodes one of its mip levels.
+     * Levels larger than the maximum texture size are skipped in favour of the largest one that fits.
+     * Goes through the decoded image cache, so textures used by several maps are decoded once.
+     */
+    std::shared_ptr<const Image> load_image(std::string texture_name, std::span<const uint8_t> texture_data, size_t level = 0);
 
     void process_normalmap(std::string texture_name, std::vector<uint8_t> texture_data, std::filesystem::path output_directory);
 
-    void process_specular(std::string texture_name, std::vector<uint8_t> specular_data, std::vector<uint8_t> albedo_data, std::filesystem::path output_directory);
+    /**
+     * Writes the metallic roughness (or ORM, see init_pack_orm) and emissive maps of a specular texture.
+     * normal_data is the material's normal map, read for its tint masks when packing ORM maps and otherwise unused.
+     */
+    void process_specular(std::string texture_name, std::vector<uint8_t> specular_data, std::vector<uint8_t> albedo_data, std::filesystem::path output_directory, std::vector<uint8_t> normal_data = {});
 
     void process_detailcube(std::string texture_name, std::vector<uint8_t> texture_data, std::filesystem::path output_directory);
 
+    /**
+     * Splits process_detailcube into one job per face, so the faces of a large cube can be written by several threads.
+     * Returns no jobs if the cube was fetched from the texture cache. The last face to finish stores the cube in the cache.
+     */
+    std::vector<std::function<void()>> detailcube_jobs(std::string texture_name, std::vector<uint8_t> texture_data, std::filesystem::path output_directory);
+
     std::optional<gli::texture2d> load_texture(std::string texture_name, std::vector<uint8_t>& texture_data);
 
     void save_texture(std::string texture_name, std::vector<uint8_t> texture_data, std::filesystem::path output_directory);
@@ -0,0 +1,16 @@
+#pragma once
+#include "argparse/argparse.hpp"
+
+namespace warpgate::utils::textures {
+    /**
+     * Adds the texture output options shared by the converters: --png-compression, --texture-format, --bc-quality, --mips,
+     * --texture-cache, --image-cache-size, --max-texture-size and, for models with material textures, --pack-orm.
+     */
+    void add_texture_arguments(argparse::ArgumentParser &parser, bool pack_orm = true);
+
+    /**
+     * Initializes the texture settings from the options added by add_texture_arguments once parser has parsed its arguments.
+     * Logs an error and returns false if a value is invalid.
+     */
+    bool apply_texture_arguments(argparse::ArgumentParser &parser, bool pack_orm = true);
+}
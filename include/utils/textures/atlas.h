@@ -0,0 +1,59 @@
+#pragma once
+#include <cstdint>
+#include <filesystem>
+#include <string>
+
+#include "utils/textures/terrain.h"
+
+namespace warpgate::utils::textures::atlas {
+    /**
+     * Where a texture was placed in the atlas. Texture coordinates in [0, 1] map to (u, v) + (texture coordinate * scale).
+     */
+    struct Slot {
+        uint32_t page;
+        float u, v, scale;
+    };
+
+    /**
+     * Packs chunk terrain maps into square pages of page_size pixels instead of writing each chunk's maps separately.
+     * Each map is resampled to cell_size pixels and placed on a fixed grid with its edges repeated into a small gutter.
+     * Pages are written to <output_directory>/textures/<name>_atlas_<page>_<C|S|N>.
+     *
+     * Returns false if a page cannot hold a single cell. Call before any chunks are added.
+     */
+    bool init_atlas(std::filesystem::path output_directory, std::string name, uint32_t page_size, uint32_t cell_size);
+    bool enabled();
+
+    /**
+     * Reserves the next free cell for texture_name. Slots are handed out in order, filling one page before starting the next.
+     * Starting a new page waits while too many earlier pages still have cells to be filled, so the caller must queue each
+     * reserved texture before reserving cells on later pages.
+     */
+    Slot reserve(const std::string &texture_name);
+
+    /**
+     * Whether texture_name has a reserved cell that has not been filled yet
+     */
+    bool reserved(const std::string &texture_name);
+
+    std::string page_name(uint32_t page);
+    std::filesystem::path page_path(uint32_t page, char label);
+
+    /**
+     * Copies maps into the cell reserved for texture_name. Pages are only allocated once their first cell is filled,
+     * and are written and freed as soon as their last cell is, so only the pages currently being filled are held in memory.
+     */
+    void place(const std::string &texture_name, const terrain::TerrainMaps &maps);
+
+    /**
+     * Gives up the cell reserved for texture_name after its maps failed to decode, leaving its placeholder fill
+     * so the page can still be completed and written.
+     */
+    void abandon(const std::string &texture_name);
+
+    /**
+     * Writes the pages that still have empty cells, such as the last page. Every page a cell was reserved on is written,
+     * with cells that were never filled left as placeholders.
+     */
+    void finish();
+}
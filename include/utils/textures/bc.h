@@ -0,0 +1,52 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+
+#include "utils/textures/image.h"
+
+namespace warpgate::utils::textures::bc {
+    enum class Format {
+        BC1,
+        BC2,
+        BC3,
+        // Single channel, decoded into red
+        BC4,
+        // Two channels, decoded into red and green
+        BC5,
+        // RGBA with per block modes and partitions. Always decoded with scalar code.
+        BC7,
+    };
+
+    struct Region {
+        uint32_t x, y, width, height;
+    };
+
+    /**
+     * Bytes per 4x4 block
+     */
+    size_t block_size(Format format);
+
+    /**
+     * Bytes used by a width x height mip level
+     */
+    size_t level_size(Format format, uint32_t width, uint32_t height);
+
+    /**
+     * Decodes one block into a 4x4 area of output, `stride` pixels per row.
+     * Rows are decoded four texels at a time when built with SSE4.1 or AVX2.
+     */
+    void decode_block(Format format, const uint8_t *block, uint32_t *output, size_t stride);
+
+    /**
+     * Decodes one row of blocks covering `width` texels into four rows of `stride` pixels, stride being at least width rounded up to 4
+     */
+    void decode_block_row(Format format, const uint8_t *blocks, uint32_t width, uint32_t *output, size_t stride);
+
+    /**
+     * Decodes `region` (the whole level by default) of a width x height mip level whose blocks are stored row by row in `blocks`.
+     * Only the blocks overlapping the region are read. Bands of block rows are shared with idle texture threads.
+     */
+    std::optional<Image> decode(Format format, std::span<const uint8_t> blocks, uint32_t width, uint32_t height, std::optional<Region> region = {});
+}
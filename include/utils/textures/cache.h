@@ -0,0 +1,44 @@
+#pragma once
+#include <filesystem>
+#include <initializer_list>
+#include <optional>
+#include <span>
+
+#include "utils/hash.h"
+
+namespace warpgate::utils::textures::cache {
+    // Bump whenever a texture processing step changes its output
+    constexpr uint32_t format_version = 5;
+
+    enum class Mode {
+        Texture,
+        NormalMap,
+        Specular,
+        DetailCube,
+        CnxSny,
+    };
+
+    /**
+     * Enables the cache. Entries are stored under `directory`, which is created if needed.
+     */
+    void init_cache(std::filesystem::path directory);
+    bool enabled();
+
+    /**
+     * Keyed by the source textures' content, the processing mode and the output format/compression settings.
+     * Returns nothing if the cache is disabled.
+     */
+    std::optional<hash::Hash128> texture_key(Mode mode, std::initializer_list<std::span<const uint8_t>> sources);
+
+    /**
+     * Hard links (or copies, where links are unsupported) a cached entry's files to `outputs`.
+     * Returns false if there is no complete entry for key.
+     */
+    bool fetch(const hash::Hash128 &key, std::span<const std::filesystem::path> outputs);
+
+    /**
+     * Copies the written outputs into the cache. Does nothing unless every output exists.
+     * The entry is assembled in a temporary directory and renamed into place, so concurrent exporters never see partial entries.
+     */
+    void store(const hash::Hash128 &key, std::span<const std::filesystem::path> outputs);
+}
@@ -0,0 +1,24 @@
+#pragma once
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <vector>
+
+#include "utils/textures/bc.h"
+
+namespace warpgate::utils::textures::container {
+    /**
+     * One mip level. data holds the level's blocks, or its RGBA8 pixels for uncompressed textures.
+     */
+    struct Level {
+        uint32_t width, height;
+        std::span<const uint8_t> data;
+    };
+
+    /**
+     * Builds a DDS file from mip levels in `format`, or RGBA8 if format is empty.
+     * Block formats use the legacy DXT1/DXT3/DXT5/ATI1/ATI2 FourCCs for the widest reader support. BC7 and sRGB textures
+     * have no legacy FourCC, so they use the DX10 extended header. srgb is ignored for BC4 and BC5.
+     */
+    std::vector<uint8_t> write_dds(std::optional<bc::Format> format, bool srgb, std::span<const Level> levels);
+}
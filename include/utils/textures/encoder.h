@@ -0,0 +1,49 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+#include "utils/textures/bc.h"
+
+namespace warpgate::utils::textures::encoder {
+    enum class Quality {
+        // Processed maps are written to DDS uncompressed, as RGBA8
+        None,
+        // BC7 endpoints at the ends of each block's principal axis, BC4/BC5 endpoints at each block's minimum and maximum
+        Fast,
+        // Endpoints refined by least squares, BC4/BC5 also trying the mode with exact 0 and 255
+        Default,
+        // Refined until the error stops improving, trying every BC7 p-bit combination and nearby BC4/BC5 endpoints
+        Best,
+    };
+
+    /**
+     * Parses a quality preset: "none", "fast", "default" or "best"
+     */
+    std::optional<Quality> parse_quality(std::string_view value);
+
+    /**
+     * Sets the quality used by every following encode. Call before any textures are written.
+     */
+    void init_encoder(Quality quality);
+    Quality quality();
+
+    /**
+     * Whether format can be encoded: BC4 (red), BC5 (red and green) or BC7 (RGBA)
+     */
+    bool supported(bc::Format format);
+
+    /**
+     * Encodes the 4x4 texels at pixels, `stride` pixels per row, into one block. quality must not be None.
+     */
+    void encode_block(bc::Format format, const uint32_t *pixels, size_t stride, Quality quality, uint8_t *block);
+
+    /**
+     * Encodes a width x height image, repeating the last row and column to fill the edge blocks.
+     * Rows of blocks are shared with idle texture threads through scheduler::parallel_for.
+     * Returns nothing if the format is not supported or quality is None.
+     */
+    std::vector<uint8_t> encode(bc::Format format, const uint32_t *pixels, uint32_t width, uint32_t height, Quality quality = encoder::quality());
+}
@@ -0,0 +1,25 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace warpgate::utils::textures {
+    /**
+     * Row-major 8 bit RGBA pixels, red in the lowest byte of each pixel (the layout of gli's FORMAT_RGBA8_UNORM_PACK8)
+     */
+    struct Image {
+        uint32_t width = 0, height = 0;
+        std::vector<uint32_t> pixels;
+
+        Image() = default;
+        Image(uint32_t width, uint32_t height) : width(width), height(height), pixels((size_t)width * height) {}
+
+        uint32_t *row(uint32_t y) {
+            return pixels.data() + (size_t)y * width;
+        }
+
+        const uint32_t *row(uint32_t y) const {
+            return pixels.data() + (size_t)y * width;
+        }
+    };
+}
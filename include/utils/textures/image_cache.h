@@ -0,0 +1,23 @@
+#pragma once
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+
+#include "utils/textures/image.h"
+
+namespace warpgate::utils::textures::image_cache {
+    /**
+     * Keeps up to `capacity` bytes of decoded images, evicting the least recently used. 0 disables the cache.
+     */
+    void init_image_cache(size_t capacity);
+    bool enabled();
+
+    /**
+     * Returns the decoded image for mip `level` of texture `name`, calling decode only if it is not cached.
+     * Threads asking for an image that another thread is still decoding wait for that decode instead of starting their own.
+     * Failed decodes return null and are not cached.
+     */
+    std::shared_ptr<const Image> get(const std::string &name, size_t level, const std::function<std::optional<Image>()> &decode);
+}
@@ -0,0 +1,60 @@
+#pragma once
+#include <cstdint>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+#include "utils/textures/image.h"
+
+namespace warpgate::utils::textures::mips {
+    enum class Filter {
+        // Textures are written with a single level
+        None,
+        // 2x2 average
+        Box,
+        // 8x8 Kaiser windowed sinc, keeps more detail in the smaller levels at the cost of slight ringing
+        Kaiser,
+    };
+
+    enum class Content {
+        // sRGB color, filtered in linear light. Alpha is filtered as stored.
+        Color,
+        // Masks, roughness and other values filtered as stored
+        Data,
+        // X in red and Y in green, with Z reconstructed from them. Filtered as vectors and renormalized, Z written to blue and alpha opaque.
+        Normal,
+    };
+
+    /**
+     * The next mip level down: each pixel is the rounded average of a 2x2 box, dimensions halve (rounding down, at least 1).
+     * Processes 2 pixels per iteration with SSE2, with results identical to the scalar path.
+     */
+    Image halve(const Image &image);
+
+    /**
+     * Halves image until neither dimension is larger than max_size
+     */
+    Image downscale(const Image &image, uint32_t max_size);
+
+    /**
+     * Parses a mip filter: "none", "box" or "kaiser"
+     */
+    std::optional<Filter> parse_filter(std::string_view value);
+
+    /**
+     * Sets the filter used to generate the mip levels of every following texture written. Call before any textures are written.
+     */
+    void init_mips(Filter filter);
+    Filter filter();
+
+    /**
+     * The next mip level down, filtered according to content. Dimensions halve as with halve().
+     * Each pixel is filtered as a vector of four floats with SSE, and bands of rows are shared with idle texture threads.
+     */
+    Image next_level(const Image &image, Content content, Filter filter);
+
+    /**
+     * Every level below image, down to 1x1. Empty if filter is None.
+     */
+    std::vector<Image> chain(const Image &image, Content content, Filter filter = mips::filter());
+}
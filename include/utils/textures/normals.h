@@ -0,0 +1,36 @@
+#pragma once
+#include <cstdint>
+#include <optional>
+#include <span>
+
+#include "utils/textures/bc.h"
+#include "utils/textures/image.h"
+
+namespace warpgate::utils::textures::normals {
+    enum class Layout {
+        // BC3n/DXT5nm: X in alpha, Y in green, tint mask bits in red and blue
+        XInAlpha,
+        // BC5/RG: X in red, Y in green
+        XInRed,
+    };
+
+    struct NormalMap {
+        Image normal;
+        Image tint;
+    };
+
+    /**
+     * Writes the glTF normal (X, Y and the reconstructed Z) and the tint mask for each input pixel.
+     * Processes 8 pixels per iteration when built with AVX2, with results identical to the scalar path.
+     */
+    void convert_pixels(std::span<const uint32_t> input, Layout layout, uint32_t *normal, uint32_t *tint);
+
+    NormalMap convert(const Image &image, Layout layout);
+
+    /**
+     * Decodes a block compressed normal map and converts it a row of blocks at a time,
+     * so the decoded texels never leave the cache before being converted.
+     * Bands of block rows are shared with idle texture threads through scheduler::parallel_rows.
+     */
+    std::optional<NormalMap> decode(bc::Format format, std::span<const uint8_t> blocks, uint32_t width, uint32_t height);
+}
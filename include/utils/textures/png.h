@@ -0,0 +1,34 @@
+#pragma once
+#include <cstdint>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+namespace warpgate::utils::textures::png {
+    struct Settings {
+        // zlib compression level, 0-9
+        int level = 6;
+        // Picks the best of the five PNG filters for each row. Otherwise every row uses the Up filter.
+        bool adaptive_filter = true;
+        // Most segments one image is split into, 0 for one per hardware thread. The segments run on the texture threads.
+        uint32_t threads = 0;
+    };
+
+    /**
+     * Parses a compression setting: "fast" (level 1, Up filter), "default", "best" or a zlib level 0-9
+     */
+    std::optional<Settings> parse_settings(std::string_view value);
+
+    /**
+     * Sets the settings used by every following encode. Call before any textures are written.
+     */
+    void init_png(Settings settings);
+    const Settings &settings();
+
+    /**
+     * Encodes RGBA8 pixels as a PNG.
+     * The rows are split into segments that are filtered and then deflated in parallel through scheduler::parallel_for, each segment
+     * primed with the end of the previous one as its dictionary. The compressed segments are concatenated into a single zlib stream.
+     */
+    std::vector<uint8_t> encode(const uint32_t *pixels, uint32_t width, uint32_t height, const Settings &settings = png::settings());
+}
@@ -0,0 +1,121 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <span>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "utils/notifier.h"
+#include "utils/textures/cache.h"
+#include "utils/tsqueue.h"
+
+namespace warpgate::utils::textures::scheduler {
+    /**
+     * Sets how many threads a parallel_for uses while no image threads are running, normally the --threads value.
+     * Defaults to the number of hardware threads.
+     */
+    void init_scheduler(uint32_t threads);
+
+    /**
+     * Estimates the relative cost of processing a DDS in `mode` from its header alone:
+     * the pixels that will be decoded (all faces of cube maps, capped by the maximum texture size) times a per-mode weight.
+     */
+    uint64_t estimate_cost(cache::Mode mode, std::span<const uint8_t> dds_data);
+
+    /**
+     * Queues a texture job. Jobs are run most expensive first, so a large texture queued last doesn't leave
+     * one thread working alone after the others have finished. Large jobs should be submitted as several smaller ones.
+     */
+    void submit(std::string name, uint64_t cost, std::function<void()> job);
+
+    /**
+     * Notified whenever a job is submitted. Image threads attach their input queues to it with tsqueue::set_notifier,
+     * then sleep on it until a queue or the scheduler has work.
+     */
+    notifier &work_available();
+
+    /**
+     * Runs the most expensive queued job on the calling thread, waiting up to timeout for one to be queued.
+     * Returns false if there was no job to run.
+     */
+    bool run_next(std::chrono::milliseconds timeout);
+
+    /**
+     * Calls fn(0) to fn(count - 1) on the calling thread, with idle texture threads picking up indices alongside it.
+     * The helpers are queued ahead of every other job and return straight away if the loop has already finished.
+     * Returns once every call has finished. Only texture threads get help from the pool, other callers run the whole loop themselves,
+     * unless no texture threads are running at all, in which case the loop starts threads of its own, up to the count set by init_scheduler.
+     */
+    void parallel_for(size_t count, std::function<void(size_t)> fn);
+
+    // Images smaller than this are processed as a single band by parallel_rows
+    constexpr uint64_t min_parallel_pixels = 256 * 256;
+
+    /**
+     * Splits rows 0 to height into bands of `rows` rows and calls fn(first_row, end_row) for each through parallel_for.
+     * Keep rows a multiple of 4 for work on 4x4 blocks. Images below min_parallel_pixels are done in one call on the calling thread.
+     */
+    void parallel_rows(uint32_t width, uint32_t height, std::function<void(uint32_t, uint32_t)> fn, uint32_t rows = 64);
+
+    /**
+     * A queue of textures feeding the image threads. take moves one texture from the queue into submitted jobs,
+     * returning false if the queue was empty, and closed says whether the queue has been closed and emptied.
+     */
+    struct Source {
+        std::function<bool()> take;
+        std::function<bool()> closed;
+    };
+
+    /**
+     * The body of an image thread. Hands textures from sources to the scheduler while fewer than max_pending jobs are waiting
+     * and runs the most expensive job, sleeping on work_available while there is nothing to do.
+     * Returns once every source is closed and every job has been run.
+     *
+     * The calling thread counts as an image thread until then: its jobs are reported, and its parallel_for loops are helped.
+     */
+    void drain(std::vector<Source> sources);
+
+    /**
+     * Wraps queue as a source for drain, passing each texture taken from it to submit, which is expected to submit its jobs.
+     * Also attaches the queue to work_available.
+     */
+    template <class T>
+    Source source(tsqueue<T> &queue, std::type_identity_t<std::function<void(T)>> submit) {
+        queue.set_notifier(&work_available());
+        return {
+            [&queue, submit = std::move(submit)]() {
+                std::optional<T> value = queue.try_dequeue();
+                if(!value) {
+                    return false;
+                }
+                submit(std::move(*value));
+                return true;
+            },
+            [&queue]() { return queue.is_closed(); }
+        };
+    }
+
+    template <class T>
+    void drain(tsqueue<T> &queue, std::type_identity_t<std::function<void(T)>> submit) {
+        drain({source(queue, std::move(submit))});
+    }
+
+    /**
+     * The number of jobs queued but not yet started
+     */
+    size_t pending();
+
+    // Image threads stop taking textures off their queues while this many jobs are waiting, so producers are held back by the
+    // bounded queues instead of loaded textures piling up here
+    constexpr size_t max_pending = 64;
+
+    /**
+     * Logs how busy the threads running jobs were, next to an estimate of how long the same jobs
+     * would have taken if they had been run in the order they were submitted, then forgets them so the next export is reported on its own.
+     * Jobs queued to help a parallel_for count towards their thread's busy time, but not as jobs of their own.
+     */
+    void report();
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include <cstdint>
+#include <span>
+
+#include "utils/textures/image.h"
+
+namespace warpgate::utils::textures::specular {
+    struct SpecularMaps {
+        Image metallic_roughness;
+        Image emissive;
+    };
+
+    struct OrmMaps {
+        Image orm;
+        Image emissive;
+    };
+
+    /**
+     * Converts one row of specular pixels and the albedo pixels sampled at the same texels.
+     *   metallic_roughness: roughness from specular alpha in green, metalness from specular red in blue
+     *   emissive:           albedo with specular blue as alpha where specular blue is above 0.2 and albedo is not transparent, 0 elsewhere
+     *
+     * Processes 8 pixels per iteration when built with AVX2, with results identical to the scalar path.
+     */
+    void convert_pixels(std::span<const uint32_t> specular, const uint32_t *albedo, uint32_t *metallic_roughness, uint32_t *emissive);
+
+    /**
+     * Builds the metallic roughness and emissive maps row by row in one pass over both inputs, in bands shared with idle texture threads.
+     * albedo is nearest sampled when its size differs from specular.
+     */
+    SpecularMaps convert(const Image &specular, const Image &albedo);
+
+    /**
+     * The tint masks of a normal map pixel (see normals::convert_pixels) packed into one channel, 51 apart so they survive block compression:
+     * 51 * (2 * region + camo), region being 0 where blue is below 50, 2 where it is above 150 and 1 elsewhere, camo 1 where red is below 50.
+     * 102 is untinted.
+     */
+    uint32_t packed_tint(uint32_t normal);
+
+    /**
+     * As convert_pixels, with occlusion, roughness and metalness packed into one map along with the normal map's tint masks.
+     *   orm: occlusion in red (opaque white, the specular maps carry none), roughness in green, metalness in blue, packed_tint in alpha
+     * normal may be null, in which case the alpha is untinted.
+     */
+    void convert_orm_pixels(std::span<const uint32_t> specular, const uint32_t *albedo, const uint32_t *normal, uint32_t *orm, uint32_t *emissive);
+
+    /**
+     * Builds the ORM and emissive maps row by row in one pass over all three inputs, banded as convert.
+     * albedo and normal are nearest sampled when their sizes differ from specular, normal may be null.
+     */
+    OrmMaps convert_orm(const Image &specular, const Image &albedo, const Image *normal);
+}
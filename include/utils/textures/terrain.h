@@ -0,0 +1,40 @@
+#pragma once
+#include <cstdint>
+#include <optional>
+#include <span>
+
+#include "utils/textures/bc.h"
+#include "utils/textures/image.h"
+
+namespace warpgate::utils::textures::terrain {
+    struct TerrainMaps {
+        Image color;
+        Image specular;
+        Image normal;
+    };
+
+    /**
+     * Splits one row of color_nx and specular_ny pixels into
+     *   color:    color_nx made opaque
+     *   specular: specular_ny made opaque with green and blue inverted
+     *   normal:   X from color_nx alpha, Y from specular_ny alpha, blue and alpha 255
+     *
+     * Processes 8 pixels per iteration when built with AVX2.
+     */
+    void split_pixels(std::span<const uint32_t> color_nx, const uint32_t *specular_ny, uint32_t *color, uint32_t *specular, uint32_t *normal);
+
+    /**
+     * Splits matching color_nx and specular_ny images into preallocated color, specular and normal maps
+     */
+    TerrainMaps split(const Image &color_nx, const Image &specular_ny);
+
+    /**
+     * Decodes both block compressed maps a row of blocks at a time and splits each row as it is decoded.
+     * Bands of block rows are shared with idle texture threads through scheduler::parallel_rows.
+     */
+    std::optional<TerrainMaps> decode(
+        bc::Format color_nx_format, std::span<const uint8_t> color_nx_blocks,
+        bc::Format specular_ny_format, std::span<const uint8_t> specular_ny_blocks,
+        uint32_t width, uint32_t height
+    );
+}
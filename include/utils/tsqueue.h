@@ -1,35 +1,90 @@
 #pragma once
-#include <queue>
-#include <mutex>
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
 #include <optional>
-#include <chrono>
 
 namespace warpgate::utils {
-    // A threadsafe-queue.
+    class notifier;
+
+    /**
+     * A bounded threadsafe queue for any number of producers and consumers.
+     *
+     * Elements live in a ring buffer of `capacity` cells (rounded up to a power of two). Each cell has a sequence number saying whether
+     * it is free or holds an element on the current lap around the ring, so producers and consumers claim cells with a single
+     * compare-exchange on their own end of the queue and never take a lock while it is neither full nor empty.
+     * Producers wait while the queue is full, which holds them back to the pace of the consumers. Waiting threads sleep on a
+     * condition variable that is only signalled when a thread is actually asleep on it.
+     *
+     * Elements are moved in and out, so move-only types can be queued.
+     */
     template <class T>
     class tsqueue
     {
     public:
-        tsqueue(void);
+        explicit tsqueue(size_t capacity = 256);
         ~tsqueue();
 
-        // Add an element to the queue.
-        void enqueue(T t);
+        tsqueue(const tsqueue&) = delete;
+        tsqueue &operator=(const tsqueue&) = delete;
+
+        // Add an element to the queue, waiting while it is full.
+        // Returns false, dropping t, if the queue has been closed.
+        bool enqueue(T t);
+        // Add an element if there is room, only moving from t if it was added.
+        bool try_enqueue(T &t);
 
         // Get the "front"-element.
-        // If the queue is empty, wait till a element is avaiable.
+        // If the queue is empty, wait till a element is avaiable. Returns T{} if the queue is closed and empty.
         T dequeue(void);
+        // As dequeue, returning def if the queue is closed and empty.
         T try_dequeue(T def);
+        // Get the "front"-element if there is one, without waiting.
+        std::optional<T> try_dequeue(void);
+        // Wait up to ms for an element. Returns nothing on timeout or if the queue is closed and empty.
         std::optional<T> try_dequeue_for(const std::chrono::milliseconds ms);
 
+        // True once the queue is closed and every element has been taken.
         bool is_closed(void);
+        // Stop accepting elements and wake every waiting thread. Elements already queued can still be taken.
         void close(void);
 
+        // Also notify n whenever an element is added or the queue is closed, so one thread can wait on several queues at once.
+        void set_notifier(notifier *n);
+
+        size_t capacity(void) const;
+        // The number of elements queued, only exact while no other thread is using the queue.
+        // Counts elements a producer is still moving in, so it may be more than can be taken straight away.
+        size_t size(void) const;
+
     private:
-        std::queue<T> q;
-        mutable std::mutex m;
-        std::condition_variable c;
-        bool closed;
+        struct Cell {
+            std::atomic<size_t> sequence;
+            alignas(T) unsigned char storage[sizeof(T)];
+        };
+
+        bool push(T &t);
+        std::optional<T> pop(void);
+        // Whether push or pop could go ahead now. Unlike size(), these only look at cells whose elements have finished
+        // moving in or out, so a waiting thread doesn't wake into a busy loop while another thread is midway through a cell
+        bool writable(void) const;
+        bool readable(void) const;
+        std::optional<T> wait_pop(std::optional<std::chrono::steady_clock::time_point> deadline);
+        void wake(std::atomic<size_t> &waiting, std::condition_variable &c);
+        void added(void);
+
+        size_t mask;
+        std::unique_ptr<Cell[]> cells;
+        // Kept on separate cache lines so producers and consumers don't contend over the same line
+        alignas(64) std::atomic<size_t> head;
+        alignas(64) std::atomic<size_t> tail;
+        alignas(64) std::atomic<bool> closed;
+        std::atomic<size_t> waiting_producers, waiting_consumers;
+        std::atomic<notifier*> listener;
+        std::mutex m;
+        std::condition_variable not_full, not_empty;
     };
-}
\ No newline at end of file
+}
@@ -13,10 +13,17 @@
 #include "dme_loader.h"
 #include "utils/actor_sockets.h"
 #include "utils/adr.h"
+#include "utils/archive.h"
+#include "utils/gltf/common.h"
 #include "utils/gltf/dme.h"
 #include "utils/gltf/dmat.h"
+#include "utils/gltf/staging.h"
+#include "utils/gltf/writer.h"
 #include "utils/materials_3.h"
+#include "utils/mesh_cache.h"
+#include "utils/skinning.h"
 #include "utils/textures.h"
+#include "utils/textures/arguments.h"
 #include "utils/tsqueue.h"
 #include "utils.h"
 #include "tiny_gltf.h"
@@ -57,6 +64,11 @@ void build_argument_parser(argparse::ArgumentParser &parser, int &log_level) {
         .default_value(4u)
         .scan<'u', uint32_t>();
 
+    utils::textures::add_texture_arguments(parser);
+
+    parser.add_argument("--archive")
+        .help("Write textures into this store-only .zip or .tar, at their paths relative to the output directory, instead of as separate files");
+
     parser.add_argument("--no-skeleton", "-s")
         .help("Exclude the skeleton from the output")
         .default_value(false)
@@ -81,6 +93,20 @@ void build_argument_parser(argparse::ArgumentParser &parser, int &log_level) {
         .default_value(false)
         .implicit_value(true)
         .nargs(0);
+
+    parser.add_argument("--mesh-cache")
+        .help("Directory used to cache expanded mesh data between runs");
+
+    parser.add_argument("--staging-directory")
+        .help("Directory used to stage buffer data on disk once --staging-threshold is exceeded, keeping memory use bounded");
+
+    parser.add_argument("--staging-threshold")
+        .help("How many MiB of buffer data to keep in memory before staging to disk")
+        .default_value(1024u)
+        .scan<'u', uint32_t>();
+
+    parser.add_argument("--pose")
+        .help("Export a static mesh posed by an animation from the ADR's animation network, given as <animation>:<time in seconds>");
 }
 
 void load_asset(synthium::Manager &manager, std::string input_str, std::vector<uint8_t> &data_vector, std::span<uint8_t> &data_span, std::shared_ptr<uint8_t[]> &data) {
@@ -121,6 +147,59 @@ void load_asset(synthium::Manager &manager, std::string input_str, std::vector<u
     }
 }
 
+bool pose_gltf(synthium::Manager &manager, utils::ADR &adr, const DME &dme, tinygltf::Model &gltf, const utils::skinning::PoseRequest &pose) {
+    std::optional<std::string> mrn_file = adr.animation_network();
+    if(!mrn_file) {
+        logger::error("ADR has no animation network to pose the model with");
+        return false;
+    }
+
+    std::shared_ptr<uint8_t[]> mrn_data;
+    std::vector<uint8_t> mrn_data_vector;
+    std::span<uint8_t> mrn_data_span;
+    load_asset(manager, *mrn_file, mrn_data_vector, mrn_data_span, mrn_data);
+    mrn::MRN mrn(mrn_data_span, *mrn_file);
+
+    std::shared_ptr<mrn::SkeletonData> skeleton_data;
+    uint32_t best_match = 0;
+    for(uint32_t skeleton_index : mrn.skeleton_indices()) {
+        std::shared_ptr<mrn::SkeletonData> candidate = static_pointer_cast<mrn::SkeletonPacket>(mrn[skeleton_index])->skeleton_data();
+        uint32_t matches = utils::skinning::matching_bones(dme, *candidate->skeleton());
+        if(matches > best_match) {
+            best_match = matches;
+            skeleton_data = candidate;
+        }
+    }
+    if(!skeleton_data) {
+        logger::error("No skeleton in {} matches the bones of {}", *mrn_file, dme.get_name());
+        return false;
+    }
+    logger::debug("Using skeleton matching {}/{} bones", best_match, (uint32_t)dme.bone_count());
+
+    std::vector<std::string> animation_names = mrn.file_names()->files()->animation_names()->strings();
+    std::string animation_name = utils::uppercase(pose.animation);
+    auto animation_it = std::find_if(animation_names.begin(), animation_names.end(), [&](const std::string &name) {
+        return utils::uppercase(name) == animation_name;
+    });
+    if(animation_it == animation_names.end()) {
+        logger::error("Animation '{}' not found in {}", pose.animation, *mrn_file);
+        return false;
+    }
+    uint32_t animation_index = (uint32_t)(animation_it - animation_names.begin());
+    if(mrn[animation_index]->header()->type() != mrn::PacketType::NSAData) {
+        logger::error("Animation '{}' is not stored as NSA data", pose.animation);
+        return false;
+    }
+    std::shared_ptr<mrn::NSAFile> animation = static_pointer_cast<mrn::NSAFilePacket>(mrn[animation_index])->animation();
+
+    logger::info("Posing {} with {} at {}s...", dme.get_name(), *animation_it, pose.time);
+    std::vector<glm::mat4> posed = utils::skinning::evaluate_pose(skeleton_data, animation, pose.time);
+    std::vector<glm::mat4> joints = utils::skinning::joint_matrices(dme, *skeleton_data->skeleton(), posed);
+    utils::skinning::apply_pose(gltf, joints);
+    logger::info("Posed {}.", dme.get_name());
+    return true;
+}
+
 bool isCOG(tinygltf::Node node) {
     return node.name == "COG";
 }
@@ -151,10 +230,20 @@ int main(int argc, const char* argv[]) {
     }
     logger::set_level(logger::level::level_enum(log_level));
 
+    if(!utils::textures::apply_texture_arguments(parser)) {
+        std::exit(1);
+    }
+    // Textures are only processed by the image threads, and the bounded image queue would never be emptied without them
+    if(!parser.get<bool>("--no-textures") && parser.get<uint32_t>("--threads") == 0) {
+        logger::error("--threads must be at least 1 when exporting textures");
+        std::exit(1);
+    }
+
     std::string input_str = parser.get<std::string>("input_file");
 
     logger::info("Converting file {} using adr_converter {}", input_str, WARPGATE_VERSION);
     uint32_t image_processor_thread_count = parser.get<uint32_t>("--threads");
+    utils::textures::scheduler::init_scheduler(image_processor_thread_count);
     std::string path = parser.get<std::string>("--assets-directory");
     std::filesystem::path server(path);
     std::vector<std::filesystem::path> assets;
@@ -171,6 +260,14 @@ int main(int argc, const char* argv[]) {
     utils::materials3::init_materials();
     logger::info("Loaded materials.json");
 
+    if(auto mesh_cache = parser.present<std::string>("--mesh-cache")) {
+        utils::mesh_cache::init_cache(*mesh_cache);
+    }
+
+    if(auto staging_directory = parser.present<std::string>("--staging-directory")) {
+        utils::gltf::staging::init_staging(*staging_directory, (size_t)parser.get<uint32_t>("--staging-threshold") << 20);
+    }
+
     std::shared_ptr<uint8_t[]> actorsockets_data;
     std::vector<uint8_t> actorsockets_data_vector;
     std::span<uint8_t> actorsockets_data_span;
@@ -199,7 +296,13 @@ int main(int argc, const char* argv[]) {
         }
     } catch (std::filesystem::filesystem_error& err) {
         logger::error("Failed to create directory {}: {}", err.path1().string(), err.what());
-        std::exit(3);
+        return 3;
+    }
+
+    if(auto archive_path = parser.present<std::string>("--archive")) {
+        if(!utils::archive::init_archive(*archive_path, *output_directory)) {
+            return 3;
+        }
     }
 
     utils::tsqueue<std::pair<std::string, Semantic>> image_queue;
@@ -209,6 +312,23 @@ int main(int argc, const char* argv[]) {
     bool export_textures = !parser.get<bool>("--no-textures");
     bool rigify_skeleton = parser.get<bool>("--rigify");
 
+    std::optional<utils::skinning::PoseRequest> pose;
+    if(auto pose_value = parser.present<std::string>("--pose")) {
+        pose = utils::skinning::parse_pose(*pose_value);
+        if(!pose) {
+            logger::error("Invalid pose '{}', expected <animation>:<time>", *pose_value);
+            std::exit(1);
+        }
+        // Skinning needs the joints and weights, the skin itself is removed again once posed
+        include_skeleton = true;
+    }
+
+    utils::ADR adr(data_span);
+    std::optional<std::string> dme_file = adr.base_model();
+    if(!dme_file) {
+        return 1;
+    }
+
     std::vector<std::thread> image_processor_pool;
     if(export_textures) {
         logger::info("Using {} image processing thread{}", image_processor_thread_count, image_processor_thread_count == 1 ? "" : "s");
@@ -223,12 +343,15 @@ int main(int argc, const char* argv[]) {
     } else {
         logger::info("Not exporting textures by user request.");
     }
-
-    utils::ADR adr(data_span);
-    std::optional<std::string> dme_file = adr.base_model();
-    if(!dme_file) {
-        std::exit(1);
-    }
+    // Every return after this point stops the image threads first, even on failure
+    auto stop_image_threads = [&]() {
+        image_queue.close();
+        logger::info("Joining image processing thread{}...", image_processor_pool.size() == 1 ? "" : "s");
+        for(uint32_t i = 0; i < image_processor_pool.size(); i++) {
+            image_processor_pool.at(i).join();
+        }
+        utils::textures::scheduler::report();
+    };
 
     std::optional<std::string> dmat_file = adr.base_palette();
     std::shared_ptr<DMAT> dmat = nullptr;
@@ -263,15 +386,26 @@ int main(int argc, const char* argv[]) {
         }
         utils::gltf::dme::add_actorsockets_to_gltf(gltf, actorSockets, basename, parent_index);
     }
+
+    // Posed after the sockets are added so they follow the bones they hang off
+    if(pose && !pose_gltf(manager, adr, *dme, gltf, *pose)) {
+        stop_image_threads();
+        return 1;
+    }
     
+    size_t deduplicated = utils::gltf::deduplicate_buffers(gltf);
+    logger::info("Deduplicated {} bytes of buffer data", deduplicated);
+
     logger::info("Writing GLTF2 file {}...", output_filename.filename().string());
-    tinygltf::TinyGLTF writer;
-    writer.WriteGltfSceneToFile(&gltf, output_filename.string(), false, format == "glb", format == "gltf", format == "glb");
+    bool written = utils::gltf::write_gltf(gltf, output_filename, format == "glb", format == "gltf");
+    utils::gltf::staging::release(gltf);
     
-    image_queue.close();
-    logger::info("Joining image processing thread{}...", image_processor_pool.size() == 1 ? "" : "s");
-    for(uint32_t i = 0; i < image_processor_pool.size(); i++) {
-        image_processor_pool.at(i).join();
+    stop_image_threads();
+    if(utils::archive::enabled() && !utils::archive::close_archive()) {
+        return 3;
+    }
+    if(!written) {
+        return 3;
     }
     logger::info("Done.");
     return 0;
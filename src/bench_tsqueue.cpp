@@ -0,0 +1,156 @@
+#include "utils/tsqueue.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <queue>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+
+namespace logger = spdlog;
+
+namespace {
+    // The unbounded queue tsqueue replaced, kept as it was apart from size() for comparison
+    template <class T>
+    class legacy_tsqueue {
+    public:
+        void enqueue(T t) {
+            if(closed) {
+                return;
+            }
+            std::lock_guard<std::mutex> lock(m);
+            q.push(t);
+            c.notify_one();
+        }
+
+        T try_dequeue(T def) {
+            std::unique_lock<std::mutex> lock(m);
+            while (q.empty() && !closed)
+            {
+                c.wait(lock);
+            }
+            if(q.empty() && closed) {
+                return def;
+            }
+            T val = q.front();
+            q.pop();
+            return val;
+        }
+
+        void close() {
+            closed = true;
+            c.notify_all();
+        }
+
+        size_t size() {
+            std::lock_guard<std::mutex> lock(m);
+            return q.size();
+        }
+
+    private:
+        std::queue<T> q;
+        std::mutex m;
+        std::condition_variable c;
+        bool closed = false;
+    };
+
+    struct Result {
+        double seconds;
+        size_t peak;
+    };
+
+    /**
+     * Pushes items strings of 64 characters through queue from producers threads to consumers threads, while sampling the queue's length.
+     * Consumers spend work iterations on each item, standing in for the texture threads being slower than the producers.
+     */
+    template <class Queue>
+    Result run(Queue &queue, uint32_t producers, uint32_t consumers, size_t items, uint32_t work) {
+        std::atomic<size_t> consumed = 0;
+        std::atomic<bool> done = false;
+        size_t peak = 0;
+        std::thread monitor([&]() {
+            while(!done) {
+                peak = std::max(peak, queue.size());
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+            }
+        });
+
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::thread> threads;
+        for(uint32_t i = 0; i < consumers; i++) {
+            threads.push_back(std::thread([&]() {
+                size_t count = 0;
+                volatile uint32_t sink = 0;
+                while(true) {
+                    std::string value = queue.try_dequeue("");
+                    if(value.empty()) {
+                        break;
+                    }
+                    for(uint32_t j = 0; j < work; j++) {
+                        sink = sink + (uint8_t)value[j % value.size()];
+                    }
+                    count++;
+                }
+                consumed += count;
+            }));
+        }
+        std::vector<std::thread> producer_threads;
+        for(uint32_t i = 0; i < producers; i++) {
+            producer_threads.push_back(std::thread([&, i]() {
+                std::string value(64, (char)('a' + i % 26));
+                for(size_t j = i; j < items; j += producers) {
+                    queue.enqueue(value);
+                }
+            }));
+        }
+        for(std::thread &thread : producer_threads) {
+            thread.join();
+        }
+        queue.close();
+        for(std::thread &thread : threads) {
+            thread.join();
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        done = true;
+        monitor.join();
+        if(consumed != items) {
+            logger::error("Consumed {} of {} items", consumed.load(), items);
+            std::exit(1);
+        }
+        return {seconds, peak};
+    }
+}
+
+int main(int argc, const char* argv[]) {
+    size_t items = argc > 1 ? std::stoull(argv[1]) : 1000000;
+    size_t capacity = argc > 2 ? std::stoull(argv[2]) : 256;
+
+    struct Case {
+        uint32_t producers, consumers, work;
+    };
+    std::vector<Case> cases = {
+        {1, 1, 0},
+        {4, 4, 0},
+        {8, 8, 0},
+        {2, 8, 0},
+        // Consumers slower than the producers, as texture threads are with zone_converter
+        {4, 4, 2000},
+    };
+
+    logger::info("{} items per case, tsqueue capacity {}", items, capacity);
+    logger::info("{:>9} {:>9} {:>6} | {:>12} {:>10} | {:>12} {:>10}", "producers", "consumers", "work", "legacy Mop/s", "peak", "tsqueue Mop/s", "peak");
+    for(const Case &test : cases) {
+        legacy_tsqueue<std::string> legacy;
+        Result before = run(legacy, test.producers, test.consumers, items, test.work);
+        warpgate::utils::tsqueue<std::string> bounded(capacity);
+        Result after = run(bounded, test.producers, test.consumers, items, test.work);
+        logger::info(
+            "{:>9} {:>9} {:>6} | {:>12.2f} {:>10} | {:>12.2f} {:>10}", test.producers, test.consumers, test.work,
+            items / before.seconds / 1e6, before.peak, items / after.seconds / 1e6, after.peak
+        );
+    }
+    return 0;
+}
@@ -5,8 +5,11 @@
 
 #include "argparse/argparse.hpp"
 #include "cnk_loader.h"
+#include "utils/archive.h"
 #include "utils/gltf/chunk.h"
+#include "utils/gltf/writer.h"
 #include "utils/textures.h"
+#include "utils/textures/arguments.h"
 #include "utils/tsqueue.h"
 #include "synthium/synthium.h"
 #include "tiny_gltf.h"
@@ -28,16 +31,16 @@ void process_images(
     std::filesystem::path output_directory
 ) {
     logger::debug("Got output directory {}", output_directory.string());
-    while(!queue.is_closed()) {
-        auto[texture_basename, cnx_data, cnx_length, sny_data, sny_length] = queue.try_dequeue({"", {}, 0, {}, 0});
-        if(texture_basename == "") {
-            logger::info("Got default value from try_dequeue, stopping thread.");
-            break;
-        }
+    warpgate::utils::textures::scheduler::drain(queue, [&](auto value) {
+        auto[texture_basename, cnx_data, cnx_length, sny_data, sny_length] = value;
         std::span<uint8_t> cnx_map(cnx_data.get(), cnx_length);
-        std::span<uint8_t> sny_map(sny_data.get(), sny_length);
-        warpgate::utils::textures::process_cnx_sny(texture_basename, cnx_map, sny_map, output_directory);
-    }
+        uint64_t cost = warpgate::utils::textures::scheduler::estimate_cost(warpgate::utils::textures::cache::Mode::CnxSny, cnx_map);
+        warpgate::utils::textures::scheduler::submit(texture_basename, cost, [=]() {
+            std::span<uint8_t> cnx_map(cnx_data.get(), cnx_length);
+            std::span<uint8_t> sny_map(sny_data.get(), sny_length);
+            warpgate::utils::textures::process_cnx_sny(texture_basename, cnx_map, sny_map, output_directory);
+        });
+    });
 }
 
 void build_argument_parser(argparse::ArgumentParser &parser, int &log_level) {
@@ -72,6 +75,20 @@ void build_argument_parser(argparse::ArgumentParser &parser, int &log_level) {
         .default_value(4u)
         .scan<'u', uint32_t>();
 
+    warpgate::utils::textures::add_texture_arguments(parser, false);
+
+    parser.add_argument("--archive")
+        .help("Write textures into this store-only .zip or .tar, at their paths relative to the output directory, instead of as separate files");
+
+    parser.add_argument("--terrain-atlas")
+        .help("Pack terrain textures into square atlas pages of this many pixels, with one material per page, instead of writing every chunk's textures separately")
+        .scan<'u', uint32_t>();
+
+    parser.add_argument("--terrain-atlas-cell")
+        .help("The size in pixels terrain textures are resampled to in the atlas")
+        .default_value(256u)
+        .scan<'u', uint32_t>();
+
     parser.add_argument("--no-textures", "-i")
         .help("Exclude the textures from the output")
         .default_value(false)
@@ -103,6 +120,15 @@ int main(int argc, char* argv[]) {
 
     logger::set_level(logger::level::level_enum(log_level));
 
+    if(!warpgate::utils::textures::apply_texture_arguments(parser, false)) {
+        std::exit(1);
+    }
+    // Textures are only processed by the image threads, and the bounded image queue would never be emptied without them
+    if(!parser.get<bool>("--no-textures") && parser.get<uint32_t>("--threads") == 0) {
+        logger::error("--threads must be at least 1 when exporting textures");
+        std::exit(1);
+    }
+
     std::string input_str = parser.get<std::string>("input_file");
     
     logger::info("Converting file {} using dme_converter {}", input_str, WARPGATE_VERSION);
@@ -158,12 +184,25 @@ int main(int argc, char* argv[]) {
         }
     } catch (std::filesystem::filesystem_error& err) {
         logger::error("Failed to create directory {}: {}", err.path1().string(), err.what());
-        std::exit(3);
+        return 3;
+    }
+
+    if(auto archive_path = parser.present<std::string>("--archive")) {
+        if(!warpgate::utils::archive::init_archive(*archive_path, output_directory)) {
+            return 3;
+        }
+    }
+
+    if(auto atlas_size = parser.present<uint32_t>("--terrain-atlas")) {
+        if(!warpgate::utils::textures::atlas::init_atlas(output_directory, input_filename.stem().string(), *atlas_size, parser.get<uint32_t>("--terrain-atlas-cell"))) {
+            std::exit(1);
+        }
     }
 
     std::string format = parser.get<std::string>("--format");
     bool export_textures = !parser.get<bool>("--no-textures");
     uint32_t image_processor_thread_count = parser.get<uint32_t>("--threads");
+    warpgate::utils::textures::scheduler::init_scheduler(image_processor_thread_count);
     // hmm
     warpgate::utils::tsqueue<
         std::tuple<
@@ -202,15 +241,25 @@ int main(int argc, char* argv[]) {
     logger::info("Added chunk to gltf");
 
     logger::info("Writing gltf file...");
-    tinygltf::TinyGLTF writer;
-    writer.WriteGltfSceneToFile(&gltf, output_filename.string(), false, format == "glb", format == "gltf", format == "glb");
-    logger::info("Successfully wrote gltf file!");
+    bool written = warpgate::utils::gltf::write_gltf(gltf, output_filename, format == "glb", format == "gltf");
+    if(written) {
+        logger::info("Successfully wrote gltf file!");
+    }
 
+    // The image threads are always stopped before returning, even if the model couldn't be written
     image_queue.close();
     logger::info("Joining image processing thread{}...", image_processor_pool.size() == 1 ? "" : "s");
     for(uint32_t i = 0; i < image_processor_pool.size(); i++) {
         image_processor_pool.at(i).join();
     }
+    warpgate::utils::textures::scheduler::report();
+    warpgate::utils::textures::atlas::finish();
+    if(warpgate::utils::archive::enabled() && !warpgate::utils::archive::close_archive()) {
+        return 3;
+    }
+    if(!written) {
+        return 3;
+    }
     logger::info("Done.");
     return 0;
 }
\ No newline at end of file
@@ -11,10 +11,15 @@
 
 #include "argparse/argparse.hpp"
 #include "dme_loader.h"
+#include "utils/archive.h"
+#include "utils/gltf/common.h"
 #include "utils/gltf/dme.h"
 #include "utils/gltf/dmat.h"
+#include "utils/gltf/writer.h"
 #include "utils/materials_3.h"
+#include "utils/mesh_cache.h"
 #include "utils/textures.h"
+#include "utils/textures/arguments.h"
 #include "utils/tsqueue.h"
 #include "utils.h"
 #include "tiny_gltf.h"
@@ -55,6 +60,11 @@ void build_argument_parser(argparse::ArgumentParser &parser, int &log_level) {
         .default_value(4u)
         .scan<'u', uint32_t>();
 
+    utils::textures::add_texture_arguments(parser);
+
+    parser.add_argument("--archive")
+        .help("Write textures into this store-only .zip or .tar, at their paths relative to the output directory, instead of as separate files");
+
     parser.add_argument("--no-skeleton", "-s")
         .help("Exclude the skeleton from the output")
         .default_value(false)
@@ -79,6 +89,9 @@ void build_argument_parser(argparse::ArgumentParser &parser, int &log_level) {
         .default_value(false)
         .implicit_value(true)
         .nargs(0);
+
+    parser.add_argument("--mesh-cache")
+        .help("Directory used to cache expanded mesh data between runs");
     
 }
 
@@ -97,10 +110,20 @@ int main(int argc, const char* argv[]) {
     }
     logger::set_level(logger::level::level_enum(log_level));
 
+    if(!utils::textures::apply_texture_arguments(parser)) {
+        std::exit(1);
+    }
+    // Textures are only processed by the image threads, and the bounded image queue would never be emptied without them
+    if(!parser.get<bool>("--no-textures") && parser.get<uint32_t>("--threads") == 0) {
+        logger::error("--threads must be at least 1 when exporting textures");
+        std::exit(1);
+    }
+
     std::string input_str = parser.get<std::string>("input_file");
     
     logger::info("Converting file {} using dme_converter {}", input_str, WARPGATE_VERSION);
     uint32_t image_processor_thread_count = parser.get<uint32_t>("--threads");
+    utils::textures::scheduler::init_scheduler(image_processor_thread_count);
     std::string path = parser.get<std::string>("--assets-directory");
     std::filesystem::path server(path);
     std::vector<std::filesystem::path> assets;
@@ -116,6 +139,10 @@ int main(int argc, const char* argv[]) {
     utils::materials3::init_materials();
     logger::info("Loaded materials.json");
 
+    if(auto mesh_cache = parser.present<std::string>("--mesh-cache")) {
+        utils::mesh_cache::init_cache(*mesh_cache);
+    }
+
     std::filesystem::path input_filename(input_str);
     std::unique_ptr<uint8_t[]> data;
     std::vector<uint8_t> data_vector;
@@ -170,7 +197,13 @@ int main(int argc, const char* argv[]) {
         }
     } catch (std::filesystem::filesystem_error& err) {
         logger::error("Failed to create directory {}: {}", err.path1().string(), err.what());
-        std::exit(3);
+        return 3;
+    }
+
+    if(auto archive_path = parser.present<std::string>("--archive")) {
+        if(!utils::archive::init_archive(*archive_path, output_directory)) {
+            return 3;
+        }
     }
 
     utils::tsqueue<std::pair<std::string, Semantic>> image_queue;
@@ -199,15 +232,25 @@ int main(int argc, const char* argv[]) {
     DME dme(data_span, output_filename.stem().string());
     tinygltf::Model gltf = utils::gltf::dme::build_gltf_from_dme(dme, image_queue, output_directory, export_textures, include_skeleton, rigify_skeleton);
     
+    size_t deduplicated = utils::gltf::deduplicate_buffers(gltf);
+    logger::info("Deduplicated {} bytes of buffer data", deduplicated);
+
     logger::info("Writing GLTF2 file {}...", output_filename.filename().string());
-    tinygltf::TinyGLTF writer;
-    writer.WriteGltfSceneToFile(&gltf, output_filename.string(), false, format == "glb", format == "gltf", format == "glb");
+    bool written = utils::gltf::write_gltf(gltf, output_filename, format == "glb", format == "gltf");
     
+    // The image threads are always stopped before returning, even if the model couldn't be written
     image_queue.close();
     logger::info("Joining image processing thread{}...", image_processor_pool.size() == 1 ? "" : "s");
     for(uint32_t i = 0; i < image_processor_pool.size(); i++) {
         image_processor_pool.at(i).join();
     }
+    utils::textures::scheduler::report();
+    if(utils::archive::enabled() && !utils::archive::close_archive()) {
+        return 3;
+    }
+    if(!written) {
+        return 3;
+    }
     logger::info("Done.");
     return 0;
 }
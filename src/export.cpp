@@ -7,6 +7,7 @@
 #include <cnk_loader.h>
 #include <glob/glob.h>
 #include <synthium/synthium.h>
+#include <utils/archive.h>
 #include <utils/textures.h>
 
 namespace logger = spdlog;
@@ -60,6 +61,13 @@ void build_argument_parser(argparse::ArgumentParser &parser, int &log_level) {
         .default_value(false)
         .implicit_value(true);
     
+    parser.add_argument("--png-compression")
+        .help("PNG compression for exported textures: fast, default, best or a zlib level from 0 to 9")
+        .default_value(std::string("default"));
+
+    parser.add_argument("--archive", "-a")
+        .help("Write the exported files into this store-only .zip or .tar, at their paths relative to the output directory, instead of as separate files");
+
     parser.add_argument("--extra-packs", "-e")
         .help("Extra glob patterns to use when loading packs.")
         .nargs(argparse::nargs_pattern::at_least_one);
@@ -79,6 +87,14 @@ int main(int argc, char* argv[]) {
     }
     logger::set_level(logger::level::level_enum(log_level));
 
+    std::string png_compression = parser.get<std::string>("--png-compression");
+    if(auto png_settings = warpgate::utils::textures::png::parse_settings(png_compression)) {
+        warpgate::utils::textures::png::init_png(*png_settings);
+    } else {
+        logger::error("Invalid PNG compression '{}', expected fast, default, best or a level from 0 to 9", png_compression);
+        std::exit(1);
+    }
+
     logger::info("export: loading assets (using synthium {})", synthium::version());
     std::string server = parser.get<std::string>("--assets-directory");
     std::string input_filename = parser.get<std::string>("asset_name");
@@ -139,6 +155,10 @@ int main(int argc, char* argv[]) {
 
     bool by_magic = parser.get<bool>("--by-magic");
     bool raw = parser.get<bool>("--raw");
+    if(by_magic && parser.is_used("--archive")) {
+        logger::error("--archive cannot be used with --by-magic");
+        std::exit(1);
+    }
     if(by_magic) {
         size_t curr_pos = 0;
         size_t pos = input_filename.find_first_of("\\x");
@@ -171,6 +191,12 @@ int main(int argc, char* argv[]) {
         return 0;
     }
 
+    if(auto archive_path = parser.present<std::string>("--archive")) {
+        if(!warpgate::utils::archive::init_archive(*archive_path, output_directory)) {
+            std::exit(3);
+        }
+    }
+
     if(raw) {
         logger::info("Exporting raw data");
     }
@@ -229,6 +255,11 @@ int main(int argc, char* argv[]) {
             ){
                 logger::debug("Saved texture to {}", output_name.lexically_relative(output_directory).string());
             }
+        } else if(warpgate::utils::archive::enabled()) {
+            if(!warpgate::utils::archive::write_file(output_name, data_span)) {
+                logger::error("Failed to add {} to the archive", output_name.string());
+                continue;
+            }
         } else {
             std::ofstream output(output_name, std::ios::binary);
             output.write((char*)data_span.data(), data_span.size());
@@ -236,5 +267,8 @@ int main(int argc, char* argv[]) {
         }
         logger::info("Wrote {} to {}", synthium::utils::human_bytes(data_span.size()), output_name.string());
     }
+    if(warpgate::utils::archive::enabled() && !warpgate::utils::archive::close_archive()) {
+        std::exit(3);
+    }
     return 0;
 }
\ No newline at end of file
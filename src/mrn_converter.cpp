@@ -15,6 +15,7 @@
 
 #include "argparse/argparse.hpp"
 #include "mrn_loader.h"
+#include "utils/gltf/writer.h"
 #include "tiny_gltf.h"
 #include "json.hpp"
 #include "version.h"
@@ -661,8 +662,9 @@ int main(int argc, const char* argv[]) {
     }
 
     logger::info("Writing GLTF2 file {}...", output_filename.filename().string());
-    tinygltf::TinyGLTF writer;
-    writer.WriteGltfSceneToFile(&gltf, output_filename.string(), false, format == "glb", format == "gltf", format == "glb");
+    if(!utils::gltf::write_gltf(gltf, output_filename, format == "glb", format == "gltf")) {
+        std::exit(3);
+    }
     logger::info("Done.");
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,196 @@
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "tiny_gltf.h"
+#include "utils/gltf/staging.h"
+#include "utils/gltf/writer.h"
+#include "version.h"
+
+#include <spdlog/spdlog.h>
+
+namespace logger = spdlog;
+using namespace warpgate;
+
+namespace {
+    bool load(tinygltf::Model &gltf, const std::filesystem::path &path) {
+        tinygltf::TinyGLTF loader;
+        // Only the image uris are compared, so the images themselves are never decoded
+        loader.SetImageLoader([](tinygltf::Image*, const int, std::string*, std::string*, int, int, const unsigned char*, int, void*) {
+            return true;
+        }, nullptr);
+        std::string error, warning;
+        bool ok = path.extension() == ".glb"
+            ? loader.LoadBinaryFromFile(&gltf, &error, &warning, path.string())
+            : loader.LoadASCIIFromFile(&gltf, &error, &warning, path.string());
+        if(!ok) {
+            logger::error("Failed to load {}: {}", path.string(), error);
+        }
+        return ok;
+    }
+
+    std::vector<char> read_file(const std::filesystem::path &path) {
+        std::ifstream input(path, std::ios::binary);
+        return std::vector<char>(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>());
+    }
+
+    /**
+     * Gives every bufferView a buffer of its own holding exactly its bytes, so models whose buffers were laid out
+     * differently (merged or not) compare equal when they reference the same data.
+     */
+    void split_buffer_views(tinygltf::Model &gltf) {
+        std::vector<tinygltf::Buffer> buffers;
+        for(uint32_t i = 0; i < gltf.bufferViews.size(); i++) {
+            tinygltf::BufferView &view = gltf.bufferViews[i];
+            const std::vector<uint8_t> &data = gltf.buffers.at(view.buffer).data;
+            tinygltf::Buffer buffer;
+            buffer.data.assign(data.begin() + view.byteOffset, data.begin() + view.byteOffset + view.byteLength);
+            buffers.push_back(std::move(buffer));
+            view.buffer = i;
+            view.byteOffset = 0;
+        }
+        gltf.buffers = std::move(buffers);
+    }
+
+    template <class T>
+    bool compare(const std::string &name, const std::vector<T> &expected, const std::vector<T> &actual) {
+        if(expected.size() != actual.size()) {
+            logger::error("{}: expected {} elements, got {}", name, expected.size(), actual.size());
+            return false;
+        }
+        for(uint32_t i = 0; i < expected.size(); i++) {
+            if(!(expected[i] == actual[i])) {
+                logger::error("{}[{}] differs from tinygltf's output", name, i);
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool compare_models(tinygltf::Model expected, tinygltf::Model actual) {
+        split_buffer_views(expected);
+        split_buffer_views(actual);
+        bool ok = compare("accessors", expected.accessors, actual.accessors)
+            && compare("animations", expected.animations, actual.animations)
+            && compare("buffers", expected.buffers, actual.buffers)
+            && compare("bufferViews", expected.bufferViews, actual.bufferViews)
+            && compare("images", expected.images, actual.images)
+            && compare("lights", expected.lights, actual.lights)
+            && compare("materials", expected.materials, actual.materials)
+            && compare("meshes", expected.meshes, actual.meshes)
+            && compare("nodes", expected.nodes, actual.nodes)
+            && compare("samplers", expected.samplers, actual.samplers)
+            && compare("scenes", expected.scenes, actual.scenes)
+            && compare("skins", expected.skins, actual.skins)
+            && compare("textures", expected.textures, actual.textures)
+            && compare("extensionsUsed", expected.extensionsUsed, actual.extensionsUsed);
+        if(ok && expected.defaultScene != actual.defaultScene) {
+            logger::error("Default scene {} differs from tinygltf's {}", actual.defaultScene, expected.defaultScene);
+            ok = false;
+        }
+        return ok;
+    }
+
+    /**
+     * Writes gltf with tinygltf and with utils::gltf::write_gltf, reads both back and compares them.
+     * If the buffers name their own files, each file must also match tinygltf's byte for byte.
+     * If given, written is passed to write_gltf in place of gltf, such as the same model with its buffers staged.
+     */
+    bool check(const tinygltf::Model &gltf, const std::filesystem::path &directory, const std::string &filename, const tinygltf::Model *written = nullptr) {
+        std::filesystem::path reference_path = directory / "tinygltf" / filename, written_path = directory / "warpgate" / filename;
+        std::filesystem::create_directories(reference_path.parent_path());
+        std::filesystem::create_directories(written_path.parent_path());
+        bool binary = written_path.extension() == ".glb";
+
+        tinygltf::TinyGLTF writer;
+        tinygltf::Model reference_model = gltf;
+        if(!writer.WriteGltfSceneToFile(&reference_model, reference_path.string(), false, binary, !binary, binary)) {
+            logger::error("tinygltf failed to write {}", reference_path.string());
+            return false;
+        }
+        if(!utils::gltf::write_gltf(written ? *written : gltf, written_path, binary, !binary)) {
+            return false;
+        }
+
+        tinygltf::Model expected, actual;
+        if(!load(expected, reference_path) || !load(actual, written_path) || !compare_models(expected, actual)) {
+            logger::error("{} does not match tinygltf's output", filename);
+            return false;
+        }
+
+        bool has_uris = !gltf.buffers.empty() && std::all_of(gltf.buffers.begin(), gltf.buffers.end(), [](const tinygltf::Buffer &buffer) {
+            return !buffer.uri.empty();
+        });
+        if(!binary && has_uris) {
+            if(actual.buffers.size() != gltf.buffers.size()) {
+                logger::error("{}: {} buffers were merged into {}", filename, gltf.buffers.size(), actual.buffers.size());
+                return false;
+            }
+            for(const tinygltf::Buffer &buffer : gltf.buffers) {
+                if(read_file(reference_path.parent_path() / buffer.uri) != read_file(written_path.parent_path() / buffer.uri)) {
+                    logger::error("{}: {} differs from tinygltf's", filename, buffer.uri);
+                    return false;
+                }
+            }
+        }
+        logger::info("{} matches tinygltf", filename);
+        return true;
+    }
+}
+
+int main(int argc, const char* argv[]) {
+    logger::info("test_gltf_writer using warpgate version {}", WARPGATE_VERSION);
+    std::filesystem::path sample = argc > 1 ? argv[1] : "export/gltf/sample.glb";
+    std::filesystem::path directory = "export/test_gltf_writer";
+
+    tinygltf::Model gltf;
+    if(!load(gltf, sample)) {
+        std::exit(2);
+    }
+
+    // Merged into one buffer, as the converters write models
+    tinygltf::Model merged = gltf;
+    for(tinygltf::Buffer &buffer : merged.buffers) {
+        buffer.uri.clear();
+    }
+    // Each buffer in its own file, as mrn_converter writes animations
+    tinygltf::Model separate = gltf;
+    for(uint32_t i = 0; i < separate.buffers.size(); i++) {
+        separate.buffers[i].uri = "buffer" + std::to_string(i) + ".bin";
+    }
+
+    // Every buffer moved to the staging file, as models past --staging-threshold are. Their uris only mark them as staged,
+    // so they must be merged into one .bin like the in-memory buffers rather than written to files of those names
+    std::filesystem::create_directories(directory);
+    utils::gltf::staging::init_staging(directory, 0);
+    tinygltf::Model staged = merged;
+    utils::gltf::staging::stage_buffers(staged, 0);
+    bool all_staged = std::all_of(staged.buffers.begin(), staged.buffers.end(), utils::gltf::staging::is_staged);
+    if(!all_staged) {
+        logger::error("Not every buffer was staged with a threshold of 0");
+    }
+
+    bool ok = check(merged, directory, "merged.glb")
+        && check(merged, directory, "merged.gltf")
+        && check(separate, directory, "separate.gltf")
+        && all_staged
+        && check(merged, directory, "staged.gltf", &staged);
+    utils::gltf::staging::release(staged);
+    tinygltf::Model reloaded;
+    if(ok && load(reloaded, directory / "warpgate" / "staged.gltf")) {
+        for(const tinygltf::Buffer &buffer : reloaded.buffers) {
+            if(buffer.uri != "staged.bin") {
+                logger::error("staged.gltf references buffer {}, expected the merged staged.bin", buffer.uri);
+                ok = false;
+            }
+        }
+    }
+    if(!ok) {
+        return 1;
+    }
+    logger::info("All assertions passed");
+    return 0;
+}
@@ -0,0 +1,429 @@
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "utils/textures.h"
+#include "utils/textures/bc.h"
+#include "utils/textures/container.h"
+#include "utils/textures/encoder.h"
+#include "utils/textures/scheduler.h"
+#include "utils/textures/specular.h"
+#include "utils/textures/terrain.h"
+#include "version.h"
+
+#include <spdlog/spdlog.h>
+
+namespace logger = spdlog;
+using namespace warpgate;
+using utils::textures::bc::Format;
+
+namespace {
+    bool failed = false;
+
+    void check(bool condition, const std::string &what) {
+        if(!condition) {
+            logger::error("{}", what);
+            failed = true;
+        }
+    }
+
+    std::string format_name(Format format) {
+        constexpr std::array<const char*, 6> names = {"BC1", "BC2", "BC3", "BC4", "BC5", "BC7"};
+        return names[(size_t)format];
+    }
+
+    // FNV-1a, so the golden values below don't depend on anything but the bytes checked
+    uint64_t checksum(std::span<const uint8_t> bytes) {
+        uint64_t hash = 0xcbf29ce484222325;
+        for(uint8_t byte : bytes) {
+            hash = (hash ^ byte) * 0x100000001b3;
+        }
+        return hash;
+    }
+
+    uint64_t checksum(const utils::textures::Image &image) {
+        return checksum({(const uint8_t*)image.pixels.data(), image.pixels.size() * sizeof(uint32_t)});
+    }
+
+    struct Random {
+        uint64_t state;
+
+        uint32_t next() {
+            state = state * 6364136223846793005 + 1442695040888963407;
+            return (uint32_t)(state >> 32);
+        }
+    };
+
+    /**
+     * Block data filled from a fixed seed, so the fixtures are the same on every run. BC7 blocks cycle through all eight modes,
+     * the lowest set bit of a block's first byte selecting its mode.
+     */
+    std::vector<uint8_t> fixture_blocks(Format format, uint32_t width, uint32_t height, uint64_t seed) {
+        Random random{seed};
+        std::vector<uint8_t> blocks(utils::textures::bc::level_size(format, width, height));
+        for(uint8_t &byte : blocks) {
+            byte = (uint8_t)random.next();
+        }
+        if(format == Format::BC7) {
+            for(size_t block = 0; block < blocks.size() / 16; block++) {
+                uint32_t mode = block % 8;
+                blocks[block * 16] = (uint8_t)((blocks[block * 16] & ~((2u << mode) - 1)) | (1u << mode));
+            }
+        }
+        return blocks;
+    }
+
+    std::vector<uint8_t> fixture_dds(Format format, std::span<const uint8_t> blocks, uint32_t width, uint32_t height) {
+        utils::textures::container::Level level{width, height, blocks};
+        return utils::textures::container::write_dds(format, false, {&level, 1});
+    }
+
+    std::vector<uint8_t> fixture_dds(Format format, std::span<const std::vector<uint8_t>> level_blocks, uint32_t width, uint32_t height) {
+        std::vector<utils::textures::container::Level> levels;
+        for(const std::vector<uint8_t> &blocks : level_blocks) {
+            levels.push_back({width, height, blocks});
+            width = std::max(1u, width / 2);
+            height = std::max(1u, height / 2);
+        }
+        return utils::textures::container::write_dds(format, false, levels);
+    }
+
+    // Loads a fixture the way the converters load textures from the packs
+    std::optional<utils::textures::Image> decode_dds(std::vector<uint8_t> &dds, std::optional<utils::textures::bc::Region> region = {}) {
+        gli::texture2d texture(gli::load_dds((const char*)dds.data(), dds.size()));
+        if(texture.format() == gli::format::FORMAT_UNDEFINED) {
+            return {};
+        }
+        return utils::textures::decode_texture(texture, 0, region);
+    }
+
+    utils::textures::Image crop(const utils::textures::Image &image, utils::textures::bc::Region region) {
+        utils::textures::Image cropped(region.width, region.height);
+        for(uint32_t y = 0; y < region.height; y++) {
+            std::copy_n(image.row(region.y + y) + region.x, region.width, cropped.row(y));
+        }
+        return cropped;
+    }
+
+    /**
+     * Single blocks whose texels can be worked out by hand from the format specifications
+     */
+    void test_known_blocks() {
+        std::array<uint32_t, 16> texels;
+        // BC1: color0 pure red (0xF800), color1 pure blue (0x001F), texels picking color0 then color1 two rows each
+        const uint8_t bc1[8] = {0x00, 0xF8, 0x1F, 0x00, 0x00, 0x00, 0x55, 0x55};
+        utils::textures::bc::decode_block(Format::BC1, bc1, texels.data(), 4);
+        check(texels[0] == 0xFF0000FF && texels[7] == 0xFF0000FF, "BC1 index 0 should decode to opaque red");
+        check(texels[8] == 0xFFFF0000 && texels[15] == 0xFFFF0000, "BC1 index 1 should decode to opaque blue");
+
+        // BC1 with color0 <= color1 has a transparent black fourth entry
+        const uint8_t bc1_alpha[8] = {0x00, 0x00, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+        utils::textures::bc::decode_block(Format::BC1, bc1_alpha, texels.data(), 4);
+        check(texels[0] == 0x00000000, "BC1 index 3 should decode to transparent black when color0 <= color1");
+
+        // BC4: red0 200 > red1 100, so index 1 is red1 and index 2 is (6 * 200 + 1 * 100) / 7
+        const uint8_t bc4[8] = {200, 100, 0x01, 0x00, 0x00, 0x00, 0x00, 0x40};
+        utils::textures::bc::decode_block(Format::BC4, bc4, texels.data(), 4);
+        check((texels[0] & 0xFF) == 100, "BC4 index 1 should decode to red1");
+        check((texels[1] & 0xFF) == 200, "BC4 index 0 should decode to red0");
+        check((texels[15] & 0xFF) == (6 * 200 + 100 + 3) / 7, "BC4 index 2 should interpolate a seventh of the way to red1");
+
+        // BC7 mode 6 with both endpoints 127 and p-bit 1 (RGBA 255) decodes to opaque white whatever the indices
+        const uint8_t bc7_white[16] = {0xC0, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x01, 0, 0, 0, 0, 0, 0, 0};
+        utils::textures::bc::decode_block(Format::BC7, bc7_white, texels.data(), 4);
+        check(std::all_of(texels.begin(), texels.end(), [](uint32_t texel) { return texel == 0xFFFFFFFF; }), "BC7 mode 6 should decode to opaque white");
+
+        // A reserved BC7 mode (no mode bit set) decodes to transparent black
+        const uint8_t bc7_reserved[16] = {};
+        utils::textures::bc::decode_block(Format::BC7, bc7_reserved, texels.data(), 4);
+        check(std::all_of(texels.begin(), texels.end(), [](uint32_t texel) { return texel == 0; }), "Reserved BC7 mode should decode to transparent black");
+    }
+
+    /**
+     * sRGB textures and BC7 have no legacy FourCC, so their DDS files need the DX10 header and its DXGI format.
+     * BC4 and BC5 have no sRGB variant and keep their FourCC.
+     */
+    void test_dds_headers() {
+        struct HeaderCase {
+            std::optional<Format> format;
+            bool srgb;
+            const char *fourcc;
+            uint32_t dxgi_format;
+        };
+        constexpr std::array<HeaderCase, 8> cases = {{
+            {Format::BC1, false, "DXT1", 0}, {Format::BC1, true, "DX10", 72},
+            {Format::BC3, true, "DX10", 78}, {Format::BC4, true, "ATI1", 0},
+            {Format::BC7, false, "DX10", 98}, {Format::BC7, true, "DX10", 99},
+            {std::nullopt, false, "", 0}, {std::nullopt, true, "DX10", 29},
+        }};
+        std::vector<uint8_t> data(64);
+        utils::textures::container::Level level{4, 4, data};
+        for(const HeaderCase &test : cases) {
+            std::string name = fmt::format("{} DDS{}", test.format ? format_name(*test.format) : "RGBA8", test.srgb ? " (sRGB)" : "");
+            std::vector<uint8_t> dds = utils::textures::container::write_dds(test.format, test.srgb, {&level, 1});
+            std::string fourcc((const char*)dds.data() + 84, std::strlen(test.fourcc));
+            check(fourcc == test.fourcc && (test.fourcc[0] != 0 || dds[84] == 0), name + " has the wrong FourCC");
+            uint32_t dxgi_format = 0;
+            if(test.dxgi_format != 0 && dds.size() >= 132) {
+                std::memcpy(&dxgi_format, dds.data() + 128, sizeof(dxgi_format));
+            }
+            check(dxgi_format == test.dxgi_format, fmt::format("{} has DXGI format {}, expected {}", name, dxgi_format, test.dxgi_format));
+        }
+    }
+
+    // Checksums of the 16x16 fixture blocks decoded by bc::decode, in Format order
+    constexpr std::array<uint64_t, 6> decode_goldens = {
+        0x0061eb8bd1b258f8, 0x7fc275d28794135e, 0xe6fbe32d8c27fb41,
+        0xc85bfb308975e202, 0x2eb909e1a8ed69fb, 0xc29b44b03264f1a5,
+    };
+
+    /**
+     * Every supported format decoded from fixture blocks, checked against the golden checksums. The same blocks loaded
+     * from a DDS through gli, the way the converters load them, have to decode to the same texels.
+     */
+    void test_decode_goldens() {
+        for(Format format : {Format::BC1, Format::BC2, Format::BC3, Format::BC4, Format::BC5, Format::BC7}) {
+            std::vector<uint8_t> blocks = fixture_blocks(format, 16, 16, 1 + (uint64_t)format);
+            std::optional<utils::textures::Image> image = utils::textures::bc::decode(format, blocks, 16, 16);
+            if(!image) {
+                check(false, format_name(format) + " fixture failed to decode");
+                continue;
+            }
+            uint64_t golden = decode_goldens[(size_t)format];
+            check(checksum(*image) == golden, fmt::format("{} fixture decoded to {:016x}, expected {:016x}", format_name(format), checksum(*image), golden));
+
+            std::vector<uint8_t> dds = fixture_dds(format, blocks, 16, 16);
+            std::optional<utils::textures::Image> loaded = decode_dds(dds);
+            check(loaded && loaded->pixels == image->pixels, format_name(format) + " DDS fixture decodes differently from its blocks");
+        }
+    }
+
+    /**
+     * Textures are loaded from their largest mip level within the maximum texture size, and box filtered down to it
+     * when no level is small enough
+     */
+    void test_max_texture_size() {
+        constexpr uint32_t size = 32;
+        std::vector<std::vector<uint8_t>> level_blocks;
+        for(uint32_t level = 0, level_size = size; level < 3; level++, level_size /= 2) {
+            level_blocks.push_back(fixture_blocks(Format::BC1, level_size, level_size, 200 + level));
+        }
+        std::vector<uint8_t> mipped = fixture_dds(Format::BC1, level_blocks, size, size);
+        std::vector<uint8_t> single = fixture_dds(Format::BC1, std::span(level_blocks).first(1), size, size);
+
+        struct SizeCase {
+            uint32_t max_size;
+            // Level expected to be loaded from the mipped fixture, the last one being downscaled further if needed
+            size_t level;
+        };
+        for(SizeCase test : {SizeCase{0, 0}, SizeCase{32, 0}, SizeCase{31, 1}, SizeCase{16, 1}, SizeCase{8, 2}, SizeCase{5, 2}}) {
+            utils::textures::init_max_texture_size(test.max_size);
+            uint32_t level_size = size >> test.level;
+            utils::textures::Image expected = *utils::textures::bc::decode(Format::BC1, level_blocks[test.level], level_size, level_size);
+            if(test.max_size > 0 && level_size > test.max_size) {
+                expected = utils::textures::mips::downscale(expected, test.max_size);
+            }
+            std::shared_ptr<const utils::textures::Image> image = utils::textures::load_image(fmt::format("mipped_{}", test.max_size), mipped);
+            check(image && image->width == expected.width && image->height == expected.height && image->pixels == expected.pixels,
+                fmt::format("Mipped texture with a maximum size of {} should load as level {} ({}x{})", test.max_size, test.level, expected.width, expected.height));
+
+            expected = *utils::textures::bc::decode(Format::BC1, level_blocks[0], size, size);
+            if(test.max_size > 0 && size > test.max_size) {
+                expected = utils::textures::mips::downscale(expected, test.max_size);
+            }
+            image = utils::textures::load_image(fmt::format("single_{}", test.max_size), single);
+            check(image && image->width == expected.width && image->height == expected.height && image->pixels == expected.pixels,
+                fmt::format("Texture without mips and a maximum size of {} should be downscaled to {}x{}", test.max_size, expected.width, expected.height));
+        }
+        utils::textures::init_max_texture_size(0);
+    }
+
+    /**
+     * Large images are decoded in bands of block rows shared between threads, and regions only decode the blocks they overlap.
+     * Both have to match decoding every row of blocks in order on one thread.
+     */
+    void test_banded_decode() {
+        constexpr uint32_t width = 520, height = 388;
+        constexpr utils::textures::bc::Region region{37, 70, 300, 150};
+        for(Format format : {Format::BC1, Format::BC3, Format::BC5, Format::BC7}) {
+            std::vector<uint8_t> blocks = fixture_blocks(format, width, height, 100 + (uint64_t)format);
+            size_t row_size = utils::textures::bc::level_size(format, width, 4);
+            utils::textures::Image expected(width, height), padded(width, 4);
+            for(uint32_t y = 0; y < height; y += 4) {
+                utils::textures::bc::decode_block_row(format, blocks.data() + y / 4 * row_size, width, padded.pixels.data(), width);
+                std::copy_n(padded.pixels.data(), (size_t)std::min(4u, height - y) * width, expected.row(y));
+            }
+
+            std::optional<utils::textures::Image> whole = utils::textures::bc::decode(format, blocks, width, height);
+            check(whole && whole->pixels == expected.pixels, format_name(format) + " banded decode differs from decoding row by row");
+
+            std::optional<utils::textures::Image> part = utils::textures::bc::decode(format, blocks, width, height, region);
+            check(part && part->pixels == crop(expected, region).pixels, format_name(format) + " region decode differs from the same area of the whole image");
+
+            std::vector<uint8_t> dds = fixture_dds(format, blocks, width, height);
+            std::optional<utils::textures::Image> loaded = decode_dds(dds, region);
+            check(loaded && loaded->pixels == crop(expected, region).pixels, format_name(format) + " region of the DDS fixture differs from the same area of the whole image");
+        }
+    }
+
+    /**
+     * A smooth gradient with a little noise, enough to need every endpoint and index bit
+     */
+    utils::textures::Image encoder_input() {
+        Random random{7};
+        utils::textures::Image image(32, 32);
+        for(uint32_t y = 0; y < image.height; y++) {
+            for(uint32_t x = 0; x < image.width; x++) {
+                uint32_t noise = random.next() & 7;
+                uint32_t red = x * 8 + noise, green = y * 8 + noise, blue = 255 - x * 4 - y * 4, alpha = 128 + x * 4 - noise;
+                image.row(y)[x] = red | green << 8 | blue << 16 | alpha << 24;
+            }
+        }
+        return image;
+    }
+
+    struct EncodeCase {
+        Format format;
+        // Bits of each texel the format keeps
+        uint32_t channels;
+        // Largest difference allowed in any kept channel after decoding. Better qualities must not do worse overall.
+        uint32_t tolerance;
+    };
+
+    constexpr std::array<EncodeCase, 3> encode_cases = {{
+        {Format::BC7, 0xFFFFFFFF, 20},
+        {Format::BC4, 0x000000FF, 4},
+        {Format::BC5, 0x0000FFFF, 4},
+    }};
+
+    /**
+     * Encodes a fixed image at each quality and checks the decoded texels against the input. The encoder's endpoint fitting
+     * is floating point, whose rounding differs between compilers, so its blocks are checked by their error instead of a checksum.
+     */
+    void test_encode() {
+        utils::textures::Image input = encoder_input();
+        for(const EncodeCase &test : encode_cases) {
+            uint64_t previous_error = UINT64_MAX;
+            for(utils::textures::encoder::Quality quality : {
+                utils::textures::encoder::Quality::Fast, utils::textures::encoder::Quality::Default, utils::textures::encoder::Quality::Best
+            }) {
+                std::string name = fmt::format("{} at quality {}", format_name(test.format), (int)quality);
+                std::vector<uint8_t> blocks = utils::textures::encoder::encode(test.format, input.pixels.data(), input.width, input.height, quality);
+                std::optional<utils::textures::Image> decoded = utils::textures::bc::decode(test.format, blocks, input.width, input.height);
+                if(!decoded) {
+                    check(false, name + " failed to decode");
+                    continue;
+                }
+                uint32_t largest = 0;
+                uint64_t error = 0;
+                for(size_t i = 0; i < input.pixels.size(); i++) {
+                    for(uint32_t shift = 0; shift < 32; shift += 8) {
+                        if((test.channels >> shift) & 0xFF) {
+                            int difference = (int)((input.pixels[i] >> shift) & 0xFF) - (int)((decoded->pixels[i] >> shift) & 0xFF);
+                            largest = std::max(largest, (uint32_t)std::abs(difference));
+                            error += (uint64_t)(difference * difference);
+                        }
+                    }
+                }
+                logger::debug("{}: largest difference {}, squared error {}", name, largest, error);
+                check(largest <= test.tolerance, fmt::format("{} is off by up to {}, expected at most {}", name, largest, test.tolerance));
+                check(error <= previous_error, fmt::format("{} has a squared error of {}, more than the quality below it ({})", name, error, previous_error));
+                previous_error = error;
+
+                std::vector<uint8_t> again = utils::textures::encoder::encode(test.format, input.pixels.data(), input.width, input.height, quality);
+                check(again == blocks, name + " encoded differently the second time");
+            }
+        }
+    }
+
+    /**
+     * Terrain color_nx and specular_ny maps split into color, specular and normal maps, checked channel by channel.
+     * Enough texels for both the 8 wide and the scalar code paths.
+     */
+    void test_terrain_split() {
+        utils::textures::Image color_nx(8 * 3 + 5, 2), specular_ny(color_nx.width, color_nx.height);
+        Random random{11};
+        for(size_t i = 0; i < color_nx.pixels.size(); i++) {
+            color_nx.pixels[i] = random.next();
+            specular_ny.pixels[i] = random.next();
+        }
+        auto channel = [](uint32_t pixel, uint32_t index) { return (pixel >> (index * 8)) & 0xFF; };
+        utils::textures::terrain::TerrainMaps maps = utils::textures::terrain::split(color_nx, specular_ny);
+        for(size_t i = 0; i < color_nx.pixels.size(); i++) {
+            uint32_t cnx = color_nx.pixels[i], sny = specular_ny.pixels[i];
+            uint32_t color = maps.color.pixels[i], specular = maps.specular.pixels[i], normal = maps.normal.pixels[i];
+            bool color_matches = channel(color, 0) == channel(cnx, 0) && channel(color, 1) == channel(cnx, 1) 
+                && channel(color, 2) == channel(cnx, 2) && channel(color, 3) == 255;
+            bool specular_matches = channel(specular, 0) == channel(sny, 0) && channel(specular, 1) == 255 - channel(sny, 1) 
+                && channel(specular, 2) == 255 - channel(sny, 2) && channel(specular, 3) == 255;
+            bool normal_matches = channel(normal, 0) == channel(cnx, 3) && channel(normal, 1) == channel(sny, 3) 
+                && channel(normal, 2) == 255 && channel(normal, 3) == 255;
+            check(color_matches, fmt::format("Terrain color texel {} is {:08x} from color_nx {:08x}", i, color, cnx));
+            check(specular_matches, fmt::format("Terrain specular texel {} is {:08x} from specular_ny {:08x}", i, specular, sny));
+            check(normal_matches, fmt::format("Terrain normal texel {} is {:08x} from color_nx {:08x} and specular_ny {:08x}", i, normal, cnx, sny));
+        }
+
+        // Decoding and splitting a row of blocks at a time has to match splitting the whole decoded maps
+        constexpr uint32_t width = 70, height = 46;
+        std::vector<uint8_t> color_nx_blocks = fixture_blocks(Format::BC3, width, height, 300);
+        std::vector<uint8_t> specular_ny_blocks = fixture_blocks(Format::BC7, width, height, 301);
+        utils::textures::terrain::TerrainMaps expected = utils::textures::terrain::split(
+            *utils::textures::bc::decode(Format::BC3, color_nx_blocks, width, height),
+            *utils::textures::bc::decode(Format::BC7, specular_ny_blocks, width, height)
+        );
+        std::optional<utils::textures::terrain::TerrainMaps> decoded = utils::textures::terrain::decode(
+            Format::BC3, color_nx_blocks, Format::BC7, specular_ny_blocks, width, height
+        );
+        check(decoded && decoded->color.pixels == expected.color.pixels && decoded->specular.pixels == expected.specular.pixels 
+            && decoded->normal.pixels == expected.normal.pixels, "Terrain maps decoded by rows of blocks differ from splitting the decoded maps");
+    }
+
+    /**
+     * Specular blue above 0.2 (as unorm) marks emissive texels. Checked for every blue value against the float comparison,
+     * with enough texels that both the 8 wide and the scalar code paths are used.
+     */
+    void test_specular_threshold() {
+        constexpr size_t count = 256 * 2 + 3;
+        std::vector<uint32_t> specular(count), albedo(count), metallic_roughness(count), emissive(count);
+        for(size_t i = 0; i < count; i++) {
+            uint32_t blue = i % 256;
+            specular[i] = 0x40 | 0x80 << 8 | blue << 16 | 0xC0u << 24;
+            // Every other texel of the second half is transparent, which is never emissive
+            albedo[i] = 0x00123456 | (i >= 256 && i % 2 ? 0u : 0xFFu << 24);
+        }
+        utils::textures::specular::convert_pixels(specular, albedo.data(), metallic_roughness.data(), emissive.data());
+        for(size_t i = 0; i < count; i++) {
+            uint32_t blue = i % 256;
+            bool lit = blue * (1 / 255.0f) > 0.2f && (albedo[i] >> 24) != 0;
+            uint32_t expected = lit ? 0x00123456 | blue << 24 : 0;
+            check(emissive[i] == expected, fmt::format("Emissive texel {} (blue {}) is {:08x}, expected {:08x}", i, blue, emissive[i], expected));
+            check(metallic_roughness[i] == (0xFF000000 | 0x40 << 16 | 0xC0 << 8), fmt::format("Metallic roughness texel {} is {:08x}", i, metallic_roughness[i]));
+        }
+    }
+}
+
+int main() {
+    logger::info("test_textures using warpgate version {}", WARPGATE_VERSION);
+    // Large decodes are split between threads even without image threads running
+    utils::textures::scheduler::init_scheduler(4);
+
+    test_known_blocks();
+    test_dds_headers();
+    test_decode_goldens();
+    test_banded_decode();
+    test_max_texture_size();
+    test_terrain_split();
+    test_encode();
+    test_specular_threshold();
+    if(failed) {
+        return 1;
+    }
+    logger::info("All assertions passed");
+    return 0;
+}
@@ -0,0 +1,421 @@
+#include "utils/archive.h"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+
+#include <spdlog/spdlog.h>
+#include <zlib.h>
+
+namespace logger = spdlog;
+using namespace warpgate;
+
+namespace {
+    constexpr size_t segment_size = 4 << 20;
+    constexpr size_t tar_block = 512;
+    constexpr uint64_t zip32_limit = 0xFFFFFFFF;
+    constexpr uint64_t tar_size_limit = 077777777777;
+    constexpr uint8_t zeros[tar_block * 2] = {};
+
+    std::unique_ptr<utils::archive::Writer> current;
+    std::filesystem::path archive_root;
+
+    void put16(std::vector<uint8_t> &output, uint16_t value) {
+        output.push_back((uint8_t)value);
+        output.push_back((uint8_t)(value >> 8));
+    }
+
+    void put32(std::vector<uint8_t> &output, uint32_t value) {
+        put16(output, (uint16_t)value);
+        put16(output, (uint16_t)(value >> 16));
+    }
+
+    void put64(std::vector<uint8_t> &output, uint64_t value) {
+        put32(output, (uint32_t)value);
+        put32(output, (uint32_t)(value >> 32));
+    }
+
+    void put_bytes(std::vector<uint8_t> &output, std::string_view bytes) {
+        output.insert(output.end(), bytes.begin(), bytes.end());
+    }
+
+    /**
+     * Normalizes an entry name to '/' separated components without empty or "." ones. Returns nothing for names that are empty,
+     * absolute (including Windows drive letters) or step out of the archive with "..", which extractors would write outside the
+     * directory they extract to.
+     */
+    std::optional<std::string> entry_name(std::string_view name) {
+        if(name.empty() || name.front() == '/' || name.front() == '\\' || (name.size() > 1 && name[1] == ':')) {
+            return {};
+        }
+        std::string normalized;
+        size_t start = 0;
+        while(start <= name.size()) {
+            size_t end = std::min(name.find_first_of("/\\", start), name.size());
+            std::string_view component = name.substr(start, end - start);
+            start = end + 1;
+            if(component.empty() || component == ".") {
+                continue;
+            }
+            if(component == "..") {
+                return {};
+            }
+            if(!normalized.empty()) {
+                normalized += '/';
+            }
+            normalized += component;
+        }
+        if(normalized.empty()) {
+            return {};
+        }
+        return normalized;
+    }
+
+    uint32_t crc(std::span<const uint8_t> data) {
+        uLong value = crc32(0L, Z_NULL, 0);
+        for(size_t offset = 0; offset < data.size(); offset += 1 << 30) {
+            size_t count = std::min<size_t>(data.size() - offset, 1 << 30);
+            value = crc32(value, data.data() + offset, (uInt)count);
+        }
+        return (uint32_t)value;
+    }
+
+    // Local file header of a stored zip entry. Sizes are 32 bit, entries of 4 GiB or more are rejected before getting here.
+    std::vector<uint8_t> zip_local_header(std::string_view name, uint64_t size, uint32_t checksum, uint16_t time, uint16_t date) {
+        std::vector<uint8_t> header;
+        header.reserve(30 + name.size());
+        put32(header, 0x04034b50);
+        put16(header, 20);
+        // Names are UTF-8
+        put16(header, 0x0800);
+        put16(header, 0);
+        put16(header, time);
+        put16(header, date);
+        put32(header, checksum);
+        put32(header, (uint32_t)size);
+        put32(header, (uint32_t)size);
+        put16(header, (uint16_t)name.size());
+        put16(header, 0);
+        put_bytes(header, name);
+        return header;
+    }
+
+    void tar_octal(char *field, size_t width, uint64_t value) {
+        // width - 1 digits and a terminating NUL
+        for(size_t i = width - 1; i-- > 0; value >>= 3) {
+            field[i] = (char)('0' + (value & 7));
+        }
+        field[width - 1] = '\0';
+    }
+
+    std::vector<uint8_t> tar_header(std::string_view name, std::string_view prefix, uint64_t size, uint64_t mtime, char type) {
+        std::vector<uint8_t> header(tar_block);
+        char *block = (char*)header.data();
+        std::memcpy(block, name.data(), std::min<size_t>(name.size(), 100));
+        tar_octal(block + 100, 8, 0644);
+        tar_octal(block + 108, 8, 0);
+        tar_octal(block + 116, 8, 0);
+        tar_octal(block + 124, 12, std::min(size, tar_size_limit));
+        tar_octal(block + 136, 12, mtime);
+        block[156] = type;
+        std::memcpy(block + 257, "ustar", 6);
+        std::memcpy(block + 263, "00", 2);
+        std::memcpy(block + 345, prefix.data(), std::min<size_t>(prefix.size(), 155));
+
+        // The checksum is summed with its own field filled with spaces
+        std::memset(block + 148, ' ', 8);
+        uint32_t sum = 0;
+        for(uint8_t byte : header) {
+            sum += byte;
+        }
+        tar_octal(block + 148, 7, sum);
+        block[155] = ' ';
+        return header;
+    }
+
+    // A pax record: "<length> <key>=<value>\n", the length counting its own digits
+    std::string pax_record(std::string_view key, std::string_view value) {
+        size_t length = key.size() + value.size() + 3;
+        size_t digits = std::to_string(length).size();
+        while(std::to_string(length + digits).size() != digits) {
+            digits++;
+        }
+        return std::to_string(length + digits) + " " + std::string(key) + "=" + std::string(value) + "\n";
+    }
+
+    /**
+     * The headers of a tar entry: a ustar header, preceded by a pax extended header when the name doesn't fit
+     * the 100 byte name and 155 byte prefix fields, or the size doesn't fit in 11 octal digits.
+     */
+    std::vector<uint8_t> tar_headers(std::string_view name, uint64_t size, uint64_t mtime) {
+        std::string_view prefix, short_name = name;
+        bool fits = name.size() <= 100;
+        if(!fits) {
+            // Split at a '/' so the prefix holds the leading directories
+            size_t split = name.rfind('/', 155);
+            if(split != std::string_view::npos && split > 0 && name.size() - split - 1 <= 100) {
+                prefix = name.substr(0, split);
+                short_name = name.substr(split + 1);
+                fits = true;
+            }
+        }
+        std::vector<uint8_t> headers;
+        if(!fits || size > tar_size_limit) {
+            std::string records;
+            if(!fits) {
+                records += pax_record("path", name);
+                short_name = name.substr(name.size() - std::min<size_t>(name.size(), 100));
+            }
+            if(size > tar_size_limit) {
+                records += pax_record("size", std::to_string(size));
+            }
+            headers = tar_header("PaxHeader", "", records.size(), mtime, 'x');
+            headers.insert(headers.end(), records.begin(), records.end());
+            headers.resize((headers.size() + tar_block - 1) / tar_block * tar_block);
+        }
+        std::vector<uint8_t> header = tar_header(short_name, prefix, size, mtime, '0');
+        headers.insert(headers.end(), header.begin(), header.end());
+        return headers;
+    }
+}
+
+struct utils::archive::Writer::Segment {
+    std::vector<uint8_t> bytes = std::vector<uint8_t>(segment_size);
+    std::atomic<size_t> filled = 0;
+};
+
+std::optional<utils::archive::Format> utils::archive::format_for(const std::filesystem::path &path) {
+    std::string extension = path.extension().string();
+    std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+    if(extension == ".zip") {
+        return Format::Zip;
+    } else if(extension == ".tar") {
+        return Format::Tar;
+    }
+    return {};
+}
+
+utils::archive::Writer::Writer(std::filesystem::path path, Format format)
+    : m_path(path)
+    , m_format(format)
+    , m_file(std::fopen(path.string().c_str(), "wb"))
+{
+    std::time_t now = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+    m_mtime = (uint64_t)std::max<std::time_t>(now, 0);
+    std::tm local{};
+#ifdef _WIN32
+    localtime_s(&local, &now);
+#else
+    localtime_r(&now, &local);
+#endif
+    m_dos_time = (uint16_t)(local.tm_hour << 11 | local.tm_min << 5 | local.tm_sec / 2);
+    m_dos_date = (uint16_t)(std::max(local.tm_year - 80, 0) << 9 | (local.tm_mon + 1) << 5 | local.tm_mday);
+}
+
+utils::archive::Writer::~Writer() {
+    if(!m_finished) {
+        finish();
+    }
+}
+
+bool utils::archive::Writer::is_open() const {
+    return m_file != nullptr;
+}
+
+uint64_t utils::archive::Writer::reserve(uint64_t size) {
+    return m_end.fetch_add(size);
+}
+
+void utils::archive::Writer::write(uint64_t offset, std::span<const uint8_t> data) {
+    while(!data.empty()) {
+        uint64_t index = offset / segment_size;
+        size_t start = (size_t)(offset % segment_size), count = std::min(data.size(), segment_size - start);
+        std::shared_ptr<Segment> segment;
+        {
+            std::lock_guard<std::mutex> lock(m_segments_mutex);
+            std::shared_ptr<Segment> &slot = m_segments[index];
+            if(!slot) {
+                slot = std::make_shared<Segment>();
+            }
+            segment = slot;
+        }
+        std::memcpy(segment->bytes.data() + start, data.data(), count);
+        // Reserved ranges never overlap, so the thread that brings the count to a full segment wrote its last bytes
+        if(segment->filled.fetch_add(count) + count == segment_size) {
+            flush(index, *segment, segment_size);
+            std::lock_guard<std::mutex> lock(m_segments_mutex);
+            m_segments.erase(index);
+        }
+        offset += count;
+        data = data.subspan(count);
+    }
+}
+
+void utils::archive::Writer::flush(uint64_t index, const Segment &segment, size_t size) {
+    std::lock_guard<std::mutex> lock(m_file_mutex);
+    uint64_t offset = index * segment_size;
+#ifdef _WIN32
+    bool positioned = _fseeki64(m_file, (int64_t)offset, SEEK_SET) == 0;
+#else
+    bool positioned = fseeko(m_file, (off_t)offset, SEEK_SET) == 0;
+#endif
+    if(!positioned || std::fwrite(segment.bytes.data(), 1, size, m_file) != size) {
+        if(!m_failed.exchange(true)) {
+            logger::error("Failed to write to archive {}", m_path.string());
+        }
+    }
+}
+
+bool utils::archive::Writer::add(std::string_view requested_name, std::span<const uint8_t> data) {
+    if(m_file == nullptr || m_finished) {
+        return false;
+    }
+    std::optional<std::string> normalized = entry_name(requested_name);
+    if(!normalized) {
+        logger::error("Cannot store '{}' in {}: entry names must be relative and stay inside the archive", requested_name, m_path.string());
+        return false;
+    }
+    std::string_view name = *normalized;
+    if(m_format == Format::Zip) {
+        if(data.size() >= zip32_limit) {
+            logger::error("Cannot store {} in {}: entries are limited to 4 GiB", name, m_path.string());
+            return false;
+        }
+        uint32_t checksum = crc(data);
+        std::vector<uint8_t> header = zip_local_header(name, data.size(), checksum, m_dos_time, m_dos_date);
+        uint64_t offset = reserve(header.size() + data.size());
+        write(offset, header);
+        write(offset + header.size(), data);
+        std::lock_guard<std::mutex> lock(m_entries_mutex);
+        m_entries.push_back({*normalized, offset, data.size(), checksum});
+    } else {
+        std::vector<uint8_t> headers = tar_headers(name, data.size(), m_mtime);
+        size_t padding = (tar_block - data.size() % tar_block) % tar_block;
+        uint64_t offset = reserve(headers.size() + data.size() + padding);
+        write(offset, headers);
+        write(offset + headers.size(), data);
+        write(offset + headers.size() + data.size(), {zeros, padding});
+    }
+    m_count++;
+    return !m_failed;
+}
+
+bool utils::archive::Writer::finish() {
+    if(m_file == nullptr || m_finished.exchange(true)) {
+        return false;
+    }
+    if(m_format == Format::Zip) {
+        std::vector<uint8_t> directory;
+        for(const Entry &entry : m_entries) {
+            bool zip64 = entry.offset >= zip32_limit;
+            put32(directory, 0x02014b50);
+            put16(directory, 45);
+            put16(directory, zip64 ? 45 : 20);
+            put16(directory, 0x0800);
+            put16(directory, 0);
+            put16(directory, m_dos_time);
+            put16(directory, m_dos_date);
+            put32(directory, entry.crc);
+            put32(directory, (uint32_t)entry.size);
+            put32(directory, (uint32_t)entry.size);
+            put16(directory, (uint16_t)entry.name.size());
+            put16(directory, zip64 ? 12 : 0);
+            put16(directory, 0);
+            put16(directory, 0);
+            put16(directory, 0);
+            put32(directory, 0);
+            put32(directory, zip64 ? (uint32_t)zip32_limit : (uint32_t)entry.offset);
+            put_bytes(directory, entry.name);
+            if(zip64) {
+                // Zip64 extended information holding just the local header offset
+                put16(directory, 0x0001);
+                put16(directory, 8);
+                put64(directory, entry.offset);
+            }
+        }
+        uint64_t directory_offset = reserve(directory.size()), count = m_entries.size();
+        bool zip64 = count >= 0xFFFF || directory_offset >= zip32_limit || directory.size() >= zip32_limit;
+        std::vector<uint8_t> end;
+        if(zip64) {
+            uint64_t record_offset = directory_offset + directory.size();
+            put32(end, 0x06064b50);
+            put64(end, 44);
+            put16(end, 45);
+            put16(end, 45);
+            put32(end, 0);
+            put32(end, 0);
+            put64(end, count);
+            put64(end, count);
+            put64(end, directory.size());
+            put64(end, directory_offset);
+            put32(end, 0x07064b50);
+            put32(end, 0);
+            put64(end, record_offset);
+            put32(end, 1);
+        }
+        put32(end, 0x06054b50);
+        put16(end, 0);
+        put16(end, 0);
+        put16(end, zip64 ? 0xFFFF : (uint16_t)count);
+        put16(end, zip64 ? 0xFFFF : (uint16_t)count);
+        put32(end, zip64 ? (uint32_t)zip32_limit : (uint32_t)directory.size());
+        put32(end, zip64 ? (uint32_t)zip32_limit : (uint32_t)directory_offset);
+        put16(end, 0);
+        write(directory_offset, directory);
+        write(reserve(end.size()), end);
+    } else {
+        write(reserve(sizeof(zeros)), {zeros, sizeof(zeros)});
+    }
+
+    // Every segment left is the partially filled last one, or one the archive ended before completing
+    uint64_t total = m_end;
+    for(auto &[index, segment] : m_segments) {
+        flush(index, *segment, (size_t)std::min<uint64_t>(segment_size, total - index * segment_size));
+    }
+    m_segments.clear();
+    if(std::fclose(m_file) != 0) {
+        m_failed = true;
+    }
+    m_file = nullptr;
+    logger::info("Wrote {} entr{} to {}", m_count.load(), m_count == 1 ? "y" : "ies", m_path.string());
+    return !m_failed;
+}
+
+bool utils::archive::init_archive(std::filesystem::path path, std::filesystem::path root) {
+    std::optional<Format> format = format_for(path);
+    if(!format) {
+        logger::error("Unknown archive format {}, expected a .zip or .tar file", path.string());
+        return false;
+    }
+    std::unique_ptr<Writer> writer = std::make_unique<Writer>(path, *format);
+    if(!writer->is_open()) {
+        logger::error("Failed to create archive {}", path.string());
+        return false;
+    }
+    current = std::move(writer);
+    archive_root = root;
+    return true;
+}
+
+bool utils::archive::enabled() {
+    return current != nullptr;
+}
+
+bool utils::archive::write_file(const std::filesystem::path &path, std::span<const uint8_t> data) {
+    if(!current) {
+        return false;
+    }
+    // Empty if path has no relative form, which add rejects along with paths outside the root
+    return current->add(path.lexically_normal().lexically_relative(archive_root.lexically_normal()).generic_string(), data);
+}
+
+bool utils::archive::close_archive() {
+    if(!current) {
+        return false;
+    }
+    bool finished = current->finish();
+    current.reset();
+    return finished;
+}
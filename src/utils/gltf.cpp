@@ -1,6 +1,7 @@
 #include "utils/gltf/common.h"
 #include "utils/gltf/dme.h"
 #include "utils/gltf/dmat.h"
+#include "utils/gltf/staging.h"
 
 #define _USE_MATH_DEFINES
 #include <math.h>
@@ -14,6 +15,7 @@
 #include "jenkins.h"
 #include "ps2_bone_map.h"
 #include "utils/materials_3.h"
+#include "utils/mesh_cache.h"
 
 #include "utils/textures.h"
 #include "utils.h"
@@ -81,9 +83,14 @@ int utils::gltf::dme::add_dme_to_gltf(
 ) {
     std::vector<int> mesh_nodes;
     int parent_index;
+    // Hashed once here rather than once per mesh
+    std::optional<utils::hash::Hash128> dme_key;
+    if(utils::mesh_cache::enabled()) {
+        dme_key = utils::mesh_cache::dme_key(dme);
+    }
     for(uint32_t i = 0; i < dme.mesh_count(); i++) {
         int material_index = dmat::add_material_to_gltf(gltf, *dme.dmat(), i, sampler_index, export_textures, texture_indices, material_indices, image_queue, output_directory, dme.get_name());
-        int node_index = add_mesh_to_gltf(gltf, dme, i, material_index, include_skeleton);
+        int node_index = add_mesh_to_gltf(gltf, dme, i, material_index, include_skeleton, dme_key);
         mesh_nodes.push_back(node_index);
         
         logger::debug("Added mesh {} to gltf", i);
@@ -104,7 +111,11 @@ int utils::gltf::dme::add_dme_to_gltf(
     return parent_index;
 }
 
-int utils::gltf::dme::add_mesh_to_gltf(tinygltf::Model &gltf, const DME &dme, uint32_t index, uint32_t material_index, bool include_skeleton) {
+int utils::gltf::dme::add_mesh_to_gltf(
+    tinygltf::Model &gltf, const DME &dme, uint32_t index, uint32_t material_index, bool include_skeleton,
+    std::optional<utils::hash::Hash128> dme_key
+) {
+    size_t first_buffer = gltf.buffers.size();
     int texcoord = 0;
     int color = 0;
     tinygltf::Mesh gltf_mesh;
@@ -121,14 +132,43 @@ int utils::gltf::dme::add_mesh_to_gltf(tinygltf::Model &gltf, const DME &dme, ui
     bool rigid = utils::uppercase(layout_name).find("RIGID") != std::string::npos || utils::uppercase(layout_name) == "VEHICLE";
     
     std::vector<tinygltf::Buffer> buffers;
-    for(uint32_t j = 0; j < mesh->vertex_stream_count(); j++) {
-        std::span<uint8_t> vertex_stream = mesh->vertex_stream(j);
-        tinygltf::Buffer buffer;
-        logger::debug("Expanding vertex stream {}", j);
-        buffer.data = expand_vertex_stream(*input_layout, vertex_stream, j, rigid, dme, mesh);
-        buffers.push_back(buffer);
-    }
-    logger::debug("Expanded vertex streams");
+    std::optional<utils::mesh_cache::CachedMesh> cached_mesh;
+    utils::hash::Hash128 cache_key;
+    if(utils::mesh_cache::enabled()) {
+        if(!dme_key) {
+            dme_key = utils::mesh_cache::dme_key(dme);
+        }
+        cache_key = utils::mesh_cache::mesh_key(*dme_key, dme, index, *input_layout);
+        cached_mesh = utils::mesh_cache::load(cache_key);
+    }
+
+    if(cached_mesh && cached_mesh->vertex_streams.size() == mesh->vertex_stream_count()) {
+        logger::debug("Using cached vertex streams");
+        input_layout = std::move(cached_mesh->layout);
+        for(uint32_t j = 0; j < mesh->vertex_stream_count(); j++) {
+            tinygltf::Buffer buffer;
+            buffer.data = std::move(cached_mesh->vertex_streams[j]);
+            buffers.push_back(std::move(buffer));
+        }
+    } else {
+        cached_mesh.reset();
+        for(uint32_t j = 0; j < mesh->vertex_stream_count(); j++) {
+            std::span<uint8_t> vertex_stream = mesh->vertex_stream(j);
+            tinygltf::Buffer buffer;
+            logger::debug("Expanding vertex stream {}", j);
+            buffer.data = expand_vertex_stream(*input_layout, vertex_stream, j, rigid, dme, mesh);
+            buffers.push_back(buffer);
+        }
+        logger::debug("Expanded vertex streams");
+
+        if(utils::mesh_cache::enabled()) {
+            std::vector<std::span<const uint8_t>> streams;
+            for(const tinygltf::Buffer &buffer : buffers) {
+                streams.push_back(buffer.data);
+            }
+            utils::mesh_cache::store(cache_key, *input_layout, streams);
+        }
+    }
     // using namespace std::chrono_literals;
     // std::this_thread::sleep_for(20ms);
 
@@ -221,6 +261,7 @@ int utils::gltf::dme::add_mesh_to_gltf(tinygltf::Model &gltf, const DME &dme, ui
     gltf.accessors.push_back(accessor);
     gltf.bufferViews.push_back(bufferview);
     gltf.buffers.push_back(buffer);
+    utils::gltf::staging::stage_buffers(gltf, first_buffer);
 
     gltf.scenes.at(gltf.defaultScene).nodes.push_back((int)gltf.nodes.size());
 
@@ -431,22 +472,13 @@ tinygltf::Model utils::gltf::dme::build_gltf_from_dme(
     return gltf;
 }
 
-void utils::gltf::dmat::process_images(
-    synthium::Manager& manager, 
-    utils::tsqueue<std::pair<std::string, Semantic>>& queue, 
-    std::shared_ptr<std::filesystem::path> output_directory
-) {
-    logger::debug("Got output directory {}", output_directory->string());
-    while(!queue.is_closed()) {
-        auto texture_info = queue.try_dequeue({"", Semantic::UNKNOWN});
-        std::string texture_name = texture_info.first, albedo_name;
+namespace {
+    // Reads the texture (and the albedo, and normal map when packing ORM maps, for specular maps) and queues its processing with the texture scheduler
+    void schedule_image(synthium::Manager& manager, std::string texture_name, Semantic semantic, std::filesystem::path output_directory) {
+        std::string albedo_name, normal_name;
         size_t index;
-        Semantic semantic = texture_info.second;
-        if(semantic == Semantic::UNKNOWN) {
-            logger::info("Got default value from try_dequeue, stopping thread.");
-            break;
-        }
-
+        std::vector<uint8_t> data, albedo_data, normal_data;
+        uint64_t cost;
         switch (semantic)
         {
         case Semantic::Color:
@@ -473,7 +505,11 @@ void utils::gltf::dmat::process_images(
         case Semantic::Overlay3:
         case Semantic::Overlay4:
         case Semantic::TilingOverlay:
-            utils::textures::save_texture(texture_name, manager.get(texture_name)->get_data(), *output_directory);
+            data = manager.get(texture_name)->get_data();
+            cost = utils::textures::scheduler::estimate_cost(utils::textures::cache::Mode::Texture, data);
+            utils::textures::scheduler::submit(texture_name, cost, [=, data = std::move(data)]() mutable {
+                utils::textures::save_texture(texture_name, std::move(data), output_directory);
+            });
             break;
         case Semantic::Bump:
         case Semantic::BumpMap:
@@ -481,7 +517,11 @@ void utils::gltf::dmat::process_images(
         case Semantic::BumpMap2:
         case Semantic::BumpMap3:
         case Semantic::bumpMap:
-            utils::textures::process_normalmap(texture_name, manager.get(texture_name)->get_data(), *output_directory);
+            data = manager.get(texture_name)->get_data();
+            cost = utils::textures::scheduler::estimate_cost(utils::textures::cache::Mode::NormalMap, data);
+            utils::textures::scheduler::submit(texture_name, cost, [=, data = std::move(data)]() mutable {
+                utils::textures::process_normalmap(texture_name, std::move(data), output_directory);
+            });
             break;
         case Semantic::Spec:
         case Semantic::SpecMap:
@@ -490,16 +530,36 @@ void utils::gltf::dmat::process_images(
             albedo_name = texture_name;
             index = albedo_name.find_last_of('_');
             albedo_name[index + 1] = 'C';
+            normal_name = texture_name;
+            normal_name[index + 1] = 'N';
+            data = manager.get(texture_name)->get_data();
             if(manager.contains(albedo_name)) {
-                utils::textures::process_specular(texture_name, manager.get(texture_name)->get_data(), manager.get(albedo_name)->get_data(), *output_directory);
+                albedo_data = manager.get(albedo_name)->get_data();
+                if(utils::textures::pack_orm() && manager.contains(normal_name)) {
+                    normal_data = manager.get(normal_name)->get_data();
+                }
+                cost = utils::textures::scheduler::estimate_cost(utils::textures::cache::Mode::Specular, data);
+                utils::textures::scheduler::submit(texture_name, cost, [=, data = std::move(data), albedo_data = std::move(albedo_data), normal_data = std::move(normal_data)]() mutable {
+                    utils::textures::process_specular(texture_name, std::move(data), std::move(albedo_data), output_directory, std::move(normal_data));
+                });
             } else {
-                utils::textures::save_texture(texture_name, manager.get(texture_name)->get_data(), *output_directory);
+                cost = utils::textures::scheduler::estimate_cost(utils::textures::cache::Mode::Texture, data);
+                utils::textures::scheduler::submit(texture_name, cost, [=, data = std::move(data)]() mutable {
+                    utils::textures::save_texture(texture_name, std::move(data), output_directory);
+                });
             }
             break;
         case Semantic::detailBump:
-        case Semantic::DetailBump:
-            utils::textures::process_detailcube(texture_name, manager.get(texture_name)->get_data(), *output_directory);
+        case Semantic::DetailBump: {
+            // Cubes are the largest textures, so each face is its own job
+            data = manager.get(texture_name)->get_data();
+            cost = utils::textures::scheduler::estimate_cost(utils::textures::cache::Mode::DetailCube, data);
+            std::vector<std::function<void()>> faces = utils::textures::detailcube_jobs(texture_name, std::move(data), output_directory);
+            for(std::function<void()> &face : faces) {
+                utils::textures::scheduler::submit(texture_name, cost / faces.size(), std::move(face));
+            }
             break;
+        }
         default:
             logger::warn("Skipping unimplemented semantic: {} ({})", texture_name, semantic_name(semantic));
             break;
@@ -507,6 +567,17 @@ void utils::gltf::dmat::process_images(
     }
 }
 
+void utils::gltf::dmat::process_images(
+    synthium::Manager& manager, 
+    utils::tsqueue<std::pair<std::string, Semantic>>& queue, 
+    std::shared_ptr<std::filesystem::path> output_directory
+) {
+    logger::debug("Got output directory {}", output_directory->string());
+    utils::textures::scheduler::drain(queue, [&](std::pair<std::string, Semantic> texture_info) {
+        schedule_image(manager, texture_info.first, texture_info.second, *output_directory);
+    });
+}
+
 void utils::gltf::dmat::build_material(
     tinygltf::Model &gltf, 
     tinygltf::Material &material,
@@ -573,6 +644,10 @@ void utils::gltf::dmat::build_material(
             if(!info_pair)
                 break;
             material.pbrMetallicRoughness.metallicRoughnessTexture = info_pair->first;
+            if(utils::textures::pack_orm()) {
+                // Occlusion is read from the red channel of the same map
+                material.occlusionTexture.index = info_pair->first.index;
+            }
             material.emissiveTexture = info_pair->second;
             material.emissiveFactor = {1.0, 1.0, 1.0};
             break;
@@ -588,13 +663,13 @@ void utils::gltf::dmat::build_material(
                 texture_indices[hash] = (uint32_t)gltf.textures.size();
                 image_queue.enqueue({*texture_name, semantic});
                 if (!(semantic == Semantic::detailBump || semantic == Semantic::DetailBump)) {
-                    add_texture_to_gltf(gltf, (output_directory / "textures" / *texture_name).replace_extension(".png"), output_directory, sampler, label);
+                    add_texture_to_gltf(gltf, (output_directory / "textures" / *texture_name).replace_extension(utils::textures::output_extension()), output_directory, sampler, label);
                 } else {
                     temp = std::filesystem::path(*texture_name);
                     for(std::string face : utils::materials3::detailcube_faces) {
                         add_texture_to_gltf(
                             gltf, 
-                            (output_directory / "textures" / (temp.stem().string() + "_" + face)).replace_extension(".png"),
+                            (output_directory / "textures" / (temp.stem().string() + "_" + face)).replace_extension(utils::textures::output_extension()),
                             output_directory,
                             sampler,
                             *label + " " + face
@@ -629,7 +704,7 @@ std::optional<tinygltf::TextureInfo> utils::gltf::dmat::load_texture_info(
         image_queue.enqueue({*texture_name, semantic});
         
         std::filesystem::path texture_path(*texture_name);
-        texture_path.replace_extension(".png");
+        texture_path.replace_extension(utils::textures::output_extension());
         texture_path = output_directory / "textures" / texture_path;
         
         texture_indices[hash] = (uint32_t)gltf.textures.size();
@@ -659,10 +734,10 @@ std::optional<std::pair<tinygltf::TextureInfo, tinygltf::TextureInfo>> utils::gl
     std::unordered_map<uint32_t, uint32_t>::iterator value;
     if((value = texture_indices.find(hash)) == texture_indices.end()) {
         image_queue.enqueue({*texture_name, semantic});
-        std::string metallic_roughness_name = utils::textures::relabel_texture(*texture_name, "MR");
+        std::string metallic_roughness_name = utils::textures::relabel_texture(*texture_name, utils::textures::pack_orm() ? "ORM" : "MR");
 
         std::filesystem::path metallic_roughness_path(metallic_roughness_name);
-        metallic_roughness_path.replace_extension(".png");
+        metallic_roughness_path.replace_extension(utils::textures::output_extension());
         metallic_roughness_path = output_directory / "textures" / metallic_roughness_path;
         
         texture_indices[hash] = (uint32_t)gltf.textures.size();
@@ -670,7 +745,7 @@ std::optional<std::pair<tinygltf::TextureInfo, tinygltf::TextureInfo>> utils::gl
         
         std::string emissive_name = utils::textures::relabel_texture(*texture_name, "E");
         std::filesystem::path emissive_path = metallic_roughness_path.parent_path() / emissive_name;
-        emissive_path.replace_extension(".png");
+        emissive_path.replace_extension(utils::textures::output_extension());
 
         hash = jenkins::oaat(emissive_name);
         texture_indices[hash] = (uint32_t)gltf.textures.size();
@@ -6,6 +6,7 @@
 
 #include "utils/textures.h"
 #include "utils/gltf/common.h"
+#include "utils/gltf/staging.h"
 #include "utils/tsqueue.h"
 
 #if __cpp_lib_shared_ptr_arrays < 201707L
@@ -26,6 +27,32 @@ struct Color2 {
     uint32_t color1, color2;
 };
 
+namespace {
+    // Which of the chunk's textures a render batch is drawn with
+    uint32_t batch_texture(uint32_t render_batch) {
+        return (render_batch & 2) + ((render_batch >> 3) & 1);
+    }
+
+    int atlas_page_material(tinygltf::Model &gltf, uint32_t page, std::filesystem::path output_directory, int sampler_index) {
+        std::string material_name = utils::textures::atlas::page_name(page);
+        for(size_t i = 0; i < gltf.materials.size(); i++) {
+            if(gltf.materials[i].name == material_name) {
+                return (int)i;
+            }
+        }
+        tinygltf::Material material;
+        material.pbrMetallicRoughness.baseColorTexture.index = utils::gltf::add_texture_to_gltf(gltf, utils::textures::atlas::page_path(page, 'C'), output_directory, sampler_index);
+        material.pbrMetallicRoughness.metallicRoughnessTexture.index = utils::gltf::add_texture_to_gltf(gltf, utils::textures::atlas::page_path(page, 'S'), output_directory, sampler_index);
+        material.normalTexture.index = utils::gltf::add_texture_to_gltf(gltf, utils::textures::atlas::page_path(page, 'N'), output_directory, sampler_index);
+        material.doubleSided = true;
+        material.extensions["KHR_materials_specular"] = tinygltf::Value(tinygltf::Value::Object());
+        material.extensions["KHR_materials_specular"].Get<tinygltf::Value::Object>()["specularFactor"] = tinygltf::Value(0.0f);
+        material.name = material_name;
+        gltf.materials.push_back(material);
+        return (int)gltf.materials.size() - 1;
+    }
+}
+
 int utils::gltf::chunk::add_chunks_to_gltf(
     tinygltf::Model &gltf,
     const warpgate::chunk::CNK0 &chunk0,
@@ -41,7 +68,10 @@ int utils::gltf::chunk::add_chunks_to_gltf(
     if(aabb && !aabb->overlaps(utils::AABB({0.0, 0.0, 0.0, 1.0}, {256.0, 1024.0, 256.0, 1.0}))) {
         return -1;
     }
-    if(export_textures) {
+    if(export_textures && utils::textures::atlas::enabled()) {
+        std::vector<AtlasTexture> atlas_textures = add_atlas_materials_to_gltf(gltf, chunk1, image_queue, output_directory, name, sampler_index);
+        return add_mesh_to_gltf(gltf, chunk0, -1, name, false, atlas_textures);
+    } else if(export_textures) {
         base_index = add_materials_to_gltf(gltf, chunk1, image_queue, output_directory, name, sampler_index);
     }
     return add_mesh_to_gltf(gltf, chunk0, base_index, name);
@@ -52,8 +82,10 @@ int utils::gltf::chunk::add_mesh_to_gltf(
     const warpgate::chunk::CNK0 &chunk,
     int material_base_index,
     std::string name,
-    bool include_colors
+    bool include_colors,
+    std::span<const AtlasTexture> atlas_textures
 ) {
+    size_t first_buffer = gltf.buffers.size();
     uint32_t render_batch_count = chunk.render_batch_count();
     std::span<warpgate::chunk::RenderBatch> render_batches = chunk.render_batches();
     tinygltf::Node parent;
@@ -170,8 +202,10 @@ int utils::gltf::chunk::add_mesh_to_gltf(
         }
 
         primitive.mode = TINYGLTF_MODE_TRIANGLES;
-        if(material_base_index >= 0) {
-            primitive.material = material_base_index + (i & 2) + ((i >> 3) & 1);
+        if(batch_texture(i) < atlas_textures.size()) {
+            primitive.material = atlas_textures[batch_texture(i)].material;
+        } else if(material_base_index >= 0) {
+            primitive.material = material_base_index + batch_texture(i);
         }
         mesh.primitives.push_back(primitive);
 
@@ -200,6 +234,12 @@ int utils::gltf::chunk::add_mesh_to_gltf(
         Float2 texcoord;
         texcoord.u = (float)raw_vertex.y / 128.0f + (((vertex_mesh >> 2) & 1) * 0.5f);
         texcoord.v = (float)raw_vertex.x / 128.0f + ((vertex_mesh & 1) * 0.5f);
+        if(batch_texture(vertex_mesh) < atlas_textures.size()) {
+            // Move the texture's [0, 1] range onto its cell of the atlas page
+            const utils::textures::atlas::Slot &slot = atlas_textures[batch_texture(vertex_mesh)].slot;
+            texcoord.u = slot.u + texcoord.u * slot.scale;
+            texcoord.v = slot.v + texcoord.v * slot.scale;
+        }
         texcoords.push_back(texcoord);
 
         Float3 vertex;
@@ -247,6 +287,7 @@ int utils::gltf::chunk::add_mesh_to_gltf(
 
         gltf.buffers.push_back(colors_buffer);
     }
+    utils::gltf::staging::stage_buffers(gltf, first_buffer);
 
     return parent_index;
 }
@@ -276,9 +317,9 @@ int utils::gltf::chunk::add_materials_to_gltf(
 
         image_queue.enqueue({save_path.string(), cnx_data, (uint32_t)cnx_map.size(), sny_data, (uint32_t)sny_map.size()});
 
-        material.pbrMetallicRoughness.baseColorTexture.index = utils::gltf::add_texture_to_gltf(gltf, output_directory / "textures" / name / (texture_basename + "_C.png"), output_directory, sampler_index);
-        material.pbrMetallicRoughness.metallicRoughnessTexture.index = utils::gltf::add_texture_to_gltf(gltf, output_directory / "textures" / name / (texture_basename + "_S.png"), output_directory, sampler_index);
-        material.normalTexture.index = utils::gltf::add_texture_to_gltf(gltf, output_directory / "textures" / name / (texture_basename + "_N.png"), output_directory, sampler_index);
+        material.pbrMetallicRoughness.baseColorTexture.index = utils::gltf::add_texture_to_gltf(gltf, output_directory / "textures" / name / (texture_basename + "_C" + utils::textures::output_extension()), output_directory, sampler_index);
+        material.pbrMetallicRoughness.metallicRoughnessTexture.index = utils::gltf::add_texture_to_gltf(gltf, output_directory / "textures" / name / (texture_basename + "_S" + utils::textures::output_extension()), output_directory, sampler_index);
+        material.normalTexture.index = utils::gltf::add_texture_to_gltf(gltf, output_directory / "textures" / name / (texture_basename + "_N" + utils::textures::output_extension()), output_directory, sampler_index);
         material.doubleSided = true;
         material.extensions["KHR_materials_specular"] = tinygltf::Value(tinygltf::Value::Object());
         material.extensions["KHR_materials_specular"].Get<tinygltf::Value::Object>()["specularFactor"] = tinygltf::Value(0.0f);
@@ -288,6 +329,32 @@ int utils::gltf::chunk::add_materials_to_gltf(
     return material_start_index;
 }
 
+std::vector<utils::gltf::chunk::AtlasTexture> utils::gltf::chunk::add_atlas_materials_to_gltf(
+    tinygltf::Model &gltf,
+    const warpgate::chunk::CNK1 &chunk,
+    utils::tsqueue<std::tuple<std::string, std::shared_ptr<uint8_t[]>, uint32_t, std::shared_ptr<uint8_t[]>, uint32_t>> &image_queue,
+    std::filesystem::path output_directory,
+    std::string name,
+    int sampler_index
+) {
+    std::vector<AtlasTexture> atlas_textures;
+    for(uint32_t texture = 0; texture < chunk.textures_count(); texture++) {
+        std::span<uint8_t> cnx_map = chunk.textures()[texture].color_nx_map();
+        std::span<uint8_t> sny_map = chunk.textures()[texture].specular_ny_map();
+        std::shared_ptr<uint8_t[]> cnx_data = std::make_shared<uint8_t[]>(cnx_map.size());
+        std::shared_ptr<uint8_t[]> sny_data = std::make_shared<uint8_t[]>(sny_map.size());
+        std::memcpy(cnx_data.get(), cnx_map.data(), cnx_map.size());
+        std::memcpy(sny_data.get(), sny_map.data(), sny_map.size());
+        std::string texture_name = (std::filesystem::path(name) / (name + "_" + std::to_string(texture))).string();
+
+        // Reserved before queueing, so the image threads always find the cell
+        utils::textures::atlas::Slot slot = utils::textures::atlas::reserve(texture_name);
+        image_queue.enqueue({texture_name, cnx_data, (uint32_t)cnx_map.size(), sny_data, (uint32_t)sny_map.size()});
+        atlas_textures.push_back({slot, atlas_page_material(gltf, slot.page, output_directory, sampler_index)});
+    }
+    return atlas_textures;
+}
+
 tinygltf::Model utils::gltf::chunk::build_gltf_from_chunks(
     const warpgate::chunk::CNK0 &chunk0,
     const warpgate::chunk::CNK1 &chunk1,
@@ -1,7 +1,13 @@
 #include "utils/gltf/common.h"
 
 // Here it is
+#include "utils/hash.h"
 #include "utils/sign.h"
+#include "utils/gltf/staging.h"
+
+#include <algorithm>
+#include <cstring>
+#include <unordered_map>
 
 #include <glm/vec3.hpp>
 #include <glm/gtx/quaternion.hpp>
@@ -22,6 +28,22 @@ int utils::gltf::add_texture_to_gltf(
     tex.sampler = sampler;
     tinygltf::Image img;
     img.uri = texture_path.lexically_relative(output_directory).string();
+
+    std::string extension = texture_path.extension().string();
+    if(extension == ".dds") {
+        // No PNG fallback is written, so the image can only be reached through the extension
+        std::string extension_name = "MSFT_texture_dds";
+        img.mimeType = "image/vnd-ms.dds";
+        tinygltf::Value::Object source;
+        source["source"] = tinygltf::Value(tex.source);
+        tex.extensions[extension_name] = tinygltf::Value(source);
+        tex.source = -1;
+        for(std::vector<std::string> *extensions : {&gltf.extensionsUsed, &gltf.extensionsRequired}) {
+            if(std::find(extensions->begin(), extensions->end(), extension_name) == extensions->end()) {
+                extensions->push_back(extension_name);
+            }
+        }
+    }
     
     gltf.textures.push_back(tex);
     gltf.images.push_back(img);
@@ -76,6 +98,137 @@ void utils::gltf::update_bone_transforms(tinygltf::Model &gltf, int skeleton_roo
     }
 }
 
+size_t utils::gltf::deduplicate_buffers(tinygltf::Model &gltf) {
+    using utils::hash::Hash128;
+    size_t original_size = 0;
+    for(const tinygltf::Buffer &buffer : gltf.buffers) {
+        original_size += utils::gltf::staging::buffer_length(buffer);
+    }
+
+    std::unordered_map<Hash128, std::vector<int>, utils::hash::Hash128Hasher> buffers_by_hash;
+    std::unordered_map<std::string, int> staged_buffers;
+    std::vector<int> buffer_remap(gltf.buffers.size());
+    for(int i = 0; i < (int)gltf.buffers.size(); i++) {
+        buffer_remap[i] = i;
+        const std::vector<uint8_t> &data = gltf.buffers[i].data;
+        if(data.empty()) {
+            // Staged buffers were matched against the staging file when they were staged, so equal contents share a uri
+            if(utils::gltf::staging::is_staged(gltf.buffers[i])) {
+                buffer_remap[i] = staged_buffers.try_emplace(gltf.buffers[i].uri, i).first->second;
+            }
+            continue;
+        }
+        std::vector<int> &candidates = buffers_by_hash[utils::hash::hash128(data)];
+        auto match = std::find_if(candidates.begin(), candidates.end(), [&](int candidate) {
+            return gltf.buffers[candidate].data == data;
+        });
+        if(match != candidates.end()) {
+            buffer_remap[i] = *match;
+        } else {
+            candidates.push_back(i);
+        }
+    }
+
+    auto view_data = [&](const tinygltf::BufferView &view) {
+        const std::vector<uint8_t> &data = gltf.buffers.at(view.buffer).data;
+        if(view.byteOffset + view.byteLength > data.size()) {
+            return std::span<const uint8_t>();
+        }
+        return std::span<const uint8_t>(data.data() + view.byteOffset, view.byteLength);
+    };
+
+    std::unordered_map<Hash128, std::vector<int>, utils::hash::Hash128Hasher> views_by_hash;
+    std::vector<int> view_remap(gltf.bufferViews.size());
+    for(int i = 0; i < (int)gltf.bufferViews.size(); i++) {
+        tinygltf::BufferView &view = gltf.bufferViews[i];
+        view_remap[i] = i;
+        if(view.buffer < 0) {
+            continue;
+        }
+        view.buffer = buffer_remap.at(view.buffer);
+        std::span<const uint8_t> data = view_data(view);
+        if(data.empty()) {
+            continue;
+        }
+        Hash128 key = utils::hash::combine(utils::hash::hash128(data), ((uint64_t)view.byteStride << 32) | (uint32_t)view.target);
+        std::vector<int> &candidates = views_by_hash[key];
+        auto match = std::find_if(candidates.begin(), candidates.end(), [&](int candidate) {
+            const tinygltf::BufferView &other = gltf.bufferViews[candidate];
+            std::span<const uint8_t> other_data = view_data(other);
+            return other.byteStride == view.byteStride
+                && other.target == view.target
+                && other_data.size() == data.size()
+                && std::memcmp(other_data.data(), data.data(), data.size()) == 0;
+        });
+        if(match != candidates.end()) {
+            view_remap[i] = *match;
+        } else {
+            candidates.push_back(i);
+        }
+    }
+
+    std::vector<bool> view_used(gltf.bufferViews.size(), false);
+    for(tinygltf::Accessor &accessor : gltf.accessors) {
+        if(accessor.bufferView >= 0) {
+            accessor.bufferView = view_remap.at(accessor.bufferView);
+            view_used[accessor.bufferView] = true;
+        }
+    }
+    for(tinygltf::Image &image : gltf.images) {
+        if(image.bufferView >= 0) {
+            image.bufferView = view_remap.at(image.bufferView);
+            view_used[image.bufferView] = true;
+        }
+    }
+
+    std::vector<bool> buffer_used(gltf.buffers.size(), false);
+    std::vector<int> view_index(gltf.bufferViews.size(), -1);
+    std::vector<tinygltf::BufferView> views;
+    for(int i = 0; i < (int)gltf.bufferViews.size(); i++) {
+        if(!view_used[i]) {
+            continue;
+        }
+        view_index[i] = (int)views.size();
+        if(gltf.bufferViews[i].buffer >= 0) {
+            buffer_used[gltf.bufferViews[i].buffer] = true;
+        }
+        views.push_back(std::move(gltf.bufferViews[i]));
+    }
+
+    std::vector<int> buffer_index(gltf.buffers.size(), -1);
+    std::vector<tinygltf::Buffer> buffers;
+    size_t final_size = 0;
+    for(int i = 0; i < (int)gltf.buffers.size(); i++) {
+        if(!buffer_used[i]) {
+            utils::gltf::staging::release(gltf.buffers[i]);
+            continue;
+        }
+        buffer_index[i] = (int)buffers.size();
+        final_size += utils::gltf::staging::buffer_length(gltf.buffers[i]);
+        buffers.push_back(std::move(gltf.buffers[i]));
+    }
+
+    for(tinygltf::BufferView &view : views) {
+        if(view.buffer >= 0) {
+            view.buffer = buffer_index[view.buffer];
+        }
+    }
+    for(tinygltf::Accessor &accessor : gltf.accessors) {
+        if(accessor.bufferView >= 0) {
+            accessor.bufferView = view_index[accessor.bufferView];
+        }
+    }
+    for(tinygltf::Image &image : gltf.images) {
+        if(image.bufferView >= 0) {
+            image.bufferView = view_index[image.bufferView];
+        }
+    }
+
+    gltf.bufferViews = std::move(views);
+    gltf.buffers = std::move(buffers);
+    return original_size - final_size;
+}
+
 bool utils::gltf::isCOG(tinygltf::Node node) {
     return node.name == "COG";
 }
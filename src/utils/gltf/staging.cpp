@@ -0,0 +1,350 @@
+#include "utils/gltf/staging.h"
+#include "utils/hash.h"
+
+#include <algorithm>
+#include <charconv>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <span>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__linux__)
+#include <sys/sendfile.h>
+#include <unistd.h>
+#endif
+
+#include <spdlog/spdlog.h>
+
+namespace logger = spdlog;
+using namespace warpgate;
+
+namespace {
+    constexpr std::string_view staged_prefix = "warpgate-staged:";
+    constexpr size_t copy_chunk_size = 1 << 20;
+
+    bool seek(std::FILE *file, uint64_t offset) {
+#ifdef _WIN32
+        return _fseeki64(file, (int64_t)offset, SEEK_SET) == 0;
+#else
+        return fseeko(file, (off_t)offset, SEEK_SET) == 0;
+#endif
+    }
+
+    /**
+     * Temporary file holding staged buffer data. Removed again when the process exits.
+     */
+    class Arena {
+    public:
+        Arena(std::filesystem::path path) : m_path(path), m_file(std::fopen(path.string().c_str(), "w+b")) {}
+
+        ~Arena() {
+            if(m_file != nullptr) {
+                std::fclose(m_file);
+            }
+            std::error_code err;
+            std::filesystem::remove(m_path, err);
+        }
+
+        bool is_open() const {
+            return m_file != nullptr;
+        }
+
+        bool write(uint64_t offset, std::span<const uint8_t> data) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if(!seek(m_file, offset) || std::fwrite(data.data(), 1, data.size(), m_file) != data.size() || std::fflush(m_file) != 0) {
+                return false;
+            }
+            m_length = std::max<uint64_t>(m_length, offset + data.size());
+            return true;
+        }
+
+        uint64_t length() {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return m_length;
+        }
+
+        // Drops the file's contents once no staged buffer refers to them any more
+        void truncate() {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            std::error_code err;
+            std::filesystem::resize_file(m_path, 0, err);
+            if(err) {
+                logger::debug("Failed to truncate staging file {}: {}", m_path.string(), err.message());
+                return;
+            }
+            m_length = 0;
+        }
+
+        bool read(uint64_t offset, std::span<uint8_t> data) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return seek(m_file, offset) && std::fread(data.data(), 1, data.size(), m_file) == data.size();
+        }
+
+        bool copy_to(uint64_t offset, uint64_t length, std::FILE *output) {
+#if defined(__linux__)
+            // Appended data is always flushed, so the kernel can copy straight from the arena's file
+            if(std::fflush(output) != 0) {
+                return false;
+            }
+            int input_fd = fileno(m_file), output_fd = fileno(output);
+            off_t input_offset = (off_t)offset;
+            while(length > 0) {
+                ssize_t copied = copy_file_range(input_fd, &input_offset, output_fd, nullptr, length, 0);
+                if(copied <= 0) {
+                    copied = sendfile(output_fd, input_fd, &input_offset, length);
+                }
+                if(copied <= 0) {
+                    break;
+                }
+                length -= copied;
+            }
+            offset = (uint64_t)input_offset;
+#endif
+            std::vector<uint8_t> chunk(std::min<uint64_t>(length, copy_chunk_size));
+            while(length > 0) {
+                size_t count = (size_t)std::min<uint64_t>(length, chunk.size());
+                if(!read(offset, {chunk.data(), count}) || std::fwrite(chunk.data(), 1, count, output) != count) {
+                    return false;
+                }
+                offset += count;
+                length -= count;
+            }
+            return true;
+        }
+
+    private:
+        std::filesystem::path m_path;
+        std::FILE *m_file;
+        std::mutex m_mutex;
+        uint64_t m_length = 0;
+    };
+
+    // A range of the arena holding one staged buffer's data, shared by every buffer with the same contents
+    struct Region {
+        uint64_t length;
+        utils::hash::Hash128 hash;
+        uint32_t references;
+    };
+
+    std::unique_ptr<Arena> arena;
+    size_t staging_threshold = 0;
+    // Guards everything below. Bytes of buffer data counted against the threshold and still held in memory by models not yet released
+    std::mutex staging_mutex;
+    size_t resident_bytes = 0;
+    std::map<uint64_t, Region> regions;
+    std::unordered_map<utils::hash::Hash128, std::vector<uint64_t>, utils::hash::Hash128Hasher> regions_by_hash;
+    // Ranges of the arena left by released regions, by offset
+    std::map<uint64_t, uint64_t> free_ranges;
+
+    uint64_t allocate(uint64_t length) {
+        for(auto it = free_ranges.begin(); it != free_ranges.end(); it++) {
+            auto [offset, free_length] = *it;
+            if(free_length >= length) {
+                free_ranges.erase(it);
+                if(free_length > length) {
+                    free_ranges[offset + length] = free_length - length;
+                }
+                return offset;
+            }
+        }
+        return arena->length();
+    }
+
+    void free_range(uint64_t offset, uint64_t length) {
+        auto next = free_ranges.lower_bound(offset);
+        if(next != free_ranges.end() && offset + length == next->first) {
+            length += next->second;
+            next = free_ranges.erase(next);
+        }
+        if(next != free_ranges.begin()) {
+            auto previous = std::prev(next);
+            if(previous->first + previous->second == offset) {
+                previous->second += length;
+                return;
+            }
+        }
+        free_ranges[offset] = length;
+    }
+
+    // Expects staging_mutex to be held
+    void unreference(uint64_t offset) {
+        auto region = regions.find(offset);
+        if(region == regions.end() || --region->second.references > 0) {
+            return;
+        }
+        std::vector<uint64_t> &same_hash = regions_by_hash[region->second.hash];
+        std::erase(same_hash, offset);
+        if(same_hash.empty()) {
+            regions_by_hash.erase(region->second.hash);
+        }
+        free_range(offset, region->second.length);
+        regions.erase(region);
+        if(regions.empty()) {
+            free_ranges.clear();
+            arena->truncate();
+        }
+    }
+
+    /**
+     * Finds data in the arena or writes it to a free range. Returns the offset of its region, which holds a reference for the caller.
+     */
+    std::optional<uint64_t> stage(std::span<const uint8_t> data, const utils::hash::Hash128 &hash) {
+        std::lock_guard<std::mutex> lock(staging_mutex);
+        auto candidates = regions_by_hash.find(hash);
+        if(candidates != regions_by_hash.end()) {
+            std::vector<uint8_t> staged;
+            for(uint64_t offset : candidates->second) {
+                Region &region = regions.at(offset);
+                if(region.length != data.size()) {
+                    continue;
+                }
+                staged.resize(data.size());
+                if(arena->read(offset, staged) && std::equal(staged.begin(), staged.end(), data.begin())) {
+                    region.references++;
+                    return offset;
+                }
+            }
+        }
+
+        uint64_t offset = allocate(data.size());
+        if(!arena->write(offset, data)) {
+            free_range(offset, data.size());
+            return {};
+        }
+        regions[offset] = {data.size(), hash, 1};
+        regions_by_hash[hash].push_back(offset);
+        return offset;
+    }
+
+    bool parse_staged(const tinygltf::Buffer &buffer, uint64_t &offset, uint64_t &length) {
+        std::string_view uri = buffer.uri;
+        if(!uri.starts_with(staged_prefix)) {
+            return false;
+        }
+        uri.remove_prefix(staged_prefix.size());
+        size_t separator = uri.find(':');
+        if(separator == std::string_view::npos) {
+            return false;
+        }
+        auto [offset_end, offset_error] = std::from_chars(uri.data(), uri.data() + separator, offset);
+        auto [length_end, length_error] = std::from_chars(uri.data() + separator + 1, uri.data() + uri.size(), length);
+        return offset_error == std::errc() && length_error == std::errc();
+    }
+}
+
+void utils::gltf::staging::init_staging(std::filesystem::path directory, size_t threshold) {
+    try {
+        std::filesystem::create_directories(directory);
+    } catch(std::filesystem::filesystem_error &err) {
+        logger::error("Failed to create staging directory {}: {}", err.path1().string(), err.what());
+        return;
+    }
+    std::filesystem::path path = directory / ("warpgate-staging-" + std::to_string(std::random_device{}()) + ".tmp");
+    std::unique_ptr<Arena> new_arena = std::make_unique<Arena>(path);
+    if(!new_arena->is_open()) {
+        logger::error("Failed to open staging file {}", path.string());
+        return;
+    }
+    arena = std::move(new_arena);
+    staging_threshold = threshold;
+    logger::info("Staging buffer data beyond {} bytes to {}", threshold, path.string());
+}
+
+bool utils::gltf::staging::enabled() {
+    return arena != nullptr;
+}
+
+void utils::gltf::staging::stage_buffers(tinygltf::Model &gltf, size_t first_buffer) {
+    if(!arena) {
+        return;
+    }
+    for(size_t i = first_buffer; i < gltf.buffers.size(); i++) {
+        tinygltf::Buffer &buffer = gltf.buffers[i];
+        size_t size = buffer.data.size();
+        if(size == 0) {
+            continue;
+        }
+        {
+            std::lock_guard<std::mutex> lock(staging_mutex);
+            if(resident_bytes + size <= staging_threshold) {
+                resident_bytes += size;
+                continue;
+            }
+        }
+        // Hashed before staging so repeated buffers (instanced meshes, shared chunk data) are only staged once
+        std::optional<uint64_t> offset = stage(buffer.data, utils::hash::hash128(buffer.data));
+        if(!offset) {
+            logger::warn("Failed to stage {} bytes of buffer data, keeping it in memory", size);
+            std::lock_guard<std::mutex> lock(staging_mutex);
+            resident_bytes += size;
+            continue;
+        }
+        buffer.uri = std::string(staged_prefix) + std::to_string(*offset) + ":" + std::to_string(size);
+        std::vector<uint8_t>().swap(buffer.data);
+    }
+}
+
+bool utils::gltf::staging::is_staged(const tinygltf::Buffer &buffer) {
+    return buffer.data.empty() && buffer.uri.starts_with(staged_prefix);
+}
+
+size_t utils::gltf::staging::buffer_length(const tinygltf::Buffer &buffer) {
+    uint64_t offset, length;
+    if(buffer.data.empty() && parse_staged(buffer, offset, length)) {
+        return (size_t)length;
+    }
+    return buffer.data.size();
+}
+
+bool utils::gltf::staging::restore(tinygltf::Buffer &buffer) {
+    uint64_t offset, length;
+    if(!buffer.data.empty() || !parse_staged(buffer, offset, length)) {
+        return true;
+    }
+    buffer.data.resize((size_t)length);
+    if(!arena || !arena->read(offset, buffer.data)) {
+        logger::error("Failed to read staged buffer data at offset {}", offset);
+        buffer.data.clear();
+        return false;
+    }
+    buffer.uri.clear();
+    std::lock_guard<std::mutex> lock(staging_mutex);
+    unreference(offset);
+    resident_bytes += length;
+    return true;
+}
+
+void utils::gltf::staging::release(tinygltf::Buffer &buffer) {
+    if(!arena) {
+        return;
+    }
+    uint64_t offset, length;
+    std::lock_guard<std::mutex> lock(staging_mutex);
+    if(buffer.data.empty() && parse_staged(buffer, offset, length)) {
+        unreference(offset);
+    } else {
+        resident_bytes -= std::min(resident_bytes, buffer.data.size());
+    }
+    buffer.uri.clear();
+    std::vector<uint8_t>().swap(buffer.data);
+}
+
+void utils::gltf::staging::release(tinygltf::Model &gltf) {
+    for(tinygltf::Buffer &buffer : gltf.buffers) {
+        release(buffer);
+    }
+    gltf.buffers.clear();
+}
+
+bool utils::gltf::staging::copy_staged(const tinygltf::Buffer &buffer, std::FILE *output) {
+    uint64_t offset, length;
+    if(!arena || !parse_staged(buffer, offset, length)) {
+        return false;
+    }
+    return arena->copy_to(offset, length, output);
+}
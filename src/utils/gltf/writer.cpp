@@ -0,0 +1,853 @@
+#include "utils/gltf/writer.h"
+#include "utils/gltf/staging.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+
+namespace logger = spdlog;
+using namespace warpgate;
+
+namespace {
+    constexpr uint32_t buffer_alignment = 16;
+    constexpr uint32_t glb_magic = 0x46546C67;
+    constexpr uint32_t glb_json_chunk = 0x4E4F534A;
+    constexpr uint32_t glb_bin_chunk = 0x004E4942;
+
+    size_t align(size_t value, size_t alignment) {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+
+    /**
+     * Buffers that all name their own file (as mrn_converter's do) are written to those files rather than merged,
+     * the way tinygltf wrote them. Staged buffers are marked through their uri too, but it names no file, so they are merged.
+     */
+    bool keeps_buffer_uris(const tinygltf::Model &gltf) {
+        return !gltf.buffers.empty() && std::all_of(gltf.buffers.begin(), gltf.buffers.end(), [](const tinygltf::Buffer &buffer) {
+            return !buffer.uri.empty() && buffer.uri.rfind("data:", 0) != 0 && !utils::gltf::staging::is_staged(buffer);
+        });
+    }
+
+    std::vector<size_t> buffer_offsets(const tinygltf::Model &gltf, size_t &total) {
+        std::vector<size_t> offsets;
+        total = 0;
+        for(const tinygltf::Buffer &buffer : gltf.buffers) {
+            total = align(total, buffer_alignment);
+            offsets.push_back(total);
+            total += utils::gltf::staging::buffer_length(buffer);
+        }
+        return offsets;
+    }
+
+    /**
+     * Minimal streaming JSON emitter. Commas and (optional) indentation are handled here,
+     * so callers only describe the structure.
+     */
+    class JsonWriter {
+    public:
+        JsonWriter(std::string &output, bool pretty): out(output), pretty(pretty) {}
+
+        void begin_object() {
+            separate();
+            out.push_back('{');
+            first.push_back(true);
+        }
+
+        void end_object() {
+            close('}');
+        }
+
+        void begin_array() {
+            separate();
+            out.push_back('[');
+            first.push_back(true);
+        }
+
+        void end_array() {
+            close(']');
+        }
+
+        void key(std::string_view name) {
+            separate();
+            string(name);
+            out.push_back(':');
+            if(pretty) {
+                out.push_back(' ');
+            }
+            after_key = true;
+        }
+
+        void value(std::string_view text) {
+            separate();
+            string(text);
+        }
+
+        void value(const char *text) {
+            value(std::string_view(text));
+        }
+
+        void value(const std::string &text) {
+            value(std::string_view(text));
+        }
+
+        void null() {
+            separate();
+            out.append("null");
+        }
+
+        void value(bool boolean) {
+            separate();
+            out.append(boolean ? "true" : "false");
+        }
+
+        void value(int number) {
+            integer((int64_t)number);
+        }
+
+        void value(size_t number) {
+            integer((int64_t)number);
+        }
+
+        void value(double number) {
+            separate();
+            if(!std::isfinite(number)) {
+                out.append("null");
+                return;
+            }
+            char buffer[32];
+            auto [end, error] = std::to_chars(buffer, buffer + sizeof(buffer), number);
+            out.append(buffer, end);
+        }
+
+        template <typename T>
+        void property(std::string_view name, const T &data) {
+            key(name);
+            value(data);
+        }
+
+        template <typename T>
+        void array(std::string_view name, const std::vector<T> &values) {
+            key(name);
+            begin_array();
+            for(const T &item : values) {
+                value(item);
+            }
+            end_array();
+        }
+
+    private:
+        std::string &out;
+        bool pretty;
+        bool after_key = false;
+        std::vector<bool> first;
+
+        void newline() {
+            out.push_back('\n');
+            out.append(first.size() * 2, ' ');
+        }
+
+        void separate() {
+            if(after_key) {
+                after_key = false;
+                return;
+            }
+            if(first.empty()) {
+                return;
+            }
+            if(!first.back()) {
+                out.push_back(',');
+            }
+            first.back() = false;
+            if(pretty) {
+                newline();
+            }
+        }
+
+        void close(char bracket) {
+            bool empty = first.back();
+            first.pop_back();
+            if(pretty && !empty) {
+                newline();
+            }
+            out.push_back(bracket);
+        }
+
+        void integer(int64_t number) {
+            separate();
+            char buffer[24];
+            auto [end, error] = std::to_chars(buffer, buffer + sizeof(buffer), number);
+            out.append(buffer, end);
+        }
+
+        void string(std::string_view text) {
+            static const char *hex = "0123456789abcdef";
+            out.push_back('"');
+            for(char c : text) {
+                switch(c) {
+                case '"':
+                    out.append("\\\"");
+                    break;
+                case '\\':
+                    out.append("\\\\");
+                    break;
+                case '\n':
+                    out.append("\\n");
+                    break;
+                case '\r':
+                    out.append("\\r");
+                    break;
+                case '\t':
+                    out.append("\\t");
+                    break;
+                case '\b':
+                    out.append("\\b");
+                    break;
+                case '\f':
+                    out.append("\\f");
+                    break;
+                default:
+                    if((unsigned char)c < 0x20) {
+                        out.append("\\u00");
+                        out.push_back(hex[(c >> 4) & 0xF]);
+                        out.push_back(hex[c & 0xF]);
+                    } else {
+                        out.push_back(c);
+                    }
+                }
+            }
+            out.push_back('"');
+        }
+    };
+
+    void write_value(JsonWriter &json, const tinygltf::Value &value) {
+        if(value.IsBool()) {
+            json.value(value.Get<bool>());
+        } else if(value.IsInt()) {
+            json.value(value.Get<int>());
+        } else if(value.IsReal()) {
+            json.value(value.Get<double>());
+        } else if(value.IsString()) {
+            json.value(value.Get<std::string>());
+        } else if(value.IsArray()) {
+            json.begin_array();
+            for(const tinygltf::Value &item : value.Get<tinygltf::Value::Array>()) {
+                write_value(json, item);
+            }
+            json.end_array();
+        } else if(value.IsObject()) {
+            json.begin_object();
+            for(const auto &[name, item] : value.Get<tinygltf::Value::Object>()) {
+                json.key(name);
+                write_value(json, item);
+            }
+            json.end_object();
+        } else {
+            json.null();
+        }
+    }
+
+    void write_extras(JsonWriter &json, const tinygltf::ExtensionMap &extensions, const tinygltf::Value &extras) {
+        if(!extensions.empty()) {
+            json.key("extensions");
+            json.begin_object();
+            for(const auto &[name, extension] : extensions) {
+                json.key(name);
+                if(extension.Type() == tinygltf::NULL_TYPE) {
+                    json.begin_object();
+                    json.end_object();
+                } else {
+                    write_value(json, extension);
+                }
+            }
+            json.end_object();
+        }
+        if(extras.Type() != tinygltf::NULL_TYPE) {
+            json.key("extras");
+            write_value(json, extras);
+        }
+    }
+
+    void write_name(JsonWriter &json, const std::string &name) {
+        if(!name.empty()) {
+            json.property("name", name);
+        }
+    }
+
+    void write_index(JsonWriter &json, std::string_view name, int index) {
+        if(index >= 0) {
+            json.property(name, index);
+        }
+    }
+
+    template <typename T>
+    void write_optional_array(JsonWriter &json, std::string_view name, const std::vector<T> &values) {
+        if(!values.empty()) {
+            json.array(name, values);
+        }
+    }
+
+    template <typename Info>
+    void write_texture_info(JsonWriter &json, std::string_view name, const Info &info) {
+        if(info.index < 0) {
+            return;
+        }
+        json.key(name);
+        json.begin_object();
+        json.property("index", info.index);
+        if(info.texCoord != 0) {
+            json.property("texCoord", info.texCoord);
+        }
+        if constexpr(std::is_same_v<Info, tinygltf::NormalTextureInfo>) {
+            if(info.scale != 1.0) {
+                json.property("scale", info.scale);
+            }
+        } else if constexpr(std::is_same_v<Info, tinygltf::OcclusionTextureInfo>) {
+            if(info.strength != 1.0) {
+                json.property("strength", info.strength);
+            }
+        }
+        write_extras(json, info.extensions, info.extras);
+        json.end_object();
+    }
+
+    void write_accessors(JsonWriter &json, const tinygltf::Model &gltf) {
+        json.key("accessors");
+        json.begin_array();
+        for(const tinygltf::Accessor &accessor : gltf.accessors) {
+            json.begin_object();
+            write_index(json, "bufferView", accessor.bufferView);
+            if(accessor.byteOffset != 0) {
+                json.property("byteOffset", accessor.byteOffset);
+            }
+            json.property("componentType", accessor.componentType);
+            if(accessor.normalized) {
+                json.property("normalized", true);
+            }
+            json.property("count", accessor.count);
+            switch(accessor.type) {
+            case TINYGLTF_TYPE_SCALAR: json.property("type", "SCALAR"); break;
+            case TINYGLTF_TYPE_VEC2: json.property("type", "VEC2"); break;
+            case TINYGLTF_TYPE_VEC3: json.property("type", "VEC3"); break;
+            case TINYGLTF_TYPE_VEC4: json.property("type", "VEC4"); break;
+            case TINYGLTF_TYPE_MAT2: json.property("type", "MAT2"); break;
+            case TINYGLTF_TYPE_MAT3: json.property("type", "MAT3"); break;
+            case TINYGLTF_TYPE_MAT4: json.property("type", "MAT4"); break;
+            }
+            write_optional_array(json, "min", accessor.minValues);
+            write_optional_array(json, "max", accessor.maxValues);
+            write_name(json, accessor.name);
+            write_extras(json, accessor.extensions, accessor.extras);
+            json.end_object();
+        }
+        json.end_array();
+    }
+
+    void write_animations(JsonWriter &json, const tinygltf::Model &gltf) {
+        json.key("animations");
+        json.begin_array();
+        for(const tinygltf::Animation &animation : gltf.animations) {
+            json.begin_object();
+            json.key("channels");
+            json.begin_array();
+            for(const tinygltf::AnimationChannel &channel : animation.channels) {
+                json.begin_object();
+                json.property("sampler", channel.sampler);
+                json.key("target");
+                json.begin_object();
+                write_index(json, "node", channel.target_node);
+                json.property("path", channel.target_path);
+                json.end_object();
+                write_extras(json, channel.extensions, channel.extras);
+                json.end_object();
+            }
+            json.end_array();
+            json.key("samplers");
+            json.begin_array();
+            for(const tinygltf::AnimationSampler &sampler : animation.samplers) {
+                json.begin_object();
+                json.property("input", sampler.input);
+                json.property("output", sampler.output);
+                json.property("interpolation", sampler.interpolation.empty() ? std::string("LINEAR") : sampler.interpolation);
+                write_extras(json, sampler.extensions, sampler.extras);
+                json.end_object();
+            }
+            json.end_array();
+            write_name(json, animation.name);
+            write_extras(json, animation.extensions, animation.extras);
+            json.end_object();
+        }
+        json.end_array();
+    }
+
+    void write_buffer_views(JsonWriter &json, const tinygltf::Model &gltf, const std::vector<size_t> &offsets, bool keep_buffers) {
+        json.key("bufferViews");
+        json.begin_array();
+        for(const tinygltf::BufferView &view : gltf.bufferViews) {
+            json.begin_object();
+            json.property("buffer", keep_buffers ? view.buffer : 0);
+            size_t base = !keep_buffers && view.buffer >= 0 && view.buffer < (int)offsets.size() ? offsets[view.buffer] : 0;
+            if(base + view.byteOffset != 0) {
+                json.property("byteOffset", base + view.byteOffset);
+            }
+            json.property("byteLength", view.byteLength);
+            if(view.byteStride != 0) {
+                json.property("byteStride", view.byteStride);
+            }
+            if(view.target != 0) {
+                json.property("target", view.target);
+            }
+            write_name(json, view.name);
+            write_extras(json, view.extensions, view.extras);
+            json.end_object();
+        }
+        json.end_array();
+    }
+
+    void write_images(JsonWriter &json, const tinygltf::Model &gltf) {
+        json.key("images");
+        json.begin_array();
+        for(const tinygltf::Image &image : gltf.images) {
+            json.begin_object();
+            write_name(json, image.name);
+            if(image.bufferView >= 0) {
+                json.property("bufferView", image.bufferView);
+                json.property("mimeType", image.mimeType);
+            } else {
+                json.property("uri", image.uri);
+                if(!image.mimeType.empty()) {
+                    json.property("mimeType", image.mimeType);
+                }
+            }
+            write_extras(json, image.extensions, image.extras);
+            json.end_object();
+        }
+        json.end_array();
+    }
+
+    void write_lights(JsonWriter &json, const tinygltf::Model &gltf) {
+        json.key("lights");
+        json.begin_array();
+        for(const tinygltf::Light &light : gltf.lights) {
+            json.begin_object();
+            write_name(json, light.name);
+            json.property("type", light.type);
+            write_optional_array(json, "color", light.color);
+            json.property("intensity", light.intensity);
+            if(light.range > 0) {
+                json.property("range", light.range);
+            }
+            if(light.type == "spot") {
+                json.key("spot");
+                json.begin_object();
+                json.property("innerConeAngle", light.spot.innerConeAngle);
+                json.property("outerConeAngle", light.spot.outerConeAngle);
+                json.end_object();
+            }
+            write_extras(json, light.extensions, light.extras);
+            json.end_object();
+        }
+        json.end_array();
+    }
+
+    void write_materials(JsonWriter &json, const tinygltf::Model &gltf) {
+        json.key("materials");
+        json.begin_array();
+        for(const tinygltf::Material &material : gltf.materials) {
+            json.begin_object();
+            write_name(json, material.name);
+
+            const tinygltf::PbrMetallicRoughness &pbr = material.pbrMetallicRoughness;
+            json.key("pbrMetallicRoughness");
+            json.begin_object();
+            if(pbr.baseColorFactor.size() == 4 && pbr.baseColorFactor != std::vector<double>{1.0, 1.0, 1.0, 1.0}) {
+                json.array("baseColorFactor", pbr.baseColorFactor);
+            }
+            write_texture_info(json, "baseColorTexture", pbr.baseColorTexture);
+            if(pbr.metallicFactor != 1.0) {
+                json.property("metallicFactor", pbr.metallicFactor);
+            }
+            if(pbr.roughnessFactor != 1.0) {
+                json.property("roughnessFactor", pbr.roughnessFactor);
+            }
+            write_texture_info(json, "metallicRoughnessTexture", pbr.metallicRoughnessTexture);
+            write_extras(json, pbr.extensions, pbr.extras);
+            json.end_object();
+
+            write_texture_info(json, "normalTexture", material.normalTexture);
+            write_texture_info(json, "occlusionTexture", material.occlusionTexture);
+            write_texture_info(json, "emissiveTexture", material.emissiveTexture);
+            if(material.emissiveFactor.size() == 3 && material.emissiveFactor != std::vector<double>{0.0, 0.0, 0.0}) {
+                json.array("emissiveFactor", material.emissiveFactor);
+            }
+            if(!material.alphaMode.empty() && material.alphaMode != "OPAQUE") {
+                json.property("alphaMode", material.alphaMode);
+                if(material.alphaMode == "MASK" && material.alphaCutoff != 0.5) {
+                    json.property("alphaCutoff", material.alphaCutoff);
+                }
+            }
+            if(material.doubleSided) {
+                json.property("doubleSided", true);
+            }
+            write_extras(json, material.extensions, material.extras);
+            json.end_object();
+        }
+        json.end_array();
+    }
+
+    void write_meshes(JsonWriter &json, const tinygltf::Model &gltf) {
+        json.key("meshes");
+        json.begin_array();
+        for(const tinygltf::Mesh &mesh : gltf.meshes) {
+            json.begin_object();
+            json.key("primitives");
+            json.begin_array();
+            for(const tinygltf::Primitive &primitive : mesh.primitives) {
+                json.begin_object();
+                json.key("attributes");
+                json.begin_object();
+                for(const auto &[attribute, accessor] : primitive.attributes) {
+                    json.property(attribute, accessor);
+                }
+                json.end_object();
+                write_index(json, "indices", primitive.indices);
+                write_index(json, "material", primitive.material);
+                json.property("mode", primitive.mode);
+                if(!primitive.targets.empty()) {
+                    json.key("targets");
+                    json.begin_array();
+                    for(const std::map<std::string, int> &target : primitive.targets) {
+                        json.begin_object();
+                        for(const auto &[attribute, accessor] : target) {
+                            json.property(attribute, accessor);
+                        }
+                        json.end_object();
+                    }
+                    json.end_array();
+                }
+                write_extras(json, primitive.extensions, primitive.extras);
+                json.end_object();
+            }
+            json.end_array();
+            write_optional_array(json, "weights", mesh.weights);
+            write_name(json, mesh.name);
+            write_extras(json, mesh.extensions, mesh.extras);
+            json.end_object();
+        }
+        json.end_array();
+    }
+
+    void write_nodes(JsonWriter &json, const tinygltf::Model &gltf) {
+        json.key("nodes");
+        json.begin_array();
+        for(const tinygltf::Node &node : gltf.nodes) {
+            json.begin_object();
+            write_name(json, node.name);
+            write_index(json, "camera", node.camera);
+            write_index(json, "skin", node.skin);
+            write_index(json, "mesh", node.mesh);
+            write_optional_array(json, "children", node.children);
+            write_optional_array(json, "matrix", node.matrix);
+            write_optional_array(json, "translation", node.translation);
+            write_optional_array(json, "rotation", node.rotation);
+            write_optional_array(json, "scale", node.scale);
+            write_optional_array(json, "weights", node.weights);
+            write_extras(json, node.extensions, node.extras);
+            json.end_object();
+        }
+        json.end_array();
+    }
+
+    void write_samplers(JsonWriter &json, const tinygltf::Model &gltf) {
+        json.key("samplers");
+        json.begin_array();
+        for(const tinygltf::Sampler &sampler : gltf.samplers) {
+            json.begin_object();
+            write_name(json, sampler.name);
+            if(sampler.magFilter != -1) {
+                json.property("magFilter", sampler.magFilter);
+            }
+            if(sampler.minFilter != -1) {
+                json.property("minFilter", sampler.minFilter);
+            }
+            json.property("wrapS", sampler.wrapS);
+            json.property("wrapT", sampler.wrapT);
+            write_extras(json, sampler.extensions, sampler.extras);
+            json.end_object();
+        }
+        json.end_array();
+    }
+
+    void write_scenes(JsonWriter &json, const tinygltf::Model &gltf) {
+        json.key("scenes");
+        json.begin_array();
+        for(const tinygltf::Scene &scene : gltf.scenes) {
+            json.begin_object();
+            write_name(json, scene.name);
+            write_optional_array(json, "nodes", scene.nodes);
+            write_extras(json, scene.extensions, scene.extras);
+            json.end_object();
+        }
+        json.end_array();
+    }
+
+    void write_skins(JsonWriter &json, const tinygltf::Model &gltf) {
+        json.key("skins");
+        json.begin_array();
+        for(const tinygltf::Skin &skin : gltf.skins) {
+            json.begin_object();
+            write_name(json, skin.name);
+            write_index(json, "inverseBindMatrices", skin.inverseBindMatrices);
+            write_index(json, "skeleton", skin.skeleton);
+            json.array("joints", skin.joints);
+            write_extras(json, skin.extensions, skin.extras);
+            json.end_object();
+        }
+        json.end_array();
+    }
+
+    void write_textures(JsonWriter &json, const tinygltf::Model &gltf) {
+        json.key("textures");
+        json.begin_array();
+        for(const tinygltf::Texture &texture : gltf.textures) {
+            json.begin_object();
+            write_name(json, texture.name);
+            write_index(json, "sampler", texture.sampler);
+            write_index(json, "source", texture.source);
+            write_extras(json, texture.extensions, texture.extras);
+            json.end_object();
+        }
+        json.end_array();
+    }
+
+    using OutputFile = std::unique_ptr<std::FILE, int(*)(std::FILE*)>;
+
+    OutputFile open_output(const std::filesystem::path &path) {
+        return OutputFile(std::fopen(path.string().c_str(), "wb"), &std::fclose);
+    }
+
+    bool close_output(OutputFile &output) {
+        return std::fclose(output.release()) == 0;
+    }
+
+    bool write_all(std::FILE *output, const char *data, size_t length) {
+        return std::fwrite(data, 1, length, output) == length;
+    }
+
+    bool write_padding(std::FILE *output, size_t length, char fill) {
+        static const char zeros[buffer_alignment] = {};
+        static const char spaces[buffer_alignment] = {' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' '};
+        return write_all(output, fill == ' ' ? spaces : zeros, length);
+    }
+
+    bool write_buffer(std::FILE *output, const tinygltf::Buffer &buffer) {
+        // Staged buffers are copied from the staging file without passing through memory
+        return utils::gltf::staging::is_staged(buffer)
+            ? utils::gltf::staging::copy_staged(buffer, output)
+            : write_all(output, (const char*)buffer.data.data(), buffer.data.size());
+    }
+
+    bool write_buffers(std::FILE *output, const tinygltf::Model &gltf) {
+        size_t written = 0;
+        for(const tinygltf::Buffer &buffer : gltf.buffers) {
+            size_t aligned = align(written, buffer_alignment);
+            if(!write_padding(output, aligned - written, '\0') || !write_buffer(output, buffer)) {
+                return false;
+            }
+            written = aligned + utils::gltf::staging::buffer_length(buffer);
+        }
+        return true;
+    }
+}
+
+std::string utils::gltf::serialize_gltf(const tinygltf::Model &gltf, bool pretty, std::string buffer_uri, bool keep_buffers) {
+    size_t total_length;
+    std::vector<size_t> offsets = buffer_offsets(gltf, total_length);
+
+    std::string output;
+    output.reserve(256 + 96 * (gltf.accessors.size() + gltf.bufferViews.size() + gltf.nodes.size()));
+    JsonWriter json(output, pretty);
+
+    json.begin_object();
+    if(!gltf.accessors.empty()) {
+        write_accessors(json, gltf);
+    }
+    if(!gltf.animations.empty()) {
+        write_animations(json, gltf);
+    }
+
+    json.key("asset");
+    json.begin_object();
+    if(!gltf.asset.copyright.empty()) {
+        json.property("copyright", gltf.asset.copyright);
+    }
+    if(!gltf.asset.generator.empty()) {
+        json.property("generator", gltf.asset.generator);
+    }
+    if(!gltf.asset.minVersion.empty()) {
+        json.property("minVersion", gltf.asset.minVersion);
+    }
+    json.property("version", gltf.asset.version.empty() ? std::string("2.0") : gltf.asset.version);
+    write_extras(json, gltf.asset.extensions, gltf.asset.extras);
+    json.end_object();
+
+    if(!gltf.bufferViews.empty()) {
+        write_buffer_views(json, gltf, offsets, keep_buffers);
+    }
+    if(keep_buffers) {
+        json.key("buffers");
+        json.begin_array();
+        for(const tinygltf::Buffer &buffer : gltf.buffers) {
+            json.begin_object();
+            json.property("byteLength", utils::gltf::staging::buffer_length(buffer));
+            json.property("uri", buffer.uri);
+            write_name(json, buffer.name);
+            json.end_object();
+        }
+        json.end_array();
+    } else if(!gltf.buffers.empty()) {
+        json.key("buffers");
+        json.begin_array();
+        json.begin_object();
+        json.property("byteLength", total_length);
+        if(!buffer_uri.empty()) {
+            json.property("uri", buffer_uri);
+        }
+        json.end_object();
+        json.end_array();
+    }
+
+    std::vector<std::string> extensions_used = gltf.extensionsUsed;
+    if(!gltf.lights.empty() && std::find(extensions_used.begin(), extensions_used.end(), "KHR_lights_punctual") == extensions_used.end()) {
+        extensions_used.push_back("KHR_lights_punctual");
+    }
+    if(!gltf.lights.empty() || !gltf.extensions.empty()) {
+        json.key("extensions");
+        json.begin_object();
+        for(const auto &[name, extension] : gltf.extensions) {
+            if(name == "KHR_lights_punctual" && !gltf.lights.empty()) {
+                continue;
+            }
+            json.key(name);
+            write_value(json, extension);
+        }
+        if(!gltf.lights.empty()) {
+            json.key("KHR_lights_punctual");
+            json.begin_object();
+            write_lights(json, gltf);
+            json.end_object();
+        }
+        json.end_object();
+    }
+    write_optional_array(json, "extensionsRequired", gltf.extensionsRequired);
+    write_optional_array(json, "extensionsUsed", extensions_used);
+    if(gltf.extras.Type() != tinygltf::NULL_TYPE) {
+        json.key("extras");
+        write_value(json, gltf.extras);
+    }
+
+    if(!gltf.images.empty()) {
+        write_images(json, gltf);
+    }
+    if(!gltf.materials.empty()) {
+        write_materials(json, gltf);
+    }
+    if(!gltf.meshes.empty()) {
+        write_meshes(json, gltf);
+    }
+    if(!gltf.nodes.empty()) {
+        write_nodes(json, gltf);
+    }
+    if(!gltf.samplers.empty()) {
+        write_samplers(json, gltf);
+    }
+    if(gltf.defaultScene >= 0) {
+        json.property("scene", gltf.defaultScene);
+    }
+    if(!gltf.scenes.empty()) {
+        write_scenes(json, gltf);
+    }
+    if(!gltf.skins.empty()) {
+        write_skins(json, gltf);
+    }
+    if(!gltf.textures.empty()) {
+        write_textures(json, gltf);
+    }
+    json.end_object();
+
+    if(!gltf.cameras.empty()) {
+        logger::warn("Cameras are not supported by the glTF writer and were skipped");
+    }
+    return output;
+}
+
+bool utils::gltf::write_gltf(const tinygltf::Model &gltf, std::filesystem::path path, bool binary, bool pretty) {
+    size_t total_length;
+    buffer_offsets(gltf, total_length);
+
+    if(binary) {
+        std::string json = serialize_gltf(gltf, pretty);
+        size_t json_length = align(json.size(), 4);
+        size_t bin_length = align(total_length, 4);
+        bool has_bin = !gltf.buffers.empty();
+        size_t file_length = 12 + 8 + json_length + (has_bin ? 8 + bin_length : 0);
+        if(file_length > UINT32_MAX) {
+            logger::error("{} would be {} bytes, larger than a GLB can hold", path.string(), file_length);
+            return false;
+        }
+
+        OutputFile output = open_output(path);
+        if(!output) {
+            logger::error("Failed to open {} for writing", path.string());
+            return false;
+        }
+        uint32_t header[5] = {glb_magic, 2, (uint32_t)file_length, (uint32_t)json_length, glb_json_chunk};
+        bool ok = write_all(output.get(), (const char*)header, sizeof(header))
+            && write_all(output.get(), json.data(), json.size())
+            && write_padding(output.get(), json_length - json.size(), ' ');
+        if(ok && has_bin) {
+            uint32_t bin_header[2] = {(uint32_t)bin_length, glb_bin_chunk};
+            ok = write_all(output.get(), (const char*)bin_header, sizeof(bin_header))
+                && write_buffers(output.get(), gltf)
+                && write_padding(output.get(), bin_length - total_length, '\0');
+        }
+        ok = close_output(output) && ok;
+        if(!ok) {
+            logger::error("Failed to write {}", path.string());
+        }
+        return ok;
+    }
+
+    bool keep_buffers = keeps_buffer_uris(gltf);
+    std::filesystem::path bin_path = path;
+    bin_path.replace_extension(".bin");
+    std::string json = serialize_gltf(gltf, pretty, gltf.buffers.empty() ? "" : bin_path.filename().string(), keep_buffers);
+    OutputFile output = open_output(path);
+    if(!output || !write_all(output.get(), json.data(), json.size()) || !close_output(output)) {
+        logger::error("Failed to write {}", path.string());
+        return false;
+    }
+
+    if(keep_buffers) {
+        for(const tinygltf::Buffer &buffer : gltf.buffers) {
+            std::filesystem::path buffer_path = path.parent_path() / buffer.uri;
+            OutputFile buffer_output = open_output(buffer_path);
+            if(!buffer_output || !write_buffer(buffer_output.get(), buffer) || !close_output(buffer_output)) {
+                logger::error("Failed to write {}", buffer_path.string());
+                return false;
+            }
+        }
+    } else if(!gltf.buffers.empty()) {
+        OutputFile bin_output = open_output(bin_path);
+        if(!bin_output || !write_buffers(bin_output.get(), gltf) || !close_output(bin_output)) {
+            logger::error("Failed to write {}", bin_path.string());
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,105 @@
+#include "utils/hash.h"
+
+#include <cstring>
+
+using namespace warpgate;
+
+static inline uint64_t rotl64(uint64_t x, int8_t r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t fmix64(uint64_t k) {
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdull;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ull;
+    k ^= k >> 33;
+    return k;
+}
+
+static inline uint64_t load64(const uint8_t *p) {
+    uint64_t value;
+    std::memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+std::string utils::hash::Hash128::hex() const {
+    static const char digits[] = "0123456789abcdef";
+    std::string out(32, '0');
+    for(int i = 0; i < 16; i++) {
+        out[i] = digits[(low >> (60 - i * 4)) & 0xF];
+        out[i + 16] = digits[(high >> (60 - i * 4)) & 0xF];
+    }
+    return out;
+}
+
+utils::hash::Hash128 utils::hash::hash128(std::span<const uint8_t> data, uint64_t seed) {
+    const uint8_t *bytes = data.data();
+    const size_t length = data.size();
+    const size_t block_count = length / 16;
+
+    uint64_t h1 = seed, h2 = seed;
+    const uint64_t c1 = 0x87c37b91114253d5ull;
+    const uint64_t c2 = 0x4cf5ad432745937full;
+
+    for(size_t i = 0; i < block_count; i++) {
+        uint64_t k1 = load64(bytes + i * 16);
+        uint64_t k2 = load64(bytes + i * 16 + 8);
+
+        k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+        h1 = rotl64(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+
+        k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+        h2 = rotl64(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+    }
+
+    const uint8_t *tail = bytes + block_count * 16;
+    uint64_t k1 = 0, k2 = 0;
+    switch(length & 15) {
+    case 15: k2 ^= ((uint64_t)tail[14]) << 48; [[fallthrough]];
+    case 14: k2 ^= ((uint64_t)tail[13]) << 40; [[fallthrough]];
+    case 13: k2 ^= ((uint64_t)tail[12]) << 32; [[fallthrough]];
+    case 12: k2 ^= ((uint64_t)tail[11]) << 24; [[fallthrough]];
+    case 11: k2 ^= ((uint64_t)tail[10]) << 16; [[fallthrough]];
+    case 10: k2 ^= ((uint64_t)tail[ 9]) << 8;  [[fallthrough]];
+    case  9: k2 ^= ((uint64_t)tail[ 8]) << 0;
+        k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+        [[fallthrough]];
+    case  8: k1 ^= ((uint64_t)tail[ 7]) << 56; [[fallthrough]];
+    case  7: k1 ^= ((uint64_t)tail[ 6]) << 48; [[fallthrough]];
+    case  6: k1 ^= ((uint64_t)tail[ 5]) << 40; [[fallthrough]];
+    case  5: k1 ^= ((uint64_t)tail[ 4]) << 32; [[fallthrough]];
+    case  4: k1 ^= ((uint64_t)tail[ 3]) << 24; [[fallthrough]];
+    case  3: k1 ^= ((uint64_t)tail[ 2]) << 16; [[fallthrough]];
+    case  2: k1 ^= ((uint64_t)tail[ 1]) << 8;  [[fallthrough]];
+    case  1: k1 ^= ((uint64_t)tail[ 0]) << 0;
+        k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+    }
+
+    h1 ^= (uint64_t)length;
+    h2 ^= (uint64_t)length;
+
+    h1 += h2;
+    h2 += h1;
+
+    h1 = fmix64(h1);
+    h2 = fmix64(h2);
+
+    h1 += h2;
+    h2 += h1;
+
+    return {h1, h2};
+}
+
+utils::hash::Hash128 utils::hash::hash128(std::string_view data, uint64_t seed) {
+    return hash128(std::span<const uint8_t>((const uint8_t*)data.data(), data.size()), seed);
+}
+
+utils::hash::Hash128 utils::hash::combine(Hash128 hash, Hash128 other) {
+    uint64_t parts[4] = {hash.low, hash.high, other.low, other.high};
+    return hash128(std::span<const uint8_t>((const uint8_t*)parts, sizeof(parts)));
+}
+
+utils::hash::Hash128 utils::hash::combine(Hash128 hash, uint64_t value) {
+    return combine(hash, Hash128{value, 0});
+}
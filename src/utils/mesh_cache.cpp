@@ -0,0 +1,171 @@
+#include "utils/mesh_cache.h"
+
+#include <atomic>
+#include <cstring>
+#include <fstream>
+#include <thread>
+
+#include <spdlog/spdlog.h>
+
+namespace logger = spdlog;
+using namespace warpgate;
+
+namespace {
+    const char cache_magic[4] = {'W', 'G', 'M', 'C'};
+
+    std::filesystem::path cache_directory;
+    bool cache_enabled = false;
+
+    template <typename T>
+    bool read(std::ifstream &input, T &value) {
+        input.read((char*)&value, sizeof(T));
+        return !input.fail();
+    }
+
+    std::filesystem::path entry_path(const utils::hash::Hash128 &key) {
+        std::string name = key.hex();
+        return cache_directory / "meshes" / name.substr(0, 2) / (name + ".wgm");
+    }
+}
+
+void utils::mesh_cache::init_cache(std::filesystem::path directory) {
+    try {
+        std::filesystem::create_directories(directory / "meshes");
+    } catch(std::filesystem::filesystem_error &err) {
+        logger::error("Failed to create mesh cache directory {}: {}", err.path1().string(), err.what());
+        return;
+    }
+    cache_directory = directory;
+    cache_enabled = true;
+    logger::info("Using mesh cache at {}", cache_directory.string());
+}
+
+bool utils::mesh_cache::enabled() {
+    return cache_enabled;
+}
+
+utils::hash::Hash128 utils::mesh_cache::dme_key(const DME &dme) {
+    return hash::hash128(std::span<const uint8_t>(dme.buf_.data(), dme.buf_.size()), format_version);
+}
+
+utils::hash::Hash128 utils::mesh_cache::mesh_key(const hash::Hash128 &dme_key, const DME &dme, uint32_t mesh_index, const nlohmann::json &layout) {
+    hash::Hash128 key = hash::combine(dme_key, hash::hash128(layout.dump()));
+    if(dme.dmat() != nullptr) {
+        key = hash::combine(key, (uint64_t)dme.dmat()->material(mesh_index)->definition());
+    }
+    return hash::combine(key, (uint64_t)mesh_index);
+}
+
+std::optional<utils::mesh_cache::CachedMesh> utils::mesh_cache::load(const hash::Hash128 &key) {
+    if(!cache_enabled) {
+        return {};
+    }
+    std::filesystem::path path = entry_path(key);
+    std::ifstream input(path, std::ios::binary);
+    if(input.fail()) {
+        return {};
+    }
+
+    char magic[4];
+    uint32_t version, stream_count;
+    uint64_t layout_length;
+    if(!read(input, magic) || std::memcmp(magic, cache_magic, sizeof(magic)) != 0
+        || !read(input, version) || version != format_version
+        || !read(input, stream_count) || !read(input, layout_length)) {
+        logger::warn("Ignoring malformed mesh cache entry {}", path.string());
+        return {};
+    }
+
+    // Counts and lengths come from the file, so check them against what is left of it before allocating
+    std::error_code ec;
+    uint64_t remaining = std::filesystem::file_size(path, ec) - (uint64_t)input.tellg();
+    bool truncated = ec || stream_count > remaining / sizeof(uint64_t);
+    if(!truncated) {
+        remaining -= stream_count * sizeof(uint64_t);
+        truncated = layout_length > remaining;
+    }
+    std::vector<uint64_t> stream_lengths(truncated ? 0 : stream_count);
+    remaining -= truncated ? 0 : layout_length;
+    for(uint32_t i = 0; i < stream_lengths.size() && !truncated; i++) {
+        truncated = !read(input, stream_lengths[i]) || stream_lengths[i] > remaining;
+        remaining -= truncated ? 0 : stream_lengths[i];
+    }
+    if(truncated) {
+        logger::warn("Ignoring truncated mesh cache entry {}", path.string());
+        return {};
+    }
+
+    CachedMesh mesh;
+    std::string layout_string(layout_length, '\0');
+    input.read(layout_string.data(), layout_length);
+    mesh.layout = nlohmann::json::parse(layout_string, nullptr, false);
+    if(input.fail() || mesh.layout.is_discarded()) {
+        logger::warn("Ignoring mesh cache entry {} with invalid layout", path.string());
+        return {};
+    }
+
+    // Streams are read straight into the vectors handed to the glTF buffers, so each byte is copied once
+    mesh.vertex_streams.resize(stream_count);
+    for(uint32_t i = 0; i < stream_count; i++) {
+        mesh.vertex_streams[i].resize(stream_lengths[i]);
+        input.read((char*)mesh.vertex_streams[i].data(), stream_lengths[i]);
+        if(input.fail()) {
+            logger::warn("Ignoring truncated mesh cache entry {}", path.string());
+            return {};
+        }
+    }
+    logger::debug("Mesh cache hit {}", key.hex());
+    return mesh;
+}
+
+bool utils::mesh_cache::store(
+    const hash::Hash128 &key, 
+    const nlohmann::json &layout, 
+    std::vector<std::span<const uint8_t>> vertex_streams
+) {
+    if(!cache_enabled) {
+        return false;
+    }
+    static std::atomic<uint32_t> temp_counter = 0;
+    std::filesystem::path path = entry_path(key);
+    std::filesystem::path temp_path = path;
+    temp_path += ".tmp" + std::to_string(std::hash<std::thread::id>{}(std::this_thread::get_id())) + "_" + std::to_string(temp_counter++);
+
+    std::string layout_string = layout.dump();
+    uint32_t stream_count = (uint32_t)vertex_streams.size();
+    uint64_t layout_length = layout_string.size();
+    try {
+        std::filesystem::create_directories(path.parent_path());
+        std::ofstream output(temp_path, std::ios::binary);
+        if(output.fail()) {
+            logger::warn("Could not write mesh cache entry {}", temp_path.string());
+            return false;
+        }
+        output.write(cache_magic, sizeof(cache_magic));
+        output.write((const char*)&format_version, sizeof(format_version));
+        output.write((const char*)&stream_count, sizeof(stream_count));
+        output.write((const char*)&layout_length, sizeof(layout_length));
+        for(std::span<const uint8_t> stream : vertex_streams) {
+            uint64_t stream_length = stream.size();
+            output.write((const char*)&stream_length, sizeof(stream_length));
+        }
+        output.write(layout_string.data(), layout_string.size());
+        for(std::span<const uint8_t> stream : vertex_streams) {
+            output.write((const char*)stream.data(), stream.size());
+        }
+        output.close();
+        if(output.fail()) {
+            logger::warn("Failed writing mesh cache entry {}", temp_path.string());
+            std::filesystem::remove(temp_path);
+            return false;
+        }
+        std::filesystem::rename(temp_path, path);
+    } catch(std::filesystem::filesystem_error &err) {
+        logger::warn("Failed to store mesh cache entry {}: {}", path.string(), err.what());
+        std::error_code ec;
+        std::filesystem::remove(temp_path, ec);
+        return false;
+    }
+    logger::debug("Stored mesh cache entry {}", key.hex());
+    return true;
+}
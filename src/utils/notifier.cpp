@@ -0,0 +1,23 @@
+#include "utils/notifier.h"
+
+using namespace warpgate;
+
+uint64_t utils::notifier::token() const {
+    return epoch.load();
+}
+
+void utils::notifier::notify() {
+    // Either a thread about to wait sees the new epoch, or this sees it waiting and signals it once it is asleep (it holds m until then)
+    epoch.fetch_add(1);
+    if(waiting.load() > 0) {
+        std::lock_guard<std::mutex> lock(m);
+        c.notify_all();
+    }
+}
+
+void utils::notifier::wait(uint64_t token) {
+    std::unique_lock<std::mutex> lock(m);
+    waiting++;
+    c.wait(lock, [&]() { return epoch.load() != token; });
+    waiting--;
+}
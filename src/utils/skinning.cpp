@@ -0,0 +1,697 @@
+#include "utils/skinning.h"
+#include "utils/gltf/staging.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <unordered_map>
+#include <unordered_set>
+
+#if defined(__AVX2__) && (defined(__FMA__) || defined(_MSC_VER))
+#include <immintrin.h>
+#endif
+
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtx/quaternion.hpp>
+#include <spdlog/spdlog.h>
+
+#include "bone.h"
+#include "ps2_bone_map.h"
+#include "utils.h"
+
+namespace logger = spdlog;
+using namespace warpgate;
+
+namespace {
+    void calculate_globals(
+        const mrn::Skeleton &skeleton,
+        const std::vector<glm::vec3> &translations,
+        const std::vector<glm::quat> &rotations,
+        uint32_t bone,
+        const glm::mat4 &parent,
+        std::vector<glm::mat4> &globals
+    ) {
+        globals[bone] = parent * glm::translate(glm::identity<glm::mat4>(), translations[bone]) * glm::toMat4(rotations[bone]);
+        for(uint32_t child : skeleton.bones[bone].children) {
+            calculate_globals(skeleton, translations, rotations, child, globals[bone], globals);
+        }
+    }
+
+    std::vector<glm::mat4> model_transforms(
+        const mrn::Skeleton &skeleton,
+        const std::vector<glm::vec3> &translations,
+        const std::vector<glm::quat> &rotations
+    ) {
+        std::vector<bool> is_child(skeleton.bones.size(), false);
+        for(const mrn::Bone &bone : skeleton.bones) {
+            for(uint32_t child : bone.children) {
+                is_child[child] = true;
+            }
+        }
+
+        std::vector<glm::mat4> globals(skeleton.bones.size(), glm::identity<glm::mat4>());
+        for(uint32_t i = 0; i < skeleton.bones.size(); i++) {
+            if(!is_child[i]) {
+                calculate_globals(skeleton, translations, rotations, i, glm::identity<glm::mat4>(), globals);
+            }
+        }
+        return globals;
+    }
+
+    std::vector<glm::mat4> bind_transforms(const mrn::Skeleton &skeleton) {
+        std::vector<glm::vec3> translations;
+        std::vector<glm::quat> rotations;
+        for(const mrn::Bone &bone : skeleton.bones) {
+            translations.push_back(bone.position);
+            rotations.push_back(bone.rotation);
+        }
+        return model_transforms(skeleton, translations, rotations);
+    }
+
+    std::optional<std::string> bone_name(uint32_t namehash) {
+        auto name_iter = utils::bone_hashmap.find(namehash);
+        if(name_iter == utils::bone_hashmap.end()) {
+            return {};
+        }
+        return utils::uppercase(name_iter->second);
+    }
+
+    std::unordered_map<std::string, uint32_t> skeleton_indices(const mrn::Skeleton &skeleton) {
+        std::unordered_map<std::string, uint32_t> indices;
+        for(uint32_t i = 0; i < skeleton.bones.size(); i++) {
+            indices[utils::uppercase(skeleton.bones[i].name)] = i;
+        }
+        return indices;
+    }
+
+    // Rows of the upper 3x4 of each matrix, the layout both skinning paths read from
+    std::vector<float> pack_rows(std::span<const glm::mat4> matrices) {
+        std::vector<float> rows(matrices.size() * 12);
+        for(uint32_t i = 0; i < matrices.size(); i++) {
+            for(uint32_t row = 0; row < 3; row++) {
+                for(uint32_t column = 0; column < 4; column++) {
+                    rows[i * 12 + row * 4 + column] = matrices[i][column][row];
+                }
+            }
+        }
+        return rows;
+    }
+
+    void skin_vertex(
+        const float *rows,
+        uint32_t joint_count,
+        const uint32_t *joints,
+        const float *weights,
+        float *position,
+        float *normal
+    ) {
+        float blended[12] = {};
+        float total = 0;
+        for(uint32_t influence = 0; influence < 4; influence++) {
+            uint32_t joint = joints[influence] < joint_count ? joints[influence] : 0;
+            float weight = weights[influence];
+            total += weight;
+            for(uint32_t element = 0; element < 12; element++) {
+                blended[element] += weight * rows[joint * 12 + element];
+            }
+        }
+        if(total <= 0) {
+            return;
+        }
+        float scale = 1.0f / total;
+        for(uint32_t element = 0; element < 12; element++) {
+            blended[element] *= scale;
+        }
+
+        float x = position[0], y = position[1], z = position[2];
+        for(uint32_t row = 0; row < 3; row++) {
+            position[row] = blended[row * 4] * x + blended[row * 4 + 1] * y + blended[row * 4 + 2] * z + blended[row * 4 + 3];
+        }
+
+        if(normal == nullptr) {
+            return;
+        }
+        // Normals are transformed by the inverse transpose, which is the cofactor matrix over the determinant.
+        // Only the determinant's sign survives renormalizing.
+        const float *m = blended;
+        float cofactors[9] = {
+            m[5] * m[10] - m[6] * m[9], m[6] * m[8] - m[4] * m[10], m[4] * m[9] - m[5] * m[8],
+            m[2] * m[9] - m[1] * m[10], m[0] * m[10] - m[2] * m[8], m[1] * m[8] - m[0] * m[9],
+            m[1] * m[6] - m[2] * m[5], m[2] * m[4] - m[0] * m[6], m[0] * m[5] - m[1] * m[4],
+        };
+        float determinant = m[0] * cofactors[0] + m[1] * cofactors[1] + m[2] * cofactors[2];
+        float sign = determinant < 0 ? -1.0f : 1.0f;
+        x = normal[0], y = normal[1], z = normal[2];
+        float transformed[3];
+        for(uint32_t row = 0; row < 3; row++) {
+            transformed[row] = sign * (cofactors[row * 3] * x + cofactors[row * 3 + 1] * y + cofactors[row * 3 + 2] * z);
+        }
+        float length = std::sqrt(transformed[0] * transformed[0] + transformed[1] * transformed[1] + transformed[2] * transformed[2]);
+        if(length > 0) {
+            normal[0] = transformed[0] / length;
+            normal[1] = transformed[1] / length;
+            normal[2] = transformed[2] / length;
+        }
+    }
+
+#if defined(__AVX2__) && (defined(__FMA__) || defined(_MSC_VER))
+    // Skins 8 vertices starting at first. Joint indices must already be clamped to the joint count.
+    void skin_vertices_avx2(
+        const float *rows,
+        const uint32_t *joints,
+        const float *weights,
+        float *positions,
+        float *normals,
+        uint32_t first
+    ) {
+        const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+        const __m256i vertex = _mm256_add_epi32(_mm256_set1_epi32((int)first), lanes);
+        const __m256i influence_base = _mm256_slli_epi32(vertex, 2);
+        const __m256i component_base = _mm256_mullo_epi32(vertex, _mm256_set1_epi32(3));
+
+        __m256 blended[12];
+        for(uint32_t element = 0; element < 12; element++) {
+            blended[element] = _mm256_setzero_ps();
+        }
+        __m256 total = _mm256_setzero_ps();
+        for(uint32_t influence = 0; influence < 4; influence++) {
+            __m256i index = _mm256_add_epi32(influence_base, _mm256_set1_epi32((int)influence));
+            __m256i joint = _mm256_i32gather_epi32((const int*)joints, index, 4);
+            __m256 weight = _mm256_i32gather_ps(weights, index, 4);
+            __m256i matrix = _mm256_mullo_epi32(joint, _mm256_set1_epi32(12));
+            total = _mm256_add_ps(total, weight);
+            for(uint32_t element = 0; element < 12; element++) {
+                __m256 value = _mm256_i32gather_ps(rows, _mm256_add_epi32(matrix, _mm256_set1_epi32((int)element)), 4);
+                blended[element] = _mm256_fmadd_ps(weight, value, blended[element]);
+            }
+        }
+
+        // Vertices without any weight keep their bind pose, same as the scalar path
+        __m256 weighted = _mm256_cmp_ps(total, _mm256_setzero_ps(), _CMP_GT_OQ);
+        __m256 scale = _mm256_div_ps(_mm256_set1_ps(1.0f), _mm256_blendv_ps(_mm256_set1_ps(1.0f), total, weighted));
+        for(uint32_t element = 0; element < 12; element++) {
+            blended[element] = _mm256_mul_ps(blended[element], scale);
+        }
+
+        __m256 x = _mm256_i32gather_ps(positions, component_base, 4);
+        __m256 y = _mm256_i32gather_ps(positions, _mm256_add_epi32(component_base, _mm256_set1_epi32(1)), 4);
+        __m256 z = _mm256_i32gather_ps(positions, _mm256_add_epi32(component_base, _mm256_set1_epi32(2)), 4);
+        alignas(32) float result[3][8];
+        __m256 original[3] = {x, y, z};
+        for(uint32_t row = 0; row < 3; row++) {
+            __m256 value = _mm256_fmadd_ps(blended[row * 4], x, blended[row * 4 + 3]);
+            value = _mm256_fmadd_ps(blended[row * 4 + 1], y, value);
+            value = _mm256_fmadd_ps(blended[row * 4 + 2], z, value);
+            _mm256_store_ps(result[row], _mm256_blendv_ps(original[row], value, weighted));
+        }
+        for(uint32_t lane = 0; lane < 8; lane++) {
+            for(uint32_t row = 0; row < 3; row++) {
+                positions[(first + lane) * 3 + row] = result[row][lane];
+            }
+        }
+
+        if(normals == nullptr) {
+            return;
+        }
+        // Inverse transpose as in skin_vertex
+        auto difference = [&](uint32_t a, uint32_t b, uint32_t c, uint32_t d) {
+            return _mm256_fmsub_ps(blended[a], blended[b], _mm256_mul_ps(blended[c], blended[d]));
+        };
+        __m256 cofactors[9] = {
+            difference(5, 10, 6, 9), difference(6, 8, 4, 10), difference(4, 9, 5, 8),
+            difference(2, 9, 1, 10), difference(0, 10, 2, 8), difference(1, 8, 0, 9),
+            difference(1, 6, 2, 5), difference(2, 4, 0, 6), difference(0, 5, 1, 4),
+        };
+        __m256 determinant = _mm256_fmadd_ps(blended[0], cofactors[0], _mm256_fmadd_ps(blended[1], cofactors[1], _mm256_mul_ps(blended[2], cofactors[2])));
+        __m256 sign = _mm256_blendv_ps(_mm256_set1_ps(1.0f), _mm256_set1_ps(-1.0f), _mm256_cmp_ps(determinant, _mm256_setzero_ps(), _CMP_LT_OQ));
+        x = _mm256_i32gather_ps(normals, component_base, 4);
+        y = _mm256_i32gather_ps(normals, _mm256_add_epi32(component_base, _mm256_set1_epi32(1)), 4);
+        z = _mm256_i32gather_ps(normals, _mm256_add_epi32(component_base, _mm256_set1_epi32(2)), 4);
+        __m256 transformed[3];
+        for(uint32_t row = 0; row < 3; row++) {
+            transformed[row] = _mm256_mul_ps(cofactors[row * 3], x);
+            transformed[row] = _mm256_fmadd_ps(cofactors[row * 3 + 1], y, transformed[row]);
+            transformed[row] = _mm256_fmadd_ps(cofactors[row * 3 + 2], z, transformed[row]);
+            transformed[row] = _mm256_mul_ps(sign, transformed[row]);
+        }
+        __m256 length = _mm256_sqrt_ps(_mm256_fmadd_ps(transformed[0], transformed[0], _mm256_fmadd_ps(transformed[1], transformed[1], _mm256_mul_ps(transformed[2], transformed[2]))));
+        __m256 valid = _mm256_and_ps(weighted, _mm256_cmp_ps(length, _mm256_setzero_ps(), _CMP_GT_OQ));
+        __m256 safe_length = _mm256_blendv_ps(_mm256_set1_ps(1.0f), length, valid);
+        original[0] = x;
+        original[1] = y;
+        original[2] = z;
+        for(uint32_t row = 0; row < 3; row++) {
+            _mm256_store_ps(result[row], _mm256_blendv_ps(original[row], _mm256_div_ps(transformed[row], safe_length), valid));
+        }
+        for(uint32_t lane = 0; lane < 8; lane++) {
+            for(uint32_t row = 0; row < 3; row++) {
+                normals[(first + lane) * 3 + row] = result[row][lane];
+            }
+        }
+    }
+#endif
+}
+
+std::optional<utils::skinning::PoseRequest> utils::skinning::parse_pose(std::string_view value) {
+    size_t separator = value.find_last_of(':');
+    if(separator == std::string_view::npos || separator == 0 || separator == value.size() - 1) {
+        return {};
+    }
+    PoseRequest request;
+    request.animation = std::string(value.substr(0, separator));
+    std::string_view time = value.substr(separator + 1);
+    auto [end, error] = std::from_chars(time.data(), time.data() + time.size(), request.time);
+    if(error != std::errc() || end != time.data() + time.size() || request.time < 0) {
+        return {};
+    }
+    return request;
+}
+
+std::vector<glm::mat4> utils::skinning::evaluate_pose(std::shared_ptr<mrn::SkeletonData> skeleton_data, std::shared_ptr<mrn::NSAFile> animation, float time) {
+    std::shared_ptr<mrn::Skeleton> skeleton = skeleton_data->skeleton();
+    uint32_t bone_count = (uint32_t)skeleton->bones.size();
+    std::vector<glm::vec3> translations;
+    std::vector<glm::quat> rotations;
+    for(const mrn::Bone &bone : skeleton->bones) {
+        translations.push_back(bone.position);
+        rotations.push_back(bone.rotation);
+    }
+
+    uint32_t bone_offset = skeleton_data->bone_count() - animation->bone_count();
+    uint32_t sample_count = 1;
+    if(animation->root_segment() == nullptr && animation->dynamic_segment() != nullptr) {
+        sample_count = animation->dynamic_segment()->sample_count();
+    } else if(animation->root_segment() != nullptr) {
+        sample_count = animation->root_segment()->sample_count();
+    }
+
+    float sample = std::clamp(time * animation->sample_rate(), 0.0f, (float)(sample_count - 1));
+    uint32_t first = (uint32_t)sample;
+    uint32_t second = std::min(first + 1, sample_count - 1);
+    float factor = sample - (float)first;
+    logger::debug("Sampling pose at {:.3f}s (sample {} of {})", time, sample, sample_count);
+
+    animation->dequantize();
+
+    auto set_translation = [&](uint32_t bone, glm::vec3 value) {
+        if(bone < bone_count) {
+            translations[bone] = value;
+        }
+    };
+    auto set_rotation = [&](uint32_t bone, glm::quat value) {
+        if(bone < bone_count) {
+            rotations[bone] = value;
+        }
+    };
+
+    std::vector<glm::vec3> static_translation = animation->static_translation();
+    std::span<uint16_t> static_translation_bones = animation->static_translation_bone_indices();
+    for(uint32_t i = 0; i < static_translation.size() && i < static_translation_bones.size(); i++) {
+        set_translation(static_translation_bones[i] + bone_offset, static_translation[i]);
+    }
+
+    std::vector<glm::quat> static_rotation = animation->static_rotation();
+    std::span<uint16_t> static_rotation_bones = animation->static_rotation_bone_indices();
+    for(uint32_t i = 0; i < static_rotation.size() && i < static_rotation_bones.size(); i++) {
+        set_rotation(static_rotation_bones[i] + bone_offset, static_rotation[i]);
+    }
+
+    std::vector<std::vector<glm::vec3>> dynamic_translation = animation->dynamic_translation();
+    if(dynamic_translation.size() != 0) {
+        const std::vector<glm::vec3> &from = dynamic_translation[std::min<size_t>(first, dynamic_translation.size() - 1)];
+        const std::vector<glm::vec3> &to = dynamic_translation[std::min<size_t>(second, dynamic_translation.size() - 1)];
+        std::span<uint16_t> bones = animation->dynamic_translation_bone_indices();
+        for(uint32_t i = 0; i < bones.size() && i < from.size() && i < to.size(); i++) {
+            set_translation(bones[i] + bone_offset, glm::mix(from[i], to[i], factor));
+        }
+    }
+
+    std::vector<std::vector<glm::quat>> dynamic_rotation = animation->dynamic_rotation();
+    if(dynamic_rotation.size() != 0) {
+        const std::vector<glm::quat> &from = dynamic_rotation[std::min<size_t>(first, dynamic_rotation.size() - 1)];
+        const std::vector<glm::quat> &to = dynamic_rotation[std::min<size_t>(second, dynamic_rotation.size() - 1)];
+        std::span<uint16_t> bones = animation->dynamic_rotation_bone_indices();
+        for(uint32_t i = 0; i < bones.size() && i < from.size() && i < to.size(); i++) {
+            set_rotation(bones[i] + bone_offset, glm::slerp(from[i], to[i], factor));
+        }
+    }
+
+    std::vector<glm::vec3> root_translation = animation->root_translation();
+    if(root_translation.size() != 0) {
+        set_translation(0, glm::mix(
+            root_translation[std::min<size_t>(first, root_translation.size() - 1)],
+            root_translation[std::min<size_t>(second, root_translation.size() - 1)],
+            factor
+        ));
+    }
+
+    std::vector<glm::quat> root_rotation = animation->root_rotation();
+    if(root_rotation.size() != 0) {
+        set_rotation(0, glm::slerp(
+            root_rotation[std::min<size_t>(first, root_rotation.size() - 1)],
+            root_rotation[std::min<size_t>(second, root_rotation.size() - 1)],
+            factor
+        ));
+    }
+
+    return model_transforms(*skeleton, translations, rotations);
+}
+
+uint32_t utils::skinning::matching_bones(const DME &dme, const mrn::Skeleton &skeleton) {
+    std::unordered_map<std::string, uint32_t> indices = skeleton_indices(skeleton);
+    uint32_t matches = 0;
+    for(uint32_t i = 0; i < dme.bone_count(); i++) {
+        std::optional<std::string> name = bone_name(dme.bone(i).namehash);
+        if(name && indices.contains(*name)) {
+            matches++;
+        }
+    }
+    return matches;
+}
+
+std::vector<glm::mat4> utils::skinning::joint_matrices(const DME &dme, const mrn::Skeleton &skeleton, std::span<const glm::mat4> posed) {
+    std::vector<glm::mat4> bind = bind_transforms(skeleton);
+    std::unordered_map<std::string, uint32_t> indices = skeleton_indices(skeleton);
+
+    std::vector<glm::mat4> joints;
+    for(uint32_t i = 0; i < dme.bone_count(); i++) {
+        uint32_t namehash = dme.bone(i).namehash;
+        glm::mat4 joint = glm::identity<glm::mat4>();
+        while(namehash != 0) {
+            std::optional<std::string> name = bone_name(namehash);
+            std::unordered_map<std::string, uint32_t>::iterator index;
+            if(name && (index = indices.find(*name)) != indices.end() && index->second < posed.size()) {
+                joint = posed[index->second] * glm::inverse(bind[index->second]);
+                break;
+            }
+            auto parent = utils::bone_hierarchy.find(namehash);
+            namehash = parent != utils::bone_hierarchy.end() ? parent->second : 0;
+        }
+        joints.push_back(joint);
+    }
+    return joints;
+}
+
+void utils::skinning::skin_vertices(
+    std::span<const glm::mat4> joint_matrices,
+    std::span<const uint32_t> joints,
+    std::span<const float> weights,
+    std::span<float> positions,
+    std::span<float> normals
+) {
+    if(joint_matrices.size() == 0) {
+        return;
+    }
+    uint32_t count = (uint32_t)std::min({joints.size() / 4, weights.size() / 4, positions.size() / 3});
+    float *normal_data = normals.size() / 3 >= count ? normals.data() : nullptr;
+    std::vector<float> rows = pack_rows(joint_matrices);
+    uint32_t joint_count = (uint32_t)joint_matrices.size();
+
+    uint32_t vertex = 0;
+#if defined(__AVX2__) && (defined(__FMA__) || defined(_MSC_VER))
+    std::vector<uint32_t> clamped(joints.begin(), joints.begin() + count * 4);
+    for(uint32_t &joint : clamped) {
+        joint = joint < joint_count ? joint : 0;
+    }
+    for(; vertex + 8 <= count; vertex += 8) {
+        skin_vertices_avx2(rows.data(), clamped.data(), weights.data(), positions.data(), normal_data, vertex);
+    }
+#endif
+    for(; vertex < count; vertex++) {
+        skin_vertex(
+            rows.data(),
+            joint_count,
+            joints.data() + vertex * 4,
+            weights.data() + vertex * 4,
+            positions.data() + vertex * 3,
+            normal_data != nullptr ? normal_data + vertex * 3 : nullptr
+        );
+    }
+}
+
+namespace {
+    const uint8_t *accessor_element(const tinygltf::Model &gltf, const tinygltf::Accessor &accessor, uint32_t index) {
+        const tinygltf::BufferView &view = gltf.bufferViews.at(accessor.bufferView);
+        int stride = accessor.ByteStride(view);
+        return gltf.buffers.at(view.buffer).data.data() + view.byteOffset + accessor.byteOffset + (size_t)index * stride;
+    }
+
+    bool is_float_vec3(const tinygltf::Accessor &accessor) {
+        return accessor.componentType == TINYGLTF_COMPONENT_TYPE_FLOAT && accessor.type == TINYGLTF_TYPE_VEC3;
+    }
+
+    std::vector<float> read_vec3(const tinygltf::Model &gltf, const tinygltf::Accessor &accessor) {
+        std::vector<float> values(accessor.count * 3);
+        for(uint32_t i = 0; i < accessor.count; i++) {
+            std::memcpy(values.data() + i * 3, accessor_element(gltf, accessor, i), sizeof(float) * 3);
+        }
+        return values;
+    }
+
+    void write_vec3(tinygltf::Model &gltf, const tinygltf::Accessor &accessor, const std::vector<float> &values) {
+        for(uint32_t i = 0; i < accessor.count; i++) {
+            std::memcpy(const_cast<uint8_t*>(accessor_element(gltf, accessor, i)), values.data() + i * 3, sizeof(float) * 3);
+        }
+    }
+
+    std::optional<std::vector<uint32_t>> read_joints(const tinygltf::Model &gltf, const tinygltf::Accessor &accessor) {
+        if(accessor.type != TINYGLTF_TYPE_VEC4) {
+            return {};
+        }
+        std::vector<uint32_t> values(accessor.count * 4);
+        for(uint32_t i = 0; i < accessor.count; i++) {
+            const uint8_t *element = accessor_element(gltf, accessor, i);
+            for(uint32_t j = 0; j < 4; j++) {
+                if(accessor.componentType == TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE) {
+                    values[i * 4 + j] = element[j];
+                } else if(accessor.componentType == TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT) {
+                    uint16_t joint;
+                    std::memcpy(&joint, element + j * sizeof(joint), sizeof(joint));
+                    values[i * 4 + j] = joint;
+                } else {
+                    return {};
+                }
+            }
+        }
+        return values;
+    }
+
+    std::optional<std::vector<float>> read_weights(const tinygltf::Model &gltf, const tinygltf::Accessor &accessor) {
+        if(accessor.type != TINYGLTF_TYPE_VEC4) {
+            return {};
+        }
+        std::vector<float> values(accessor.count * 4);
+        for(uint32_t i = 0; i < accessor.count; i++) {
+            const uint8_t *element = accessor_element(gltf, accessor, i);
+            for(uint32_t j = 0; j < 4; j++) {
+                if(accessor.componentType == TINYGLTF_COMPONENT_TYPE_FLOAT) {
+                    std::memcpy(&values[i * 4 + j], element + j * sizeof(float), sizeof(float));
+                } else if(accessor.componentType == TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE) {
+                    values[i * 4 + j] = element[j] / 255.0f;
+                } else if(accessor.componentType == TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT) {
+                    uint16_t weight;
+                    std::memcpy(&weight, element + j * sizeof(weight), sizeof(weight));
+                    values[i * 4 + j] = weight / 65535.0f;
+                } else {
+                    return {};
+                }
+            }
+        }
+        return values;
+    }
+}
+
+namespace {
+    glm::mat4 local_transform(const tinygltf::Node &node) {
+        glm::mat4 transform = glm::identity<glm::mat4>();
+        if(node.matrix.size() == 16) {
+            // glTF matrices are column major, as are glm's
+            for(uint32_t i = 0; i < 16; i++) {
+                transform[i / 4][i % 4] = (float)node.matrix[i];
+            }
+            return transform;
+        }
+        if(node.translation.size() == 3) {
+            transform = glm::translate(transform, glm::vec3(node.translation[0], node.translation[1], node.translation[2]));
+        }
+        if(node.rotation.size() == 4) {
+            transform *= glm::toMat4(glm::quat((float)node.rotation[3], (float)node.rotation[0], (float)node.rotation[1], (float)node.rotation[2]));
+        }
+        if(node.scale.size() == 3) {
+            transform = glm::scale(transform, glm::vec3(node.scale[0], node.scale[1], node.scale[2]));
+        }
+        return transform;
+    }
+
+    /**
+     * Removes the skin joints from gltf's node tree. Nodes hanging off a joint (sockets, for instance) are moved to their closest
+     * ancestor that is not a joint, keeping the place the pose put them in.
+     */
+    void remove_joints(tinygltf::Model &gltf, const std::unordered_map<int, uint32_t> &joint_slots, std::span<const glm::mat4> joint_matrices) {
+        std::vector<int> parents(gltf.nodes.size(), -1);
+        for(uint32_t i = 0; i < gltf.nodes.size(); i++) {
+            for(int child : gltf.nodes[i].children) {
+                parents.at(child) = i;
+            }
+        }
+
+        // Joint nodes hold the bind pose, so a joint's posed transform is its skinning matrix applied to its bind transform
+        std::vector<std::optional<glm::mat4>> bind(gltf.nodes.size()), posed(gltf.nodes.size());
+        std::function<glm::mat4(int)> bind_world = [&](int node) {
+            if(!bind[node]) {
+                glm::mat4 local = local_transform(gltf.nodes[node]);
+                bind[node] = parents[node] == -1 ? local : bind_world(parents[node]) * local;
+            }
+            return *bind[node];
+        };
+        std::function<glm::mat4(int)> posed_world = [&](int node) {
+            if(!posed[node]) {
+                auto slot = joint_slots.find(node);
+                if(slot != joint_slots.end()) {
+                    glm::mat4 skinning = slot->second < joint_matrices.size() ? joint_matrices[slot->second] : glm::identity<glm::mat4>();
+                    posed[node] = skinning * bind_world(node);
+                } else {
+                    glm::mat4 local = local_transform(gltf.nodes[node]);
+                    posed[node] = parents[node] == -1 ? local : posed_world(parents[node]) * local;
+                }
+            }
+            return *posed[node];
+        };
+
+        if(gltf.scenes.empty()) {
+            gltf.scenes.push_back({});
+            gltf.defaultScene = 0;
+        }
+        tinygltf::Scene &scene = gltf.scenes.at(gltf.defaultScene >= 0 ? gltf.defaultScene : 0);
+        for(uint32_t i = 0; i < gltf.nodes.size(); i++) {
+            if(parents[i] == -1 || joint_slots.contains(i) || !joint_slots.contains(parents[i])) {
+                continue;
+            }
+            int ancestor = parents[i];
+            while(ancestor != -1 && joint_slots.contains(ancestor)) {
+                ancestor = parents[ancestor];
+            }
+            glm::mat4 transform = posed_world(i);
+            if(ancestor == -1) {
+                scene.nodes.push_back(i);
+            } else {
+                transform = glm::inverse(posed_world(ancestor)) * transform;
+                gltf.nodes[ancestor].children.push_back(i);
+            }
+            tinygltf::Node &node = gltf.nodes[i];
+            node.translation.clear();
+            node.rotation.clear();
+            node.scale.clear();
+            node.matrix.resize(16);
+            for(uint32_t j = 0; j < 16; j++) {
+                node.matrix[j] = transform[j / 4][j % 4];
+            }
+        }
+
+        std::vector<int> remap(gltf.nodes.size(), -1);
+        std::vector<tinygltf::Node> nodes;
+        for(uint32_t i = 0; i < gltf.nodes.size(); i++) {
+            if(!joint_slots.contains(i)) {
+                remap[i] = (int)nodes.size();
+                nodes.push_back(std::move(gltf.nodes[i]));
+            }
+        }
+        auto remap_indices = [&](std::vector<int> &indices) {
+            std::erase_if(indices, [&](int index) { return remap.at(index) == -1; });
+            for(int &index : indices) {
+                index = remap[index];
+            }
+        };
+        for(tinygltf::Node &node : nodes) {
+            remap_indices(node.children);
+        }
+        for(tinygltf::Scene &each : gltf.scenes) {
+            remap_indices(each.nodes);
+        }
+        for(tinygltf::Animation &animation : gltf.animations) {
+            std::erase_if(animation.channels, [&](const tinygltf::AnimationChannel &channel) {
+                return channel.target_node >= 0 && remap.at(channel.target_node) == -1;
+            });
+            for(tinygltf::AnimationChannel &channel : animation.channels) {
+                if(channel.target_node >= 0) {
+                    channel.target_node = remap[channel.target_node];
+                }
+            }
+        }
+        gltf.nodes = std::move(nodes);
+    }
+}
+
+void utils::skinning::apply_pose(tinygltf::Model &gltf, std::span<const glm::mat4> joint_matrices) {
+    // Vertex data is rewritten in place, so anything staged to disk is read back first
+    for(tinygltf::Buffer &buffer : gltf.buffers) {
+        utils::gltf::staging::restore(buffer);
+    }
+    std::unordered_set<int> skinned;
+    for(tinygltf::Node &node : gltf.nodes) {
+        if(node.mesh == -1 || node.skin == -1) {
+            continue;
+        }
+        for(tinygltf::Primitive &primitive : gltf.meshes.at(node.mesh).primitives) {
+            auto position = primitive.attributes.find("POSITION");
+            auto normal = primitive.attributes.find("NORMAL");
+            auto joints = primitive.attributes.find("JOINTS_0");
+            auto weights = primitive.attributes.find("WEIGHTS_0");
+            if(position == primitive.attributes.end() || joints == primitive.attributes.end() || weights == primitive.attributes.end()) {
+                continue;
+            }
+
+            tinygltf::Accessor &position_accessor = gltf.accessors.at(position->second);
+            std::optional<std::vector<uint32_t>> joint_values = read_joints(gltf, gltf.accessors.at(joints->second));
+            std::optional<std::vector<float>> weight_values = read_weights(gltf, gltf.accessors.at(weights->second));
+            if(!is_float_vec3(position_accessor) || !joint_values || !weight_values) {
+                logger::warn("Skipping primitive with unsupported skinning attribute formats");
+                continue;
+            }
+
+            if(!skinned.contains(position->second)) {
+                std::vector<float> positions = read_vec3(gltf, position_accessor);
+                std::vector<float> normals;
+                bool has_normals = normal != primitive.attributes.end() && is_float_vec3(gltf.accessors.at(normal->second));
+                if(has_normals) {
+                    normals = read_vec3(gltf, gltf.accessors.at(normal->second));
+                }
+
+                skin_vertices(joint_matrices, *joint_values, *weight_values, positions, normals);
+
+                write_vec3(gltf, position_accessor, positions);
+                if(has_normals) {
+                    write_vec3(gltf, gltf.accessors.at(normal->second), normals);
+                }
+
+                if(positions.size() != 0) {
+                    glm::vec3 minimum(positions[0], positions[1], positions[2]), maximum = minimum;
+                    for(uint32_t i = 0; i < positions.size(); i += 3) {
+                        glm::vec3 value(positions[i], positions[i + 1], positions[i + 2]);
+                        minimum = glm::min(minimum, value);
+                        maximum = glm::max(maximum, value);
+                    }
+                    position_accessor.minValues = {minimum.x, minimum.y, minimum.z};
+                    position_accessor.maxValues = {maximum.x, maximum.y, maximum.z};
+                }
+                skinned.insert(position->second);
+            }
+
+            primitive.attributes.erase("JOINTS_0");
+            primitive.attributes.erase("WEIGHTS_0");
+        }
+        node.skin = -1;
+    }
+
+    std::unordered_map<int, uint32_t> joint_slots;
+    for(const tinygltf::Skin &skin : gltf.skins) {
+        for(uint32_t i = 0; i < skin.joints.size(); i++) {
+            joint_slots.try_emplace(skin.joints[i], i);
+        }
+    }
+    gltf.skins.clear();
+    remove_joints(gltf, joint_slots, joint_matrices);
+    logger::debug("Posed {} primitive{}, removed {} joint node{}", skinned.size(), skinned.size() == 1 ? "" : "s", joint_slots.size(), joint_slots.size() == 1 ? "" : "s");
+}
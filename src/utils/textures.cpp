@@ -1,13 +1,199 @@
 #include "utils/textures.h"
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstring>
+#include <fstream>
+
 #include <spdlog/spdlog.h>
 
+#include "utils/archive.h"
 #include "utils/materials_3.h"
-#include "stb_image_write.h"
+#include "utils/textures/atlas.h"
+#include "utils/textures/cache.h"
+#include "utils/textures/mips.h"
 
 namespace logger = spdlog;
 using namespace warpgate;
 
+namespace {
+    std::optional<utils::textures::bc::Format> block_format(gli::format format) {
+        switch(format) {
+        case gli::format::FORMAT_RGB_DXT1_UNORM_BLOCK8:
+        case gli::format::FORMAT_RGB_DXT1_SRGB_BLOCK8:
+        case gli::format::FORMAT_RGBA_DXT1_UNORM_BLOCK8:
+        case gli::format::FORMAT_RGBA_DXT1_SRGB_BLOCK8:
+            return utils::textures::bc::Format::BC1;
+        case gli::format::FORMAT_RGBA_DXT3_UNORM_BLOCK16:
+        case gli::format::FORMAT_RGBA_DXT3_SRGB_BLOCK16:
+            return utils::textures::bc::Format::BC2;
+        case gli::format::FORMAT_RGBA_DXT5_UNORM_BLOCK16:
+        case gli::format::FORMAT_RGBA_DXT5_SRGB_BLOCK16:
+            return utils::textures::bc::Format::BC3;
+        case gli::format::FORMAT_R_ATI1N_UNORM_BLOCK8:
+            return utils::textures::bc::Format::BC4;
+        case gli::format::FORMAT_RG_ATI2N_UNORM_BLOCK16:
+            return utils::textures::bc::Format::BC5;
+        case gli::format::FORMAT_RGBA_BP_UNORM_BLOCK16:
+        case gli::format::FORMAT_RGBA_BP_SRGB_BLOCK16:
+            return utils::textures::bc::Format::BC7;
+        default:
+            return {};
+        }
+    }
+
+    gli::texture2d to_texture(const utils::textures::Image &image) {
+        gli::texture2d texture(gli::format::FORMAT_RGBA8_UNORM_PACK8, gli::texture2d::extent_type(image.width, image.height), 1);
+        std::memcpy(texture.data(), image.pixels.data(), image.pixels.size() * sizeof(uint32_t));
+        return texture;
+    }
+
+    utils::textures::OutputFormat texture_output_format = utils::textures::OutputFormat::PNG;
+    uint32_t max_size = 0;
+    bool orm_packing = false;
+
+    bool fits(gli::texture2d::extent_type extent) {
+        return max_size == 0 || ((uint32_t)extent.x <= max_size && (uint32_t)extent.y <= max_size);
+    }
+
+    /**
+     * The largest mip level of texture that fits within the maximum texture size, or its smallest level if none do
+     */
+    size_t output_level(const gli::texture2d &texture) {
+        for(size_t level = 0; level < texture.levels(); level++) {
+            if(fits(texture.extent(level))) {
+                return level;
+            }
+        }
+        return texture.max_level();
+    }
+
+    /**
+     * Box filters image down to the maximum texture size, for textures without a small enough mip level
+     */
+    std::optional<utils::textures::Image> fit(std::optional<utils::textures::Image> image) {
+        if(image && max_size > 0 && (image->width > max_size || image->height > max_size)) {
+            logger::trace("Downscaling ({}, {}) image to at most {} pixels", image->width, image->height, max_size);
+            return utils::textures::mips::downscale(*image, max_size);
+        }
+        return image;
+    }
+
+    bool write_file(std::filesystem::path path, std::span<const uint8_t> data) {
+        if(data.empty()) {
+            return false;
+        }
+        if(utils::archive::enabled()) {
+            return utils::archive::write_file(path, data);
+        }
+        // Replace rather than truncate, the old file may be a hard link into the texture cache
+        std::error_code ec;
+        std::filesystem::remove(path, ec);
+        std::ofstream output(path, std::ios::binary);
+        output.write((const char*)data.data(), data.size());
+        return !output.fail();
+    }
+
+    // Mip levels of PNG outputs are written next to them, as <name>_mip<level>.png
+    std::filesystem::path level_path(const std::filesystem::path &path, size_t level) {
+        return path.parent_path() / (path.stem().string() + "_mip" + std::to_string(level) + path.extension().string());
+    }
+
+    bool write_pixels(const utils::textures::Image &image, std::filesystem::path path, utils::textures::mips::Content content) {
+        std::vector<utils::textures::Image> smaller = utils::textures::mips::chain(image, content);
+        if(texture_output_format == utils::textures::OutputFormat::PNG) {
+            bool written = write_file(path, utils::textures::png::encode(image.pixels.data(), image.width, image.height));
+            for(size_t level = 0; level < smaller.size() && written; level++) {
+                const utils::textures::Image &mip = smaller[level];
+                written = write_file(level_path(path, level + 1), utils::textures::png::encode(mip.pixels.data(), mip.width, mip.height));
+            }
+            return written;
+        }
+
+        std::optional<utils::textures::bc::Format> format;
+        if(utils::textures::encoder::quality() != utils::textures::encoder::Quality::None) {
+            // Normal maps too: glTF has no way to reconstruct Z from a BC5 map's X and Y, so it is kept in blue
+            format = utils::textures::bc::Format::BC7;
+        }
+        std::vector<std::vector<uint8_t>> blocks(smaller.size() + 1);
+        std::vector<utils::textures::container::Level> levels;
+        for(size_t level = 0; level <= smaller.size(); level++) {
+            const utils::textures::Image &mip = level == 0 ? image : smaller[level - 1];
+            std::span<const uint8_t> data((const uint8_t*)mip.pixels.data(), mip.pixels.size() * sizeof(uint32_t));
+            if(format) {
+                blocks[level] = utils::textures::encoder::encode(*format, mip.pixels.data(), mip.width, mip.height);
+                data = blocks[level];
+            }
+            levels.push_back({mip.width, mip.height, data});
+        }
+        return write_file(path, utils::textures::container::write_dds(format, content == utils::textures::mips::Content::Color, levels));
+    }
+
+    /**
+     * Moves the mip levels of texture, from its output level down, into a DDS container without decoding them.
+     * Returns nothing if the format has to be decoded first or no level fits within the maximum texture size.
+     */
+    std::optional<std::vector<uint8_t>> pack_blocks(const gli::texture2d &texture) {
+        std::optional<utils::textures::bc::Format> format = block_format(texture.format());
+        if(!format && texture.format() != gli::format::FORMAT_RGBA8_UNORM_PACK8 && texture.format() != gli::format::FORMAT_RGBA8_SRGB_PACK8) {
+            return {};
+        }
+        size_t first_level = output_level(texture);
+        if(!fits(texture.extent(first_level))) {
+            return {};
+        }
+        std::vector<utils::textures::container::Level> levels;
+        for(size_t level = first_level; level < texture.levels(); level++) {
+            gli::texture2d::extent_type extent = texture.extent(level);
+            levels.push_back({(uint32_t)extent.x, (uint32_t)extent.y, {(const uint8_t*)texture.data(0, 0, level), texture.size(level)}});
+        }
+        return utils::textures::container::write_dds(format, gli::is_srgb(texture.format()), levels);
+    }
+}
+
+std::optional<utils::textures::OutputFormat> utils::textures::parse_output_format(std::string_view value) {
+    if(value == "png") {
+        return OutputFormat::PNG;
+    } else if(value == "dds") {
+        return OutputFormat::DDS;
+    }
+    return {};
+}
+
+void utils::textures::init_output_format(OutputFormat format) {
+    texture_output_format = format;
+}
+
+utils::textures::OutputFormat utils::textures::output_format() {
+    return texture_output_format;
+}
+
+std::string utils::textures::output_extension() {
+    switch(texture_output_format) {
+    case OutputFormat::DDS:
+        return ".dds";
+    default:
+        return ".png";
+    }
+}
+
+void utils::textures::init_max_texture_size(uint32_t size) {
+    max_size = size;
+}
+
+uint32_t utils::textures::max_texture_size() {
+    return max_size;
+}
+
+void utils::textures::init_pack_orm(bool pack) {
+    orm_packing = pack;
+}
+
+bool utils::textures::pack_orm() {
+    return orm_packing;
+}
+
 std::string utils::textures::relabel_texture(std::string texture_name, std::string label) {
     size_t index = texture_name.find_last_of('_');
     if(index == std::string::npos) {
@@ -16,166 +202,199 @@ std::string utils::textures::relabel_texture(std::string texture_name, std::stri
     return texture_name.substr(0, index + 1) + label + texture_name.substr(index + 2);
 }
 
-bool utils::textures::write_texture(std::span<uint32_t> data, std::filesystem::path texture_path, gli::texture2d::extent_type extent) {
-    if(!stbi_write_png(
-            texture_path.string().c_str(), 
-            extent.x, extent.y, 
-            4, 
-            data.data(),
-            4 * extent.x
-        )) {
+bool utils::textures::write_texture(std::span<uint32_t> data, std::filesystem::path texture_path, gli::texture2d::extent_type extent, mips::Content content) {
+    Image image(extent.x, extent.y);
+    std::copy_n(data.begin(), image.pixels.size(), image.pixels.begin());
+    return write_texture(image, texture_path, content);
+}
+
+bool utils::textures::write_texture(const Image &image, std::filesystem::path texture_path, mips::Content content) {
+    if(!write_pixels(image, texture_path, content)) {
         logger::error("Failed to write to {}", texture_path.string());
         return false;
     }
     return true;
 }
 
-void utils::textures::process_normalmap(std::string texture_name, std::vector<uint8_t> texture_data, std::filesystem::path output_directory) {
-    logger::debug("Processing normal map...");
-    gli::texture2d texture(gli::load_dds((char*)texture_data.data(), texture_data.size()));
-    if(texture.format() == gli::format::FORMAT_UNDEFINED) {
-        logger::error("Failed to load {} from memory", texture_name);
+std::optional<utils::textures::Image> utils::textures::decode_texture(const gli::texture2d &texture, size_t level, std::optional<bc::Region> region) {
+    if(texture.empty() || level > texture.max_level()) {
+        return {};
     }
-    if(gli::is_compressed(texture.format())) {
-        logger::trace("Compressed texture (format {})", (int)texture.format());
-        texture = gli::convert(texture, gli::format::FORMAT_RGBA8_UNORM_PACK8);
+    gli::texture2d::extent_type extent = texture.extent(level);
+    if(std::optional<bc::Format> format = block_format(texture.format())) {
+        std::span<const uint8_t> blocks((const uint8_t*)texture.data(0, 0, level), texture.size(level));
+        return bc::decode(*format, blocks, extent.x, extent.y, region);
     }
-    std::span<uint32_t> pixels = std::span<uint32_t>(texture.data<uint32_t>(), texture.size<uint32_t>());
-    std::unique_ptr<uint32_t[]> unpacked_normal = std::make_unique<uint32_t[]>(pixels.size());
-    std::unique_ptr<uint32_t[]> tint_map = std::make_unique<uint32_t[]>(pixels.size());
 
-    for(int i = 0; i < pixels.size(); i++) {
-        uint32_t pixel = pixels[i];
-        uint32_t unpack = ((pixel & 0xFF000000) >> 24) | (pixel & 0x0000FF00) | 0xFFFF0000;
-        uint32_t tint = ((pixel & 0x00FF0000) < ( 50 << 16) ? 0x000000FF : 0) 
-                    | ((pixel & 0x000000FF) < ( 50 <<  0) ? 0x0000FF00 : 0)
-                    | ((pixel & 0x00FF0000) > (150 << 16) ? 0x00FF0000 : 0)
-                    |                                       0xFF000000;
-        unpacked_normal[i] = unpack;
-        tint_map[i] = tint;
+    gli::texture2d converted = texture.format() == gli::format::FORMAT_RGBA8_UNORM_PACK8 
+        ? texture 
+        : gli::convert(texture, gli::format::FORMAT_RGBA8_UNORM_PACK8);
+    if(converted.empty()) {
+        return {};
+    }
+    bc::Region area = region.value_or(bc::Region{0, 0, (uint32_t)extent.x, (uint32_t)extent.y});
+    if(area.x >= (uint32_t)extent.x || area.y >= (uint32_t)extent.y) {
+        return {};
+    }
+    area.width = std::min(area.width, (uint32_t)extent.x - area.x);
+    area.height = std::min(area.height, (uint32_t)extent.y - area.y);
+    Image image(area.width, area.height);
+    const uint32_t *pixels = converted.data<uint32_t>(0, 0, level);
+    for(uint32_t y = 0; y < area.height; y++) {
+        std::memcpy(image.row(y), pixels + (size_t)(area.y + y) * extent.x + area.x, area.width * sizeof(uint32_t));
     }
+    return image;
+}
+
+std::shared_ptr<const utils::textures::Image> utils::textures::load_image(std::string texture_name, std::span<const uint8_t> texture_data, size_t level) {
+    return image_cache::get(texture_name, level, [&]() -> std::optional<Image> {
+        gli::texture2d texture(gli::load_dds((const char*)texture_data.data(), texture_data.size()));
+        if(texture.format() == gli::format::FORMAT_UNDEFINED) {
+            logger::error("Failed to load {} from memory", texture_name);
+            return {};
+        }
+        size_t first_level = std::max(level, output_level(texture));
+        logger::trace("Decoding {} level {} (format {})", texture_name, first_level, (int)texture.format());
+        std::optional<Image> image = fit(decode_texture(texture, first_level));
+        if(!image) {
+            logger::error("Failed to decode {}", texture_name);
+        }
+        return image;
+    });
+}
 
+void utils::textures::process_normalmap(std::string texture_name, std::vector<uint8_t> texture_data, std::filesystem::path output_directory) {
+    logger::debug("Processing normal map...");
     std::filesystem::path normal_path(texture_name);
-    normal_path.replace_extension(".png");
+    normal_path.replace_extension(output_extension());
     normal_path = output_directory / "textures" / normal_path;
-    auto extent = texture.extent();
-    logger::trace("Writing image of size ({}, {}) to {}", extent.x, extent.y, normal_path.lexically_relative(output_directory).string());
-    if(write_texture(std::span<uint32_t>(unpacked_normal.get(), pixels.size()), normal_path, extent)) {
-        logger::debug("Saved normal map to {}", normal_path.lexically_relative(output_directory).string());
-    }
-
     std::string tint_name = relabel_texture(texture_name, "T");
     std::filesystem::path tint_path = normal_path.parent_path() / tint_name;
-    tint_path.replace_extension(".png");
-    logger::trace("Writing image of size ({}, {}) to {}", extent.x, extent.y, tint_path.lexically_relative(output_directory).string());
-    if(write_texture(std::span<uint32_t>(tint_map.get(), pixels.size()), tint_path, extent)) {
-        logger::debug("Saved tint map to {}", tint_path.lexically_relative(output_directory).string());
+    tint_path.replace_extension(output_extension());
+    // Packed ORM maps carry the tint masks in their alpha instead
+    std::vector<std::filesystem::path> outputs = {normal_path};
+    if(!orm_packing) {
+        outputs.push_back(tint_path);
+    }
+    std::optional<hash::Hash128> cache_key = cache::texture_key(cache::Mode::NormalMap, {texture_data});
+    if(cache_key && cache::fetch(*cache_key, outputs)) {
+        return;
     }
-}
 
-void utils::textures::process_specular(std::string texture_name, std::vector<uint8_t> specular_data, std::vector<uint8_t> albedo_data, std::filesystem::path output_directory) {
-    logger::debug("Processing specular...");
-    gli::texture2d specular(gli::load_dds((char*)specular_data.data(), specular_data.size()));
-    if(specular.format() == gli::format::FORMAT_UNDEFINED) {
+    gli::texture2d texture(gli::load_dds((const char*)texture_data.data(), texture_data.size()));
+    if(texture.format() == gli::format::FORMAT_UNDEFINED) {
         logger::error("Failed to load {} from memory", texture_name);
+        return;
     }
-    if(gli::is_compressed(specular.format())) {
-        logger::trace("Compressed texture (format {})", (int)specular.format());
-        specular = gli::convert(specular, gli::format::FORMAT_RGBA8_UNORM_PACK8);
-    }
-    gli::texture2d albedo(gli::load_dds((char*)albedo_data.data(), albedo_data.size()));
-    if(albedo.format() == gli::format::FORMAT_UNDEFINED) {
-        logger::error("Failed to load albedo from memory");
-    }
-    if(gli::is_compressed(albedo.format())) {
-        logger::trace("Compressed texture (format {})", (int)albedo.format());
-        albedo = gli::convert(albedo, gli::format::FORMAT_RGBA8_UNORM_PACK8);
-    }
-
-    // std::span<uint32_t> specular_pixels = std::span<uint32_t>(specular.data<uint32_t>(), specular.size<uint32_t>());
-    // std::span<uint32_t> albedo_pixels = std::span<uint32_t>(albedo.data<uint32_t>(), albedo.size<uint32_t>());
-    // std::unique_ptr<uint32_t[]> metallic_roughness = std::make_unique<uint32_t[]>(specular_pixels.size());
-    // std::unique_ptr<uint32_t[]> emissive = std::make_unique<uint32_t[]>(specular_pixels.size());
-    auto extent = specular.extent();
-    // float ratio_s2a = (float)albedo_pixels.size() / specular_pixels.size();
-    // for(int i = 0; i < specular_pixels.size(); i++) {
-    //     uint32_t pixel = specular_pixels[i];
-    //     uint32_t albedo_pixel = albedo_pixels[(int)(i * ratio_s2a)];
-    //     //uint32_t value = ((((pixel & 0x0000FF00) >> 8 | (pixel & 0x000000FF) << 8) / 255) & 0xFF) << 16;
-    //     uint32_t metal_rough = ((pixel & 0xFF000000) >> 16) | ((pixel & 0x000000FF) << 16) | 0xFF000000;
-    //     uint32_t emissive_pixel = (((pixel & 0x00FF0000) > (50 << 16)) && (albedo_pixel & 0xFF000000) != 0) ? albedo_pixel : 0; 
-    //     metallic_roughness[i] = metal_rough;
-    //     emissive[i] = emissive_pixel;
-    // }
-
-    gli::texture2d metallic_roughness(gli::format::FORMAT_RGBA8_UNORM_PACK8, extent);
-    gli::texture2d emissive(gli::format::FORMAT_RGBA8_UNORM_PACK8, extent);
-    gli::sampler2d<float> color_sampler(albedo, gli::wrap::WRAP_REPEAT);
-    gli::sampler2d<float> spec_sampler(specular, gli::wrap::WRAP_REPEAT);
-    gli::sampler2d<float> mr_sampler(metallic_roughness, gli::wrap::WRAP_REPEAT);
-    gli::sampler2d<float> e_sampler(emissive, gli::wrap::WRAP_REPEAT);
-    // std::unique_ptr<uint32_t[]> metallic_roughness = std::make_unique<uint32_t[]>(extent.x * extent.y);
-    // std::unique_ptr<uint32_t[]> emissive = std::make_unique<uint32_t[]>(extent.x * extent.y);
-
-    auto albedo_extent = albedo.extent();
-    float x_ratio = ((float)albedo_extent.x) / extent.x;
-    float y_ratio = ((float)albedo_extent.y) / extent.y;
-    for(int32_t x = 0; x < extent.x; x++) {
-        for(int32_t y = 0; y < extent.y; y++) {
-            gli::texture2d::extent_type texel_loc(x, y);
-            glm::vec<4, float> spec_pixel = spec_sampler.texel_fetch(texel_loc, 0);
-            glm::vec<4, float> albedo_pixel = color_sampler.texel_fetch({(int)(x * x_ratio), (int)(y * y_ratio)}, 0);
-
-            if(spec_pixel.b > 0.2f && albedo_pixel.a != 0) {
-                albedo_pixel.a = spec_pixel.b;
-                e_sampler.texel_write(texel_loc, 0, albedo_pixel);
-            }
-            spec_pixel.g = spec_pixel.a;
-            spec_pixel.b = spec_pixel.r;
-            spec_pixel.r = 0;
-            spec_pixel.a = 1.0f;
-            mr_sampler.texel_write(texel_loc, 0, spec_pixel);
+
+    std::optional<normals::NormalMap> maps;
+    size_t level = output_level(texture);
+    std::optional<bc::Format> format = block_format(texture.format());
+    if(format == bc::Format::BC3 || format == bc::Format::BC5) {
+        // Decode and convert together, a row of blocks at a time
+        gli::texture2d::extent_type extent = texture.extent(level);
+        std::span<const uint8_t> blocks((const uint8_t*)texture.data(0, 0, level), texture.size(level));
+        maps = normals::decode(*format, blocks, extent.x, extent.y);
+    } else if(std::optional<Image> image = decode_texture(texture, level)) {
+        bool two_channel = gli::component_count(texture.format()) == 2;
+        maps = normals::convert(*image, two_channel ? normals::Layout::XInRed : normals::Layout::XInAlpha);
+    }
+    if(!maps) {
+        logger::error("Failed to decode {}", texture_name);
+        return;
+    }
+    maps->normal = *fit(std::move(maps->normal));
+    const Image &unpacked_normal = maps->normal;
+
+    logger::trace("Writing image of size ({}, {}) to {}", unpacked_normal.width, unpacked_normal.height, normal_path.lexically_relative(output_directory).string());
+    bool written = write_texture(unpacked_normal, normal_path, mips::Content::Normal);
+    if(written) {
+        logger::debug("Saved normal map to {}", normal_path.lexically_relative(output_directory).string());
+    }
+
+    if(!orm_packing) {
+        Image tint_map = *fit(std::move(maps->tint));
+        logger::trace("Writing image of size ({}, {}) to {}", tint_map.width, tint_map.height, tint_path.lexically_relative(output_directory).string());
+        if(write_texture(tint_map, tint_path, mips::Content::Data)) {
+            logger::debug("Saved tint map to {}", tint_path.lexically_relative(output_directory).string());
+        } else {
+            written = false;
         }
     }
+    // Only complete sets of outputs are cached, a failed write is retried on the next export
+    if(cache_key && written) {
+        cache::store(*cache_key, outputs);
+    }
+}
 
-    std::string metallic_roughness_name = relabel_texture(texture_name, "MR");
+void utils::textures::process_specular(std::string texture_name, std::vector<uint8_t> specular_data, std::vector<uint8_t> albedo_data, std::filesystem::path output_directory, std::vector<uint8_t> normal_data) {
+    logger::debug("Processing specular...");
+    std::string metallic_roughness_name = relabel_texture(texture_name, orm_packing ? "ORM" : "MR");
     std::filesystem::path metallic_roughness_path(metallic_roughness_name);
-    metallic_roughness_path.replace_extension(".png");
+    metallic_roughness_path.replace_extension(output_extension());
     metallic_roughness_path = output_directory / "textures" / metallic_roughness_path;
-    logger::trace("Writing image of size ({}, {}) to {}", extent.x, extent.y, metallic_roughness_path.lexically_relative(output_directory).string());
-    if(write_texture({metallic_roughness.data<uint32_t>(), (size_t)(extent.x * extent.y)}, metallic_roughness_path, extent)){
-        logger::debug("Saved metallic roughness map to {}", metallic_roughness_path.lexically_relative(output_directory).string());
-    }
-
     std::string emissive_name = relabel_texture(texture_name, "E");
     std::filesystem::path emissive_path = metallic_roughness_path.parent_path() / emissive_name;
-    emissive_path.replace_extension(".png");
-    logger::trace("Writing image of size ({}, {}) to {}", extent.x, extent.y, emissive_path.lexically_relative(output_directory).string());
-    if(write_texture({emissive.data<uint32_t>(), (size_t)(extent.x * extent.y)}, emissive_path, extent)) {
+    emissive_path.replace_extension(output_extension());
+    std::array<std::filesystem::path, 2> outputs = {metallic_roughness_path, emissive_path};
+    if(!orm_packing) {
+        normal_data.clear();
+    }
+    std::optional<hash::Hash128> cache_key = cache::texture_key(cache::Mode::Specular, {specular_data, albedo_data, normal_data});
+    if(cache_key && cache::fetch(*cache_key, outputs)) {
+        return;
+    }
+
+    std::shared_ptr<const Image> specular_image = load_image(texture_name, specular_data);
+    std::shared_ptr<const Image> albedo_image = load_image(relabel_texture(texture_name, "C"), albedo_data);
+    if(!specular_image || !albedo_image) {
+        return;
+    }
+    std::shared_ptr<const Image> normal_image;
+    if(!normal_data.empty()) {
+        // Decoded as stored, the tint masks are in its red and blue channels
+        normal_image = load_image(relabel_texture(texture_name, "N"), normal_data);
+    }
+
+    // Metallic roughness and ORM maps both hold roughness in green and metalness in blue
+    Image metallic_roughness, emissive;
+    if(orm_packing) {
+        specular::OrmMaps maps = specular::convert_orm(*specular_image, *albedo_image, normal_image.get());
+        metallic_roughness = std::move(maps.orm);
+        emissive = std::move(maps.emissive);
+    } else {
+        specular::SpecularMaps maps = specular::convert(*specular_image, *albedo_image);
+        metallic_roughness = std::move(maps.metallic_roughness);
+        emissive = std::move(maps.emissive);
+    }
+    uint32_t width = specular_image->width, height = specular_image->height;
+
+    logger::trace("Writing image of size ({}, {}) to {}", width, height, metallic_roughness_path.lexically_relative(output_directory).string());
+    bool written = write_texture(metallic_roughness, metallic_roughness_path, mips::Content::Data);
+    if(written){
+        logger::debug("Saved {} map to {}", orm_packing ? "ORM" : "metallic roughness", metallic_roughness_path.lexically_relative(output_directory).string());
+    }
+
+    logger::trace("Writing image of size ({}, {}) to {}", width, height, emissive_path.lexically_relative(output_directory).string());
+    if(write_texture(emissive, emissive_path)) {
         logger::debug("Saved emissive map to {}", emissive_path.lexically_relative(output_directory).string());
+    } else {
+        written = false;
+    }
+    if(cache_key && written) {
+        cache::store(*cache_key, outputs);
     }
 }
 
-void utils::textures::process_detailcube(std::string texture_name, std::vector<uint8_t> texture_data, std::filesystem::path output_directory) {
-    logger::debug("Saving detail cube {} as png...", texture_name);
-    gli::texture_cube texture(gli::load_dds((char*)texture_data.data(), texture_data.size()));
-    if(texture.format() == gli::format::FORMAT_UNDEFINED) {
-        logger::error("Failed to load {} from memory", texture_name);
-    }
-    std::filesystem::path texture_path(texture_name);
-    logger::trace("Cube map info:");
-    logger::trace("    Base level: {}", texture.base_level());
-    logger::trace("    Max level:  {}", texture.max_level());
-    logger::trace("    Base Face:  {}", texture.base_face());
-    logger::trace("    Max Face:   {}", texture.max_face());
-    logger::trace("    Base Layer: {}", texture.base_layer());
-    logger::trace("    Max Layer:  {}", texture.max_layer());
-    for(size_t face = 0; face < texture.faces(); face++){
+namespace {
+    bool write_detailcube_face(
+        const std::string &texture_name,
+        const gli::texture_cube &texture,
+        size_t face,
+        const std::filesystem::path &texture_path,
+        const std::filesystem::path &output_directory
+    ) {
         gli::texture2d face_texture = texture[face];
-        if(gli::is_compressed(face_texture.format())) {
-            logger::trace("Compressed detailcube texture (format {})", (int)texture.format());
-            face_texture = gli::convert(face_texture, gli::format::FORMAT_RGBA8_UNORM_PACK8);
-        }
         logger::trace("Cube map {} face info:", utils::materials3::detailcube_faces[face]);
         logger::trace("    Base level: {}", face_texture.base_level());
         logger::trace("    Max level:  {}", face_texture.max_level());
@@ -183,107 +402,232 @@ void utils::textures::process_detailcube(std::string texture_name, std::vector<u
         logger::trace("    Max face:   {}", face_texture.max_face());
         logger::trace("    Base layer: {}", face_texture.base_layer());
         logger::trace("    Max layer:  {}", face_texture.max_layer());
-        auto extent = face_texture.extent();
-        texture_path = output_directory / "textures" / (std::filesystem::path(texture_name).stem().string() + "_" + utils::materials3::detailcube_faces.at(face));
-        texture_path.replace_extension(".png");
-        logger::trace("Writing image of size ({}, {}) to {}", extent.x, extent.y, texture_path.lexically_relative(output_directory).string());
-        if(write_texture(std::span<uint32_t>(face_texture.data<uint32_t>(), face_texture.size<uint32_t>()), texture_path, extent)){
+        std::optional<std::vector<uint8_t>> packed;
+        if(texture_output_format != utils::textures::OutputFormat::PNG && (packed = pack_blocks(face_texture))) {
+            if(!write_file(texture_path, *packed)) {
+                logger::error("Failed to write to {}", texture_path.string());
+                return false;
+            }
             logger::debug("   Saved face {} to {}", utils::materials3::detailcube_faces.at(face), texture_path.lexically_relative(output_directory).string());
+            return true;
+        }
+        std::optional<utils::textures::Image> face_image = fit(utils::textures::decode_texture(face_texture, output_level(face_texture)));
+        if(!face_image) {
+            logger::error("Failed to decode {} face {}", texture_name, utils::materials3::detailcube_faces.at(face));
+            return false;
         }
+        logger::trace("Writing image of size ({}, {}) to {}", face_image->width, face_image->height, texture_path.lexically_relative(output_directory).string());
+        if(!utils::textures::write_texture(*face_image, texture_path, utils::textures::mips::Content::Data)){
+            return false;
+        }
+        logger::debug("   Saved face {} to {}", utils::materials3::detailcube_faces.at(face), texture_path.lexically_relative(output_directory).string());
+        return true;
     }
 }
 
-std::optional<gli::texture2d> utils::textures::load_texture(std::string texture_name, std::vector<uint8_t>& texture_data) {
-    gli::texture2d texture(gli::load_dds((char*)texture_data.data(), texture_data.size()));
-    if(texture.format() == gli::format::FORMAT_UNDEFINED) {
+std::vector<std::function<void()>> utils::textures::detailcube_jobs(std::string texture_name, std::vector<uint8_t> texture_data, std::filesystem::path output_directory) {
+    logger::debug("Saving detail cube {} as {}...", texture_name, output_extension().substr(1));
+    std::vector<std::filesystem::path> outputs;
+    for(const std::string &face : utils::materials3::detailcube_faces) {
+        std::filesystem::path face_path = output_directory / "textures" / (std::filesystem::path(texture_name).stem().string() + "_" + face);
+        outputs.push_back(face_path.replace_extension(output_extension()));
+    }
+    std::optional<hash::Hash128> cache_key = cache::texture_key(cache::Mode::DetailCube, {texture_data});
+    if(cache_key && cache::fetch(*cache_key, outputs)) {
+        return {};
+    }
+
+    std::shared_ptr<const gli::texture_cube> texture = std::make_shared<const gli::texture_cube>(gli::load_dds((char*)texture_data.data(), texture_data.size()));
+    if(texture->format() == gli::format::FORMAT_UNDEFINED) {
         logger::error("Failed to load {} from memory", texture_name);
         return {};
     }
-    if(gli::is_compressed(texture.format())) {
-        logger::trace("Compressed texture (format {})", (int)texture.format());
-        texture = gli::convert(texture, gli::format::FORMAT_RGBA8_UNORM_PACK8);
+    logger::trace("Cube map info:");
+    logger::trace("    Base level: {}", texture->base_level());
+    logger::trace("    Max level:  {}", texture->max_level());
+    logger::trace("    Base Face:  {}", texture->base_face());
+    logger::trace("    Max Face:   {}", texture->max_face());
+    logger::trace("    Base Layer: {}", texture->base_layer());
+    logger::trace("    Max Layer:  {}", texture->max_layer());
+
+    // Whichever face finishes last stores the cube in the texture cache, if every face was written
+    size_t face_count = std::min(texture->faces(), outputs.size());
+    std::shared_ptr<std::atomic<size_t>> remaining = std::make_shared<std::atomic<size_t>>(face_count);
+    std::shared_ptr<std::atomic<bool>> failed = std::make_shared<std::atomic<bool>>(face_count < outputs.size());
+    std::vector<std::function<void()>> jobs;
+    for(size_t face = 0; face < face_count; face++) {
+        jobs.push_back([=]() {
+            if(!write_detailcube_face(texture_name, *texture, face, outputs.at(face), output_directory)) {
+                *failed = true;
+            }
+            if(--*remaining == 0 && cache_key && !*failed) {
+                cache::store(*cache_key, outputs);
+            }
+        });
     }
-    return texture;
+    return jobs;
 }
 
-void utils::textures::save_texture(std::string texture_name, std::vector<uint8_t> texture_data, std::filesystem::path output_directory) {
-    logger::debug("Saving {} as png...", texture_name);
-    std::optional<gli::texture2d> texture = load_texture(texture_name, texture_data);
-    if(!texture.has_value()) {
-        return;
+void utils::textures::process_detailcube(std::string texture_name, std::vector<uint8_t> texture_data, std::filesystem::path output_directory) {
+    for(std::function<void()> &job : detailcube_jobs(texture_name, std::move(texture_data), output_directory)) {
+        job();
     }
+}
+
+std::optional<gli::texture2d> utils::textures::load_texture(std::string texture_name, std::vector<uint8_t>& texture_data) {
+    std::shared_ptr<const Image> image = load_image(texture_name, texture_data);
+    if(!image) {
+        return {};
+    }
+    return to_texture(*image);
+}
+
+void utils::textures::save_texture(std::string texture_name, std::vector<uint8_t> texture_data, std::filesystem::path output_directory) {
+    logger::debug("Saving {} as {}...", texture_name, output_extension().substr(1));
     std::filesystem::path texture_path(texture_name);
-    texture_path.replace_extension(".png");
+    texture_path.replace_extension(output_extension());
     texture_path = output_directory / "textures" / texture_path;
-    auto extent = texture->extent();
-    logger::trace("Writing image of size ({}, {}) to {}", extent.x, extent.y, texture_path.lexically_relative(output_directory).string());
-    if(write_texture(std::span<uint32_t>(texture->data<uint32_t>(), texture->size<uint32_t>()), texture_path, extent)){
-        logger::debug("Saved texture to {}", texture_path.lexically_relative(output_directory).string());
+    std::optional<hash::Hash128> cache_key = cache::texture_key(cache::Mode::Texture, {texture_data});
+    if(cache_key && cache::fetch(*cache_key, {&texture_path, 1})) {
+        return;
+    }
+
+    std::optional<std::vector<uint8_t>> packed;
+    if(texture_output_format == OutputFormat::DDS && max_size == 0) {
+        // Already a DDS, so the pack's bytes are written as they are
+        packed = texture_data;
+    } else if(texture_output_format != OutputFormat::PNG) {
+        gli::texture2d texture(gli::load_dds((const char*)texture_data.data(), texture_data.size()));
+        if(texture.format() != gli::format::FORMAT_UNDEFINED) {
+            packed = pack_blocks(texture);
+        }
+    }
+    if(packed) {
+        if(write_file(texture_path, *packed)) {
+            logger::debug("Saved texture to {}", texture_path.lexically_relative(output_directory).string());
+            if(cache_key) {
+                cache::store(*cache_key, {&texture_path, 1});
+            }
+        } else {
+            logger::error("Failed to write to {}", texture_path.string());
+        }
+        return;
+    }
+
+    std::shared_ptr<const Image> texture = load_image(texture_name, texture_data);
+    if(!texture) {
+        return;
+    }
+    logger::trace("Writing image of size ({}, {}) to {}", texture->width, texture->height, texture_path.lexically_relative(output_directory).string());
+    if(!write_texture(*texture, texture_path)){
+        return;
+    }
+    logger::debug("Saved texture to {}", texture_path.lexically_relative(output_directory).string());
+    if(cache_key) {
+        cache::store(*cache_key, {&texture_path, 1});
     }
 }
 
 void utils::textures::process_cnx_sny(std::string texture_name, std::span<uint8_t> cnx_data, std::span<uint8_t> sny_data, std::filesystem::path output_directory) {
     logger::debug("Processing color_nx/specular_ny maps for {}...", texture_name);
-    gli::texture2d color_nx(gli::load_dds((char*)cnx_data.data(), cnx_data.size()));
+    std::array<std::filesystem::path, 3> outputs;
+    for(size_t i = 0; i < outputs.size(); i++) {
+        outputs[i] = output_directory / "textures" / (texture_name + "_" + "CSN"[i]);
+        outputs[i].replace_extension(output_extension());
+    }
+    // Maps packed into a terrain atlas are written with their page rather than on their own
+    bool atlased = atlas::reserved(texture_name);
+    std::optional<hash::Hash128> cache_key;
+    if(!atlased) {
+        cache_key = cache::texture_key(cache::Mode::CnxSny, {cnx_data, sny_data});
+    }
+    if(cache_key && cache::fetch(*cache_key, outputs)) {
+        return;
+    }
+    // A cell whose maps can't be decoded is given up, so its page is still written
+    auto abandon = [&]() {
+        if(atlased) {
+            atlas::abandon(texture_name);
+        }
+    };
+
+    gli::texture2d color_nx(gli::load_dds((const char*)cnx_data.data(), cnx_data.size()));
     if(color_nx.format() == gli::format::FORMAT_UNDEFINED) {
         logger::error("Failed to load {} color nx map from memory", texture_name);
+        abandon();
         return;
     }
     
-    gli::texture2d specular_ny(gli::load_dds((char*)sny_data.data(), sny_data.size()));
+    gli::texture2d specular_ny(gli::load_dds((const char*)sny_data.data(), sny_data.size()));
     if(specular_ny.format() == gli::format::FORMAT_UNDEFINED) {
         logger::error("Failed to load {} specular ny map from memory", texture_name);
+        abandon();
         return;
     }
 
-    if(gli::is_compressed(color_nx.format())) {
-        logger::trace("Decompressing color nx map...");
-        color_nx = gli::convert(color_nx, gli::format::FORMAT_RGBA8_UNORM_PACK8);
-    }
-
-    if(gli::is_compressed(specular_ny.format())) {
-        logger::trace("Decompressing specular ny map...");
-        specular_ny = gli::convert(specular_ny, gli::format::FORMAT_RGBA8_UNORM_PACK8);
-    }
-
-    if(!(color_nx.extent().x == specular_ny.extent().x && color_nx.extent().y == specular_ny.extent().y)) {
+    gli::texture2d::extent_type extent = color_nx.extent();
+    if(extent != specular_ny.extent()) {
         logger::error(
             "color_nx and specular_ny maps *must* have matching dimentions: ({}, {}) != ({}, {})", 
-            color_nx.extent().x,
-            color_nx.extent().y,
+            extent.x,
+            extent.y,
             specular_ny.extent().x,
             specular_ny.extent().y
         );
+        abandon();
         return;
     }
 
-    std::vector<uint32_t> normal_map;
-    std::span<uint32_t> cnx_span(color_nx.data<uint32_t>(), color_nx.size<uint32_t>());
-    std::span<uint32_t> sny_span(specular_ny.data<uint32_t>(), specular_ny.size<uint32_t>());
-    for(uint32_t i = 0; i < cnx_span.size(); i++) {
-        normal_map.push_back(0xFFFF0000 | ((sny_span[i] >> 16) & 0x0000FF00) | (cnx_span[i] >> 24));
-        sny_span[i] |= 0xFF000000;
-        sny_span[i] ^= 0x00FFFF00;
-        cnx_span[i] |= 0xFF000000;
+    std::optional<terrain::TerrainMaps> maps;
+    // Both maps have the same extent, but not necessarily the same number of mip levels
+    size_t level = std::min(output_level(color_nx), output_level(specular_ny));
+    extent = color_nx.extent(level);
+    std::optional<bc::Format> cnx_format = block_format(color_nx.format()), sny_format = block_format(specular_ny.format());
+    if(cnx_format && sny_format) {
+        // Decode both maps and split them together, a row of blocks at a time
+        maps = terrain::decode(
+            *cnx_format, {(const uint8_t*)color_nx.data(0, 0, level), color_nx.size(level)},
+            *sny_format, {(const uint8_t*)specular_ny.data(0, 0, level), specular_ny.size(level)},
+            extent.x, extent.y
+        );
+    } else {
+        std::optional<Image> cnx_image = decode_texture(color_nx, level), sny_image = decode_texture(specular_ny, level);
+        if(cnx_image && sny_image) {
+            maps = terrain::split(*cnx_image, *sny_image);
+        }
+    }
+    if(!maps) {
+        logger::error("Failed to decode color_nx/specular_ny maps for {}", texture_name);
+        abandon();
+        return;
+    }
+    maps->color = *fit(std::move(maps->color));
+    maps->specular = *fit(std::move(maps->specular));
+    maps->normal = *fit(std::move(maps->normal));
+    if(atlased) {
+        atlas::place(texture_name, *maps);
+        return;
     }
 
-    std::filesystem::path texture_path(texture_name + "_C");
-    texture_path.replace_extension(".png");
-    texture_path = output_directory / "textures" / texture_path;
-    auto extent = color_nx.extent();
-    if(write_texture(cnx_span, texture_path, extent)){
-        logger::debug("Saved albedo texture to {}", texture_path.lexically_relative(output_directory).string());
+    bool written = true;
+    if(write_texture(maps->color, outputs[0])){
+        logger::debug("Saved albedo texture to {}", outputs[0].lexically_relative(output_directory).string());
+    } else {
+        written = false;
     }
 
-    texture_path = output_directory / "textures" / (texture_name + "_S");
-    texture_path.replace_extension(".png");
-    if(write_texture(sny_span, texture_path, extent)){
-        logger::debug("Saved metallic roughness texture to {}", texture_path.lexically_relative(output_directory).string());
+    if(write_texture(maps->specular, outputs[1], mips::Content::Data)){
+        logger::debug("Saved metallic roughness texture to {}", outputs[1].lexically_relative(output_directory).string());
+    } else {
+        written = false;
     }
 
-    texture_path = output_directory / "textures" / (texture_name + "_N");
-    texture_path.replace_extension(".png");
-    if(write_texture(normal_map, texture_path, extent)){
-        logger::debug("Saved normal map to {}", texture_path.lexically_relative(output_directory).string());
+    if(write_texture(maps->normal, outputs[2], mips::Content::Normal)){
+        logger::debug("Saved normal map to {}", outputs[2].lexically_relative(output_directory).string());
+    } else {
+        written = false;
+    }
+    if(cache_key && written) {
+        cache::store(*cache_key, outputs);
     }
 }
\ No newline at end of file
@@ -0,0 +1,91 @@
+#include "utils/textures/arguments.h"
+#include "utils/textures.h"
+#include "utils/textures/cache.h"
+
+#include <spdlog/spdlog.h>
+
+namespace logger = spdlog;
+using namespace warpgate;
+
+void utils::textures::add_texture_arguments(argparse::ArgumentParser &parser, bool pack_orm) {
+    parser.add_argument("--png-compression")
+        .help("PNG compression for exported textures: fast, default, best or a zlib level from 0 to 9")
+        .default_value(std::string("default"));
+
+    parser.add_argument("--texture-format")
+        .help("Texture file format {png, dds}. dds keeps the original compressed data where no processing is needed")
+        .default_value(std::string("png"));
+
+    parser.add_argument("--bc-quality")
+        .help("Block compression of processed maps in dds output {none, fast, default, best}. Maps are written as BC7, or RGBA8 for none")
+        .default_value(std::string("default"));
+
+    parser.add_argument("--mips")
+        .help("Generate mip levels for written textures with this filter {none, box, kaiser}. Color is filtered in linear light and normal maps are renormalized")
+        .default_value(std::string("none"));
+
+    if(pack_orm) {
+        parser.add_argument("--pack-orm")
+            .help("Pack occlusion, roughness and metalness into one ORM texture per material, with the normal map's tint masks in its alpha")
+            .default_value(false)
+            .implicit_value(true)
+            .nargs(0);
+    }
+
+    parser.add_argument("--texture-cache")
+        .help("Directory used to cache processed textures between runs");
+
+    parser.add_argument("--image-cache-size")
+        .help("How many MiB of decoded textures to keep in memory for reuse by the image processing threads, 0 to disable")
+        .default_value(256u)
+        .scan<'u', uint32_t>();
+
+    parser.add_argument("--max-texture-size")
+        .help("Largest width or height of written textures, using the biggest mip level that fits and downscaling if none does. 0 for no limit")
+        .default_value(0u)
+        .scan<'u', uint32_t>();
+}
+
+bool utils::textures::apply_texture_arguments(argparse::ArgumentParser &parser, bool pack_orm) {
+    std::string png_compression = parser.get<std::string>("--png-compression");
+    if(auto png_settings = png::parse_settings(png_compression)) {
+        png::init_png(*png_settings);
+    } else {
+        logger::error("Invalid PNG compression '{}', expected fast, default, best or a level from 0 to 9", png_compression);
+        return false;
+    }
+
+    std::string texture_format = parser.get<std::string>("--texture-format");
+    if(auto output_format = parse_output_format(texture_format)) {
+        init_output_format(*output_format);
+    } else {
+        logger::error("Invalid texture format '{}', expected png or dds", texture_format);
+        return false;
+    }
+
+    std::string bc_quality = parser.get<std::string>("--bc-quality");
+    if(auto quality = encoder::parse_quality(bc_quality)) {
+        encoder::init_encoder(*quality);
+    } else {
+        logger::error("Invalid block compression quality '{}', expected none, fast, default or best", bc_quality);
+        return false;
+    }
+
+    std::string mip_filter = parser.get<std::string>("--mips");
+    if(auto filter = mips::parse_filter(mip_filter)) {
+        mips::init_mips(*filter);
+    } else {
+        logger::error("Invalid mip filter '{}', expected none, box or kaiser", mip_filter);
+        return false;
+    }
+    if(pack_orm) {
+        init_pack_orm(parser.get<bool>("--pack-orm"));
+    }
+
+    if(auto texture_cache = parser.present<std::string>("--texture-cache")) {
+        cache::init_cache(*texture_cache);
+    }
+    image_cache::init_image_cache((size_t)parser.get<uint32_t>("--image-cache-size") << 20);
+    init_max_texture_size(parser.get<uint32_t>("--max-texture-size"));
+    return true;
+}
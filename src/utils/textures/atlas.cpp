@@ -0,0 +1,260 @@
+#include "utils/textures/atlas.h"
+
+#include <algorithm>
+#include <array>
+#include <condition_variable>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <unordered_map>
+
+#include <spdlog/spdlog.h>
+
+#include "utils/textures.h"
+#include "utils/textures/mips.h"
+
+namespace logger = spdlog;
+using namespace warpgate;
+
+namespace {
+    // Pixels of each cell's edge repeated around it, so filtering near the edge doesn't pick up the neighbouring cell
+    constexpr uint32_t gutter = 4;
+    // Pages with cells still to be filled, each holding three full size maps. Reserving a cell on a new page waits past this
+    constexpr size_t max_open_pages = 2;
+    // Left in cells whose maps failed to decode: mid grey, fully rough and not metallic, and a flat normal
+    constexpr std::array<uint32_t, 3> placeholder_fill = {0xFF808080, 0xFF00FF00, 0xFFFF8080};
+
+    struct Page {
+        std::array<utils::textures::Image, 3> maps;
+        uint32_t filled = 0;
+    };
+
+    std::mutex atlas_mutex;
+    std::filesystem::path atlas_directory;
+    std::string atlas_name;
+    uint32_t atlas_page_size = 0, atlas_cell_size = 0, cells_per_side = 0;
+    uint32_t next_cell = 0;
+    std::unordered_map<std::string, uint32_t> reserved_cells;
+    std::map<uint32_t, std::unique_ptr<Page>> open_pages;
+    // Pages with a reserved cell that have not been written yet
+    std::set<uint32_t> unfinished_pages;
+    std::condition_variable page_written;
+
+    uint32_t cells_per_page() {
+        return cells_per_side * cells_per_side;
+    }
+
+    /**
+     * Box filters image down to the cell size if it is larger, then resamples it to exactly cell_size square
+     */
+    utils::textures::Image fit_cell(const utils::textures::Image &image, uint32_t cell_size) {
+        if(image.width == cell_size && image.height == cell_size) {
+            return image;
+        }
+        utils::textures::Image filtered = image.width > cell_size || image.height > cell_size
+            ? utils::textures::mips::downscale(image, cell_size)
+            : image;
+        utils::textures::Image cell(cell_size, cell_size);
+        for(uint32_t y = 0; y < cell_size; y++) {
+            const uint32_t *source = filtered.row((uint32_t)((uint64_t)y * filtered.height / cell_size));
+            uint32_t *destination = cell.row(y);
+            for(uint32_t x = 0; x < cell_size; x++) {
+                destination[x] = source[(uint64_t)x * filtered.width / cell_size];
+            }
+        }
+        return cell;
+    }
+
+    void copy_cell(const utils::textures::Image &cell, utils::textures::Image &page, uint32_t x, uint32_t y) {
+        uint32_t size = cell.width;
+        for(uint32_t row = 0; row < size + 2 * gutter; row++) {
+            const uint32_t *source = cell.row(std::clamp(row, gutter, gutter + size - 1) - gutter);
+            uint32_t *destination = page.row(y + row) + x;
+            std::fill(destination, destination + gutter, source[0]);
+            std::memcpy(destination + gutter, source, size * sizeof(uint32_t));
+            std::fill(destination + gutter + size, destination + size + 2 * gutter, source[size - 1]);
+        }
+    }
+
+    constexpr std::array<utils::textures::mips::Content, 3> page_contents = {
+        utils::textures::mips::Content::Color, utils::textures::mips::Content::Data, utils::textures::mips::Content::Normal
+    };
+
+    std::unique_ptr<Page> placeholder_page() {
+        std::unique_ptr<Page> page = std::make_unique<Page>();
+        for(size_t i = 0; i < page->maps.size(); i++) {
+            page->maps[i] = utils::textures::Image(atlas_page_size, atlas_page_size);
+            std::fill(page->maps[i].pixels.begin(), page->maps[i].pixels.end(), placeholder_fill[i]);
+        }
+        return page;
+    }
+
+    /**
+     * Takes the reservation for texture_name and returns its cell and page, allocating the page if this is its first cell.
+     * Expects atlas_mutex to be held.
+     */
+    std::optional<std::pair<uint32_t, Page*>> claim_cell(const std::string &texture_name) {
+        auto reservation = reserved_cells.find(texture_name);
+        if(reservation == reserved_cells.end()) {
+            logger::error("No terrain atlas cell was reserved for {}", texture_name);
+            return {};
+        }
+        uint32_t cell = reservation->second;
+        reserved_cells.erase(reservation);
+        std::unique_ptr<Page> &open_page = open_pages[cell / cells_per_page()];
+        if(!open_page) {
+            open_page = placeholder_page();
+        }
+        return std::make_pair(cell, open_page.get());
+    }
+
+    /**
+     * Counts one more cell of page as filled, returning the page once its last cell is so it can be written.
+     * Expects atlas_mutex to be held.
+     */
+    std::unique_ptr<Page> fill_cell(uint32_t page, Page &contents) {
+        std::unique_ptr<Page> full_page;
+        if(++contents.filled == cells_per_page()) {
+            full_page = std::move(open_pages.at(page));
+            open_pages.erase(page);
+        }
+        return full_page;
+    }
+
+    void write_page(uint32_t page, const Page &contents) {
+        logger::info("Writing terrain atlas page {} ({} of {} cells filled)", page, contents.filled, cells_per_page());
+        for(size_t i = 0; i < contents.maps.size(); i++) {
+            std::filesystem::path path = utils::textures::atlas::page_path(page, "CSN"[i]);
+            if(utils::textures::write_texture(contents.maps[i], path, page_contents[i])) {
+                logger::debug("Saved atlas page to {}", path.lexically_relative(atlas_directory).string());
+            }
+        }
+        {
+            std::lock_guard<std::mutex> lock(atlas_mutex);
+            unfinished_pages.erase(page);
+        }
+        page_written.notify_all();
+    }
+}
+
+bool utils::textures::atlas::init_atlas(std::filesystem::path output_directory, std::string name, uint32_t page_size, uint32_t cell_size) {
+    if(cell_size == 0 || page_size < cell_size + 2 * gutter) {
+        logger::error("Terrain atlas pages of {} pixels cannot hold a {} pixel cell with its {} pixel gutter", page_size, cell_size, gutter);
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(atlas_mutex);
+    atlas_directory = output_directory;
+    atlas_name = name;
+    atlas_page_size = page_size;
+    atlas_cell_size = cell_size;
+    cells_per_side = page_size / (cell_size + 2 * gutter);
+    return true;
+}
+
+bool utils::textures::atlas::enabled() {
+    std::lock_guard<std::mutex> lock(atlas_mutex);
+    return cells_per_side > 0;
+}
+
+utils::textures::atlas::Slot utils::textures::atlas::reserve(const std::string &texture_name) {
+    std::unique_lock<std::mutex> lock(atlas_mutex);
+    if(next_cell % cells_per_page() == 0) {
+        // Every cell of the earlier pages has been queued, so the image threads always get them written
+        page_written.wait(lock, []() { return unfinished_pages.size() < max_open_pages; });
+    }
+    uint32_t cell = next_cell++;
+    reserved_cells[texture_name] = cell;
+    unfinished_pages.insert(cell / cells_per_page());
+    uint32_t index = cell % cells_per_page(), stride = atlas_cell_size + 2 * gutter;
+    return {
+        cell / cells_per_page(),
+        (float)((index % cells_per_side) * stride + gutter) / atlas_page_size,
+        (float)((index / cells_per_side) * stride + gutter) / atlas_page_size,
+        (float)atlas_cell_size / atlas_page_size
+    };
+}
+
+bool utils::textures::atlas::reserved(const std::string &texture_name) {
+    std::lock_guard<std::mutex> lock(atlas_mutex);
+    return reserved_cells.find(texture_name) != reserved_cells.end();
+}
+
+std::string utils::textures::atlas::page_name(uint32_t page) {
+    return atlas_name + "_atlas_" + std::to_string(page);
+}
+
+std::filesystem::path utils::textures::atlas::page_path(uint32_t page, char label) {
+    return atlas_directory / "textures" / (page_name(page) + "_" + label + output_extension());
+}
+
+void utils::textures::atlas::place(const std::string &texture_name, const terrain::TerrainMaps &maps) {
+    std::optional<std::pair<uint32_t, Page*>> claimed;
+    {
+        std::lock_guard<std::mutex> lock(atlas_mutex);
+        claimed = claim_cell(texture_name);
+    }
+    if(!claimed) {
+        return;
+    }
+    auto [cell, contents] = *claimed;
+
+    // Cells never overlap, so they are filled without holding the lock
+    uint32_t index = cell % cells_per_page(), stride = atlas_cell_size + 2 * gutter;
+    uint32_t x = (index % cells_per_side) * stride, y = (index / cells_per_side) * stride;
+    const std::array<const Image*, 3> sources = {&maps.color, &maps.specular, &maps.normal};
+    for(size_t i = 0; i < sources.size(); i++) {
+        copy_cell(fit_cell(*sources[i], atlas_cell_size), contents->maps[i], x, y);
+    }
+
+    uint32_t page = cell / cells_per_page();
+    std::unique_ptr<Page> full_page;
+    {
+        std::lock_guard<std::mutex> lock(atlas_mutex);
+        full_page = fill_cell(page, *contents);
+    }
+    if(full_page) {
+        write_page(page, *full_page);
+    }
+}
+
+void utils::textures::atlas::abandon(const std::string &texture_name) {
+    uint32_t page;
+    std::unique_ptr<Page> full_page;
+    {
+        std::lock_guard<std::mutex> lock(atlas_mutex);
+        std::optional<std::pair<uint32_t, Page*>> claimed = claim_cell(texture_name);
+        if(!claimed) {
+            return;
+        }
+        page = claimed->first / cells_per_page();
+        full_page = fill_cell(page, *claimed->second);
+    }
+    logger::warn("Terrain atlas cell for {} left as a placeholder", texture_name);
+    if(full_page) {
+        write_page(page, *full_page);
+    }
+}
+
+void utils::textures::atlas::finish() {
+    std::map<uint32_t, std::unique_ptr<Page>> remaining;
+    {
+        std::lock_guard<std::mutex> lock(atlas_mutex);
+        remaining.swap(open_pages);
+        if(!reserved_cells.empty()) {
+            logger::warn("{} terrain atlas cell{} left empty", reserved_cells.size(), reserved_cells.size() == 1 ? " was" : "s were");
+            reserved_cells.clear();
+        }
+        // Pages none of whose cells were placed are still referenced by the model, so they are written as placeholders
+        for(uint32_t page : unfinished_pages) {
+            if(!remaining.contains(page)) {
+                remaining[page] = placeholder_page();
+            }
+        }
+    }
+    for(auto &[page, contents] : remaining) {
+        write_page(page, *contents);
+    }
+}
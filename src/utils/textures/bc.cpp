@@ -0,0 +1,439 @@
+#include "utils/textures/bc.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+#include "utils/textures/scheduler.h"
+
+#if defined(__SSE4_1__) || defined(__AVX2__)
+#define WARPGATE_BC_SIMD 1
+#include <immintrin.h>
+#endif
+
+using namespace warpgate;
+
+namespace {
+    uint32_t read_u32(const uint8_t *data) {
+        uint32_t value;
+        std::memcpy(&value, data, sizeof(value));
+        return value;
+    }
+
+    uint64_t read_u64(const uint8_t *data) {
+        uint64_t value;
+        std::memcpy(&value, data, sizeof(value));
+        return value;
+    }
+
+    uint32_t expand_565(uint16_t color) {
+        uint32_t r = (color >> 11) & 0x1F, g = (color >> 5) & 0x3F, b = color & 0x1F;
+        r = (r << 3) | (r >> 2);
+        g = (g << 2) | (g >> 4);
+        b = (b << 3) | (b >> 2);
+        return r | g << 8 | b << 16 | 0xFF000000;
+    }
+
+    uint32_t channel(uint32_t color, uint32_t shift) {
+        return (color >> shift) & 0xFF;
+    }
+
+    // (weight_a * a + weight_b * b) / (weight_a + weight_b) per channel, rounded to nearest
+    uint32_t blend(uint32_t a, uint32_t b, uint32_t weight_a, uint32_t weight_b, uint32_t alpha) {
+        uint32_t total = weight_a + weight_b, result = alpha << 24;
+        for(uint32_t shift = 0; shift < 24; shift += 8) {
+            result |= ((weight_a * channel(a, shift) + weight_b * channel(b, shift) + total / 2) / total) << shift;
+        }
+        return result;
+    }
+
+    /**
+     * BC1 color palette. BC2 and BC3 always use the four color mode, BC1 switches to three colors
+     * and transparent black when color0 <= color1.
+     */
+    std::array<uint32_t, 4> color_palette(const uint8_t *block, bool punchthrough) {
+        uint16_t color0 = (uint16_t)(block[0] | block[1] << 8), color1 = (uint16_t)(block[2] | block[3] << 8);
+        std::array<uint32_t, 4> palette;
+        palette[0] = expand_565(color0);
+        palette[1] = expand_565(color1);
+        if(color0 > color1 || !punchthrough) {
+            palette[2] = blend(palette[0], palette[1], 2, 1, 0xFF);
+            palette[3] = blend(palette[0], palette[1], 1, 2, 0xFF);
+        } else {
+            palette[2] = blend(palette[0], palette[1], 1, 1, 0xFF);
+            palette[3] = 0;
+        }
+        return palette;
+    }
+
+    std::array<uint8_t, 16> bc2_alpha(const uint8_t *block) {
+        uint64_t bits = read_u64(block);
+        std::array<uint8_t, 16> alpha;
+        for(uint32_t i = 0; i < 16; i++) {
+            alpha[i] = (uint8_t)(((bits >> (4 * i)) & 0xF) * 17);
+        }
+        return alpha;
+    }
+
+    // BC3 alpha and each BC4/BC5 channel share the same 8 value interpolated block
+    std::array<uint8_t, 16> bc3_alpha(const uint8_t *block) {
+        std::array<uint8_t, 8> palette;
+        palette[0] = block[0];
+        palette[1] = block[1];
+        if(palette[0] > palette[1]) {
+            for(uint32_t i = 1; i < 7; i++) {
+                palette[i + 1] = (uint8_t)(((7 - i) * palette[0] + i * palette[1] + 3) / 7);
+            }
+        } else {
+            for(uint32_t i = 1; i < 5; i++) {
+                palette[i + 1] = (uint8_t)(((5 - i) * palette[0] + i * palette[1] + 2) / 5);
+            }
+            palette[6] = 0;
+            palette[7] = 255;
+        }
+        uint64_t bits = read_u64(block) >> 16;
+        std::array<uint8_t, 16> alpha;
+        for(uint32_t i = 0; i < 16; i++) {
+            alpha[i] = palette[(bits >> (3 * i)) & 7];
+        }
+        return alpha;
+    }
+
+    struct Bc7Mode {
+        uint32_t subsets, partition_bits, rotation_bits, index_selection_bits;
+        uint32_t color_bits, alpha_bits, endpoint_pbits, shared_pbits, index_bits, secondary_index_bits;
+    };
+
+    constexpr Bc7Mode bc7_modes[8] = {
+        {3, 4, 0, 0, 4, 0, 1, 0, 3, 0},
+        {2, 6, 0, 0, 6, 0, 0, 1, 3, 0},
+        {3, 6, 0, 0, 5, 0, 0, 0, 2, 0},
+        {2, 6, 0, 0, 7, 0, 1, 0, 2, 0},
+        {1, 0, 2, 1, 5, 6, 0, 0, 2, 3},
+        {1, 0, 2, 0, 7, 8, 0, 0, 2, 2},
+        {1, 0, 0, 0, 7, 7, 1, 0, 4, 0},
+        {2, 6, 0, 0, 5, 5, 1, 0, 2, 0},
+    };
+
+    // Subset of each texel, one bit per texel for two subsets and two bits per texel for three
+    constexpr uint16_t bc7_partitions2[64] = {
+        0xCCCC, 0x8888, 0xEEEE, 0xECC8, 0xC880, 0xFEEC, 0xFEC8, 0xEC80, 0xC800, 0xFFEC, 0xFE80, 0xE800, 0xFFE8, 0xFF00, 0xFFF0, 0xF000,
+        0xF710, 0x008E, 0x7100, 0x08CE, 0x008C, 0x7310, 0x3100, 0x8CCE, 0x088C, 0x3110, 0x6666, 0x366C, 0x17E8, 0x0FF0, 0x718E, 0x399C,
+        0xAAAA, 0xF0F0, 0x5A5A, 0x33CC, 0x3C3C, 0x55AA, 0x9696, 0xA55A, 0x73CE, 0x13C8, 0x324C, 0x3BDC, 0x6996, 0xC33C, 0x9966, 0x0660,
+        0x0272, 0x04E4, 0x4E40, 0x2720, 0xC936, 0x936C, 0x39C6, 0x639C, 0x9336, 0x9CC6, 0x817E, 0xE718, 0xCCF0, 0x0FCC, 0x7744, 0xEE22,
+    };
+
+    constexpr uint32_t bc7_partitions3[64] = {
+        0xAA685050, 0x6A5A5040, 0x5A5A4200, 0x5450A0A8, 0xA5A50000, 0xA0A05050, 0x5555A0A0, 0x5A5A5050,
+        0xAA550000, 0xAA555500, 0xAAAA5500, 0x90909090, 0x94949494, 0xA4A4A4A4, 0xA9A59450, 0x2A0A4250,
+        0xA5945040, 0x0A425054, 0xA5A5A500, 0x55A0A0A0, 0xA8A85454, 0x6A6A4040, 0xA4A45000, 0x1A1A0500,
+        0x0050A4A4, 0xAAA59090, 0x14696914, 0x69691400, 0xA08585A0, 0xAA821414, 0x50A4A450, 0x6A5A0200,
+        0xA9A58000, 0x5090A0A8, 0xA8A09050, 0x24242424, 0x00AA5500, 0x24924924, 0x24499224, 0x50A50A50,
+        0x500AA550, 0xAAAA4444, 0x66660000, 0xA5A0A5A0, 0x50A050A0, 0x69286928, 0x44AAAA44, 0x66666600,
+        0xAA444444, 0x54A854A8, 0x95809580, 0x96969600, 0xA85454A8, 0x80959580, 0xAA141414, 0x96960000,
+        0xAAAA1414, 0xA05050A0, 0xA0A5A5A0, 0x96000000, 0x40804080, 0xA9A8A9A8, 0xAAAAAA44, 0x2A4A5254,
+    };
+
+    // The texel whose index has its top bit left out, for the second subset of two and the second and third of three
+    constexpr uint8_t bc7_anchors2[64] = {
+        15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+        15,  2,  8,  2,  2,  8,  8, 15,  2,  8,  2,  2,  8,  8,  2,  2,
+        15, 15,  6,  8,  2,  8, 15, 15,  2,  8,  2,  2,  2, 15, 15,  6,
+         6,  2,  6,  8, 15, 15,  2,  2, 15, 15, 15, 15, 15,  2,  2, 15,
+    };
+
+    constexpr uint8_t bc7_anchors3_second[64] = {
+         3,  3, 15, 15,  8,  3, 15, 15,  8,  8,  6,  6,  6,  5,  3,  3,
+         3,  3,  8, 15,  3,  3,  6, 10,  5,  8,  8,  6,  8,  5, 15, 15,
+         8, 15,  3,  5,  6, 10,  8, 15, 15,  3, 15,  5, 15, 15, 15, 15,
+         3, 15,  5,  5,  5,  8,  5, 10,  5, 10,  8, 13, 15, 12,  3,  3,
+    };
+
+    constexpr uint8_t bc7_anchors3_third[64] = {
+        15,  8,  8,  3, 15, 15,  3,  8, 15, 15, 15, 15, 15, 15, 15,  8,
+        15,  8, 15,  3, 15,  8, 15,  8,  3, 15,  6, 10, 15, 15, 10,  8,
+        15,  3, 15, 10, 10,  8,  9, 10,  6, 15,  8, 15,  3,  6,  6,  8,
+        15,  3, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,  3, 15, 15,  8,
+    };
+
+    constexpr uint8_t bc7_weights2[4] = {0, 21, 43, 64};
+    constexpr uint8_t bc7_weights3[8] = {0, 9, 18, 27, 37, 46, 55, 64};
+    constexpr uint8_t bc7_weights4[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+    class BitReader {
+    public:
+        BitReader(const uint8_t *data) : data(data) {}
+
+        uint32_t read(uint32_t count) {
+            uint32_t value = 0;
+            for(uint32_t i = 0; i < count; i++, position++) {
+                value |= (uint32_t)((data[position >> 3] >> (position & 7)) & 1) << i;
+            }
+            return value;
+        }
+
+    private:
+        const uint8_t *data;
+        uint32_t position = 0;
+    };
+
+    uint32_t bc7_interpolate(uint32_t first, uint32_t second, uint32_t index, uint32_t index_bits) {
+        const uint8_t *weights = index_bits == 2 ? bc7_weights2 : index_bits == 3 ? bc7_weights3 : bc7_weights4;
+        return ((64 - weights[index]) * first + weights[index] * second + 32) >> 6;
+    }
+
+    void decode_bc7(const uint8_t *block, uint32_t *output, size_t stride) {
+        uint32_t mode = 0;
+        while(mode < 8 && !((block[0] >> mode) & 1)) {
+            mode++;
+        }
+        if(mode == 8) {
+            // Reserved mode, decoded as transparent black
+            for(uint32_t i = 0; i < 16; i++) {
+                output[(i / 4) * stride + i % 4] = 0;
+            }
+            return;
+        }
+        const Bc7Mode &info = bc7_modes[mode];
+        BitReader reader(block);
+        reader.read(mode + 1);
+        uint32_t partition = reader.read(info.partition_bits);
+        uint32_t rotation = reader.read(info.rotation_bits);
+        uint32_t index_selection = reader.read(info.index_selection_bits);
+
+        uint32_t endpoints[3][2][4] = {};
+        for(uint32_t channel = 0; channel < 4; channel++) {
+            uint32_t bits = channel < 3 ? info.color_bits : info.alpha_bits;
+            for(uint32_t subset = 0; subset < info.subsets; subset++) {
+                for(uint32_t endpoint = 0; endpoint < 2; endpoint++) {
+                    endpoints[subset][endpoint][channel] = reader.read(bits);
+                }
+            }
+        }
+        uint32_t pbits[3][2] = {};
+        for(uint32_t subset = 0; subset < info.subsets; subset++) {
+            for(uint32_t endpoint = 0; endpoint < 2; endpoint++) {
+                if(info.endpoint_pbits) {
+                    pbits[subset][endpoint] = reader.read(1);
+                } else if(info.shared_pbits && endpoint == 0) {
+                    pbits[subset][0] = pbits[subset][1] = reader.read(1);
+                }
+            }
+        }
+        uint32_t has_pbit = info.endpoint_pbits | info.shared_pbits;
+        for(uint32_t subset = 0; subset < info.subsets; subset++) {
+            for(uint32_t endpoint = 0; endpoint < 2; endpoint++) {
+                for(uint32_t channel = 0; channel < 4; channel++) {
+                    uint32_t &value = endpoints[subset][endpoint][channel];
+                    uint32_t bits = channel < 3 ? info.color_bits : info.alpha_bits;
+                    if(bits == 0) {
+                        value = 255;
+                        continue;
+                    }
+                    value = (value << has_pbit) | (has_pbit ? pbits[subset][endpoint] : 0);
+                    bits += has_pbit;
+                    value = (value << (8 - bits)) | (value >> (2 * bits - 8));
+                }
+            }
+        }
+
+        uint32_t subsets[16] = {}, anchors[3] = {0, 0, 0};
+        for(uint32_t i = 0; i < 16; i++) {
+            if(info.subsets == 2) {
+                subsets[i] = (bc7_partitions2[partition] >> i) & 1;
+            } else if(info.subsets == 3) {
+                subsets[i] = (bc7_partitions3[partition] >> (2 * i)) & 3;
+            }
+        }
+        if(info.subsets == 2) {
+            anchors[1] = bc7_anchors2[partition];
+        } else if(info.subsets == 3) {
+            anchors[1] = bc7_anchors3_second[partition];
+            anchors[2] = bc7_anchors3_third[partition];
+        }
+        uint32_t indices[16], secondary_indices[16] = {};
+        for(uint32_t i = 0; i < 16; i++) {
+            bool anchor = i == anchors[subsets[i]];
+            indices[i] = reader.read(info.index_bits - (anchor ? 1 : 0));
+        }
+        if(info.secondary_index_bits) {
+            for(uint32_t i = 0; i < 16; i++) {
+                secondary_indices[i] = reader.read(info.secondary_index_bits - (i == 0 ? 1 : 0));
+            }
+        }
+
+        for(uint32_t i = 0; i < 16; i++) {
+            const uint32_t (&first)[4] = endpoints[subsets[i]][0], (&second)[4] = endpoints[subsets[i]][1];
+            uint32_t color_index = indices[i], color_bits = info.index_bits;
+            uint32_t alpha_index = indices[i], alpha_bits = info.index_bits;
+            if(info.secondary_index_bits) {
+                if(index_selection) {
+                    color_index = secondary_indices[i];
+                    color_bits = info.secondary_index_bits;
+                } else {
+                    alpha_index = secondary_indices[i];
+                    alpha_bits = info.secondary_index_bits;
+                }
+            }
+            uint32_t texel[4];
+            for(uint32_t channel = 0; channel < 3; channel++) {
+                texel[channel] = bc7_interpolate(first[channel], second[channel], color_index, color_bits);
+            }
+            texel[3] = bc7_interpolate(first[3], second[3], alpha_index, alpha_bits);
+            if(rotation > 0) {
+                std::swap(texel[3], texel[rotation - 1]);
+            }
+            output[(i / 4) * stride + i % 4] = texel[0] | texel[1] << 8 | texel[2] << 16 | texel[3] << 24;
+        }
+    }
+
+#ifdef WARPGATE_BC_SIMD
+    /**
+     * For every possible row of four 2 bit indices, the byte shuffle that picks those palette entries
+     * out of a vector holding the whole 4 entry palette.
+     */
+    struct RowShuffles {
+        alignas(16) uint8_t masks[256][16];
+
+        RowShuffles() {
+            for(uint32_t row = 0; row < 256; row++) {
+                for(uint32_t texel = 0; texel < 4; texel++) {
+                    uint32_t index = (row >> (2 * texel)) & 3;
+                    for(uint32_t byte = 0; byte < 4; byte++) {
+                        masks[row][texel * 4 + byte] = (uint8_t)(index * 4 + byte);
+                    }
+                }
+            }
+        }
+    };
+
+    const RowShuffles row_shuffles;
+
+    void decode_colors(const uint8_t *block, bool punchthrough, const uint8_t *alpha, uint32_t *output, size_t stride) {
+        std::array<uint32_t, 4> palette = color_palette(block, punchthrough);
+        __m128i palette_vector = _mm_loadu_si128((const __m128i*)palette.data());
+        uint32_t indices = read_u32(block + 4);
+        for(uint32_t y = 0; y < 4; y++) {
+            __m128i mask = _mm_load_si128((const __m128i*)row_shuffles.masks[(indices >> (8 * y)) & 0xFF]);
+            __m128i row = _mm_shuffle_epi8(palette_vector, mask);
+            if(alpha != nullptr) {
+                __m128i row_alpha = _mm_slli_epi32(_mm_cvtepu8_epi32(_mm_cvtsi32_si128((int)read_u32(alpha + 4 * y))), 24);
+                row = _mm_or_si128(_mm_and_si128(row, _mm_set1_epi32(0x00FFFFFF)), row_alpha);
+            }
+            _mm_storeu_si128((__m128i*)(output + y * stride), row);
+        }
+    }
+
+    void decode_channels(const uint8_t *red, const uint8_t *green, uint32_t *output, size_t stride) {
+        __m128i opaque = _mm_set1_epi32((int)0xFF000000);
+        for(uint32_t y = 0; y < 4; y++) {
+            __m128i row = _mm_or_si128(opaque, _mm_cvtepu8_epi32(_mm_cvtsi32_si128((int)read_u32(red + 4 * y))));
+            if(green != nullptr) {
+                row = _mm_or_si128(row, _mm_slli_epi32(_mm_cvtepu8_epi32(_mm_cvtsi32_si128((int)read_u32(green + 4 * y))), 8));
+            }
+            _mm_storeu_si128((__m128i*)(output + y * stride), row);
+        }
+    }
+#else
+    void decode_colors(const uint8_t *block, bool punchthrough, const uint8_t *alpha, uint32_t *output, size_t stride) {
+        std::array<uint32_t, 4> palette = color_palette(block, punchthrough);
+        uint32_t indices = read_u32(block + 4);
+        for(uint32_t i = 0; i < 16; i++) {
+            uint32_t color = palette[(indices >> (2 * i)) & 3];
+            if(alpha != nullptr) {
+                color = (color & 0x00FFFFFF) | (uint32_t)alpha[i] << 24;
+            }
+            output[(i / 4) * stride + i % 4] = color;
+        }
+    }
+
+    void decode_channels(const uint8_t *red, const uint8_t *green, uint32_t *output, size_t stride) {
+        for(uint32_t i = 0; i < 16; i++) {
+            output[(i / 4) * stride + i % 4] = 0xFF000000 | red[i] | (green != nullptr ? (uint32_t)green[i] << 8 : 0);
+        }
+    }
+#endif
+}
+
+size_t utils::textures::bc::block_size(Format format) {
+    return format == Format::BC1 || format == Format::BC4 ? 8 : 16;
+}
+
+size_t utils::textures::bc::level_size(Format format, uint32_t width, uint32_t height) {
+    return (size_t)((width + 3) / 4) * ((height + 3) / 4) * block_size(format);
+}
+
+void utils::textures::bc::decode_block(Format format, const uint8_t *block, uint32_t *output, size_t stride) {
+    std::array<uint8_t, 16> alpha, green;
+    switch(format) {
+    case Format::BC1:
+        decode_colors(block, true, nullptr, output, stride);
+        break;
+    case Format::BC2:
+        alpha = bc2_alpha(block);
+        decode_colors(block + 8, false, alpha.data(), output, stride);
+        break;
+    case Format::BC3:
+        alpha = bc3_alpha(block);
+        decode_colors(block + 8, false, alpha.data(), output, stride);
+        break;
+    case Format::BC4:
+        alpha = bc3_alpha(block);
+        decode_channels(alpha.data(), nullptr, output, stride);
+        break;
+    case Format::BC5:
+        alpha = bc3_alpha(block);
+        green = bc3_alpha(block + 8);
+        decode_channels(alpha.data(), green.data(), output, stride);
+        break;
+    case Format::BC7:
+        decode_bc7(block, output, stride);
+        break;
+    }
+}
+
+void utils::textures::bc::decode_block_row(Format format, const uint8_t *blocks, uint32_t width, uint32_t *output, size_t stride) {
+    size_t block_bytes = block_size(format);
+    for(uint32_t block_x = 0; block_x < (width + 3) / 4; block_x++) {
+        decode_block(format, blocks + block_x * block_bytes, output + block_x * 4, stride);
+    }
+}
+
+std::optional<utils::textures::Image> utils::textures::bc::decode(Format format, std::span<const uint8_t> blocks, uint32_t width, uint32_t height, std::optional<Region> region) {
+    if(blocks.size() < level_size(format, width, height)) {
+        return {};
+    }
+    Region area = region.value_or(Region{0, 0, width, height});
+    if(area.x >= width || area.y >= height) {
+        return {};
+    }
+    area.width = std::min(area.width, width - area.x);
+    area.height = std::min(area.height, height - area.y);
+
+    Image image(area.width, area.height);
+    size_t block_bytes = block_size(format), blocks_per_row = (width + 3) / 4;
+    uint32_t block_x_end = (area.x + area.width + 3) / 4, block_y_begin = area.y / 4, block_y_end = (area.y + area.height + 3) / 4;
+    // Bands of whole block rows, each writing rows of its own
+    scheduler::parallel_rows(area.width, (block_y_end - block_y_begin) * 4, [&](uint32_t first_row, uint32_t end_row) {
+        alignas(16) uint32_t texels[16];
+        for(uint32_t block_y = block_y_begin + first_row / 4; block_y < block_y_begin + end_row / 4; block_y++) {
+            for(uint32_t block_x = area.x / 4; block_x < block_x_end; block_x++) {
+                const uint8_t *block = blocks.data() + (block_y * blocks_per_row + block_x) * block_bytes;
+                int64_t left = (int64_t)block_x * 4 - area.x, top = (int64_t)block_y * 4 - area.y;
+                if(left >= 0 && top >= 0 && left + 4 <= area.width && top + 4 <= area.height) {
+                    decode_block(format, block, image.row((uint32_t)top) + left, image.width);
+                    continue;
+                }
+
+                // Blocks on the edge of the region are decoded aside and clipped
+                decode_block(format, block, texels, 4);
+                uint32_t x_begin = (uint32_t)std::max<int64_t>(0, -left), x_end = (uint32_t)std::min<int64_t>(4, area.width - left);
+                uint32_t y_begin = (uint32_t)std::max<int64_t>(0, -top), y_end = (uint32_t)std::min<int64_t>(4, area.height - top);
+                for(uint32_t y = y_begin; y < y_end; y++) {
+                    std::memcpy(image.row((uint32_t)(top + y)) + left + x_begin, texels + y * 4 + x_begin, (x_end - x_begin) * sizeof(uint32_t));
+                }
+            }
+        }
+    });
+    return image;
+}
@@ -0,0 +1,125 @@
+#include "utils/textures/cache.h"
+
+#include <atomic>
+#include <thread>
+
+#include <spdlog/spdlog.h>
+
+#include "utils/archive.h"
+#include "utils/textures.h"
+
+namespace logger = spdlog;
+using namespace warpgate;
+
+namespace {
+    std::filesystem::path cache_directory;
+    bool cache_enabled = false;
+
+    std::filesystem::path entry_path(const utils::hash::Hash128 &key) {
+        std::string name = key.hex();
+        return cache_directory / "textures" / name.substr(0, 2) / name;
+    }
+
+    std::filesystem::path entry_file(const std::filesystem::path &entry, size_t index, const std::filesystem::path &output) {
+        return entry / (std::to_string(index) + output.extension().string());
+    }
+}
+
+void utils::textures::cache::init_cache(std::filesystem::path directory) {
+    try {
+        std::filesystem::create_directories(directory / "textures");
+    } catch(std::filesystem::filesystem_error &err) {
+        logger::error("Failed to create texture cache directory {}: {}", err.path1().string(), err.what());
+        return;
+    }
+    cache_directory = directory;
+    cache_enabled = true;
+    logger::info("Using texture cache at {}", cache_directory.string());
+}
+
+bool utils::textures::cache::enabled() {
+    return cache_enabled;
+}
+
+std::optional<utils::hash::Hash128> utils::textures::cache::texture_key(Mode mode, std::initializer_list<std::span<const uint8_t>> sources) {
+    if(!cache_enabled || archive::enabled()) {
+        // Outputs written into an archive never reach the disk to be linked into the cache
+        return {};
+    }
+    if(output_format() == OutputFormat::PNG && mips::filter() != mips::Filter::None) {
+        // Mip levels are written to files of their own that the callers don't list as outputs
+        return {};
+    }
+    hash::Hash128 key = hash::hash128(std::string_view("texture"), format_version);
+    key = hash::combine(key, (uint64_t)mode);
+    key = hash::combine(key, (uint64_t)output_format());
+    key = hash::combine(key, (uint64_t)max_texture_size());
+    key = hash::combine(key, (uint64_t)mips::filter());
+    key = hash::combine(key, (uint64_t)pack_orm());
+    if(output_format() == OutputFormat::PNG) {
+        key = hash::combine(key, (uint64_t)png::settings().level << 1 | (uint64_t)png::settings().adaptive_filter);
+    } else {
+        key = hash::combine(key, (uint64_t)encoder::quality());
+    }
+    for(std::span<const uint8_t> source : sources) {
+        key = hash::combine(key, hash::hash128(source));
+    }
+    return key;
+}
+
+bool utils::textures::cache::fetch(const hash::Hash128 &key, std::span<const std::filesystem::path> outputs) {
+    if(!cache_enabled) {
+        return false;
+    }
+    std::filesystem::path entry = entry_path(key);
+    std::error_code ec;
+    for(size_t i = 0; i < outputs.size(); i++) {
+        if(!std::filesystem::is_regular_file(entry_file(entry, i, outputs[i]), ec)) {
+            return false;
+        }
+    }
+    for(size_t i = 0; i < outputs.size(); i++) {
+        std::filesystem::path cached = entry_file(entry, i, outputs[i]);
+        std::filesystem::remove(outputs[i], ec);
+        std::filesystem::create_hard_link(cached, outputs[i], ec);
+        if(ec && !std::filesystem::copy_file(cached, outputs[i], std::filesystem::copy_options::overwrite_existing, ec)) {
+            logger::warn("Could not place cached texture {}: {}", outputs[i].string(), ec.message());
+            return false;
+        }
+    }
+    logger::debug("Texture cache hit {}", key.hex());
+    return true;
+}
+
+void utils::textures::cache::store(const hash::Hash128 &key, std::span<const std::filesystem::path> outputs) {
+    if(!cache_enabled) {
+        return;
+    }
+    std::error_code ec;
+    for(const std::filesystem::path &output : outputs) {
+        if(!std::filesystem::is_regular_file(output, ec)) {
+            return;
+        }
+    }
+    static std::atomic<uint32_t> temp_counter = 0;
+    std::filesystem::path entry = entry_path(key);
+    std::filesystem::path temp_entry = entry;
+    temp_entry += ".tmp" + std::to_string(std::hash<std::thread::id>{}(std::this_thread::get_id())) + "_" + std::to_string(temp_counter++);
+    try {
+        std::filesystem::create_directories(temp_entry);
+        for(size_t i = 0; i < outputs.size(); i++) {
+            std::filesystem::copy_file(outputs[i], entry_file(temp_entry, i, outputs[i]), std::filesystem::copy_options::overwrite_existing);
+        }
+        std::filesystem::rename(temp_entry, entry, ec);
+        if(ec) {
+            // Another exporter stored the same entry first
+            std::filesystem::remove_all(temp_entry);
+            return;
+        }
+    } catch(std::filesystem::filesystem_error &err) {
+        logger::warn("Failed to store texture cache entry {}: {}", entry.string(), err.what());
+        std::filesystem::remove_all(temp_entry, ec);
+        return;
+    }
+    logger::debug("Stored texture cache entry {}", key.hex());
+}
@@ -0,0 +1,94 @@
+#include "utils/textures/container.h"
+
+#include <cstring>
+
+using namespace warpgate;
+
+namespace {
+    template <typename T>
+    void put(std::vector<uint8_t> &output, T value) {
+        size_t offset = output.size();
+        output.resize(offset + sizeof(T));
+        std::memcpy(output.data() + offset, &value, sizeof(T));
+    }
+
+    constexpr uint32_t fourcc(const char code[5]) {
+        return (uint32_t)code[0] | (uint32_t)code[1] << 8 | (uint32_t)code[2] << 16 | (uint32_t)code[3] << 24;
+    }
+
+    // DXGI format values used by the DDS DX10 header
+    uint32_t dxgi_format(std::optional<utils::textures::bc::Format> format, bool srgb) {
+        if(!format) {
+            return srgb ? 29 : 28; // DXGI_FORMAT_R8G8B8A8_UNORM_SRGB / _UNORM
+        }
+        switch(*format) {
+        case utils::textures::bc::Format::BC1:
+            return srgb ? 72 : 71; // DXGI_FORMAT_BC1_UNORM_SRGB / _UNORM
+        case utils::textures::bc::Format::BC2:
+            return srgb ? 75 : 74;
+        case utils::textures::bc::Format::BC3:
+            return srgb ? 78 : 77;
+        case utils::textures::bc::Format::BC4:
+            return 80; // DXGI_FORMAT_BC4_UNORM
+        case utils::textures::bc::Format::BC5:
+            return 83; // DXGI_FORMAT_BC5_UNORM
+        case utils::textures::bc::Format::BC7:
+            return srgb ? 99 : 98; // DXGI_FORMAT_BC7_UNORM_SRGB / _UNORM
+        }
+        return 0;
+    }
+}
+
+std::vector<uint8_t> utils::textures::container::write_dds(std::optional<bc::Format> format, bool srgb, std::span<const Level> levels) {
+    constexpr uint32_t caps = 0x1, height = 0x2, width = 0x4, pitch = 0x8, pixel_format = 0x1000, mipmap_count = 0x20000, linear_size = 0x80000;
+    constexpr uint32_t has_fourcc = 0x4, rgb = 0x40, alpha_pixels = 0x1;
+    constexpr uint32_t complex = 0x8, texture = 0x1000, mipmap = 0x400000;
+    std::vector<uint8_t> output;
+    if(levels.empty()) {
+        return output;
+    }
+    // BC4 and BC5 have no sRGB variant. Everything else that is sRGB, and BC7 always, needs the DX10 extended header.
+    srgb = srgb && format != bc::Format::BC4 && format != bc::Format::BC5;
+    bool extended = srgb || format == bc::Format::BC7;
+    put<uint32_t>(output, fourcc("DDS "));
+    put<uint32_t>(output, 124);
+    uint32_t flags = caps | height | width | pixel_format | (format ? linear_size : pitch) | (levels.size() > 1 ? mipmap_count : 0);
+    put<uint32_t>(output, flags);
+    put<uint32_t>(output, levels[0].height);
+    put<uint32_t>(output, levels[0].width);
+    put<uint32_t>(output, format ? (uint32_t)levels[0].data.size() : levels[0].width * 4);
+    put<uint32_t>(output, 0); // depth
+    put<uint32_t>(output, (uint32_t)levels.size());
+    output.resize(output.size() + 11 * sizeof(uint32_t));
+
+    put<uint32_t>(output, 32);
+    if(format || extended) {
+        static const char *codes[] = {"DXT1", "DXT3", "DXT5", "ATI1", "ATI2", "DX10"};
+        put<uint32_t>(output, has_fourcc);
+        put<uint32_t>(output, fourcc(extended ? "DX10" : codes[(int)*format]));
+        output.resize(output.size() + 5 * sizeof(uint32_t));
+    } else {
+        put<uint32_t>(output, rgb | alpha_pixels);
+        put<uint32_t>(output, 0);
+        put<uint32_t>(output, 32);
+        put<uint32_t>(output, 0x000000FF);
+        put<uint32_t>(output, 0x0000FF00);
+        put<uint32_t>(output, 0x00FF0000);
+        put<uint32_t>(output, 0xFF000000);
+    }
+    put<uint32_t>(output, texture | (levels.size() > 1 ? complex | mipmap : 0));
+    output.resize(output.size() + 4 * sizeof(uint32_t));
+
+    if(extended) {
+        put<uint32_t>(output, dxgi_format(format, srgb));
+        put<uint32_t>(output, 3); // texture 2D
+        put<uint32_t>(output, 0);
+        put<uint32_t>(output, 1); // array size
+        put<uint32_t>(output, 0);
+    }
+
+    for(const Level &level : levels) {
+        output.insert(output.end(), level.data.begin(), level.data.end());
+    }
+    return output;
+}
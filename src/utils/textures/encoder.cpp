@@ -0,0 +1,404 @@
+#include "utils/textures/encoder.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+
+#include "utils/textures/scheduler.h"
+
+using namespace warpgate;
+
+namespace {
+    using utils::textures::encoder::Quality;
+
+    Quality encoder_quality = Quality::Default;
+
+    std::array<int, 8> bc4_palette(int first, int second) {
+        std::array<int, 8> palette = {first, second};
+        if(first > second) {
+            for(int i = 1; i < 7; i++) {
+                palette[i + 1] = ((7 - i) * first + i * second + 3) / 7;
+            }
+        } else {
+            for(int i = 1; i < 5; i++) {
+                palette[i + 1] = ((5 - i) * first + i * second + 2) / 5;
+            }
+            palette[6] = 0;
+            palette[7] = 255;
+        }
+        return palette;
+    }
+
+    struct Bc4Fit {
+        int first, second;
+        uint64_t indices;
+        uint32_t error;
+    };
+
+    Bc4Fit fit_bc4(const std::array<uint8_t, 16> &values, int first, int second) {
+        std::array<int, 8> palette = bc4_palette(first, second);
+        Bc4Fit fit{first, second, 0, 0};
+        for(uint32_t i = 0; i < 16; i++) {
+            uint32_t best = 0, best_error = UINT32_MAX;
+            for(uint32_t index = 0; index < 8; index++) {
+                uint32_t error = (uint32_t)((palette[index] - values[i]) * (palette[index] - values[i]));
+                if(error < best_error) {
+                    best = index;
+                    best_error = error;
+                }
+            }
+            fit.indices |= (uint64_t)best << (3 * i);
+            fit.error += best_error;
+        }
+        return fit;
+    }
+
+    void encode_bc4(const std::array<uint8_t, 16> &values, Quality quality, uint8_t *output) {
+        auto [low, high] = std::minmax_element(values.begin(), values.end());
+        Bc4Fit best = fit_bc4(values, *high, *low);
+        if(quality != Quality::Fast && best.error > 0) {
+            // Six steps between the extremes of everything but 0 and 255, which have entries of their own
+            int inner_low = 255, inner_high = 0;
+            for(uint8_t value : values) {
+                if(value != 0 && value != 255) {
+                    inner_low = std::min<int>(inner_low, value);
+                    inner_high = std::max<int>(inner_high, value);
+                }
+            }
+            if(inner_low <= inner_high) {
+                Bc4Fit candidate = fit_bc4(values, inner_low, inner_high);
+                if(candidate.error < best.error) {
+                    best = candidate;
+                }
+            }
+        }
+        if(quality == Quality::Best && best.error > 0) {
+            // Pulling the endpoints in can bring the steps between them closer to more values than the extremes lose
+            Bc4Fit start = best;
+            bool eight_values = start.first > start.second;
+            for(int first_offset = -3; first_offset <= 3; first_offset++) {
+                for(int second_offset = -3; second_offset <= 3; second_offset++) {
+                    int first = std::clamp(start.first + first_offset, 0, 255), second = std::clamp(start.second + second_offset, 0, 255);
+                    if((first > second) != eight_values) {
+                        continue;
+                    }
+                    Bc4Fit candidate = fit_bc4(values, first, second);
+                    if(candidate.error < best.error) {
+                        best = candidate;
+                    }
+                }
+            }
+        }
+        output[0] = (uint8_t)best.first;
+        output[1] = (uint8_t)best.second;
+        for(uint32_t i = 0; i < 6; i++) {
+            output[2 + i] = (uint8_t)(best.indices >> (8 * i));
+        }
+    }
+
+    std::array<uint8_t, 16> channel_values(const uint32_t *pixels, size_t stride, uint32_t shift) {
+        std::array<uint8_t, 16> values;
+        for(uint32_t i = 0; i < 16; i++) {
+            values[i] = (uint8_t)(pixels[(i / 4) * stride + i % 4] >> shift);
+        }
+        return values;
+    }
+
+    // BC7 blocks are always written in mode 6: one subset, 7 bit RGBA endpoints with a p-bit each and 4 bit indices
+    constexpr int bc7_weights[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+    using Color = std::array<float, 4>;
+
+    struct Bc7Fit {
+        std::array<int, 4> first, second;
+        int first_pbit, second_pbit;
+        std::array<uint8_t, 16> indices;
+        uint64_t error;
+    };
+
+    /**
+     * The nearest 7 bit endpoint to color, with the p-bit appended as each channel's lowest bit
+     */
+    std::array<int, 4> quantize(const Color &color, int pbit) {
+        std::array<int, 4> quantized;
+        for(uint32_t channel = 0; channel < 4; channel++) {
+            quantized[channel] = std::clamp((int)std::lround((color[channel] - pbit) / 2.0f), 0, 127);
+        }
+        return quantized;
+    }
+
+    float quantization_error(const Color &color, int pbit) {
+        std::array<int, 4> quantized = quantize(color, pbit);
+        float error = 0;
+        for(uint32_t channel = 0; channel < 4; channel++) {
+            float difference = (float)(quantized[channel] * 2 + pbit) - color[channel];
+            error += difference * difference;
+        }
+        return error;
+    }
+
+    /**
+     * Quantizes the endpoints with the given p-bits and picks the nearest of the 16 interpolated colors for each texel
+     */
+    Bc7Fit fit_bc7(const std::array<uint32_t, 16> &texels, const Color &first, const Color &second, int first_pbit, int second_pbit) {
+        Bc7Fit fit{quantize(first, first_pbit), quantize(second, second_pbit), first_pbit, second_pbit, {}, 0};
+        std::array<std::array<int, 4>, 16> palette;
+        for(uint32_t index = 0; index < 16; index++) {
+            for(uint32_t channel = 0; channel < 4; channel++) {
+                int a = fit.first[channel] * 2 + first_pbit, b = fit.second[channel] * 2 + second_pbit;
+                palette[index][channel] = ((64 - bc7_weights[index]) * a + bc7_weights[index] * b + 32) >> 6;
+            }
+        }
+        for(uint32_t i = 0; i < 16; i++) {
+            uint32_t best = 0, best_error = UINT32_MAX;
+            for(uint32_t index = 0; index < 16; index++) {
+                uint32_t error = 0;
+                for(uint32_t channel = 0; channel < 4; channel++) {
+                    int difference = palette[index][channel] - (int)((texels[i] >> (8 * channel)) & 0xFF);
+                    error += (uint32_t)(difference * difference);
+                }
+                if(error < best_error) {
+                    best = index;
+                    best_error = error;
+                }
+            }
+            fit.indices[i] = (uint8_t)best;
+            fit.error += best_error;
+        }
+        return fit;
+    }
+
+    Bc7Fit fit_bc7(const std::array<uint32_t, 16> &texels, const Color &first, const Color &second, bool all_pbits) {
+        if(all_pbits) {
+            Bc7Fit best = fit_bc7(texels, first, second, 0, 0);
+            for(int pbits = 1; pbits < 4; pbits++) {
+                Bc7Fit candidate = fit_bc7(texels, first, second, pbits & 1, pbits >> 1);
+                if(candidate.error < best.error) {
+                    best = candidate;
+                }
+            }
+            return best;
+        }
+        int first_pbit = quantization_error(first, 1) < quantization_error(first, 0) ? 1 : 0;
+        int second_pbit = quantization_error(second, 1) < quantization_error(second, 0) ? 1 : 0;
+        return fit_bc7(texels, first, second, first_pbit, second_pbit);
+    }
+
+    /**
+     * Endpoints at the extremes of the texels projected onto their principal axis, found by power iteration
+     */
+    std::pair<Color, Color> principal_endpoints(const std::array<Color, 16> &colors) {
+        Color mean = {}, low = colors[0], high = colors[0];
+        for(const Color &color : colors) {
+            for(uint32_t channel = 0; channel < 4; channel++) {
+                mean[channel] += color[channel] / 16;
+                low[channel] = std::min(low[channel], color[channel]);
+                high[channel] = std::max(high[channel], color[channel]);
+            }
+        }
+        float covariance[4][4] = {};
+        for(const Color &color : colors) {
+            for(uint32_t row = 0; row < 4; row++) {
+                for(uint32_t column = 0; column < 4; column++) {
+                    covariance[row][column] += (color[row] - mean[row]) * (color[column] - mean[column]);
+                }
+            }
+        }
+        Color axis;
+        for(uint32_t channel = 0; channel < 4; channel++) {
+            axis[channel] = high[channel] - low[channel];
+        }
+        for(uint32_t iteration = 0; iteration < 8; iteration++) {
+            Color next = {};
+            float length = 0;
+            for(uint32_t row = 0; row < 4; row++) {
+                for(uint32_t column = 0; column < 4; column++) {
+                    next[row] += covariance[row][column] * axis[column];
+                }
+                length = std::max(length, std::abs(next[row]));
+            }
+            if(length == 0) {
+                break;
+            }
+            for(uint32_t channel = 0; channel < 4; channel++) {
+                axis[channel] = next[channel] / length;
+            }
+        }
+        float length = std::sqrt(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2] + axis[3] * axis[3]);
+        if(length == 0) {
+            return {mean, mean};
+        }
+        float low_projection = 0, high_projection = 0;
+        for(const Color &color : colors) {
+            float projection = 0;
+            for(uint32_t channel = 0; channel < 4; channel++) {
+                projection += (color[channel] - mean[channel]) * axis[channel] / length;
+            }
+            low_projection = std::min(low_projection, projection);
+            high_projection = std::max(high_projection, projection);
+        }
+        Color first, second;
+        for(uint32_t channel = 0; channel < 4; channel++) {
+            first[channel] = std::clamp(mean[channel] + low_projection * axis[channel] / length, 0.0f, 255.0f);
+            second[channel] = std::clamp(mean[channel] + high_projection * axis[channel] / length, 0.0f, 255.0f);
+        }
+        return {first, second};
+    }
+
+    /**
+     * The endpoints that minimize the squared error for fixed indices. Returns false if every texel uses the same weight.
+     */
+    bool least_squares(const std::array<Color, 16> &colors, const Bc7Fit &fit, Color &first, Color &second) {
+        float aa = 0, ab = 0, bb = 0;
+        Color ax = {}, bx = {};
+        for(uint32_t i = 0; i < 16; i++) {
+            float b = bc7_weights[fit.indices[i]] / 64.0f, a = 1 - b;
+            aa += a * a;
+            ab += a * b;
+            bb += b * b;
+            for(uint32_t channel = 0; channel < 4; channel++) {
+                ax[channel] += a * colors[i][channel];
+                bx[channel] += b * colors[i][channel];
+            }
+        }
+        float determinant = aa * bb - ab * ab;
+        if(std::abs(determinant) < 1e-6f) {
+            return false;
+        }
+        for(uint32_t channel = 0; channel < 4; channel++) {
+            first[channel] = std::clamp((bb * ax[channel] - ab * bx[channel]) / determinant, 0.0f, 255.0f);
+            second[channel] = std::clamp((aa * bx[channel] - ab * ax[channel]) / determinant, 0.0f, 255.0f);
+        }
+        return true;
+    }
+
+    class BitWriter {
+    public:
+        BitWriter(uint8_t *data, size_t size) : data(data) {
+            std::memset(data, 0, size);
+        }
+
+        void write(uint32_t value, uint32_t count) {
+            for(uint32_t i = 0; i < count; i++, position++) {
+                data[position >> 3] |= (uint8_t)(((value >> i) & 1) << (position & 7));
+            }
+        }
+
+    private:
+        uint8_t *data;
+        uint32_t position = 0;
+    };
+
+    void encode_bc7(const uint32_t *pixels, size_t stride, Quality quality, uint8_t *output) {
+        std::array<uint32_t, 16> texels;
+        std::array<Color, 16> colors;
+        for(uint32_t i = 0; i < 16; i++) {
+            texels[i] = pixels[(i / 4) * stride + i % 4];
+            for(uint32_t channel = 0; channel < 4; channel++) {
+                colors[i][channel] = (float)((texels[i] >> (8 * channel)) & 0xFF);
+            }
+        }
+
+        bool all_pbits = quality == Quality::Best;
+        auto [first, second] = principal_endpoints(colors);
+        Bc7Fit best = fit_bc7(texels, first, second, all_pbits);
+        uint32_t refinements = quality == Quality::Best ? 8 : quality == Quality::Default ? 2 : 0;
+        for(uint32_t iteration = 0; iteration < refinements && best.error > 0; iteration++) {
+            if(!least_squares(colors, best, first, second)) {
+                break;
+            }
+            Bc7Fit candidate = fit_bc7(texels, first, second, all_pbits);
+            if(candidate.error >= best.error) {
+                break;
+            }
+            best = candidate;
+        }
+
+        // The first texel's index has an implied top bit of 0, swap the endpoints if it needs a 1
+        if(best.indices[0] >= 8) {
+            std::swap(best.first, best.second);
+            std::swap(best.first_pbit, best.second_pbit);
+            for(uint8_t &index : best.indices) {
+                index = (uint8_t)(15 - index);
+            }
+        }
+
+        BitWriter writer(output, 16);
+        writer.write(1 << 6, 7);
+        for(uint32_t channel = 0; channel < 4; channel++) {
+            writer.write((uint32_t)best.first[channel], 7);
+            writer.write((uint32_t)best.second[channel], 7);
+        }
+        writer.write((uint32_t)best.first_pbit, 1);
+        writer.write((uint32_t)best.second_pbit, 1);
+        writer.write(best.indices[0], 3);
+        for(uint32_t i = 1; i < 16; i++) {
+            writer.write(best.indices[i], 4);
+        }
+    }
+}
+
+std::optional<utils::textures::encoder::Quality> utils::textures::encoder::parse_quality(std::string_view value) {
+    if(value == "none") {
+        return Quality::None;
+    } else if(value == "fast") {
+        return Quality::Fast;
+    } else if(value == "default") {
+        return Quality::Default;
+    } else if(value == "best") {
+        return Quality::Best;
+    }
+    return {};
+}
+
+void utils::textures::encoder::init_encoder(Quality quality) {
+    encoder_quality = quality;
+}
+
+utils::textures::encoder::Quality utils::textures::encoder::quality() {
+    return encoder_quality;
+}
+
+bool utils::textures::encoder::supported(bc::Format format) {
+    return format == bc::Format::BC4 || format == bc::Format::BC5 || format == bc::Format::BC7;
+}
+
+void utils::textures::encoder::encode_block(bc::Format format, const uint32_t *pixels, size_t stride, Quality quality, uint8_t *block) {
+    switch(format) {
+    case bc::Format::BC4:
+        encode_bc4(channel_values(pixels, stride, 0), quality, block);
+        break;
+    case bc::Format::BC5:
+        encode_bc4(channel_values(pixels, stride, 0), quality, block);
+        encode_bc4(channel_values(pixels, stride, 8), quality, block + 8);
+        break;
+    case bc::Format::BC7:
+        encode_bc7(pixels, stride, quality, block);
+        break;
+    default:
+        break;
+    }
+}
+
+std::vector<uint8_t> utils::textures::encoder::encode(bc::Format format, const uint32_t *pixels, uint32_t width, uint32_t height, Quality quality) {
+    if(quality == Quality::None || !supported(format) || width == 0 || height == 0) {
+        return {};
+    }
+    size_t block_bytes = bc::block_size(format);
+    uint32_t blocks_wide = (width + 3) / 4, blocks_high = (height + 3) / 4;
+    std::vector<uint8_t> blocks(bc::level_size(format, width, height));
+    scheduler::parallel_for(blocks_high, [&](size_t block_y) {
+        uint32_t texels[16];
+        for(uint32_t block_x = 0; block_x < blocks_wide; block_x++) {
+            for(uint32_t y = 0; y < 4; y++) {
+                const uint32_t *row = pixels + (size_t)std::min<uint32_t>((uint32_t)block_y * 4 + y, height - 1) * width;
+                for(uint32_t x = 0; x < 4; x++) {
+                    texels[y * 4 + x] = row[std::min(block_x * 4 + x, width - 1)];
+                }
+            }
+            encode_block(format, texels, 4, quality, blocks.data() + (block_y * blocks_wide + block_x) * block_bytes);
+        }
+    });
+    return blocks;
+}
@@ -0,0 +1,94 @@
+#include "utils/textures/image_cache.h"
+
+#include <future>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+#include <spdlog/spdlog.h>
+
+namespace logger = spdlog;
+using namespace warpgate;
+
+namespace {
+    struct Entry {
+        std::shared_future<std::shared_ptr<const utils::textures::Image>> image;
+        // Only set once the image is decoded, entries still being decoded can't be evicted
+        std::optional<std::list<std::string>::iterator> position;
+        size_t size = 0;
+    };
+
+    std::mutex cache_mutex;
+    std::unordered_map<std::string, Entry> entries;
+    std::list<std::string> recently_used;
+    size_t cache_capacity = 0, cache_used = 0;
+}
+
+void utils::textures::image_cache::init_image_cache(size_t capacity) {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    cache_capacity = capacity;
+}
+
+bool utils::textures::image_cache::enabled() {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    return cache_capacity > 0;
+}
+
+std::shared_ptr<const utils::textures::Image> utils::textures::image_cache::get(
+    const std::string &name, 
+    size_t level, 
+    const std::function<std::optional<Image>()> &decode
+) {
+    std::string key = name + ":" + std::to_string(level);
+    std::promise<std::shared_ptr<const Image>> promise;
+    {
+        std::unique_lock<std::mutex> lock(cache_mutex);
+        if(cache_capacity == 0) {
+            lock.unlock();
+            std::optional<Image> image = decode();
+            return image ? std::make_shared<const Image>(std::move(*image)) : nullptr;
+        }
+        auto entry = entries.find(key);
+        if(entry != entries.end()) {
+            if(entry->second.position) {
+                recently_used.splice(recently_used.begin(), recently_used, *entry->second.position);
+            }
+            std::shared_future<std::shared_ptr<const Image>> image = entry->second.image;
+            lock.unlock();
+            logger::trace("Image cache hit {}", key);
+            return image.get();
+        }
+        entries[key].image = promise.get_future().share();
+    }
+
+    std::shared_ptr<const Image> image;
+    try {
+        std::optional<Image> decoded = decode();
+        if(decoded) {
+            image = std::make_shared<const Image>(std::move(*decoded));
+        }
+    } catch(...) {
+        promise.set_exception(std::current_exception());
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        entries.erase(key);
+        throw;
+    }
+    promise.set_value(image);
+
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    if(!image) {
+        entries.erase(key);
+        return image;
+    }
+    Entry &entry = entries[key];
+    entry.size = image->pixels.size() * sizeof(uint32_t);
+    entry.position = recently_used.insert(recently_used.begin(), key);
+    cache_used += entry.size;
+    while(cache_used > cache_capacity && recently_used.back() != key) {
+        auto evicted = entries.find(recently_used.back());
+        cache_used -= evicted->second.size;
+        entries.erase(evicted);
+        recently_used.pop_back();
+    }
+    return image;
+}
@@ -0,0 +1,288 @@
+#include "utils/textures/mips.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define WARPGATE_MIPS_SIMD 1
+#include <emmintrin.h>
+#endif
+
+#include "utils/textures/scheduler.h"
+
+using namespace warpgate;
+
+namespace {
+    using utils::textures::mips::Content;
+    using utils::textures::mips::Filter;
+
+    Filter mip_filter = Filter::None;
+
+    // Output rows per band of next_level, each band filtered by one thread
+    constexpr uint32_t band_rows = 16;
+
+    uint32_t average(uint32_t a, uint32_t b, uint32_t c, uint32_t d) {
+        uint32_t result = 0;
+        for(uint32_t shift = 0; shift < 32; shift += 8) {
+            uint32_t sum = ((a >> shift) & 0xFF) + ((b >> shift) & 0xFF) + ((c >> shift) & 0xFF) + ((d >> shift) & 0xFF);
+            result |= ((sum + 2) >> 2) << shift;
+        }
+        return result;
+    }
+
+#ifdef WARPGATE_MIPS_SIMD
+    // Averages the 2x2 boxes of 4 pixels from each of two rows into 2 pixels
+    void average_pairs(const uint32_t *top, const uint32_t *bottom, uint32_t *output) {
+        const __m128i zero = _mm_setzero_si128();
+        __m128i first = _mm_loadu_si128((const __m128i*)top);
+        __m128i second = _mm_loadu_si128((const __m128i*)bottom);
+        __m128i low = _mm_add_epi16(_mm_unpacklo_epi8(first, zero), _mm_unpacklo_epi8(second, zero));
+        __m128i high = _mm_add_epi16(_mm_unpackhi_epi8(first, zero), _mm_unpackhi_epi8(second, zero));
+        low = _mm_add_epi16(low, _mm_srli_si128(low, 8));
+        high = _mm_add_epi16(high, _mm_srli_si128(high, 8));
+        __m128i sums = _mm_unpacklo_epi64(low, high);
+        sums = _mm_srli_epi16(_mm_add_epi16(sums, _mm_set1_epi16(2)), 2);
+        _mm_storel_epi64((__m128i*)output, _mm_packus_epi16(sums, zero));
+    }
+#endif
+
+    /**
+     * Taps of a separable 2:1 filter. Output pixel x covers source pixels 2x + first to 2x + first + weights.size() - 1.
+     */
+    struct Kernel {
+        int first;
+        std::vector<float> weights;
+    };
+
+    double bessel_i0(double x) {
+        double sum = 1, term = 1;
+        for(int k = 1; k < 32; k++) {
+            term *= (x / (2 * k)) * (x / (2 * k));
+            sum += term;
+        }
+        return sum;
+    }
+
+    Kernel kaiser_kernel() {
+        constexpr double pi = 3.14159265358979323846, alpha = 4, half_width = 4;
+        Kernel kernel{-3, {}};
+        double total = 0;
+        for(int tap = kernel.first; tap <= 4; tap++) {
+            // Distance from the output pixel's center, which lies between source pixels 2x and 2x + 1
+            double distance = tap - 0.5, t = distance / 2, ratio = distance / half_width;
+            double sinc = std::sin(pi * t) / (pi * t);
+            double window = bessel_i0(alpha * std::sqrt(std::max(0.0, 1 - ratio * ratio))) / bessel_i0(alpha);
+            kernel.weights.push_back((float)(sinc * window));
+            total += sinc * window;
+        }
+        for(float &weight : kernel.weights) {
+            weight = (float)(weight / total);
+        }
+        return kernel;
+    }
+
+    const Kernel box = {0, {0.5f, 0.5f}};
+    const Kernel kaiser = kaiser_kernel();
+
+    struct SrgbTables {
+        float to_linear[256];
+        // Indexed by linear intensity scaled to 0-65535, fine enough near black to round to the nearest 8 bit value
+        uint8_t from_linear[65536];
+
+        SrgbTables() {
+            for(uint32_t i = 0; i < 256; i++) {
+                double value = i / 255.0;
+                to_linear[i] = (float)(value <= 0.04045 ? value / 12.92 : std::pow((value + 0.055) / 1.055, 2.4));
+            }
+            for(uint32_t i = 0; i < 65536; i++) {
+                double value = i / 65535.0;
+                double encoded = value <= 0.0031308 ? value * 12.92 : 1.055 * std::pow(value, 1 / 2.4) - 0.055;
+                from_linear[i] = (uint8_t)std::lround(std::clamp(encoded, 0.0, 1.0) * 255);
+            }
+        }
+    };
+
+    const SrgbTables srgb;
+
+    float unorm(uint32_t pixel, uint32_t shift) {
+        return (float)((pixel >> shift) & 0xFF) / 255.0f;
+    }
+
+    uint32_t to_unorm(float value, uint32_t shift) {
+        return (uint32_t)std::lround(std::clamp(value, 0.0f, 1.0f) * 255.0f) << shift;
+    }
+
+    void load(const uint32_t *pixels, uint32_t width, Content content, float *output) {
+        for(uint32_t x = 0; x < width; x++, output += 4) {
+            uint32_t pixel = pixels[x];
+            switch(content) {
+            case Content::Color:
+                output[0] = srgb.to_linear[pixel & 0xFF];
+                output[1] = srgb.to_linear[(pixel >> 8) & 0xFF];
+                output[2] = srgb.to_linear[(pixel >> 16) & 0xFF];
+                output[3] = unorm(pixel, 24);
+                break;
+            case Content::Data:
+                for(uint32_t channel = 0; channel < 4; channel++) {
+                    output[channel] = unorm(pixel, 8 * channel);
+                }
+                break;
+            case Content::Normal:
+                output[0] = unorm(pixel, 0) * 2 - 1;
+                output[1] = unorm(pixel, 8) * 2 - 1;
+                output[2] = std::sqrt(std::max(0.0f, 1 - output[0] * output[0] - output[1] * output[1]));
+                output[3] = 1;
+                break;
+            }
+        }
+    }
+
+    uint32_t store(const float *input, Content content) {
+        switch(content) {
+        case Content::Color:
+            return srgb.from_linear[std::lround(std::clamp(input[0], 0.0f, 1.0f) * 65535.0f)]
+                | (uint32_t)srgb.from_linear[std::lround(std::clamp(input[1], 0.0f, 1.0f) * 65535.0f)] << 8
+                | (uint32_t)srgb.from_linear[std::lround(std::clamp(input[2], 0.0f, 1.0f) * 65535.0f)] << 16
+                | to_unorm(input[3], 24);
+        case Content::Normal: {
+            float length = std::sqrt(input[0] * input[0] + input[1] * input[1] + input[2] * input[2]);
+            if(length <= 0) {
+                return to_unorm(0.5f, 0) | to_unorm(0.5f, 8) | to_unorm(1.0f, 16) | 0xFF000000;
+            }
+            float x = input[0] / length, y = input[1] / length, z = input[2] / length;
+            return to_unorm(x * 0.5f + 0.5f, 0) | to_unorm(y * 0.5f + 0.5f, 8) | to_unorm(z * 0.5f + 0.5f, 16) | 0xFF000000;
+        }
+        default:
+            return to_unorm(input[0], 0) | to_unorm(input[1], 8) | to_unorm(input[2], 16) | to_unorm(input[3], 24);
+        }
+    }
+
+    /**
+     * output = the sum of weights[t] times the four floats at pixels + offsets[t]
+     */
+    void weighted_sum(const float *pixels, const size_t *offsets, const std::vector<float> &weights, float *output) {
+#ifdef WARPGATE_MIPS_SIMD
+        __m128 sum = _mm_setzero_ps();
+        for(size_t tap = 0; tap < weights.size(); tap++) {
+            sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(weights[tap]), _mm_loadu_ps(pixels + offsets[tap])));
+        }
+        _mm_storeu_ps(output, sum);
+#else
+        float sum[4] = {};
+        for(size_t tap = 0; tap < weights.size(); tap++) {
+            for(uint32_t channel = 0; channel < 4; channel++) {
+                sum[channel] += weights[tap] * pixels[offsets[tap] + channel];
+            }
+        }
+        std::copy(sum, sum + 4, output);
+#endif
+    }
+
+    uint32_t clamp_index(int64_t index, uint32_t size) {
+        return (uint32_t)std::clamp<int64_t>(index, 0, (int64_t)size - 1);
+    }
+}
+
+utils::textures::Image utils::textures::mips::halve(const Image &image) {
+    Image result(std::max(image.width / 2, 1u), std::max(image.height / 2, 1u));
+    for(uint32_t y = 0; y < result.height; y++) {
+        const uint32_t *top = image.row(std::min(2 * y, image.height - 1));
+        const uint32_t *bottom = image.row(std::min(2 * y + 1, image.height - 1));
+        uint32_t *output = result.row(y);
+        uint32_t x = 0;
+#ifdef WARPGATE_MIPS_SIMD
+        for(; 2 * x + 3 < image.width && x + 1 < result.width; x += 2) {
+            average_pairs(top + 2 * x, bottom + 2 * x, output + x);
+        }
+#endif
+        for(; x < result.width; x++) {
+            uint32_t left = std::min(2 * x, image.width - 1), right = std::min(2 * x + 1, image.width - 1);
+            output[x] = average(top[left], top[right], bottom[left], bottom[right]);
+        }
+    }
+    return result;
+}
+
+utils::textures::Image utils::textures::mips::downscale(const Image &image, uint32_t max_size) {
+    Image result = halve(image);
+    while(max_size > 0 && (result.width > max_size || result.height > max_size)) {
+        result = halve(result);
+    }
+    return result;
+}
+
+std::optional<utils::textures::mips::Filter> utils::textures::mips::parse_filter(std::string_view value) {
+    if(value == "none") {
+        return Filter::None;
+    } else if(value == "box") {
+        return Filter::Box;
+    } else if(value == "kaiser") {
+        return Filter::Kaiser;
+    }
+    return {};
+}
+
+void utils::textures::mips::init_mips(Filter filter) {
+    mip_filter = filter;
+}
+
+utils::textures::mips::Filter utils::textures::mips::filter() {
+    return mip_filter;
+}
+
+utils::textures::Image utils::textures::mips::next_level(const Image &image, Content content, Filter filter) {
+    if(content == Content::Data && filter != Filter::Kaiser) {
+        return halve(image);
+    }
+    const Kernel &kernel = filter == Filter::Kaiser ? kaiser : box;
+    size_t taps = kernel.weights.size();
+    Image result(std::max(image.width / 2, 1u), std::max(image.height / 2, 1u));
+    scheduler::parallel_for((result.height + band_rows - 1) / band_rows, [&](size_t band) {
+        uint32_t first_row = (uint32_t)band * band_rows, end_row = std::min(first_row + band_rows, result.height);
+        int64_t source_first = 2 * (int64_t)first_row + kernel.first;
+        size_t source_rows = 2 * (end_row - first_row - 1) + taps;
+
+        // Filter the source rows under the band horizontally, then filter down the columns of those
+        std::vector<float> source((size_t)image.width * 4), filtered(source_rows * result.width * 4);
+        std::vector<size_t> offsets(taps);
+        for(size_t row = 0; row < source_rows; row++) {
+            load(image.row(clamp_index(source_first + (int64_t)row, image.height)), image.width, content, source.data());
+            float *output = filtered.data() + row * result.width * 4;
+            for(uint32_t x = 0; x < result.width; x++) {
+                for(size_t tap = 0; tap < taps; tap++) {
+                    offsets[tap] = 4 * (size_t)clamp_index(2 * (int64_t)x + kernel.first + (int64_t)tap, image.width);
+                }
+                weighted_sum(source.data(), offsets.data(), kernel.weights, output + 4 * x);
+            }
+        }
+        float pixel[4];
+        for(uint32_t y = first_row; y < end_row; y++) {
+            uint32_t *output = result.row(y);
+            for(uint32_t x = 0; x < result.width; x++) {
+                for(size_t tap = 0; tap < taps; tap++) {
+                    offsets[tap] = ((2 * (size_t)(y - first_row) + tap) * result.width + x) * 4;
+                }
+                weighted_sum(filtered.data(), offsets.data(), kernel.weights, pixel);
+                output[x] = store(pixel, content);
+            }
+        }
+    });
+    return result;
+}
+
+std::vector<utils::textures::Image> utils::textures::mips::chain(const Image &image, Content content, Filter filter) {
+    std::vector<Image> levels;
+    if(filter == Filter::None) {
+        return levels;
+    }
+    size_t count = 0;
+    for(uint32_t width = image.width, height = image.height; width > 1 || height > 1; count++) {
+        width = std::max(width / 2, 1u);
+        height = std::max(height / 2, 1u);
+    }
+    levels.reserve(count);
+    for(size_t level = 0; level < count; level++) {
+        levels.push_back(next_level(level == 0 ? image : levels.back(), content, filter));
+    }
+    return levels;
+}
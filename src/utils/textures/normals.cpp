@@ -0,0 +1,110 @@
+#include "utils/textures/normals.h"
+
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#include "utils/textures/scheduler.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+using namespace warpgate;
+
+namespace {
+    /**
+     * Z of a unit normal from its 8 bit X and Y, mapped back to 0-255.
+     * Done on integers scaled by 255 so the only float operations are an exact conversion, a correctly rounded sqrt and one add,
+     * which keeps the SIMD and scalar paths identical.
+     */
+    uint32_t reconstruct_z(uint32_t x, uint32_t y) {
+        int32_t a = 2 * (int32_t)x - 255, b = 2 * (int32_t)y - 255;
+        int32_t remaining = std::max(0, 255 * 255 - a * a - b * b);
+        uint32_t z = (uint32_t)(std::sqrt((float)remaining) + 0.5f);
+        return (z + 256) >> 1;
+    }
+
+    uint32_t tint_mask(uint32_t pixel) {
+        uint32_t red = pixel & 0xFF, blue = (pixel >> 16) & 0xFF;
+        return (blue < 50 ? 0x000000FF : 0)
+            | (red < 50 ? 0x0000FF00 : 0)
+            | (blue > 150 ? 0x00FF0000 : 0)
+            | 0xFF000000;
+    }
+
+#if defined(__AVX2__)
+    void convert_avx2(const uint32_t *input, bool x_in_alpha, uint32_t *normal, uint32_t *tint) {
+        const __m256i byte_mask = _mm256_set1_epi32(0xFF);
+        const __m256i opaque = _mm256_set1_epi32((int)0xFF000000);
+        __m256i pixels = _mm256_loadu_si256((const __m256i*)input);
+        __m256i red = _mm256_and_si256(pixels, byte_mask);
+        __m256i y = _mm256_and_si256(_mm256_srli_epi32(pixels, 8), byte_mask);
+        __m256i blue = _mm256_and_si256(_mm256_srli_epi32(pixels, 16), byte_mask);
+        __m256i x = x_in_alpha ? _mm256_srli_epi32(pixels, 24) : red;
+
+        __m256i a = _mm256_sub_epi32(_mm256_slli_epi32(x, 1), byte_mask);
+        __m256i b = _mm256_sub_epi32(_mm256_slli_epi32(y, 1), byte_mask);
+        __m256i remaining = _mm256_sub_epi32(_mm256_set1_epi32(255 * 255), _mm256_add_epi32(_mm256_mullo_epi32(a, a), _mm256_mullo_epi32(b, b)));
+        remaining = _mm256_max_epi32(remaining, _mm256_setzero_si256());
+        __m256i z = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_sqrt_ps(_mm256_cvtepi32_ps(remaining)), _mm256_set1_ps(0.5f)));
+        z = _mm256_srli_epi32(_mm256_add_epi32(z, _mm256_set1_epi32(256)), 1);
+        __m256i normal_pixels = _mm256_or_si256(
+            _mm256_or_si256(x, _mm256_slli_epi32(y, 8)),
+            _mm256_or_si256(_mm256_slli_epi32(z, 16), opaque)
+        );
+        _mm256_storeu_si256((__m256i*)normal, normal_pixels);
+
+        __m256i low_blue = _mm256_cmpgt_epi32(_mm256_set1_epi32(50), blue);
+        __m256i low_red = _mm256_cmpgt_epi32(_mm256_set1_epi32(50), red);
+        __m256i high_blue = _mm256_cmpgt_epi32(blue, _mm256_set1_epi32(150));
+        __m256i tint_pixels = _mm256_or_si256(
+            _mm256_or_si256(_mm256_and_si256(low_blue, _mm256_set1_epi32(0x000000FF)), _mm256_and_si256(low_red, _mm256_set1_epi32(0x0000FF00))),
+            _mm256_or_si256(_mm256_and_si256(high_blue, _mm256_set1_epi32(0x00FF0000)), opaque)
+        );
+        _mm256_storeu_si256((__m256i*)tint, tint_pixels);
+    }
+#endif
+}
+
+void utils::textures::normals::convert_pixels(std::span<const uint32_t> input, Layout layout, uint32_t *normal, uint32_t *tint) {
+    bool x_in_alpha = layout == Layout::XInAlpha;
+    size_t i = 0;
+#if defined(__AVX2__)
+    for(; i + 8 <= input.size(); i += 8) {
+        convert_avx2(input.data() + i, x_in_alpha, normal + i, tint + i);
+    }
+#endif
+    for(; i < input.size(); i++) {
+        uint32_t pixel = input[i];
+        uint32_t x = x_in_alpha ? pixel >> 24 : pixel & 0xFF, y = (pixel >> 8) & 0xFF;
+        normal[i] = x | y << 8 | reconstruct_z(x, y) << 16 | 0xFF000000;
+        tint[i] = tint_mask(pixel);
+    }
+}
+
+utils::textures::normals::NormalMap utils::textures::normals::convert(const Image &image, Layout layout) {
+    NormalMap result{Image(image.width, image.height), Image(image.width, image.height)};
+    convert_pixels(image.pixels, layout, result.normal.pixels.data(), result.tint.pixels.data());
+    return result;
+}
+
+std::optional<utils::textures::normals::NormalMap> utils::textures::normals::decode(bc::Format format, std::span<const uint8_t> blocks, uint32_t width, uint32_t height) {
+    if(blocks.size() < bc::level_size(format, width, height)) {
+        return {};
+    }
+    Layout layout = format == bc::Format::BC5 || format == bc::Format::BC4 ? Layout::XInRed : Layout::XInAlpha;
+    NormalMap result{Image(width, height), Image(width, height)};
+    size_t stride = (width + 3) / 4 * 4, row_bytes = (width + 3) / 4 * bc::block_size(format);
+    scheduler::parallel_rows(width, height, [&](uint32_t first_row, uint32_t end_row) {
+        std::vector<uint32_t> strip(stride * 4);
+        for(uint32_t block_y = first_row / 4; block_y < (end_row + 3) / 4; block_y++) {
+            bc::decode_block_row(format, blocks.data() + block_y * row_bytes, width, strip.data(), stride);
+            for(uint32_t row = 0; row < 4 && block_y * 4 + row < height; row++) {
+                uint32_t y = block_y * 4 + row;
+                convert_pixels({strip.data() + row * stride, width}, layout, result.normal.row(y), result.tint.row(y));
+            }
+        }
+    });
+    return result;
+}
@@ -0,0 +1,234 @@
+#include "utils/textures/png.h"
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+#include <spdlog/spdlog.h>
+#include <zlib.h>
+
+#include "utils/textures/scheduler.h"
+
+namespace logger = spdlog;
+using namespace warpgate;
+
+namespace {
+    constexpr size_t bytes_per_pixel = 4;
+    // Smallest amount of filtered data worth giving its own segment
+    constexpr size_t min_segment_size = 256 * 1024;
+    constexpr size_t window_size = 32 * 1024;
+    constexpr size_t max_chunk_size = 1 << 30;
+
+    utils::textures::png::Settings png_settings;
+
+    uint8_t paeth(uint8_t a, uint8_t b, uint8_t c) {
+        int p = a + b - c;
+        int pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+        if(pa <= pb && pa <= pc) {
+            return a;
+        }
+        return pb <= pc ? b : c;
+    }
+
+    /**
+     * Writes the filter type byte followed by the filtered row. previous is null for the first row.
+     */
+    void filter_row(uint8_t filter, const uint8_t *row, const uint8_t *previous, size_t length, uint8_t *output) {
+        output[0] = filter;
+        output++;
+        for(size_t i = 0; i < length; i++) {
+            uint8_t left = i >= bytes_per_pixel ? row[i - bytes_per_pixel] : 0;
+            uint8_t up = previous ? previous[i] : 0;
+            uint8_t up_left = previous && i >= bytes_per_pixel ? previous[i - bytes_per_pixel] : 0;
+            switch(filter) {
+            case 0:
+                output[i] = row[i];
+                break;
+            case 1:
+                output[i] = row[i] - left;
+                break;
+            case 2:
+                output[i] = row[i] - up;
+                break;
+            case 3:
+                output[i] = row[i] - (uint8_t)((left + up) >> 1);
+                break;
+            case 4:
+                output[i] = row[i] - paeth(left, up, up_left);
+                break;
+            }
+        }
+    }
+
+    /**
+     * The usual heuristic for picking a filter: the smallest sum of the filtered bytes taken as signed values
+     */
+    uint64_t filter_cost(const uint8_t *filtered, size_t length) {
+        uint64_t cost = 0;
+        for(size_t i = 0; i < length; i++) {
+            cost += std::abs((int8_t)filtered[i]);
+        }
+        return cost;
+    }
+
+    void write_u32(std::vector<uint8_t> &output, uint32_t value) {
+        output.push_back((uint8_t)(value >> 24));
+        output.push_back((uint8_t)(value >> 16));
+        output.push_back((uint8_t)(value >> 8));
+        output.push_back((uint8_t)value);
+    }
+
+    void write_chunk(std::vector<uint8_t> &output, const char *type, const uint8_t *data, size_t length) {
+        write_u32(output, (uint32_t)length);
+        size_t type_offset = output.size();
+        output.insert(output.end(), type, type + 4);
+        output.insert(output.end(), data, data + length);
+        uint32_t crc = crc32(0L, output.data() + type_offset, (uInt)(length + 4));
+        write_u32(output, crc);
+    }
+
+    struct Segment {
+        uint32_t first_row = 0, rows = 0;
+        std::vector<uint8_t> compressed;
+        uLong adler = 0;
+        bool ok = false;
+    };
+}
+
+std::optional<utils::textures::png::Settings> utils::textures::png::parse_settings(std::string_view value) {
+    Settings settings;
+    if(value == "fast") {
+        settings.level = 1;
+        settings.adaptive_filter = false;
+    } else if(value == "default") {
+        settings.level = 6;
+    } else if(value == "best") {
+        settings.level = 9;
+    } else {
+        int level = -1;
+        auto result = std::from_chars(value.data(), value.data() + value.size(), level);
+        if(result.ec != std::errc() || result.ptr != value.data() + value.size() || level < 0 || level > 9) {
+            return {};
+        }
+        settings.level = level;
+    }
+    return settings;
+}
+
+void utils::textures::png::init_png(Settings settings) {
+    png_settings = settings;
+}
+
+const utils::textures::png::Settings &utils::textures::png::settings() {
+    return png_settings;
+}
+
+std::vector<uint8_t> utils::textures::png::encode(const uint32_t *pixels, uint32_t width, uint32_t height, const Settings &settings) {
+    if(width == 0 || height == 0) {
+        logger::error("Cannot encode an empty image");
+        return {};
+    }
+    size_t row_size = (size_t)width * bytes_per_pixel, filtered_row_size = row_size + 1;
+    size_t filtered_size = filtered_row_size * height;
+    uint32_t threads = settings.threads ? settings.threads : std::max(1u, std::thread::hardware_concurrency());
+    const uint8_t *image = (const uint8_t*)pixels;
+
+    size_t segment_count = std::clamp<size_t>(filtered_size / min_segment_size, 1, std::max<size_t>(threads, 1));
+    segment_count = std::min<size_t>(segment_count, std::max(height, 1u));
+    uint32_t rows_per_segment = (uint32_t)((height + segment_count - 1) / segment_count);
+    std::vector<Segment> segments;
+    for(uint32_t row = 0; row < height; row += rows_per_segment) {
+        segments.push_back({row, std::min(rows_per_segment, height - row), {}, 0, false});
+    }
+
+    std::vector<uint8_t> filtered(filtered_size);
+    scheduler::parallel_for(segments.size(), [&](size_t index) {
+        std::array<std::vector<uint8_t>, 5> candidates;
+        for(std::vector<uint8_t> &candidate : candidates) {
+            candidate.resize(filtered_row_size);
+        }
+        for(uint32_t y = segments[index].first_row; y < segments[index].first_row + segments[index].rows; y++) {
+            const uint8_t *row = image + y * row_size;
+            const uint8_t *previous = y > 0 ? row - row_size : nullptr;
+            uint8_t *output = filtered.data() + y * filtered_row_size;
+            if(!settings.adaptive_filter) {
+                filter_row(2, row, previous, row_size, output);
+                continue;
+            }
+            uint8_t best = 0;
+            uint64_t best_cost = UINT64_MAX;
+            for(uint8_t filter = 0; filter < 5; filter++) {
+                filter_row(filter, row, previous, row_size, candidates[filter].data());
+                uint64_t cost = filter_cost(candidates[filter].data() + 1, row_size);
+                if(cost < best_cost) {
+                    best = filter;
+                    best_cost = cost;
+                }
+            }
+            std::memcpy(output, candidates[best].data(), filtered_row_size);
+        }
+    });
+
+    scheduler::parallel_for(segments.size(), [&](size_t index) {
+        Segment &segment = segments[index];
+        const uint8_t *input = filtered.data() + segment.first_row * filtered_row_size;
+        size_t input_size = segment.rows * filtered_row_size;
+        bool last = index + 1 == segments.size();
+        segment.adler = adler32(1L, input, (uInt)input_size);
+
+        z_stream stream{};
+        if(deflateInit2(&stream, settings.level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            return;
+        }
+        if(index > 0) {
+            size_t dictionary_size = std::min(window_size, (size_t)(input - filtered.data()));
+            deflateSetDictionary(&stream, input - dictionary_size, (uInt)dictionary_size);
+        }
+        // Every segment but the last ends on a byte aligned, non final block so the segments can be concatenated
+        segment.compressed.resize(deflateBound(&stream, (uLong)input_size) + 16);
+        stream.next_in = (Bytef*)input;
+        stream.avail_in = (uInt)input_size;
+        stream.next_out = segment.compressed.data();
+        stream.avail_out = (uInt)segment.compressed.size();
+        int result = deflate(&stream, last ? Z_FINISH : Z_SYNC_FLUSH);
+        segment.ok = last ? result == Z_STREAM_END : result == Z_OK && stream.avail_in == 0;
+        segment.compressed.resize(stream.total_out);
+        deflateEnd(&stream);
+    });
+
+    std::vector<uint8_t> zlib_stream = {0x78, 0x01};
+    if(settings.level >= 7) {
+        zlib_stream[1] = 0xDA;
+    } else if(settings.level == 6) {
+        zlib_stream[1] = 0x9C;
+    } else if(settings.level >= 2) {
+        zlib_stream[1] = 0x5E;
+    }
+    uLong adler = 1L;
+    for(const Segment &segment : segments) {
+        if(!segment.ok) {
+            logger::error("Failed to compress image data");
+            return {};
+        }
+        zlib_stream.insert(zlib_stream.end(), segment.compressed.begin(), segment.compressed.end());
+        adler = adler32_combine(adler, segment.adler, (z_off_t)(segment.rows * filtered_row_size));
+    }
+    write_u32(zlib_stream, (uint32_t)adler);
+
+    std::vector<uint8_t> output = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    output.reserve(zlib_stream.size() + 64);
+    std::vector<uint8_t> header;
+    write_u32(header, width);
+    write_u32(header, height);
+    // 8 bit RGBA, deflate, adaptive filtering, not interlaced
+    header.insert(header.end(), {8, 6, 0, 0, 0});
+    write_chunk(output, "IHDR", header.data(), header.size());
+    for(size_t offset = 0; offset < zlib_stream.size(); offset += max_chunk_size) {
+        write_chunk(output, "IDAT", zlib_stream.data() + offset, std::min(max_chunk_size, zlib_stream.size() - offset));
+    }
+    write_chunk(output, "IEND", nullptr, 0);
+    return output;
+}
@@ -0,0 +1,317 @@
+#include "utils/textures/scheduler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <cstring>
+#include <iterator>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+
+#include "utils/textures.h"
+
+namespace logger = spdlog;
+using namespace warpgate;
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    struct Job {
+        uint64_t cost, sequence;
+        std::string name;
+        std::function<void()> run;
+        Clock::time_point submitted;
+        // Helps run a parallel_for loop, whose time is already part of the job that started the loop
+        bool helper;
+    };
+
+    // Most expensive first, then first submitted
+    bool runs_after(const Job &first, const Job &second) {
+        return first.cost < second.cost || (first.cost == second.cost && first.sequence > second.sequence);
+    }
+
+    struct Record {
+        uint64_t sequence;
+        size_t worker;
+        Clock::time_point submitted, started, finished;
+        bool helper;
+    };
+
+    std::mutex scheduler_mutex;
+    std::condition_variable job_queued;
+    std::vector<Job> jobs;
+    uint64_t next_sequence = 0;
+    std::vector<Record> records;
+    // The image threads currently running jobs, numbered from 0 since the last time none were
+    std::unordered_map<std::thread::id, size_t> workers;
+    size_t next_worker = 0;
+    // Threads a parallel_for gets when no image threads are running
+    uint32_t loop_threads = std::max(1u, std::thread::hardware_concurrency());
+    utils::notifier job_notifier;
+
+    uint32_t read_uint32(std::span<const uint8_t> data, size_t offset) {
+        uint32_t value = 0;
+        if(offset + sizeof(value) <= data.size()) {
+            std::memcpy(&value, data.data() + offset, sizeof(value));
+        }
+        return value;
+    }
+
+    // Rough time per pixel of each mode, relative to each other
+    uint64_t mode_weight(utils::textures::cache::Mode mode) {
+        switch(mode) {
+        case utils::textures::cache::Mode::NormalMap:
+            return 3;
+        case utils::textures::cache::Mode::Specular:
+            return 4;
+        case utils::textures::cache::Mode::CnxSny:
+            return 5;
+        default:
+            return 2;
+        }
+    }
+
+    struct Loop {
+        std::function<void(size_t)> fn;
+        size_t count;
+        std::atomic<size_t> next = 0;
+        size_t completed = 0;
+        std::mutex mutex;
+        std::condition_variable finished;
+
+        Loop(std::function<void(size_t)> fn, size_t count) : fn(std::move(fn)), count(count) {}
+
+        void work() {
+            size_t done = 0;
+            for(size_t i = next++; i < count; i = next++) {
+                try {
+                    fn(i);
+                } catch(std::exception &err) {
+                    logger::error("Parallel texture loop failed at {}: {}", i, err.what());
+                }
+                done++;
+            }
+            if(done == 0) {
+                return;
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            completed += done;
+            if(completed == count) {
+                finished.notify_all();
+            }
+        }
+    };
+
+    double seconds(Clock::duration duration) {
+        return std::chrono::duration<double>(duration).count();
+    }
+
+    void queue_job(std::string name, uint64_t cost, std::function<void()> run, bool helper) {
+        {
+            std::lock_guard<std::mutex> lock(scheduler_mutex);
+            jobs.push_back({cost, next_sequence++, std::move(name), std::move(run), Clock::now(), helper});
+            std::push_heap(jobs.begin(), jobs.end(), runs_after);
+        }
+        job_queued.notify_one();
+        job_notifier.notify();
+    }
+
+    // Only the jobs image threads run are reported, and only image threads get help from the others in parallel_for
+    void add_worker() {
+        std::lock_guard<std::mutex> lock(scheduler_mutex);
+        if(workers.emplace(std::this_thread::get_id(), next_worker).second) {
+            next_worker++;
+        }
+    }
+
+    void remove_worker() {
+        std::lock_guard<std::mutex> lock(scheduler_mutex);
+        workers.erase(std::this_thread::get_id());
+        if(workers.empty()) {
+            next_worker = 0;
+        }
+    }
+}
+
+void utils::textures::scheduler::init_scheduler(uint32_t threads) {
+    std::lock_guard<std::mutex> lock(scheduler_mutex);
+    loop_threads = std::max(1u, threads);
+}
+
+uint64_t utils::textures::scheduler::estimate_cost(cache::Mode mode, std::span<const uint8_t> dds_data) {
+    constexpr uint32_t cubemap_flag = 0x200;
+    uint64_t height = read_uint32(dds_data, 12), width = read_uint32(dds_data, 16);
+    uint32_t caps2 = read_uint32(dds_data, 112);
+    if(max_texture_size() > 0) {
+        width = std::min<uint64_t>(width, max_texture_size());
+        height = std::min<uint64_t>(height, max_texture_size());
+    }
+    uint64_t pixels = std::max<uint64_t>(width * height, 1) * ((caps2 & cubemap_flag) ? 6 : 1);
+    return pixels * mode_weight(mode);
+}
+
+void utils::textures::scheduler::submit(std::string name, uint64_t cost, std::function<void()> job) {
+    queue_job(std::move(name), cost, std::move(job), false);
+}
+
+utils::notifier &utils::textures::scheduler::work_available() {
+    return job_notifier;
+}
+
+bool utils::textures::scheduler::run_next(std::chrono::milliseconds timeout) {
+    Job job;
+    std::optional<size_t> worker;
+    {
+        std::unique_lock<std::mutex> lock(scheduler_mutex);
+        if(auto found = workers.find(std::this_thread::get_id()); found != workers.end()) {
+            worker = found->second;
+        }
+        if(!job_queued.wait_for(lock, timeout, []() { return !jobs.empty(); })) {
+            return false;
+        }
+        std::pop_heap(jobs.begin(), jobs.end(), runs_after);
+        job = std::move(jobs.back());
+        jobs.pop_back();
+    }
+
+    Clock::time_point started = Clock::now();
+    logger::trace("Running texture job {} (cost {})", job.name, job.cost);
+    try {
+        job.run();
+    } catch(std::exception &err) {
+        logger::error("Texture job {} failed: {}", job.name, err.what());
+    }
+    Clock::time_point finished = Clock::now();
+
+    // Jobs run by threads that aren't image threads, such as a thread waiting on a parallel_for, are left out of the report
+    if(worker) {
+        std::lock_guard<std::mutex> lock(scheduler_mutex);
+        records.push_back({job.sequence, *worker, job.submitted, started, finished, job.helper});
+    }
+    return true;
+}
+
+void utils::textures::scheduler::parallel_for(size_t count, std::function<void(size_t)> fn) {
+    if(count == 0) {
+        return;
+    }
+    std::shared_ptr<Loop> loop = std::make_shared<Loop>(std::move(fn), count);
+    size_t helpers = 0, thread_count = 1;
+    {
+        std::lock_guard<std::mutex> lock(scheduler_mutex);
+        if(workers.find(std::this_thread::get_id()) != workers.end()) {
+            helpers = std::min(count, workers.size()) - 1;
+        } else if(workers.empty()) {
+            thread_count = std::min<size_t>(count, loop_threads);
+        }
+    }
+    for(size_t i = 0; i < helpers; i++) {
+        queue_job("parallel loop", UINT64_MAX, [loop]() { loop->work(); }, true);
+    }
+
+    // Without texture threads to help, the loop gets as many threads of its own as the caller would have used for them
+    std::vector<std::thread> threads;
+    if(thread_count > 1) {
+        for(size_t i = 1; i < thread_count; i++) {
+            threads.push_back(std::thread([loop]() { loop->work(); }));
+        }
+    }
+
+    loop->work();
+    for(std::thread &thread : threads) {
+        thread.join();
+    }
+    std::unique_lock<std::mutex> lock(loop->mutex);
+    loop->finished.wait(lock, [&]() { return loop->completed == loop->count; });
+}
+
+void utils::textures::scheduler::parallel_rows(uint32_t width, uint32_t height, std::function<void(uint32_t, uint32_t)> fn, uint32_t rows) {
+    if((uint64_t)width * height < min_parallel_pixels || height <= rows) {
+        fn(0, height);
+        return;
+    }
+    parallel_for((height + rows - 1) / rows, [&](size_t band) {
+        uint32_t first_row = (uint32_t)band * rows;
+        fn(first_row, std::min(first_row + rows, height));
+    });
+}
+
+void utils::textures::scheduler::drain(std::vector<Source> sources) {
+    add_worker();
+    while(true) {
+        // Taken before looking for work, so anything queued from here on cuts the wait below short
+        uint64_t token = job_notifier.token();
+        // Hand queued textures to the scheduler, so the most expensive texture known is always processed next.
+        // Past max_pending they are left on the bounded queues, which makes the producers wait for the image threads
+        for(Source &source : sources) {
+            while(pending() < max_pending && source.take()) {}
+        }
+        if(run_next(std::chrono::milliseconds(0))) {
+            continue;
+        }
+        if(pending() == 0 && std::all_of(sources.begin(), sources.end(), [](const Source &source) { return source.closed(); })) {
+            break;
+        }
+        // Sleep until a texture is queued, a job is submitted or a queue is closed
+        job_notifier.wait(token);
+    }
+    remove_worker();
+}
+
+size_t utils::textures::scheduler::pending() {
+    std::lock_guard<std::mutex> lock(scheduler_mutex);
+    return jobs.size();
+}
+
+void utils::textures::scheduler::report() {
+    std::lock_guard<std::mutex> lock(scheduler_mutex);
+    std::vector<Record> finished;
+    finished.swap(records);
+    if(finished.empty()) {
+        return;
+    }
+    size_t thread_count = 0, job_count = 0;
+    Clock::time_point first = finished.front().submitted, last = finished.front().finished;
+    for(const Record &record : finished) {
+        thread_count = std::max(thread_count, record.worker + 1);
+        job_count += record.helper ? 0 : 1;
+        first = std::min(first, record.submitted);
+        last = std::max(last, record.finished);
+    }
+    // Time spent helping a parallel loop still counts towards the helping thread's busy time
+    Clock::duration busy{};
+    std::vector<Clock::duration> worker_busy(thread_count);
+    for(const Record &record : finished) {
+        busy += record.finished - record.started;
+        worker_busy[record.worker] += record.finished - record.started;
+    }
+
+    // Replays the measured job durations in submission order, each job going to the first thread to become free.
+    // Loop helpers are left out, the job that started each loop is replayed with the time it took with their help
+    std::vector<Record> submitted;
+    std::copy_if(finished.begin(), finished.end(), std::back_inserter(submitted), [](const Record &record) { return !record.helper; });
+    std::sort(submitted.begin(), submitted.end(), [](const Record &a, const Record &b) { return a.sequence < b.sequence; });
+    std::vector<Clock::time_point> free_at(thread_count, first);
+    for(const Record &record : submitted) {
+        auto worker = std::min_element(free_at.begin(), free_at.end());
+        *worker = std::max(*worker, record.submitted) + (record.finished - record.started);
+    }
+    Clock::time_point fifo_last = *std::max_element(free_at.begin(), free_at.end());
+
+    double capacity = seconds(last - first) * thread_count, fifo_capacity = seconds(fifo_last - first) * thread_count;
+    logger::info(
+        "Ran {} texture jobs on {} thread{} in {:.2f}s, {:.0f}% utilization (in submission order: about {:.2f}s, {:.0f}%)",
+        job_count, thread_count, thread_count == 1 ? "" : "s",
+        seconds(last - first), capacity > 0 ? 100.0 * seconds(busy) / capacity : 100.0,
+        seconds(fifo_last - first), fifo_capacity > 0 ? 100.0 * seconds(busy) / fifo_capacity : 100.0
+    );
+    for(size_t worker = 0; worker < worker_busy.size(); worker++) {
+        logger::debug("    Thread {}: busy for {:.2f}s", worker, seconds(worker_busy[worker]));
+    }
+}
@@ -0,0 +1,181 @@
+#include "utils/textures/specular.h"
+
+#include <algorithm>
+#include <optional>
+#include <vector>
+
+#include "utils/textures/scheduler.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+using namespace warpgate;
+
+namespace {
+    // Specular blue is compared as unorm (b * (1 / 255.0f) > 0.2f), which holds from 51 up
+    constexpr uint32_t emissive_threshold = 50;
+
+    // packed_tint of a pixel with no tint masks set
+    constexpr uint32_t untinted = 102;
+
+    uint32_t emissive_pixel(uint32_t spec, uint32_t color) {
+        uint32_t blue = (spec >> 16) & 0xFF;
+        return blue > emissive_threshold && (color >> 24) != 0 ? (color & 0x00FFFFFF) | blue << 24 : 0;
+    }
+
+    /**
+     * Nearest samples the rows of source at the texels of a width x height image, passing them through untouched when the sizes match.
+     * Same float math as the texel_fetch sampling this replaced, so the chosen texels don't move.
+     */
+    class RowSampler {
+    public:
+        RowSampler(const utils::textures::Image &source, uint32_t width, uint32_t height)
+            : source(source)
+            , same_size(source.width == width && source.height == height)
+            , y_ratio((float)source.height / height)
+        {
+            if(!same_size) {
+                float x_ratio = (float)source.width / width;
+                columns.resize(width);
+                for(uint32_t x = 0; x < width; x++) {
+                    columns[x] = std::min((uint32_t)(x * x_ratio), source.width - 1);
+                }
+                resampled.resize(width);
+            }
+        }
+
+        const uint32_t *row(uint32_t y) {
+            if(same_size) {
+                return source.row(y);
+            }
+            const uint32_t *source_row = source.row(std::min((uint32_t)(y * y_ratio), source.height - 1));
+            for(size_t x = 0; x < columns.size(); x++) {
+                resampled[x] = source_row[columns[x]];
+            }
+            return resampled.data();
+        }
+
+    private:
+        const utils::textures::Image &source;
+        bool same_size;
+        float y_ratio;
+        std::vector<uint32_t> columns, resampled;
+    };
+
+#if defined(__AVX2__)
+    __m256i emissive_avx2(__m256i spec, __m256i color) {
+        const __m256i byte_mask = _mm256_set1_epi32(0xFF);
+        __m256i blue = _mm256_and_si256(_mm256_srli_epi32(spec, 16), byte_mask);
+        __m256i lit = _mm256_cmpgt_epi32(blue, _mm256_set1_epi32(emissive_threshold));
+        __m256i transparent = _mm256_cmpeq_epi32(_mm256_srli_epi32(color, 24), _mm256_setzero_si256());
+        __m256i e = _mm256_or_si256(_mm256_and_si256(color, _mm256_set1_epi32(0x00FFFFFF)), _mm256_slli_epi32(blue, 24));
+        return _mm256_andnot_si256(transparent, _mm256_and_si256(lit, e));
+    }
+
+    // Roughness in green and metalness in blue
+    __m256i roughness_metalness_avx2(__m256i spec) {
+        __m256i roughness = _mm256_slli_epi32(_mm256_srli_epi32(spec, 24), 8);
+        __m256i metalness = _mm256_slli_epi32(_mm256_and_si256(spec, _mm256_set1_epi32(0xFF)), 16);
+        return _mm256_or_si256(roughness, metalness);
+    }
+
+    void convert_avx2(const uint32_t *specular, const uint32_t *albedo, uint32_t *metallic_roughness, uint32_t *emissive) {
+        __m256i spec = _mm256_loadu_si256((const __m256i*)specular);
+        __m256i color = _mm256_loadu_si256((const __m256i*)albedo);
+        __m256i mr = _mm256_or_si256(roughness_metalness_avx2(spec), _mm256_set1_epi32((int)0xFF000000));
+        _mm256_storeu_si256((__m256i*)metallic_roughness, mr);
+        _mm256_storeu_si256((__m256i*)emissive, emissive_avx2(spec, color));
+    }
+
+    void convert_orm_avx2(const uint32_t *specular, const uint32_t *albedo, const uint32_t *normal, uint32_t *orm, uint32_t *emissive) {
+        const __m256i byte_mask = _mm256_set1_epi32(0xFF);
+        const __m256i region_step = _mm256_set1_epi32(2 * 51);
+        __m256i spec = _mm256_loadu_si256((const __m256i*)specular);
+        __m256i color = _mm256_loadu_si256((const __m256i*)albedo);
+
+        __m256i tint = _mm256_set1_epi32(untinted);
+        if(normal) {
+            __m256i pixels = _mm256_loadu_si256((const __m256i*)normal);
+            __m256i red = _mm256_and_si256(pixels, byte_mask);
+            __m256i blue = _mm256_and_si256(_mm256_srli_epi32(pixels, 16), byte_mask);
+            __m256i low_blue = _mm256_cmpgt_epi32(_mm256_set1_epi32(50), blue);
+            __m256i high_blue = _mm256_cmpgt_epi32(blue, _mm256_set1_epi32(150));
+            __m256i low_red = _mm256_cmpgt_epi32(_mm256_set1_epi32(50), red);
+            tint = _mm256_sub_epi32(
+                _mm256_add_epi32(tint, _mm256_and_si256(high_blue, region_step)),
+                _mm256_and_si256(low_blue, region_step)
+            );
+            tint = _mm256_add_epi32(tint, _mm256_and_si256(low_red, _mm256_set1_epi32(51)));
+        }
+        __m256i packed = _mm256_or_si256(
+            _mm256_or_si256(roughness_metalness_avx2(spec), byte_mask),
+            _mm256_slli_epi32(tint, 24)
+        );
+        _mm256_storeu_si256((__m256i*)orm, packed);
+        _mm256_storeu_si256((__m256i*)emissive, emissive_avx2(spec, color));
+    }
+#endif
+}
+
+void utils::textures::specular::convert_pixels(std::span<const uint32_t> specular, const uint32_t *albedo, uint32_t *metallic_roughness, uint32_t *emissive) {
+    size_t i = 0;
+#if defined(__AVX2__)
+    for(; i + 8 <= specular.size(); i += 8) {
+        convert_avx2(specular.data() + i, albedo + i, metallic_roughness + i, emissive + i);
+    }
+#endif
+    for(; i < specular.size(); i++) {
+        uint32_t spec = specular[i];
+        metallic_roughness[i] = (spec >> 24) << 8 | (spec & 0xFF) << 16 | 0xFF000000;
+        emissive[i] = emissive_pixel(spec, albedo[i]);
+    }
+}
+
+utils::textures::specular::SpecularMaps utils::textures::specular::convert(const Image &specular, const Image &albedo) {
+    SpecularMaps result{Image(specular.width, specular.height), Image(specular.width, specular.height)};
+    scheduler::parallel_rows(specular.width, specular.height, [&](uint32_t first_row, uint32_t end_row) {
+        RowSampler albedo_rows(albedo, specular.width, specular.height);
+        for(uint32_t y = first_row; y < end_row; y++) {
+            convert_pixels({specular.row(y), specular.width}, albedo_rows.row(y), result.metallic_roughness.row(y), result.emissive.row(y));
+        }
+    });
+    return result;
+}
+
+uint32_t utils::textures::specular::packed_tint(uint32_t normal) {
+    uint32_t red = normal & 0xFF, blue = (normal >> 16) & 0xFF;
+    uint32_t region = blue < 50 ? 0 : (blue > 150 ? 2 : 1);
+    return 51 * (2 * region + (red < 50 ? 1 : 0));
+}
+
+void utils::textures::specular::convert_orm_pixels(std::span<const uint32_t> specular, const uint32_t *albedo, const uint32_t *normal, uint32_t *orm, uint32_t *emissive) {
+    size_t i = 0;
+#if defined(__AVX2__)
+    for(; i + 8 <= specular.size(); i += 8) {
+        convert_orm_avx2(specular.data() + i, albedo + i, normal ? normal + i : nullptr, orm + i, emissive + i);
+    }
+#endif
+    for(; i < specular.size(); i++) {
+        uint32_t spec = specular[i];
+        uint32_t tint = normal ? packed_tint(normal[i]) : untinted;
+        orm[i] = 0xFF | (spec >> 24) << 8 | (spec & 0xFF) << 16 | tint << 24;
+        emissive[i] = emissive_pixel(spec, albedo[i]);
+    }
+}
+
+utils::textures::specular::OrmMaps utils::textures::specular::convert_orm(const Image &specular, const Image &albedo, const Image *normal) {
+    OrmMaps result{Image(specular.width, specular.height), Image(specular.width, specular.height)};
+    scheduler::parallel_rows(specular.width, specular.height, [&](uint32_t first_row, uint32_t end_row) {
+        RowSampler albedo_rows(albedo, specular.width, specular.height);
+        std::optional<RowSampler> normal_rows;
+        if(normal) {
+            normal_rows.emplace(*normal, specular.width, specular.height);
+        }
+        for(uint32_t y = first_row; y < end_row; y++) {
+            const uint32_t *normal_row = normal_rows ? normal_rows->row(y) : nullptr;
+            convert_orm_pixels({specular.row(y), specular.width}, albedo_rows.row(y), normal_row, result.orm.row(y), result.emissive.row(y));
+        }
+    });
+    return result;
+}
@@ -0,0 +1,83 @@
+#include "utils/textures/terrain.h"
+
+#include <vector>
+
+#include "utils/textures/scheduler.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+using namespace warpgate;
+
+namespace {
+#if defined(__AVX2__)
+    void split_avx2(const uint32_t *color_nx, const uint32_t *specular_ny, uint32_t *color, uint32_t *specular, uint32_t *normal) {
+        const __m256i opaque = _mm256_set1_epi32((int)0xFF000000);
+        __m256i cnx = _mm256_loadu_si256((const __m256i*)color_nx);
+        __m256i sny = _mm256_loadu_si256((const __m256i*)specular_ny);
+        _mm256_storeu_si256((__m256i*)color, _mm256_or_si256(cnx, opaque));
+        _mm256_storeu_si256((__m256i*)specular, _mm256_xor_si256(_mm256_or_si256(sny, opaque), _mm256_set1_epi32(0x00FFFF00)));
+        __m256i normal_pixels = _mm256_or_si256(
+            _mm256_or_si256(_mm256_srli_epi32(cnx, 24), _mm256_and_si256(_mm256_srli_epi32(sny, 16), _mm256_set1_epi32(0x0000FF00))),
+            _mm256_set1_epi32((int)0xFFFF0000)
+        );
+        _mm256_storeu_si256((__m256i*)normal, normal_pixels);
+    }
+#endif
+}
+
+void utils::textures::terrain::split_pixels(std::span<const uint32_t> color_nx, const uint32_t *specular_ny, uint32_t *color, uint32_t *specular, uint32_t *normal) {
+    size_t i = 0;
+#if defined(__AVX2__)
+    for(; i + 8 <= color_nx.size(); i += 8) {
+        split_avx2(color_nx.data() + i, specular_ny + i, color + i, specular + i, normal + i);
+    }
+#endif
+    for(; i < color_nx.size(); i++) {
+        uint32_t cnx = color_nx[i], sny = specular_ny[i];
+        color[i] = cnx | 0xFF000000;
+        specular[i] = (sny | 0xFF000000) ^ 0x00FFFF00;
+        normal[i] = 0xFFFF0000 | ((sny >> 16) & 0x0000FF00) | (cnx >> 24);
+    }
+}
+
+utils::textures::terrain::TerrainMaps utils::textures::terrain::split(const Image &color_nx, const Image &specular_ny) {
+    TerrainMaps result{
+        Image(color_nx.width, color_nx.height), 
+        Image(color_nx.width, color_nx.height), 
+        Image(color_nx.width, color_nx.height)
+    };
+    split_pixels(color_nx.pixels, specular_ny.pixels.data(), result.color.pixels.data(), result.specular.pixels.data(), result.normal.pixels.data());
+    return result;
+}
+
+std::optional<utils::textures::terrain::TerrainMaps> utils::textures::terrain::decode(
+    bc::Format color_nx_format, std::span<const uint8_t> color_nx_blocks,
+    bc::Format specular_ny_format, std::span<const uint8_t> specular_ny_blocks,
+    uint32_t width, uint32_t height
+) {
+    if(color_nx_blocks.size() < bc::level_size(color_nx_format, width, height) 
+        || specular_ny_blocks.size() < bc::level_size(specular_ny_format, width, height)) {
+        return {};
+    }
+    TerrainMaps result{Image(width, height), Image(width, height), Image(width, height)};
+    size_t stride = (width + 3) / 4 * 4, blocks_wide = (width + 3) / 4;
+    size_t color_nx_row_bytes = blocks_wide * bc::block_size(color_nx_format);
+    size_t specular_ny_row_bytes = blocks_wide * bc::block_size(specular_ny_format);
+    scheduler::parallel_rows(width, height, [&](uint32_t first_row, uint32_t end_row) {
+        std::vector<uint32_t> color_nx_strip(stride * 4), specular_ny_strip(stride * 4);
+        for(uint32_t block_y = first_row / 4; block_y < (end_row + 3) / 4; block_y++) {
+            bc::decode_block_row(color_nx_format, color_nx_blocks.data() + block_y * color_nx_row_bytes, width, color_nx_strip.data(), stride);
+            bc::decode_block_row(specular_ny_format, specular_ny_blocks.data() + block_y * specular_ny_row_bytes, width, specular_ny_strip.data(), stride);
+            for(uint32_t row = 0; row < 4 && block_y * 4 + row < height; row++) {
+                uint32_t y = block_y * 4 + row;
+                split_pixels(
+                    {color_nx_strip.data() + row * stride, width}, specular_ny_strip.data() + row * stride,
+                    result.color.row(y), result.specular.row(y), result.normal.row(y)
+                );
+            }
+        }
+    });
+    return result;
+}
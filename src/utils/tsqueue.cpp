@@ -1,79 +1,225 @@
 #include "utils/tsqueue.h"
+#include "utils/notifier.h"
 #include "parameter.h"
 #include <filesystem>
+#include <new>
 
 using namespace warpgate;
 
 template <class T>
-utils::tsqueue<T>::tsqueue(void): q(), m(), c(), closed(false) {}
+utils::tsqueue<T>::tsqueue(size_t capacity): head(0), tail(0), closed(false), waiting_producers(0), waiting_consumers(0), listener(nullptr) {
+    size_t size = 2;
+    while(size < capacity) {
+        size <<= 1;
+    }
+    mask = size - 1;
+    cells = std::make_unique<Cell[]>(size);
+    for(size_t i = 0; i < size; i++) {
+        cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+}
 
 template <class T>
-utils::tsqueue<T>::~tsqueue(void) {}
+utils::tsqueue<T>::~tsqueue(void) {
+    while(pop()) {}
+}
 
 template <class T>
-void utils::tsqueue<T>::enqueue(T t) {
-    if(closed) {
-        return;
+bool utils::tsqueue<T>::push(T &t) {
+    size_t position = head.load(std::memory_order_relaxed);
+    Cell *cell;
+    while(true) {
+        cell = &cells[position & mask];
+        size_t sequence = cell->sequence.load(std::memory_order_acquire);
+        intptr_t difference = (intptr_t)sequence - (intptr_t)position;
+        if(difference == 0) {
+            if(head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if(difference < 0) {
+            // The cell still holds the element from the previous lap
+            return false;
+        } else {
+            position = head.load(std::memory_order_relaxed);
+        }
     }
-    std::lock_guard<std::mutex> lock(m);
-    q.push(t);
-    c.notify_one();
+    new (cell->storage) T(std::move(t));
+    cell->sequence.store(position + 1, std::memory_order_release);
+    return true;
 }
 
 template <class T>
-T utils::tsqueue<T>::dequeue(void) {
-    std::unique_lock<std::mutex> lock(m);
-    while (q.empty())
-    {
-        // release lock as long as the wait and reaquire it afterwards.
-        c.wait(lock);
+std::optional<T> utils::tsqueue<T>::pop(void) {
+    size_t position = tail.load(std::memory_order_relaxed);
+    Cell *cell;
+    while(true) {
+        cell = &cells[position & mask];
+        size_t sequence = cell->sequence.load(std::memory_order_acquire);
+        intptr_t difference = (intptr_t)sequence - (intptr_t)(position + 1);
+        if(difference == 0) {
+            if(tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if(difference < 0) {
+            // Nothing has been written to the cell on this lap yet
+            return {};
+        } else {
+            position = tail.load(std::memory_order_relaxed);
+        }
     }
-    T val = q.front();
-    q.pop();
-    return val;
+    T *value = std::launder(reinterpret_cast<T*>(cell->storage));
+    std::optional<T> result(std::move(*value));
+    value->~T();
+    cell->sequence.store(position + mask + 1, std::memory_order_release);
+    return result;
 }
 
 template <class T>
-T utils::tsqueue<T>::try_dequeue(T def) {
-    std::unique_lock<std::mutex> lock(m);
-    while (q.empty() && !closed)
-    {
-        // release lock as long as the wait and reaquire it afterwards.
-        c.wait(lock);
+bool utils::tsqueue<T>::writable(void) const {
+    size_t position = head.load(std::memory_order_relaxed);
+    // Ahead of position if another producer has filled the cell since, so push should be tried again
+    return (intptr_t)cells[position & mask].sequence.load(std::memory_order_acquire) - (intptr_t)position >= 0;
+}
+
+template <class T>
+bool utils::tsqueue<T>::readable(void) const {
+    size_t position = tail.load(std::memory_order_relaxed);
+    return (intptr_t)cells[position & mask].sequence.load(std::memory_order_acquire) - (intptr_t)(position + 1) >= 0;
+}
+
+template <class T>
+void utils::tsqueue<T>::wake(std::atomic<size_t> &waiting, std::condition_variable &c) {
+    // Pairs with the fence a waiting thread makes after counting itself: either it sees the change just made,
+    // or this sees it waiting and signals it once it is asleep (it holds m until then)
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(waiting.load(std::memory_order_relaxed) > 0) {
+        std::lock_guard<std::mutex> lock(m);
+        c.notify_one();
     }
-    if(q.empty() && closed) {
-        return def;
+}
+
+template <class T>
+void utils::tsqueue<T>::added(void) {
+    wake(waiting_consumers, not_empty);
+    // Read after the fence in wake, which pairs with the one in set_notifier
+    if(notifier *n = listener.load(std::memory_order_relaxed)) {
+        n->notify();
     }
-    T val = q.front();
-    q.pop();
-    return val;
 }
 
 template <class T>
-std::optional<T> utils::tsqueue<T>::try_dequeue_for(const std::chrono::milliseconds ms) {
-    if(is_closed()) {
-        return {};
+bool utils::tsqueue<T>::enqueue(T t) {
+    while(!closed.load()) {
+        if(push(t)) {
+            added();
+            return true;
+        }
+        std::unique_lock<std::mutex> lock(m);
+        waiting_producers++;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        not_full.wait(lock, [this]() { return closed.load() || writable(); });
+        waiting_producers--;
     }
-    std::unique_lock<std::mutex> lock(m);
-    c.wait_for(lock, ms);
-    if(q.empty()) {
-        return {};
+    return false;
+}
+
+template <class T>
+bool utils::tsqueue<T>::try_enqueue(T &t) {
+    if(closed.load() || !push(t)) {
+        return false;
     }
-    T val = q.front();
-    q.pop();
-    return val;
+    added();
+    return true;
+}
+
+template <class T>
+std::optional<T> utils::tsqueue<T>::wait_pop(std::optional<std::chrono::steady_clock::time_point> deadline) {
+    while(true) {
+        if(std::optional<T> value = pop()) {
+            wake(waiting_producers, not_full);
+            return value;
+        }
+        std::unique_lock<std::mutex> lock(m);
+        waiting_consumers++;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        // A producer that has claimed a cell but not yet written to it is waited for, it wakes this thread once it has
+        auto ready = [this]() { return readable() || (closed.load() && size() == 0); };
+        bool woken = true;
+        if(deadline) {
+            woken = not_empty.wait_until(lock, *deadline, ready);
+        } else {
+            not_empty.wait(lock, ready);
+        }
+        waiting_consumers--;
+        if(!woken || (closed.load() && size() == 0)) {
+            return {};
+        }
+    }
+}
+
+template <class T>
+T utils::tsqueue<T>::dequeue(void) {
+    std::optional<T> value = wait_pop({});
+    return value ? std::move(*value) : T{};
+}
+
+template <class T>
+T utils::tsqueue<T>::try_dequeue(T def) {
+    std::optional<T> value = wait_pop({});
+    return value ? std::move(*value) : std::move(def);
+}
+
+template <class T>
+std::optional<T> utils::tsqueue<T>::try_dequeue(void) {
+    std::optional<T> value = pop();
+    if(value) {
+        wake(waiting_producers, not_full);
+    }
+    return value;
+}
+
+template <class T>
+std::optional<T> utils::tsqueue<T>::try_dequeue_for(const std::chrono::milliseconds ms) {
+    return wait_pop(std::chrono::steady_clock::now() + ms);
 }
 
 template <class T>
 bool utils::tsqueue<T>::is_closed(void) {
-    return closed && q.empty();
+    return closed.load() && size() == 0;
 }
 
 template <class T>
 void utils::tsqueue<T>::close(void) {
-    closed = true;
-    c.notify_all();
+    closed.store(true);
+    {
+        std::lock_guard<std::mutex> lock(m);
+        not_full.notify_all();
+        not_empty.notify_all();
+    }
+    if(notifier *n = listener.load()) {
+        n->notify();
+    }
+}
+
+template <class T>
+void utils::tsqueue<T>::set_notifier(notifier *n) {
+    listener.store(n);
+    // Either an element added before this is seen by the caller's next check of the queue, or its producer sees n
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+template <class T>
+size_t utils::tsqueue<T>::capacity(void) const {
+    return mask + 1;
+}
+
+template <class T>
+size_t utils::tsqueue<T>::size(void) const {
+    size_t taken = tail.load();
+    size_t pushed = head.load();
+    return pushed > taken ? pushed - taken : 0;
 }
 
 template class utils::tsqueue<std::pair<std::string, Semantic>>;
-template class utils::tsqueue<std::tuple<std::string, std::shared_ptr<uint8_t[]>, uint32_t, std::shared_ptr<uint8_t[]>, uint32_t>>;
\ No newline at end of file
+template class utils::tsqueue<std::tuple<std::string, std::shared_ptr<uint8_t[]>, uint32_t, std::shared_ptr<uint8_t[]>, uint32_t>>;
+template class utils::tsqueue<std::string>;
@@ -1,8 +1,12 @@
+#include <atomic>
 #include <chrono>
 #include <fstream>
 #include <filesystem>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <thread>
+#include <unordered_set>
 
 #define _USE_MATH_DEFINES
 #include <math.h>
@@ -10,12 +14,19 @@
 #include "argparse/argparse.hpp"
 #include "cnk_loader.h"
 #include "dme_loader.h"
+#include "json.hpp"
 #include "zone_loader.h"
+#include "utils/archive.h"
 #include "utils/gltf/chunk.h"
+#include "utils/gltf/common.h"
 #include "utils/gltf/dme.h"
+#include "utils/gltf/staging.h"
+#include "utils/gltf/writer.h"
 #include "utils/adr.h"
 #include "utils/materials_3.h"
+#include "utils/mesh_cache.h"
 #include "utils/textures.h"
+#include "utils/textures/arguments.h"
 #include "utils/tsqueue.h"
 #include "synthium/synthium.h"
 #include "tiny_gltf.h"
@@ -29,6 +40,104 @@ using namespace std::chrono_literals;
 
 namespace logger = spdlog;
 
+// Models written into a library share textures, so each texture is only processed by the first thread to see it
+bool claim_texture(const std::string &texture_name) {
+    static std::mutex mutex;
+    static std::unordered_set<std::string> claimed;
+    std::lock_guard<std::mutex> lock(mutex);
+    return claimed.insert(texture_name).second;
+}
+
+// Reads a model texture (and the albedo, and normal map when packing ORM maps, for specular maps) and queues its processing with the texture scheduler
+void schedule_dme_image(synthium::Manager& manager, std::string texture_name, warpgate::Semantic semantic, std::filesystem::path output_directory) {
+    std::string albedo_name, normal_name;
+    size_t index;
+    std::shared_ptr<synthium::Asset2> asset, asset2, asset3;
+    std::vector<uint8_t> data, albedo_data, normal_data;
+    uint64_t cost;
+    switch (semantic)
+    {
+    case warpgate::Semantic::Diffuse:
+    case warpgate::Semantic::BaseDiffuse:
+    case warpgate::Semantic::baseDiffuse:
+    case warpgate::Semantic::diffuseTexture:
+    case warpgate::Semantic::DiffuseB:
+    case warpgate::Semantic::HoloTexture:
+    case warpgate::Semantic::DecalTint:
+    case warpgate::Semantic::TilingTint:
+    case warpgate::Semantic::DetailMask:
+    case warpgate::Semantic::detailMaskTexture:
+    case warpgate::Semantic::DetailMaskMap:
+    case warpgate::Semantic::Overlay:
+    case warpgate::Semantic::Overlay1:
+    case warpgate::Semantic::Overlay2:
+    case warpgate::Semantic::Overlay3:
+    case warpgate::Semantic::Overlay4:
+        asset = manager.get(texture_name);
+        if(asset) {
+            data = asset->get_data();
+            cost = warpgate::utils::textures::scheduler::estimate_cost(warpgate::utils::textures::cache::Mode::Texture, data);
+            warpgate::utils::textures::scheduler::submit(texture_name, cost, [=, data = std::move(data)]() mutable {
+                warpgate::utils::textures::save_texture(texture_name, std::move(data), output_directory);
+            });
+        }
+        break;
+    case warpgate::Semantic::Bump:
+    case warpgate::Semantic::BumpMap:
+    case warpgate::Semantic::BumpMap1:
+    case warpgate::Semantic::BumpMap2:
+    case warpgate::Semantic::BumpMap3:
+    case warpgate::Semantic::bumpMap:
+        asset = manager.get(texture_name);
+        if(asset) {
+            data = asset->get_data();
+            cost = warpgate::utils::textures::scheduler::estimate_cost(warpgate::utils::textures::cache::Mode::NormalMap, data);
+            warpgate::utils::textures::scheduler::submit(texture_name, cost, [=, data = std::move(data)]() mutable {
+                warpgate::utils::textures::process_normalmap(texture_name, std::move(data), output_directory);
+            });
+        }
+        break;
+    case warpgate::Semantic::Spec:
+    case warpgate::Semantic::SpecMap:
+    case warpgate::Semantic::SpecGlow:
+    case warpgate::Semantic::SpecB:
+        albedo_name = texture_name;
+        index = albedo_name.find_last_of('_');
+        albedo_name[index + 1] = 'C';
+        normal_name = texture_name;
+        normal_name[index + 1] = 'N';
+        asset = manager.get(texture_name);
+        asset2 = manager.get(albedo_name);
+        if(asset && asset2) {
+            data = asset->get_data();
+            albedo_data = asset2->get_data();
+            if(warpgate::utils::textures::pack_orm() && (asset3 = manager.get(normal_name))) {
+                normal_data = asset3->get_data();
+            }
+            cost = warpgate::utils::textures::scheduler::estimate_cost(warpgate::utils::textures::cache::Mode::Specular, data);
+            warpgate::utils::textures::scheduler::submit(texture_name, cost, [=, data = std::move(data), albedo_data = std::move(albedo_data), normal_data = std::move(normal_data)]() mutable {
+                warpgate::utils::textures::process_specular(texture_name, std::move(data), std::move(albedo_data), output_directory, std::move(normal_data));
+            });
+        }
+        break;
+    case warpgate::Semantic::detailBump:
+    case warpgate::Semantic::DetailBump:
+        asset = manager.get(texture_name);
+        if(asset) {
+            // Cubes are the largest textures, so each face is its own job
+            data = asset->get_data();
+            cost = warpgate::utils::textures::scheduler::estimate_cost(warpgate::utils::textures::cache::Mode::DetailCube, data);
+            std::vector<std::function<void()>> faces = warpgate::utils::textures::detailcube_jobs(texture_name, std::move(data), output_directory);
+            for(std::function<void()> &face : faces) {
+                warpgate::utils::textures::scheduler::submit(texture_name, cost / faces.size(), std::move(face));
+            }
+        }
+        break;
+    default:
+        logger::warn("Skipping unimplemented semantic: {}", texture_name);
+        break;
+    }
+}
 
 void process_images(
     synthium::Manager& manager,
@@ -40,85 +149,362 @@ void process_images(
         >
     >& chunk_queue,
     warpgate::utils::tsqueue<std::pair<std::string, warpgate::Semantic>> &dme_queue,
-    std::filesystem::path output_directory
+    std::filesystem::path output_directory,
+    std::filesystem::path dme_output_directory
 ) {
-    logger::debug("Got output directory {}", output_directory.string());
-    while(!chunk_queue.is_closed() || !dme_queue.is_closed()) {
-        auto chunk_value = chunk_queue.try_dequeue_for(1ms);
-        if(chunk_value) {
-            auto[texture_basename, cnx_data, cnx_length, sny_data, sny_length] = *chunk_value;
+    logger::debug("Got output directories {} and {}", output_directory.string(), dme_output_directory.string());
+    // Both queues and the scheduler share one notifier, so an idle thread sleeps until any of them has work
+    warpgate::utils::textures::scheduler::drain({
+        warpgate::utils::textures::scheduler::source(chunk_queue, [&](auto chunk_value) {
+            auto[texture_basename, cnx_data, cnx_length, sny_data, sny_length] = chunk_value;
             std::span<uint8_t> cnx_map(cnx_data.get(), cnx_length);
-            std::span<uint8_t> sny_map(sny_data.get(), sny_length);
-            warpgate::utils::textures::process_cnx_sny(texture_basename, cnx_map, sny_map, output_directory);
-        }
-
-        auto dme_value = dme_queue.try_dequeue_for(1ms);
-        if(dme_value) {
-            std::string albedo_name;
-            size_t index;
-            auto[texture_name, semantic] = *dme_value;
-            std::shared_ptr<synthium::Asset2> asset, asset2;
-            switch (semantic)
-            {
-            case warpgate::Semantic::Diffuse:
-            case warpgate::Semantic::BaseDiffuse:
-            case warpgate::Semantic::baseDiffuse:
-            case warpgate::Semantic::diffuseTexture:
-            case warpgate::Semantic::DiffuseB:
-            case warpgate::Semantic::HoloTexture:
-            case warpgate::Semantic::DecalTint:
-            case warpgate::Semantic::TilingTint:
-            case warpgate::Semantic::DetailMask:
-            case warpgate::Semantic::detailMaskTexture:
-            case warpgate::Semantic::DetailMaskMap:
-            case warpgate::Semantic::Overlay:
-            case warpgate::Semantic::Overlay1:
-            case warpgate::Semantic::Overlay2:
-            case warpgate::Semantic::Overlay3:
-            case warpgate::Semantic::Overlay4:
-                asset = manager.get(texture_name);
-                if(asset) {
-                    warpgate::utils::textures::save_texture(texture_name, asset->get_data(), output_directory);
-                }
-                break;
-            case warpgate::Semantic::Bump:
-            case warpgate::Semantic::BumpMap:
-            case warpgate::Semantic::BumpMap1:
-            case warpgate::Semantic::BumpMap2:
-            case warpgate::Semantic::BumpMap3:
-            case warpgate::Semantic::bumpMap:
-                asset = manager.get(texture_name);
-                if(asset) {
-                    warpgate::utils::textures::process_normalmap(texture_name, asset->get_data(), output_directory);
-                }
-                break;
-            case warpgate::Semantic::Spec:
-            case warpgate::Semantic::SpecMap:
-            case warpgate::Semantic::SpecGlow:
-            case warpgate::Semantic::SpecB:
-                albedo_name = texture_name;
-                index = albedo_name.find_last_of('_');
-                albedo_name[index + 1] = 'C';
-                asset = manager.get(texture_name);
-                asset2 = manager.get(albedo_name);
-                if(asset && asset2) {
-                    warpgate::utils::textures::process_specular(texture_name, asset->get_data(), asset2->get_data(), output_directory);
-                }
-                break;
-            case warpgate::Semantic::detailBump:
-            case warpgate::Semantic::DetailBump:
-                asset = manager.get(texture_name);
-                if(asset) {
-                    warpgate::utils::textures::process_detailcube(texture_name, asset->get_data(), output_directory);
+            uint64_t cost = warpgate::utils::textures::scheduler::estimate_cost(warpgate::utils::textures::cache::Mode::CnxSny, cnx_map);
+            warpgate::utils::textures::scheduler::submit(texture_basename, cost, [=]() {
+                std::span<uint8_t> cnx_map(cnx_data.get(), cnx_length);
+                std::span<uint8_t> sny_map(sny_data.get(), sny_length);
+                warpgate::utils::textures::process_cnx_sny(texture_basename, cnx_map, sny_map, output_directory);
+            });
+        }),
+        warpgate::utils::textures::scheduler::source(dme_queue, [&](auto dme_value) {
+            auto[texture_name, semantic] = dme_value;
+            if(claim_texture(texture_name)) {
+                schedule_dme_image(manager, texture_name, semantic, dme_output_directory);
+            }
+        })
+    });
+    logger::info("Both queues closed, stopping thread");
+}
+
+tinygltf::Model new_zone_model(int &dme_sampler_index, int &chunk_sampler_index) {
+    tinygltf::Model gltf;
+    tinygltf::Sampler dme_sampler, chunk_sampler;
+    dme_sampler_index = (int)gltf.samplers.size();
+    dme_sampler.magFilter = TINYGLTF_TEXTURE_FILTER_LINEAR;
+    dme_sampler.minFilter = TINYGLTF_TEXTURE_FILTER_LINEAR;
+    dme_sampler.wrapS = TINYGLTF_TEXTURE_WRAP_REPEAT;
+    dme_sampler.wrapT = TINYGLTF_TEXTURE_WRAP_REPEAT;
+    gltf.samplers.push_back(dme_sampler);
+
+    chunk_sampler_index = (int)gltf.samplers.size();
+    chunk_sampler.magFilter = TINYGLTF_TEXTURE_FILTER_LINEAR;
+    chunk_sampler.minFilter = TINYGLTF_TEXTURE_FILTER_LINEAR;
+    chunk_sampler.wrapS = TINYGLTF_TEXTURE_WRAP_CLAMP_TO_EDGE;
+    chunk_sampler.wrapT = TINYGLTF_TEXTURE_WRAP_CLAMP_TO_EDGE;
+    gltf.samplers.push_back(chunk_sampler);
+    
+    gltf.defaultScene = (int)gltf.scenes.size();
+    gltf.scenes.push_back({});
+
+    gltf.asset.version = "2.0";
+    gltf.asset.generator = "warpgate " + std::string(WARPGATE_VERSION) + " via tinygltf";
+    return gltf;
+}
+
+int add_chunk_to_gltf(
+    tinygltf::Model &gltf,
+    synthium::Manager &manager,
+    std::string chunk_stem,
+    warpgate::utils::tsqueue<
+        std::tuple<
+            std::string, 
+            std::shared_ptr<uint8_t[]>, uint32_t, 
+            std::shared_ptr<uint8_t[]>, uint32_t
+        >
+    >& chunk_image_queue,
+    std::filesystem::path output_directory,
+    int chunk_sampler_index,
+    bool export_textures
+) {
+    std::unique_ptr<uint8_t[]> decompressed_cnk0_data, decompressed_cnk1_data;
+    size_t cnk0_length, cnk1_length;
+    {
+        std::vector<uint8_t> chunk0_data = manager.get(std::filesystem::path(chunk_stem).replace_extension(".cnk0").string())->get_data();
+        warpgate::chunk::Chunk compressed_chunk0(chunk0_data);
+        decompressed_cnk0_data = std::move(compressed_chunk0.decompress());
+        cnk0_length = compressed_chunk0.decompressed_size();
+    }
+    {
+        std::vector<uint8_t> chunk1_data = manager.get(std::filesystem::path(chunk_stem).replace_extension(".cnk1").string())->get_data();
+        warpgate::chunk::Chunk compressed_chunk1(chunk1_data);
+        decompressed_cnk1_data = std::move(compressed_chunk1.decompress());
+        cnk1_length = compressed_chunk1.decompressed_size();
+    }
+
+    warpgate::chunk::CNK0 cnk0({decompressed_cnk0_data.get(), cnk0_length});
+    warpgate::chunk::CNK1 cnk1({decompressed_cnk1_data.get(), cnk1_length});
+    return warpgate::utils::gltf::chunk::add_chunks_to_gltf(
+        gltf, cnk0, cnk1, chunk_image_queue, output_directory,
+        chunk_stem, chunk_sampler_index, export_textures);
+}
+
+tinygltf::Node instance_node(const warpgate::zone::Instance &instance, std::string name) {
+    glm::dvec4 translation = ((warpgate::zone::Float4)instance.translation()).vector();
+    glm::dvec4 rot = ((warpgate::zone::Float4)instance.rotation()).vector();
+    glm::dquat rotation = glm::dquat(glm::eulerAngleYXZ(rot[0], rot[1], rot[2]));
+    glm::dvec4 scale = ((warpgate::zone::Float4)instance.scale()).vector();
+    tinygltf::Node node;
+    node.name = name;
+    node.translation = {translation.x, translation.y, translation.z};
+    node.rotation = {rotation.x, rotation.y, rotation.z, rotation.w};
+    node.scale = {scale.x, scale.y, scale.z};
+    return node;
+}
+
+std::filesystem::path library_path(std::filesystem::path directory, std::string name, std::string format) {
+    return directory / (std::filesystem::path(name).stem().string() + "." + format);
+}
+
+// Writes to a temporary file first so an interrupted run never leaves a truncated file behind to be reused
+bool write_output_file(const tinygltf::Model &gltf, std::filesystem::path path, std::string format) {
+    if(format == "gltf") {
+        // The .bin is named after the .gltf, so it cannot be renamed into place afterwards
+        return warpgate::utils::gltf::write_gltf(gltf, path, false, true);
+    }
+    std::filesystem::path temp_path = path;
+    temp_path += ".tmp";
+    if(!warpgate::utils::gltf::write_gltf(gltf, temp_path, true)) {
+        return false;
+    }
+    try {
+        std::filesystem::rename(temp_path, path);
+    } catch(std::filesystem::filesystem_error &err) {
+        logger::error("Failed to move {} into place: {}", path.string(), err.what());
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Builds and writes one library file per job. Jobs ending in .dme are models written into library_directory,
+ * any other job is a chunk stem written next to the manifest in output_directory.
+ */
+void write_library_files(
+    synthium::Manager& manager,
+    warpgate::utils::tsqueue<std::string> &job_queue,
+    warpgate::utils::tsqueue<
+        std::tuple<
+            std::string, 
+            std::shared_ptr<uint8_t[]>, uint32_t, 
+            std::shared_ptr<uint8_t[]>, uint32_t
+        >
+    >& chunk_image_queue,
+    warpgate::utils::tsqueue<std::pair<std::string, warpgate::Semantic>> &dme_image_queue,
+    std::filesystem::path output_directory,
+    std::filesystem::path library_directory,
+    std::string format,
+    bool export_textures
+) {
+    while(!job_queue.is_closed()) {
+        std::string job = job_queue.try_dequeue("");
+        if(job.empty()) {
+            break;
+        }
+        try {
+            tinygltf::Model gltf;
+            std::filesystem::path path;
+            if(std::filesystem::path(job).extension() == ".dme") {
+                path = library_path(library_directory, job, format);
+                std::vector<uint8_t> dme_data = manager.get(job)->get_data();
+                warpgate::DME dme(dme_data, path.stem().string());
+                gltf = warpgate::utils::gltf::dme::build_gltf_from_dme(dme, dme_image_queue, library_directory, export_textures, false, false);
+            } else {
+                path = library_path(output_directory, job, format);
+                int dme_sampler_index, chunk_sampler_index;
+                gltf = new_zone_model(dme_sampler_index, chunk_sampler_index);
+                add_chunk_to_gltf(gltf, manager, job, chunk_image_queue, output_directory, chunk_sampler_index, export_textures);
+            }
+            warpgate::utils::gltf::deduplicate_buffers(gltf);
+            logger::info("Writing {}...", path.filename().string());
+            if(!write_output_file(gltf, path, format)) {
+                logger::error("Failed to write {}", path.string());
+            }
+            warpgate::utils::gltf::staging::release(gltf);
+        } catch(std::exception &err) {
+            logger::error("Failed to export {}: {}", job, err.what());
+        }
+    }
+    logger::debug("Job queue closed, stopping library thread");
+}
+
+struct ObjectPlacement {
+    uint32_t object_index;
+    std::string dme_name;
+    std::vector<uint32_t> instances;
+};
+
+// The chunks, object instances and lights exported into one output model
+struct ZoneSection {
+    std::vector<std::pair<int, int>> chunks;
+    std::vector<ObjectPlacement> objects;
+    std::vector<uint32_t> lights;
+};
+
+std::string chunk_name(std::string continent_name, int x, int z) {
+    return continent_name + "_" + std::to_string(x) + "_" + std::to_string(z);
+}
+
+tinygltf::Light zone_light(const warpgate::zone::Light &zone_light) {
+    warpgate::zone::Color4ARGB color = zone_light.color();
+    warpgate::zone::LightType type = zone_light.type();
+    tinygltf::Light light;
+    light.color = {(double)color.r / 255.0, (double)color.g / 255.0, (double)color.b / 255.0};
+    light.type = type == warpgate::zone::LightType::Point ? "point" : "spot";
+    light.intensity = ((warpgate::zone::Float2)zone_light.unk_floats()).x * 1000;
+    if(type == warpgate::zone::LightType::Spot) {
+        light.spot = {};
+    }
+    return light;
+}
+
+tinygltf::Node light_node(const warpgate::zone::Light &zone_light) {
+    warpgate::zone::Float4 translation = zone_light.translation();
+    glm::vec4 rot = ((warpgate::zone::Float4)zone_light.rotation()).vector();
+    glm::dquat rotation(glm::eulerAngleYXZ(rot[0], rot[1], rot[2]));
+    tinygltf::Node node;
+    node.name = zone_light.name();
+    node.translation = {translation.x, translation.y, translation.z};
+    node.rotation = {rotation.x, rotation.y, rotation.z, rotation.w};
+    node.scale = {1.0, 1.0, -1.0};
+    return node;
+}
+
+tinygltf::Model build_section_gltf(
+    synthium::Manager& manager,
+    const warpgate::zone::Zone &continent,
+    const ZoneSection &section,
+    std::string continent_name,
+    warpgate::utils::tsqueue<
+        std::tuple<
+            std::string, 
+            std::shared_ptr<uint8_t[]>, uint32_t, 
+            std::shared_ptr<uint8_t[]>, uint32_t
+        >
+    >& chunk_image_queue,
+    warpgate::utils::tsqueue<std::pair<std::string, warpgate::Semantic>> &dme_image_queue,
+    std::filesystem::path output_directory,
+    bool export_textures
+) {
+    int dme_sampler_index, chunk_sampler_index;
+    tinygltf::Model gltf = new_zone_model(dme_sampler_index, chunk_sampler_index);
+
+    std::unordered_map<uint32_t, uint32_t> texture_indices;
+    std::unordered_map<uint32_t, std::vector<uint32_t>> material_indices;
+
+    int terrain_parent_index = (int)gltf.nodes.size();
+    tinygltf::Node terrain_parent;
+    terrain_parent.name = "Terrain";
+    gltf.nodes.push_back(terrain_parent);
+    for(auto[x, z] : section.chunks) {
+        int chunk_index = add_chunk_to_gltf(gltf, manager, chunk_name(continent_name, x, z), chunk_image_queue, output_directory, chunk_sampler_index, export_textures);
+        gltf.nodes.at(chunk_index).translation = {z * 64.0, 0.0, x * 64.0};
+        gltf.nodes.at(terrain_parent_index).children.push_back(chunk_index);
+    }
+
+    int object_parent_index = (int)gltf.nodes.size();
+    tinygltf::Node object_parent;
+    object_parent.name = "Objects";
+    gltf.nodes.push_back(object_parent);
+    for(const ObjectPlacement &placement : section.objects) {
+        std::shared_ptr<warpgate::zone::RuntimeObject> object = continent.object(placement.object_index);
+        logger::info("Adding {} instances of {}", placement.instances.size(), object->actor_file());
+        std::vector<uint8_t> dme_data = manager.get(placement.dme_name)->get_data();
+        warpgate::DME dme(dme_data, std::filesystem::path(object->actor_file()).stem().string());
+        int object_index = warpgate::utils::gltf::dme::add_dme_to_gltf(gltf, dme, dme_image_queue, output_directory, texture_indices, material_indices, dme_sampler_index, export_textures, false, false);
+        gltf.nodes.at(object_parent_index).children.push_back(object_index);
+        for(auto it = placement.instances.begin(); it != placement.instances.end(); it++) {
+            tinygltf::Node parent = instance_node(object->instance(*it), dme.get_name() + "_" + std::to_string(*it));
+            int parent_index = (int)gltf.nodes.size();
+
+            if(it == placement.instances.begin()) {
+                gltf.nodes.at(object_index).name = parent.name;
+                gltf.nodes.at(object_index).translation = parent.translation;
+                gltf.nodes.at(object_index).rotation = parent.rotation;
+                gltf.nodes.at(object_index).scale = parent.scale;
+                continue;
+            }
+
+            gltf.nodes.push_back(parent);
+            if(gltf.nodes.at(object_index).children.size() > 0) {
+                for(int child : gltf.nodes.at(object_index).children) {
+                    tinygltf::Node child_node;
+                    child_node.mesh = gltf.nodes.at(child).mesh;
+                    gltf.nodes.at(parent_index).children.push_back((int)gltf.nodes.size());
+                    gltf.nodes.push_back(child_node);
                 }
-                break;
-            default:
-                logger::warn("Skipping unimplemented semantic: {}", texture_name);
-                break;
+            } else {
+                gltf.nodes.at(parent_index).mesh = gltf.nodes.at(object_index).mesh;
             }
+            gltf.nodes.at(object_parent_index).children.push_back(parent_index);
         }
     }
-    logger::info("Both queues closed, stopping thread");
+
+    std::unordered_map<uint64_t, uint32_t> light_index_map;
+    tinygltf::Node light_parent;
+    light_parent.name = "Lights";
+    uint32_t light_parent_index = (uint32_t)gltf.nodes.size();
+    gltf.nodes.push_back(light_parent);
+    for(uint32_t index : section.lights) {
+        std::shared_ptr<warpgate::zone::Light> light = continent.light(index);
+        warpgate::zone::Color4ARGB color = light->color();
+        warpgate::zone::LightType type = light->type();
+        float intensity = ((warpgate::zone::Float2)light->unk_floats()).x;
+        uint64_t light_hash = color.r | color.g << 8 | color.b << 16 | ((uint32_t)type & 0xFF) << 24 | ((uint64_t)(*(reinterpret_cast<uint32_t*>(&intensity)))) << 32;
+        if(light_index_map.find(light_hash) == light_index_map.end()) {
+            light_index_map[light_hash] = (uint32_t)gltf.lights.size();
+            gltf.lights.push_back(zone_light(*light));
+        }
+        tinygltf::Node node = light_node(*light);
+        node.extensions["KHR_lights_punctual"] = tinygltf::Value(tinygltf::Value::Object());
+        node.extensions["KHR_lights_punctual"].Get<tinygltf::Value::Object>()["light"] = tinygltf::Value((int)light_index_map.at(light_hash));
+        gltf.nodes.at(light_parent_index).children.push_back((int)gltf.nodes.size());
+        gltf.nodes.push_back(node);
+    }
+    logger::info("Added {} lights.", gltf.nodes.at(light_parent_index).children.size());
+    return gltf;
+}
+
+std::pair<int, int> tile_key(double x, double z, double tile_size) {
+    return {(int)std::floor(x / tile_size), (int)std::floor(z / tile_size)};
+}
+
+/**
+ * Splits section into a grid of tile_size square tiles on the x/z plane.
+ * Chunks are assigned by their center, object instances and lights by their translation.
+ */
+std::map<std::pair<int, int>, ZoneSection> split_into_tiles(const warpgate::zone::Zone &continent, const ZoneSection &section, double tile_size) {
+    std::map<std::pair<int, int>, ZoneSection> tiles;
+    for(auto[x, z] : section.chunks) {
+        tiles[tile_key(z * 64.0 + 128.0, x * 64.0 + 128.0, tile_size)].chunks.push_back({x, z});
+    }
+
+    for(const ObjectPlacement &placement : section.objects) {
+        std::shared_ptr<warpgate::zone::RuntimeObject> object = continent.object(placement.object_index);
+        std::map<std::pair<int, int>, std::vector<uint32_t>> instances;
+        for(uint32_t index : placement.instances) {
+            warpgate::zone::Float4 translation = object->instance(index).translation();
+            instances[tile_key(translation.x, translation.z, tile_size)].push_back(index);
+        }
+        for(auto &[key, tile_instances] : instances) {
+            tiles[key].objects.push_back({placement.object_index, placement.dme_name, std::move(tile_instances)});
+        }
+    }
+
+    for(uint32_t index : section.lights) {
+        warpgate::zone::Float4 translation = continent.light(index)->translation();
+        tiles[tile_key(translation.x, translation.z, tile_size)].lights.push_back(index);
+    }
+    return tiles;
+}
+
+void write_manifest(const nlohmann::json &manifest, std::filesystem::path path) {
+    logger::info("Writing manifest {}...", path.filename().string());
+    std::ofstream output(path);
+    if(output.fail()) {
+        logger::error("Failed to open {} for writing", path.string());
+        std::exit(3);
+    }
+    output << manifest.dump(4);
+    output.close();
 }
 
 void build_argument_parser(argparse::ArgumentParser &parser, int &log_level) {
@@ -167,11 +553,43 @@ void build_argument_parser(argparse::ArgumentParser &parser, int &log_level) {
         .default_value(4u)
         .scan<'u', uint32_t>();
 
+    warpgate::utils::textures::add_texture_arguments(parser);
+
+    parser.add_argument("--archive")
+        .help("Write textures into this store-only .zip or .tar, at their paths relative to the output directory, instead of as separate files");
+
+    parser.add_argument("--terrain-atlas")
+        .help("Pack terrain textures into square atlas pages of this many pixels, with one material per page, instead of writing every chunk's textures separately")
+        .scan<'u', uint32_t>();
+
+    parser.add_argument("--terrain-atlas-cell")
+        .help("The size in pixels terrain textures are resampled to in the atlas")
+        .default_value(256u)
+        .scan<'u', uint32_t>();
+
     parser.add_argument("--aabb")
         .help("An axis aligned bounding box to constrain which assets are exported. (xmin zmin xmax zmax)")
         .nargs(4)
         //.default_value(std::vector<double>{0.0, 0.0, 0.0, 0.0})
         .scan<'g', double>();
+
+    parser.add_argument("--mesh-cache")
+        .help("Directory used to cache expanded mesh data between runs");
+
+    parser.add_argument("--staging-directory")
+        .help("Directory used to stage buffer data on disk once --staging-threshold is exceeded, keeping memory use bounded");
+
+    parser.add_argument("--staging-threshold")
+        .help("How many MiB of buffer data to keep in memory before staging to disk")
+        .default_value(1024u)
+        .scan<'u', uint32_t>();
+
+    parser.add_argument("--library")
+        .help("Write each unique model once into this directory and write output_file as a JSON manifest of the zone's placements");
+
+    parser.add_argument("--tile-size")
+        .help("Split the export into square tiles of this size on the x/z plane, written as one file per tile, and write output_file as a JSON manifest of the tiles")
+        .scan<'g', double>();
 }
 
 int main(int argc, char* argv[]) {
@@ -196,6 +614,15 @@ int main(int argc, char* argv[]) {
 
         logger::set_level(logger::level::level_enum(log_level));
 
+        if(!warpgate::utils::textures::apply_texture_arguments(parser)) {
+            std::exit(1);
+        }
+        // The image, library and tile threads all use this count, and nothing would empty their queues without them
+        if(parser.get<uint32_t>("--threads") == 0) {
+            logger::error("--threads must be at least 1");
+            std::exit(1);
+        }
+
         std::string input_str = parser.get<std::string>("input_file");
         
         logger::info("Converting file {} using zone_converter {}", input_str, WARPGATE_VERSION);
@@ -217,6 +644,14 @@ int main(int argc, char* argv[]) {
         warpgate::utils::materials3::init_materials();
         logger::info("Loaded materials.json");
 
+        if(auto mesh_cache = parser.present<std::string>("--mesh-cache")) {
+            warpgate::utils::mesh_cache::init_cache(*mesh_cache);
+        }
+
+        if(auto staging_directory = parser.present<std::string>("--staging-directory")) {
+            warpgate::utils::gltf::staging::init_staging(*staging_directory, (size_t)parser.get<uint32_t>("--staging-threshold") << 20);
+        }
+
         std::filesystem::path input_filename(input_str);
         std::unique_ptr<uint8_t[]> data;
         std::vector<uint8_t> data_vector, chunk1_data_vector;
@@ -245,18 +680,53 @@ int main(int argc, char* argv[]) {
             output_directory = output_filename.parent_path();
         }
 
+        std::optional<std::filesystem::path> library_directory;
+        if(auto library_value = parser.present<std::string>("--library")) {
+            library_directory = std::filesystem::weakly_canonical(*library_value);
+        }
+
+        std::optional<double> tile_size = parser.present<double>("--tile-size");
+        if(tile_size && *tile_size <= 0.0) {
+            logger::error("Tile size must be positive (got {})", *tile_size);
+            std::exit(1);
+        }
+        if(tile_size && library_directory) {
+            logger::error("--tile-size and --library cannot be used together");
+            std::exit(1);
+        }
+
+        if(auto atlas_size = parser.present<uint32_t>("--terrain-atlas")) {
+            if(!warpgate::utils::textures::atlas::init_atlas(output_directory, continent_name, *atlas_size, parser.get<uint32_t>("--terrain-atlas-cell"))) {
+                std::exit(1);
+            }
+        }
+
         try {
             if(!std::filesystem::exists(output_filename.parent_path())) {
                 std::filesystem::create_directories(output_directory / "textures");
             }
+            if(library_directory) {
+                std::filesystem::create_directories(*library_directory / "textures");
+            }
         } catch (std::filesystem::filesystem_error& err) {
             logger::error("Failed to create directory {}: {}", err.path1().string(), err.what());
             std::exit(3);
         }
 
+        if(auto archive_path = parser.present<std::string>("--archive")) {
+            if(library_directory) {
+                logger::error("--archive and --library cannot be used together");
+                std::exit(1);
+            }
+            if(!warpgate::utils::archive::init_archive(*archive_path, output_directory)) {
+                std::exit(3);
+            }
+        }
+
         std::string format = parser.get<std::string>("--format");
         bool export_textures = !parser.get<bool>("--no-textures");
         uint32_t image_processor_thread_count = parser.get<uint32_t>("--threads");
+        warpgate::utils::textures::scheduler::init_scheduler(image_processor_thread_count);
         // hmm
         warpgate::utils::tsqueue<
             std::tuple<
@@ -264,7 +734,7 @@ int main(int argc, char* argv[]) {
                 std::shared_ptr<uint8_t[]>, uint32_t, 
                 std::shared_ptr<uint8_t[]>, uint32_t
             >
-        > chunk_image_queue;
+        > chunk_image_queue(64);
 
         warpgate::utils::tsqueue<std::pair<std::string, warpgate::Semantic>> dme_image_queue;
 
@@ -277,13 +747,33 @@ int main(int argc, char* argv[]) {
                     std::ref(manager),
                     std::ref(chunk_image_queue), 
                     std::ref(dme_image_queue),
-                    output_directory
+                    output_directory,
+                    library_directory ? *library_directory : output_directory
                 });
             }
         } else {
             logger::info("Not exporting textures by user request.");
         }
 
+        warpgate::utils::tsqueue<std::string> library_queue;
+        std::vector<std::thread> library_writer_pool;
+        if(library_directory) {
+            logger::info("Writing models to library {}", library_directory->string());
+            for(uint32_t i = 0; i < image_processor_thread_count; i++) {
+                library_writer_pool.push_back(std::thread{
+                    write_library_files,
+                    std::ref(manager),
+                    std::ref(library_queue),
+                    std::ref(chunk_image_queue), 
+                    std::ref(dme_image_queue),
+                    output_directory,
+                    *library_directory,
+                    format,
+                    export_textures
+                });
+            }
+        }
+
         logger::info("Parsing zone...");
         warpgate::zone::Zone continent(data_span);
         logger::info("Parsed zone.");
@@ -293,37 +783,11 @@ int main(int argc, char* argv[]) {
             return 1;
         }
 
-        tinygltf::Model gltf;
-        tinygltf::Sampler dme_sampler, chunk_sampler;
-        int dme_sampler_index = (int)gltf.samplers.size();
-        dme_sampler.magFilter = TINYGLTF_TEXTURE_FILTER_LINEAR;
-        dme_sampler.minFilter = TINYGLTF_TEXTURE_FILTER_LINEAR;
-        dme_sampler.wrapS = TINYGLTF_TEXTURE_WRAP_REPEAT;
-        dme_sampler.wrapT = TINYGLTF_TEXTURE_WRAP_REPEAT;
-        gltf.samplers.push_back(dme_sampler);
-
-        int chunk_sampler_index = (int)gltf.samplers.size();
-        chunk_sampler.magFilter = TINYGLTF_TEXTURE_FILTER_LINEAR;
-        chunk_sampler.minFilter = TINYGLTF_TEXTURE_FILTER_LINEAR;
-        chunk_sampler.wrapS = TINYGLTF_TEXTURE_WRAP_CLAMP_TO_EDGE;
-        chunk_sampler.wrapT = TINYGLTF_TEXTURE_WRAP_CLAMP_TO_EDGE;
-        gltf.samplers.push_back(chunk_sampler);
-        
-        gltf.defaultScene = (int)gltf.scenes.size();
-        gltf.scenes.push_back({});
-
-        std::unordered_map<uint32_t, uint32_t> texture_indices;
-        std::unordered_map<uint32_t, std::vector<uint32_t>> material_indices;
-
         warpgate::zone::ZoneHeader header = continent.header();
+        ZoneSection zone_section;
 
-        int terrain_parent_index = (int)gltf.nodes.size();
-        tinygltf::Node terrain_parent;
-        terrain_parent.name = "Terrain";
-        gltf.nodes.push_back(terrain_parent);
         double min_z = header.chunk_info.start_y * 64.0;
         double max_z = ((int)(header.chunk_info.start_y + header.chunk_info.count_y)) * 64.0;
-        std::vector<std::pair<int, int>> chunk_indices;
         for(uint32_t x = 0; x < header.chunk_info.count_x; x += 4) {
             if(aabb) {
                 double curr_x = ((int)(header.chunk_info.start_x + x)) * 64.0, next_x = ((int)(header.chunk_info.start_x + x + 4)) * 64.0;
@@ -343,51 +807,10 @@ int main(int argc, char* argv[]) {
                         continue;
                     }
                 }
-                chunk_indices.push_back({(int)(header.chunk_info.start_x + x), (int)(header.chunk_info.start_y + y)});
+                zone_section.chunks.push_back({(int)(header.chunk_info.start_x + x), (int)(header.chunk_info.start_y + y)});
             }
         }
-        logger::info("Adding {} chunks...", chunk_indices.size());
-        for(auto[x, z] : chunk_indices) {
-            std::string chunk_stem = continent_name + "_" + std::to_string(x) + "_" + std::to_string(z);
-            std::unique_ptr<uint8_t[]> decompressed_cnk0_data, decompressed_cnk1_data;
-            size_t cnk0_length, cnk1_length;
-            {
-                std::vector<uint8_t> chunk0_data = manager.get(std::filesystem::path(chunk_stem).replace_extension(".cnk0").string())->get_data();
-                warpgate::chunk::Chunk compressed_chunk0(chunk0_data);
-                decompressed_cnk0_data = std::move(compressed_chunk0.decompress());
-                cnk0_length = compressed_chunk0.decompressed_size();
-            }
-            {
-                std::vector<uint8_t> chunk1_data = manager.get(std::filesystem::path(chunk_stem).replace_extension(".cnk1").string())->get_data();
-                warpgate::chunk::Chunk compressed_chunk1(chunk1_data);
-                decompressed_cnk1_data = std::move(compressed_chunk1.decompress());
-                cnk1_length = compressed_chunk1.decompressed_size();
-            }
-
-            warpgate::chunk::CNK0 cnk0({decompressed_cnk0_data.get(), cnk0_length});
-            warpgate::chunk::CNK1 cnk1({decompressed_cnk1_data.get(), cnk1_length});
-            int chunk_index = warpgate::utils::gltf::chunk::add_chunks_to_gltf(
-                gltf, cnk0, cnk1, chunk_image_queue, output_directory,
-                chunk_stem, chunk_sampler_index, export_textures);
-            std::vector<double> translation = {z * 64.0, 0.0, x * 64.0};
-            // if(aabb) {
-            //     translation[0] -= aabb->midpoint().x;
-            //     translation[2] -= aabb->midpoint().z;
-            // }
-            gltf.nodes.at(chunk_index).translation = translation;
-            gltf.nodes.at(terrain_parent_index).children.push_back(chunk_index);
-        }
-
-        int object_parent_index = (int)gltf.nodes.size();
-        tinygltf::Node object_parent;
-        object_parent.name = "Objects";
-        gltf.nodes.push_back(object_parent);
-        glm::dmat4 gltf_conversion = glm::transpose(glm::dmat4{
-            glm::dvec4{1.0, 0.0, 0.0, 0.0},
-            glm::dvec4{0.0, 1.0, 0.0, 0.0},
-            glm::dvec4{0.0, 0.0, 1.0, 0.0},
-            glm::dvec4{0.0, 0.0, 0.0, 1.0},
-        });
+        logger::info("Found {} chunks.", zone_section.chunks.size());
 
         uint32_t objects_count = continent.objects_count();
         for(uint32_t i = 0; i < objects_count; i++) {
@@ -400,114 +823,189 @@ int main(int argc, char* argv[]) {
                 logger::warn("ADR {} did not have a model file?", object->actor_file());
                 continue;
             }
-            std::vector<uint8_t> dme_data = manager.get(*dme_name)->get_data();
-            warpgate::DME dme(dme_data, std::filesystem::path(object->actor_file()).stem().string());
-            
-            warpgate::AABB aabb_data = dme.aabb();
-            warpgate::utils::AABB dme_aabb(aabb_data.min.x, aabb_data.min.y, aabb_data.min.z, aabb_data.max.x, aabb_data.max.y, aabb_data.max.z);
-            std::vector<uint32_t> instances_to_add;
+
+            std::optional<warpgate::utils::AABB> dme_aabb;
+            if(aabb) {
+                std::vector<uint8_t> dme_data = manager.get(*dme_name)->get_data();
+                warpgate::DME dme(dme_data, std::filesystem::path(object->actor_file()).stem().string());
+                warpgate::AABB aabb_data = dme.aabb();
+                dme_aabb = warpgate::utils::AABB(aabb_data.min.x, aabb_data.min.y, aabb_data.min.z, aabb_data.max.x, aabb_data.max.y, aabb_data.max.z);
+            }
+            ObjectPlacement placement{i, *dme_name, {}};
             uint32_t instance_count = object->instance_count();
             for(uint32_t j = 0; j < instance_count; j++) {
-                if(aabb && !aabb->overlaps(dme_aabb * object->instance(j).transform() /*(translation * rotation * scale)*/)) {
+                if(aabb && !aabb->overlaps(*dme_aabb * object->instance(j).transform() /*(translation * rotation * scale)*/)) {
                     continue;
                 }
-                instances_to_add.push_back(j);
+                placement.instances.push_back(j);
             }
-            if(instances_to_add.size() == 0) {
+            if(placement.instances.size() == 0) {
                 continue;
             }
-            logger::info("Adding {} instances of {}", instances_to_add.size(), object->actor_file());
-            int object_index = warpgate::utils::gltf::dme::add_dme_to_gltf(gltf, dme, dme_image_queue, output_directory, texture_indices, material_indices, dme_sampler_index, export_textures, false, false);
-            gltf.nodes.at(object_parent_index).children.push_back(object_index);
-            for(auto it = instances_to_add.begin(); it != instances_to_add.end(); it++) {
-                glm::dvec4 translation = ((warpgate::zone::Float4)object->instance(*it).translation()).vector() * gltf_conversion;
-                glm::dvec4 rot = ((warpgate::zone::Float4)object->instance(*it).rotation()).vector();
-                glm::dquat rotation = glm::dquat(glm::eulerAngleYXZ(rot[0], rot[1], rot[2]));
-                glm::dvec4 scale = ((warpgate::zone::Float4)object->instance(*it).scale()).vector() * gltf_conversion;
-                tinygltf::Node parent;
-                int parent_index = (int)gltf.nodes.size();
-                parent.name = dme.get_name() + "_" + std::to_string(*it);
-                parent.translation = {translation.x, translation.y, translation.z};
-                parent.rotation = {rotation.x, rotation.y, rotation.z, rotation.w};
-                parent.scale = {scale.x, scale.y, scale.z};
-
-                if(it == instances_to_add.begin()) {
-                    gltf.nodes.at(object_index).name = parent.name;
-                    gltf.nodes.at(object_index).translation = parent.translation;
-                    gltf.nodes.at(object_index).rotation = parent.rotation;
-                    gltf.nodes.at(object_index).scale = parent.scale;
-                    continue;
-                }
-
-                gltf.nodes.push_back(parent);
-                if(gltf.nodes.at(object_index).children.size() > 0) {
-                    for(int child : gltf.nodes.at(object_index).children) {
-                        tinygltf::Node child_node;
-                        child_node.mesh = gltf.nodes.at(child).mesh;
-                        gltf.nodes.at(parent_index).children.push_back((int)gltf.nodes.size());
-                        gltf.nodes.push_back(child_node);
-                    }
-                } else {
-                    gltf.nodes.at(parent_index).mesh = gltf.nodes.at(object_index).mesh;
-                }
-                gltf.nodes.at(object_parent_index).children.push_back(parent_index);
-            }
+            zone_section.objects.push_back(placement);
         }
 
         uint32_t lights_count = continent.lights_count();
-        std::unordered_map<uint64_t, uint32_t> light_index_map;
-        tinygltf::Node light_parent;
-        light_parent.name = "Lights";
-        uint32_t light_parent_index = (uint32_t)gltf.nodes.size();
-        gltf.nodes.push_back(light_parent);
         logger::info("Checking {} lights...", lights_count);
         for(uint32_t i = 0; i < lights_count; i++) {
             warpgate::zone::Float4 translation = continent.light(i)->translation();
             if(aabb && !aabb->contains({translation.x, translation.y, translation.z})) {
                 continue;
             }
-            warpgate::zone::Color4ARGB color = continent.light(i)->color();
-            warpgate::zone::LightType type = continent.light(i)->type();
-            glm::vec4 rot = ((warpgate::zone::Float4)continent.light(i)->rotation()).vector();
-            glm::dquat rotation(glm::eulerAngleYXZ(rot[0], rot[1], rot[2]));
-            float intensity = ((warpgate::zone::Float2)continent.light(i)->unk_floats()).x;
-            uint64_t light_hash = color.r | color.g << 8 | color.b << 16 | ((uint32_t)type & 0xFF) << 24 | ((uint64_t)(*(reinterpret_cast<uint32_t*>(&intensity)))) << 32;
-            if(light_index_map.find(light_hash) == light_index_map.end()) {
-                light_index_map[light_hash] = (uint32_t)gltf.lights.size();
-                tinygltf::Light light;
-                light.color = {(double)color.r / 255.0, (double)color.g / 255.0, (double)color.b / 255.0};
-                light.type = type == warpgate::zone::LightType::Point ? "point" : "spot";
-                light.intensity = intensity * 1000;
-                if(type == warpgate::zone::LightType::Spot) {
-                    light.spot = {};
+            zone_section.lights.push_back(i);
+        }
+
+        bool written = true;
+        if(library_directory) {
+            nlohmann::json manifest = {
+                {"version", 1},
+                {"generator", "warpgate " + std::string(WARPGATE_VERSION)},
+                {"zone", continent_name},
+                {"terrain", nlohmann::json::array()},
+                {"models", nlohmann::json::object()},
+                {"objects", nlohmann::json::array()},
+                {"lights", nlohmann::json::array()},
+            };
+
+            for(auto[x, z] : zone_section.chunks) {
+                std::string chunk_stem = chunk_name(continent_name, x, z);
+                std::filesystem::path chunk_path = library_path(output_directory, chunk_stem, format);
+                manifest["terrain"].push_back({
+                    {"name", chunk_stem},
+                    {"uri", chunk_path.lexically_relative(output_directory).generic_string()},
+                    {"translation", {z * 64.0, 0.0, x * 64.0}},
+                });
+                // Atlas pages are rebuilt every run, so chunks written by an earlier run would point at the wrong cells
+                if(warpgate::utils::textures::atlas::enabled() || !std::filesystem::exists(chunk_path)) {
+                    library_queue.enqueue(chunk_stem);
+                }
+            }
+
+            for(const ObjectPlacement &placement : zone_section.objects) {
+                std::shared_ptr<warpgate::zone::RuntimeObject> object = continent.object(placement.object_index);
+                std::filesystem::path model_path = library_path(*library_directory, placement.dme_name, format);
+                if(!manifest["models"].contains(placement.dme_name)) {
+                    manifest["models"][placement.dme_name] = model_path.lexically_proximate(output_directory).generic_string();
+                    if(std::filesystem::exists(model_path)) {
+                        logger::debug("Reusing library model {}", model_path.string());
+                    } else {
+                        library_queue.enqueue(placement.dme_name);
+                    }
+                }
+                std::string instance_stem = std::filesystem::path(object->actor_file()).stem().string();
+                nlohmann::json instances = nlohmann::json::array();
+                for(uint32_t index : placement.instances) {
+                    tinygltf::Node node = instance_node(object->instance(index), instance_stem + "_" + std::to_string(index));
+                    instances.push_back({
+                        {"name", node.name},
+                        {"translation", node.translation},
+                        {"rotation", node.rotation},
+                        {"scale", node.scale},
+                    });
                 }
-                gltf.lights.push_back(light);
+                manifest["objects"].push_back({
+                    {"actor", object->actor_file()},
+                    {"model", placement.dme_name},
+                    {"instances", instances},
+                });
+            }
+
+            for(uint32_t index : zone_section.lights) {
+                tinygltf::Light light = zone_light(*continent.light(index));
+                tinygltf::Node node = light_node(*continent.light(index));
+                manifest["lights"].push_back({
+                    {"name", node.name},
+                    {"type", light.type},
+                    {"color", light.color},
+                    {"intensity", light.intensity},
+                    {"translation", node.translation},
+                    {"rotation", node.rotation},
+                });
+            }
+
+            library_queue.close();
+            logger::info("Joining library writer thread{}...", library_writer_pool.size() == 1 ? "" : "s");
+            for(uint32_t i = 0; i < library_writer_pool.size(); i++) {
+                library_writer_pool.at(i).join();
             }
-            tinygltf::Node light_node;
-            light_node.name = continent.light(i)->name();
-            light_node.translation = {translation.x, translation.y, translation.z};
-            light_node.rotation = {rotation.x, rotation.y, rotation.z, rotation.w};
-            light_node.scale = {1.0, 1.0, -1.0};
-            light_node.extensions["KHR_lights_punctual"] = tinygltf::Value(tinygltf::Value::Object());
-            light_node.extensions["KHR_lights_punctual"].Get<tinygltf::Value::Object>()["light"] = tinygltf::Value((int)light_index_map.at(light_hash));
-            gltf.nodes.at(light_parent_index).children.push_back((int)gltf.nodes.size());
-            gltf.nodes.push_back(light_node);
-        }
-        logger::info("Added {} lights.", gltf.nodes.at(light_parent_index).children.size());
-        
-        gltf.asset.version = "2.0";
-        gltf.asset.generator = "warpgate " + std::string(WARPGATE_VERSION) + " via tinygltf";
 
-        logger::info("Writing GLTF2 file {}...", output_filename.filename().string());
-        tinygltf::TinyGLTF writer;
-        writer.WriteGltfSceneToFile(&gltf, output_filename.string(), false, format == "glb", format == "gltf", format == "glb");
+            write_manifest(manifest, output_filename);
+        } else if(tile_size) {
+            std::map<std::pair<int, int>, ZoneSection> tile_map = split_into_tiles(continent, zone_section, *tile_size);
+            std::vector<std::pair<std::pair<int, int>, ZoneSection>> tiles(tile_map.begin(), tile_map.end());
+            tile_map.clear();
+            logger::info("Writing {} tiles of size {}...", tiles.size(), *tile_size);
+
+            // Each thread builds and writes one tile at a time, so only one tile model per thread is ever held in memory
+            std::vector<nlohmann::json> tile_entries(tiles.size());
+            std::atomic<size_t> next_tile = 0;
+            std::vector<std::thread> tile_writer_pool;
+            for(uint32_t i = 0; i < image_processor_thread_count; i++) {
+                tile_writer_pool.push_back(std::thread{[&]() {
+                    for(size_t index = next_tile++; index < tiles.size(); index = next_tile++) {
+                        auto &[key, section] = tiles.at(index);
+                        std::filesystem::path tile_path = output_directory / (output_filename.stem().string() + "_" + std::to_string(key.first) + "_" + std::to_string(key.second) + "." + format);
+                        tile_entries.at(index) = {
+                            {"x", key.first},
+                            {"z", key.second},
+                            {"min", {key.first * *tile_size, key.second * *tile_size}},
+                            {"max", {(key.first + 1) * *tile_size, (key.second + 1) * *tile_size}},
+                            {"uri", tile_path.filename().generic_string()},
+                            {"chunks", section.chunks.size()},
+                            {"objects", section.objects.size()},
+                            {"lights", section.lights.size()},
+                        };
+                        try {
+                            tinygltf::Model gltf = build_section_gltf(manager, continent, section, continent_name, chunk_image_queue, dme_image_queue, output_directory, export_textures);
+                            warpgate::utils::gltf::deduplicate_buffers(gltf);
+                            logger::info("Writing tile {}...", tile_path.filename().string());
+                            if(!write_output_file(gltf, tile_path, format)) {
+                                logger::error("Failed to write tile {}", tile_path.string());
+                            }
+                            warpgate::utils::gltf::staging::release(gltf);
+                        } catch(std::exception &err) {
+                            logger::error("Failed to export tile {}: {}", tile_path.filename().string(), err.what());
+                        }
+                    }
+                }});
+            }
+            for(uint32_t i = 0; i < tile_writer_pool.size(); i++) {
+                tile_writer_pool.at(i).join();
+            }
+
+            write_manifest({
+                {"version", 1},
+                {"generator", "warpgate " + std::string(WARPGATE_VERSION)},
+                {"zone", continent_name},
+                {"tile_size", *tile_size},
+                {"tiles", tile_entries},
+            }, output_filename);
+        } else {
+            tinygltf::Model gltf = build_section_gltf(manager, continent, zone_section, continent_name, chunk_image_queue, dme_image_queue, output_directory, export_textures);
+
+            size_t deduplicated = warpgate::utils::gltf::deduplicate_buffers(gltf);
+            logger::info("Deduplicated {} bytes of buffer data", deduplicated);
+
+            logger::info("Writing GLTF2 file {}...", output_filename.filename().string());
+            written = warpgate::utils::gltf::write_gltf(gltf, output_filename, format == "glb", format == "gltf");
+            warpgate::utils::gltf::staging::release(gltf);
+        }
         
+        // The image threads are always stopped before returning, even if the model couldn't be written
         chunk_image_queue.close();
         dme_image_queue.close();
         logger::info("Joining image processing thread{}...", image_processor_pool.size() == 1 ? "" : "s");
         for(uint32_t i = 0; i < image_processor_pool.size(); i++) {
             image_processor_pool.at(i).join();
         }
+        warpgate::utils::textures::scheduler::report();
+        warpgate::utils::textures::atlas::finish();
+        if(warpgate::utils::archive::enabled() && !warpgate::utils::archive::close_archive()) {
+            return 3;
+        }
+        if(!written) {
+            return 3;
+        }
         logger::info("Done.");
     } catch(std::exception &err) {
         logger::error("Caught {}", err.what());